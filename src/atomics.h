@@ -0,0 +1,26 @@
+#ifndef FEATURES_ATOMICS_H
+#define FEATURES_ATOMICS_H
+
+// Atomic members of the public structs. C sees C11 atomics, C++ sees
+// std::atomic of the same type, which has the same size and lock free
+// representation, and the C11 functions the inline readers use.
+
+#ifdef __cplusplus
+#include <atomic>
+
+#define FEATURES_ATOMIC(type) std::atomic<type>
+
+using std::atomic_load_explicit;
+using std::atomic_store_explicit;
+using std::atomic_thread_fence;
+using std::memory_order_relaxed;
+using std::memory_order_acquire;
+using std::memory_order_release;
+using std::memory_order_seq_cst;
+#else
+#include <stdatomic.h>
+
+#define FEATURES_ATOMIC(type) _Atomic(type)
+#endif
+
+#endif
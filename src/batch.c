@@ -0,0 +1,148 @@
+#include "batch.h"
+
+#include <stdlib.h>
+
+#include "internal.h"
+
+enum {
+    // Batches up to this size are sorted on the stack
+    FEATURES_BATCH_STACK_SIZE = 128
+};
+
+typedef struct features_batch_entry_t {
+    features_switch_number_t switch_number;
+    size_t index;
+} features_batch_entry_t;
+
+static int
+features_batch_entry_compare(const void *a, const void *b);
+
+static void
+features_batch_prefetch(
+        const features_data_t *data,
+        features_switch_number_t switch_number);
+
+features_err_t
+features_switch_values_batch(
+        const features_data_t *data,
+        const features_switch_number_t *nums,
+        size_t n,
+        features_switch_value_t *out,
+        features_err_t *errs) {
+    features_batch_entry_t stack_entries[FEATURES_BATCH_STACK_SIZE];
+    features_batch_entry_t *entries;
+    features_block_number_t block_number;
+    features_block_number_t current_block;
+    features_switch_info_t switch_info;
+    features_switch_id_t switch_id;
+    features_block_t block;
+    features_err_t block_rc;
+    int sorted;
+    size_t next;
+    size_t i;
+
+    if (0 == n) {
+        return FEATURES_OK;
+    }
+
+    if (n <= FEATURES_BATCH_STACK_SIZE) {
+        entries = stack_entries;
+    } else {
+        entries = malloc(n * sizeof(features_batch_entry_t));
+
+        if (NULL == entries) {
+            return FEATURES_ERR_NOMEM;
+        }
+    }
+
+    sorted = 1;
+
+    for (i = 0; i < n; ++i) {
+        entries[i].switch_number = nums[i];
+        entries[i].index = i;
+
+        if (i > 0 && nums[i] < nums[i - 1]) {
+            sorted = 0;
+        }
+    }
+
+    // Switch numbers sort by page then block, so sorting groups every
+    // block's switches together
+    if (!sorted) {
+        qsort(entries, n, sizeof(features_batch_entry_t), features_batch_entry_compare);
+    }
+
+    current_block = 0;
+    block_rc = FEATURES_OK;
+    next = 0;
+
+    for (i = 0; i < n; ++i) {
+        switch_id = features_switch_id(entries[i].switch_number);
+        block_number = entries[i].switch_number / FEATURES_MAX_SWITCHES_PER_BLOCK;
+
+        if (0 == i || block_number != current_block) {
+            current_block = block_number;
+
+            // Fetch the next block's lines while this one is decoded
+            if (next <= i) {
+                next = i + 1;
+            }
+
+            while (next < n
+                    && entries[next].switch_number / FEATURES_MAX_SWITCHES_PER_BLOCK == block_number) {
+                ++next;
+            }
+
+            if (next < n) {
+                features_batch_prefetch(data, entries[next].switch_number);
+            }
+
+            block_rc = features_switch_block(&block, data, switch_id);
+        }
+
+        if (FEATURES_OK != block_rc) {
+            errs[entries[i].index] = block_rc;
+            continue;
+        }
+
+        features_block_switch_info(&switch_info, &block, switch_id.switch_number);
+        switch_info.flags = data->flags;
+        errs[entries[i].index] = features_switch_read(&out[entries[i].index], &switch_info);
+    }
+
+    if (entries != stack_entries) {
+        free(entries);
+    }
+
+    return FEATURES_OK;
+}
+
+static int
+features_batch_entry_compare(const void *a, const void *b) {
+    const features_batch_entry_t *entry_a = a;
+    const features_batch_entry_t *entry_b = b;
+
+    if (entry_a->switch_number < entry_b->switch_number) {
+        return -1;
+    }
+
+    return entry_a->switch_number > entry_b->switch_number;
+}
+
+static void
+features_batch_prefetch(
+        const features_data_t *data,
+        features_switch_number_t switch_number) {
+    features_switch_id_t switch_id;
+    features_page_raw_t *page_raw;
+
+    switch_id = features_switch_id(switch_number);
+    page_raw = features_data_page(data, switch_id.page_number);
+
+    if (NULL == page_raw) {
+        return;
+    }
+
+    FEATURES_PREFETCH(&page_raw->header);
+    FEATURES_PREFETCH((features_block_raw_t *)page_raw + switch_id.block_number);
+}
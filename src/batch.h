@@ -0,0 +1,29 @@
+#ifndef FEATURES_BATCH_H
+#define FEATURES_BATCH_H
+
+#include <stddef.h>
+
+#include "memory.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Looks up n switches at once. The result of nums[i] is stored in out[i]
+// and errs[i]. Lookups are grouped by block so every page and block is
+// decoded once per call, however many of the switches it holds.
+// Returns FEATURES_ERR_NOMEM if the scratch space cannot be allocated,
+// otherwise FEATURES_OK.
+features_err_t
+features_switch_values_batch(
+        const features_data_t *data,
+        const features_switch_number_t *nums,
+        size_t n,
+        features_switch_value_t *out,
+        features_err_t *errs);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
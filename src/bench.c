@@ -0,0 +1,927 @@
+// features-bench: lookup micro-benchmarks over a synthetic switch file
+//
+// Generates a switch file in memory with the requested number of
+// switches and type mix, then times features_switch_value() and every
+// typed accessor with sequential, random and clustered access, warm and
+// cold caches, and 1 up to the requested number of threads. Every run is
+// written as one JSON object per line.
+
+#include "config.h"
+
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef HAVE_LINUX_PERF_EVENT_H
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#include "builder.h"
+#include "cache.h"
+#include "memory.h"
+
+enum {
+    // Lookups timed together as one latency sample
+    FEATURES_BENCH_BATCH = 256,
+    // Latency samples taken per thread with cold caches
+    FEATURES_BENCH_COLD_SAMPLES = 100,
+    // Longest run of neighbouring switches in the clustered pattern
+    FEATURES_BENCH_CLUSTER_RUN = 32
+};
+
+typedef enum features_bench_pattern_t {
+    FEATURES_BENCH_SEQUENTIAL,
+    FEATURES_BENCH_RANDOM,
+    // Random runs of neighbouring switches, as when the switches of one
+    // feature are allocated together
+    FEATURES_BENCH_CLUSTERED
+} features_bench_pattern_t;
+
+static const char *features_bench_pattern_names[] = {"sequential", "random", "clustered"};
+
+typedef enum features_bench_cache_t {
+    FEATURES_BENCH_WARM,
+    FEATURES_BENCH_COLD
+} features_bench_cache_t;
+
+// Looks up n switches and returns a value derived from the results so
+// the lookups cannot be optimised away
+typedef uint64_t (*features_bench_fn)(
+        const features_data_t *data,
+        const features_switch_number_t *numbers,
+        size_t n);
+
+typedef struct features_bench_t {
+    const char *name;
+    // Switches of this type are looked up, FEATURES_SWITCH_TYPE_INVALID
+    // for all switches
+    features_switch_type_t type;
+    features_bench_fn fn;
+    // The same lookups through the thread's features_block_cache_t
+    features_bench_fn cached_fn;
+} features_bench_t;
+
+typedef struct features_bench_options_t {
+    uint64_t switches;
+    unsigned weights[FEATURES_SWITCH_TYPE_INVALID + 1];
+    unsigned threads;
+    uint64_t ops;
+    size_t evict_bytes;
+    int index;
+    int block_cache;
+    unsigned seed;
+    const char *filter;
+    FILE *out;
+} features_bench_options_t;
+
+typedef struct features_bench_numbers_t {
+    features_switch_number_t *numbers;
+    size_t count;
+} features_bench_numbers_t;
+
+// The threads of a run start timing together. If a thread fails to
+// start, the run is aborted and the threads that did start are released
+typedef struct features_bench_gate_t {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    unsigned waiting;
+    unsigned count;
+    int aborted;
+} features_bench_gate_t;
+
+typedef struct features_bench_run_t {
+    const features_bench_options_t *options;
+    const features_bench_t *bench;
+    const features_data_t *data;
+    const features_bench_numbers_t *numbers;
+    features_bench_pattern_t pattern;
+    features_bench_cache_t cache;
+    const uint8_t *evict;
+    features_bench_gate_t *gate;
+} features_bench_run_t;
+
+typedef struct features_bench_thread_t {
+    const features_bench_run_t *run;
+    unsigned id;
+    double *samples;
+    size_t sample_count;
+    double elapsed_ns;
+    uint64_t ops;
+    int64_t cache_misses;
+    uint64_t block_cache_hits;
+    uint64_t block_cache_misses;
+    uint64_t sink;
+    // Out of memory, the thread still waits at the gate with the others
+    int failed;
+} features_bench_thread_t;
+
+static uint64_t
+features_bench_value(const features_data_t *data, const features_switch_number_t *numbers, size_t n);
+
+static uint64_t
+features_bench_cached_value(const features_data_t *data, const features_switch_number_t *numbers, size_t n);
+
+// The data passed to the benchmarks is the first member of a snapshot
+#define features_bench_snapshot(data) ((const features_snapshot_t *)(data))
+
+#define FEATURES_BENCH_TYPED(name, value_type)\
+    static uint64_t\
+    features_bench_##name(\
+            const features_data_t *data,\
+            const features_switch_number_t *numbers,\
+            size_t n) {\
+        value_type val;\
+        uint64_t sink;\
+        size_t i;\
+        sink = 0;\
+        for (i = 0; i < n; ++i) {\
+            if (FEATURES_OK == features_switch_##name##_value(data, numbers[i], &val)) {\
+                sink += (uint64_t)val;\
+            }\
+        }\
+        return sink;\
+    }\
+    static uint64_t\
+    features_bench_cached_##name(\
+            const features_data_t *data,\
+            const features_switch_number_t *numbers,\
+            size_t n) {\
+        features_block_cache_t *cache;\
+        value_type val;\
+        uint64_t sink;\
+        size_t i;\
+        cache = features_block_cache_local();\
+        sink = 0;\
+        for (i = 0; i < n; ++i) {\
+            if (FEATURES_OK == features_cached_switch_##name##_value(cache,\
+                        features_bench_snapshot(data), numbers[i], &val)) {\
+                sink += (uint64_t)val;\
+            }\
+        }\
+        return sink;\
+    }
+
+FEATURES_BENCH_TYPED(flag, char)
+FEATURES_BENCH_TYPED(uint8, uint8_t)
+FEATURES_BENCH_TYPED(uint16, uint16_t)
+FEATURES_BENCH_TYPED(uint32, uint32_t)
+FEATURES_BENCH_TYPED(uint64, uint64_t)
+FEATURES_BENCH_TYPED(int8, int8_t)
+FEATURES_BENCH_TYPED(int16, int16_t)
+FEATURES_BENCH_TYPED(int32, int32_t)
+FEATURES_BENCH_TYPED(int64, int64_t)
+
+static const features_bench_t features_benches[] = {
+    {"value", FEATURES_SWITCH_TYPE_INVALID, features_bench_value, features_bench_cached_value},
+    {"flag", FEATURES_SWITCH_TYPE_FLAG, features_bench_flag, features_bench_cached_flag},
+    {"uint8", FEATURES_SWITCH_TYPE_UINT8, features_bench_uint8, features_bench_cached_uint8},
+    {"uint16", FEATURES_SWITCH_TYPE_UINT16, features_bench_uint16, features_bench_cached_uint16},
+    {"uint32", FEATURES_SWITCH_TYPE_UINT32, features_bench_uint32, features_bench_cached_uint32},
+    {"uint64", FEATURES_SWITCH_TYPE_UINT64, features_bench_uint64, features_bench_cached_uint64},
+    {"int8", FEATURES_SWITCH_TYPE_INT8, features_bench_int8, features_bench_cached_int8},
+    {"int16", FEATURES_SWITCH_TYPE_INT16, features_bench_int16, features_bench_cached_int16},
+    {"int32", FEATURES_SWITCH_TYPE_INT32, features_bench_int32, features_bench_cached_int32},
+    {"int64", FEATURES_SWITCH_TYPE_INT64, features_bench_int64, features_bench_cached_int64}
+};
+
+static void
+features_bench_usage(const char *program);
+
+static int
+features_bench_parse_mix(features_bench_options_t *options, const char *mix);
+
+static uint64_t
+features_bench_random(uint64_t *state);
+
+static int
+features_bench_generate(
+        const features_bench_options_t *options,
+        features_builder_t *builder,
+        features_bench_numbers_t *numbers);
+
+static int
+features_bench_run(
+        const features_bench_run_t *run,
+        unsigned threads);
+
+static void *
+features_bench_thread(void *arg);
+
+static int
+features_bench_gate_wait(features_bench_gate_t *gate);
+
+static void
+features_bench_gate_abort(features_bench_gate_t *gate);
+
+static double
+features_bench_now(void);
+
+static int
+features_bench_compare_double(const void *a, const void *b);
+
+static int
+features_bench_perf_open(void);
+
+static int64_t
+features_bench_perf_read(int fd);
+
+int
+main(int argc, char *argv[]) {
+    static const struct option long_options[] = {
+        {"switches", required_argument, NULL, 's'},
+        {"mix", required_argument, NULL, 'm'},
+        {"threads", required_argument, NULL, 't'},
+        {"ops", required_argument, NULL, 'n'},
+        {"evict-mb", required_argument, NULL, 'e'},
+        {"index", no_argument, NULL, 'i'},
+        {"block-cache", no_argument, NULL, 'c'},
+        {"seed", required_argument, NULL, 'S'},
+        {"benchmark", required_argument, NULL, 'b'},
+        {"output", required_argument, NULL, 'o'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+    features_bench_numbers_t numbers[FEATURES_SWITCH_TYPE_INVALID + 1];
+    features_bench_options_t options;
+    features_bench_run_t run;
+    features_snapshot_t snapshot;
+    features_builder_t builder;
+    features_data_t data;
+    features_bench_gate_t gate;
+    uint8_t *evict;
+    void *raw;
+    unsigned threads;
+    size_t i;
+    int pattern;
+    int cache;
+    int rc;
+    int c;
+
+    memset(&options, 0, sizeof(options));
+    options.switches = 200000;
+    options.threads = 1;
+    options.ops = 1000000;
+    options.evict_bytes = (size_t)64 << 20;
+    options.seed = 1;
+    options.out = stdout;
+    features_bench_parse_mix(&options, "flag=1,uint8=1,uint16=1,uint32=1,uint64=1,"
+            "int8=1,int16=1,int32=1,int64=1");
+
+    while (-1 != (c = getopt_long(argc, argv, "s:m:t:n:e:icS:b:o:h", long_options, NULL))) {
+        switch (c) {
+            case 's':
+                options.switches = strtoull(optarg, NULL, 10);
+                break;
+            case 'm':
+                if (0 != features_bench_parse_mix(&options, optarg)) {
+                    fprintf(stderr, "invalid type mix: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 't':
+                options.threads = (unsigned)strtoul(optarg, NULL, 10);
+                break;
+            case 'n':
+                options.ops = strtoull(optarg, NULL, 10);
+                break;
+            case 'e':
+                options.evict_bytes = (size_t)strtoull(optarg, NULL, 10) << 20;
+                break;
+            case 'i':
+                options.index = 1;
+                break;
+            case 'c':
+                options.block_cache = 1;
+                break;
+            case 'S':
+                options.seed = (unsigned)strtoul(optarg, NULL, 10);
+                break;
+            case 'b':
+                options.filter = optarg;
+                break;
+            case 'o':
+                options.out = fopen(optarg, "w");
+
+                if (NULL == options.out) {
+                    fprintf(stderr, "%s: %s\n", optarg, strerror(errno));
+                    return 1;
+                }
+                break;
+            default:
+                features_bench_usage(argv[0]);
+                return 'h' == c ? 0 : 1;
+        }
+    }
+
+    if (0 == options.switches || 0 == options.threads || 0 == options.ops) {
+        features_bench_usage(argv[0]);
+        return 1;
+    }
+
+    if (0 != features_bench_generate(&options, &builder, numbers)) {
+        fprintf(stderr, "failed to generate the switch file\n");
+        return 1;
+    }
+
+    raw = NULL;
+
+    if (0 != posix_memalign(&raw, FEATURES_PAGE_SIZE, features_builder_size(&builder))) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    features_builder_write(&builder, raw);
+    features_builder_free(&builder);
+
+    if (FEATURES_OK != features_data(&data, raw)
+            || (options.index && FEATURES_OK != features_data_index(&data))) {
+        fprintf(stderr, "failed to load the switch file\n");
+        return 1;
+    }
+
+    features_snapshot_init(&snapshot, NULL);
+    snapshot.data = data;
+
+    evict = malloc(options.evict_bytes ? options.evict_bytes : 1);
+
+    if (NULL == evict) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    memset(evict, 1, options.evict_bytes);
+
+    rc = 0;
+
+    for (i = 0; i < sizeof(features_benches) / sizeof(features_benches[0]); ++i) {
+        if (NULL != options.filter && 0 != strcmp(options.filter, features_benches[i].name)) {
+            continue;
+        }
+
+        if (0 == numbers[features_benches[i].type].count) {
+            continue;
+        }
+
+        for (pattern = FEATURES_BENCH_SEQUENTIAL; pattern <= FEATURES_BENCH_CLUSTERED; ++pattern) {
+            for (cache = FEATURES_BENCH_WARM; cache <= FEATURES_BENCH_COLD; ++cache) {
+                // 1, 2, 4 ... threads and finally the requested count
+                for (threads = 1; ;
+                        threads = threads * 2 < options.threads ? threads * 2 : options.threads) {
+
+                    run.options = &options;
+                    run.bench = &features_benches[i];
+                    run.data = &snapshot.data;
+                    run.numbers = &numbers[features_benches[i].type];
+                    run.pattern = (features_bench_pattern_t)pattern;
+                    run.cache = (features_bench_cache_t)cache;
+                    run.evict = evict;
+                    run.gate = &gate;
+
+                    pthread_mutex_init(&gate.mutex, NULL);
+                    pthread_cond_init(&gate.cond, NULL);
+                    gate.waiting = 0;
+                    gate.count = threads;
+                    gate.aborted = 0;
+                    rc |= features_bench_run(&run, threads);
+                    pthread_cond_destroy(&gate.cond);
+                    pthread_mutex_destroy(&gate.mutex);
+
+                    if (threads == options.threads) {
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    features_data_index_free(&snapshot.data);
+    free(evict);
+    free(raw);
+
+    for (i = 0; i <= FEATURES_SWITCH_TYPE_INVALID; ++i) {
+        free(numbers[i].numbers);
+    }
+
+    if (stdout != options.out) {
+        fclose(options.out);
+    }
+
+    return rc;
+}
+
+static uint64_t
+features_bench_value(
+        const features_data_t *data,
+        const features_switch_number_t *numbers,
+        size_t n) {
+    features_switch_value_t value;
+    uint64_t sink;
+    size_t i;
+
+    sink = 0;
+
+    for (i = 0; i < n; ++i) {
+        if (FEATURES_OK == features_switch_value(data, numbers[i], &value)) {
+            sink += value.value.uint8;
+        }
+    }
+
+    return sink;
+}
+
+static uint64_t
+features_bench_cached_value(
+        const features_data_t *data,
+        const features_switch_number_t *numbers,
+        size_t n) {
+    features_block_cache_t *cache;
+    features_switch_value_t value;
+    uint64_t sink;
+    size_t i;
+
+    cache = features_block_cache_local();
+    sink = 0;
+
+    for (i = 0; i < n; ++i) {
+        if (FEATURES_OK == features_cached_switch_value(cache, features_bench_snapshot(data),
+                    numbers[i], &value)) {
+            sink += value.value.uint8;
+        }
+    }
+
+    return sink;
+}
+
+static void
+features_bench_usage(const char *program) {
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -s, --switches N    switches in the generated file (200000)\n"
+            "  -m, --mix MIX       relative type weights, e.g. flag=4,uint16=1\n"
+            "  -t, --threads N     run with 1, 2, 4 ... up to N threads (1)\n"
+            "  -n, --ops N         lookups per thread for warm runs (1000000)\n"
+            "  -e, --evict-mb N    memory read between cold samples (64)\n"
+            "  -i, --index         build the block directory index\n"
+            "  -c, --block-cache   look up through a thread local block cache\n"
+            "  -S, --seed N        random seed (1)\n"
+            "  -b, --benchmark B   only run value or one typed accessor\n"
+            "  -o, --output FILE   write the JSON results to FILE\n",
+            program);
+}
+
+static int
+features_bench_parse_mix(features_bench_options_t *options, const char *mix) {
+    char buf[256];
+    char *saveptr;
+    char *item;
+    char *eq;
+    int type;
+    int found;
+
+    if (strlen(mix) >= sizeof(buf)) {
+        return -1;
+    }
+
+    strcpy(buf, mix);
+    memset(options->weights, 0, sizeof(options->weights));
+
+    for (item = strtok_r(buf, ",", &saveptr); NULL != item; item = strtok_r(NULL, ",", &saveptr)) {
+        eq = strchr(item, '=');
+
+        if (NULL == eq) {
+            return -1;
+        }
+
+        *eq = '\0';
+        found = 0;
+
+        for (type = FEATURES_SWITCH_TYPE_FLAG; type <= FEATURES_SWITCH_TYPE_INT64; ++type) {
+            if (0 == strcmp(item, features_switch_type_name((features_switch_type_t)type))) {
+                options->weights[type] = (unsigned)strtoul(eq + 1, NULL, 10);
+                found = 1;
+            }
+        }
+
+        if (!found) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+// xorshift64*, stable across platforms so runs are reproducible
+static uint64_t
+features_bench_random(uint64_t *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * UINT64_C(2685821657736338717);
+}
+
+static int
+features_bench_generate(
+        const features_bench_options_t *options,
+        features_builder_t *builder,
+        features_bench_numbers_t *numbers) {
+    features_switch_number_t switch_number;
+    features_switch_value_t value;
+    features_bench_numbers_t *set;
+    unsigned total_weight;
+    uint64_t state;
+    uint64_t pick;
+    uint64_t i;
+    int type;
+
+    total_weight = 0;
+
+    for (type = 0; type <= FEATURES_SWITCH_TYPE_INVALID; ++type) {
+        total_weight += options->weights[type];
+    }
+
+    if (0 == total_weight) {
+        return -1;
+    }
+
+    memset(numbers, 0, (FEATURES_SWITCH_TYPE_INVALID + 1) * sizeof(features_bench_numbers_t));
+
+    for (type = 0; type <= FEATURES_SWITCH_TYPE_INVALID; ++type) {
+        numbers[type].numbers = malloc(options->switches * sizeof(features_switch_number_t));
+
+        if (NULL == numbers[type].numbers) {
+            return -1;
+        }
+    }
+
+    features_builder_init(builder);
+    state = options->seed * UINT64_C(0x9e3779b97f4a7c15) + 1;
+
+    for (i = 0; i < options->switches; ++i) {
+        pick = features_bench_random(&state) % total_weight;
+
+        for (type = 0; pick >= options->weights[type]; ++type) {
+            pick -= options->weights[type];
+        }
+
+        value.type = (features_switch_type_t)type;
+        value.value.uint64 = features_bench_random(&state);
+
+        if (FEATURES_OK != features_builder_add(builder, &value,
+                    FEATURES_SWITCH_PROPERTY_USED, &switch_number)) {
+            return -1;
+        }
+
+        set = &numbers[type];
+        set->numbers[set->count++] = switch_number;
+        set = &numbers[FEATURES_SWITCH_TYPE_INVALID];
+        set->numbers[set->count++] = switch_number;
+    }
+
+    return 0;
+}
+
+static int
+features_bench_run(
+        const features_bench_run_t *run,
+        unsigned threads) {
+    features_bench_thread_t *thread_state;
+    pthread_t *thread_ids;
+    double *samples;
+    double elapsed_ns;
+    int64_t cache_misses;
+    uint64_t block_cache_hits;
+    uint64_t block_cache_misses;
+    uint64_t ops;
+    size_t sample_count;
+    size_t offset;
+    unsigned t;
+    int failed;
+
+    thread_state = calloc(threads, sizeof(features_bench_thread_t));
+    thread_ids = calloc(threads, sizeof(pthread_t));
+
+    if (NULL == thread_state || NULL == thread_ids) {
+        free(thread_state);
+        free(thread_ids);
+        return 1;
+    }
+
+    for (t = 0; t < threads; ++t) {
+        thread_state[t].run = run;
+        thread_state[t].id = t;
+        if (0 != pthread_create(&thread_ids[t], NULL, features_bench_thread, &thread_state[t])) {
+            fprintf(stderr, "failed to start benchmark thread %u of %u\n", t + 1, threads);
+            features_bench_gate_abort(run->gate);
+            break;
+        }
+    }
+
+    threads = t;
+    sample_count = 0;
+    failed = threads < run->gate->count;
+
+    for (t = 0; t < threads; ++t) {
+        pthread_join(thread_ids[t], NULL);
+        sample_count += thread_state[t].sample_count;
+        failed |= thread_state[t].failed;
+    }
+
+    samples = failed ? NULL : malloc((sample_count ? sample_count : 1) * sizeof(double));
+
+    if (NULL == samples) {
+        for (t = 0; t < threads; ++t) {
+            free(thread_state[t].samples);
+        }
+
+        free(thread_state);
+        free(thread_ids);
+        return 1;
+    }
+
+    elapsed_ns = 0;
+    ops = 0;
+    cache_misses = 0;
+    block_cache_hits = 0;
+    block_cache_misses = 0;
+    offset = 0;
+
+    for (t = 0; t < threads; ++t) {
+        memcpy(samples + offset, thread_state[t].samples,
+                thread_state[t].sample_count * sizeof(double));
+        offset += thread_state[t].sample_count;
+        elapsed_ns += thread_state[t].elapsed_ns;
+        ops += thread_state[t].ops;
+        block_cache_hits += thread_state[t].block_cache_hits;
+        block_cache_misses += thread_state[t].block_cache_misses;
+
+        if (cache_misses >= 0 && thread_state[t].cache_misses >= 0) {
+            cache_misses += thread_state[t].cache_misses;
+        } else {
+            cache_misses = -1;
+        }
+
+        free(thread_state[t].samples);
+    }
+
+    qsort(samples, sample_count, sizeof(double), features_bench_compare_double);
+
+    fprintf(run->options->out,
+            "{\"benchmark\":\"%s\",\"pattern\":\"%s\",\"cache\":\"%s\",\"threads\":%u,"
+            "\"index\":%s,\"block_cache\":%s,\"switches\":%llu,\"ops\":%llu,\"ns_per_op\":%.2f,"
+            "\"p50\":%.2f,\"p90\":%.2f,\"p99\":%.2f,\"max\":%.2f,",
+            run->bench->name,
+            features_bench_pattern_names[run->pattern],
+            FEATURES_BENCH_WARM == run->cache ? "warm" : "cold",
+            threads,
+            run->options->index ? "true" : "false",
+            run->options->block_cache ? "true" : "false",
+            (unsigned long long)run->numbers->count,
+            (unsigned long long)ops,
+            ops ? elapsed_ns / ops : 0.0,
+            sample_count ? samples[sample_count * 50 / 100] : 0.0,
+            sample_count ? samples[sample_count * 90 / 100] : 0.0,
+            sample_count ? samples[sample_count * 99 / 100] : 0.0,
+            sample_count ? samples[sample_count - 1] : 0.0);
+
+    if (run->options->block_cache && block_cache_hits + block_cache_misses) {
+        fprintf(run->options->out, "\"block_cache_hit_rate\":%.4f,",
+                (double)block_cache_hits / (block_cache_hits + block_cache_misses));
+    } else {
+        fprintf(run->options->out, "\"block_cache_hit_rate\":null,");
+    }
+
+    if (cache_misses >= 0 && ops) {
+        fprintf(run->options->out, "\"cache_misses_per_op\":%.4f}\n", (double)cache_misses / ops);
+    } else {
+        fprintf(run->options->out, "\"cache_misses_per_op\":null}\n");
+    }
+
+    fflush(run->options->out);
+
+    free(samples);
+    free(thread_state);
+    free(thread_ids);
+    return 0;
+}
+
+static void *
+features_bench_thread(void *arg) {
+    features_bench_thread_t *state;
+    features_block_cache_t *block_cache;
+    const features_bench_run_t *run;
+    features_switch_number_t *numbers;
+    features_bench_fn fn;
+    features_switch_number_t tmp;
+    volatile uint8_t evict_sink;
+    uint64_t random_state;
+    uint64_t samples;
+    uint64_t s;
+    size_t count;
+    size_t length;
+    size_t first;
+    size_t pos;
+    size_t i;
+    size_t j;
+    double start;
+    double end;
+    int64_t misses_before;
+    int perf_fd;
+
+    state = arg;
+    run = state->run;
+    count = run->numbers->count;
+    fn = run->options->block_cache ? run->bench->cached_fn : run->bench->fn;
+
+    numbers = malloc(count * sizeof(features_switch_number_t));
+
+    if (NULL == numbers) {
+        state->failed = 1;
+        features_bench_gate_wait(run->gate);
+        return NULL;
+    }
+
+    // The switch lists are built in ascending number order
+    memcpy(numbers, run->numbers->numbers, count * sizeof(features_switch_number_t));
+
+    random_state = (run->options->seed + state->id + 1) * UINT64_C(0x9e3779b97f4a7c15);
+
+    if (FEATURES_BENCH_RANDOM == run->pattern) {
+        for (i = count - 1; i > 0; --i) {
+            j = features_bench_random(&random_state) % (i + 1);
+            tmp = numbers[i];
+            numbers[i] = numbers[j];
+            numbers[j] = tmp;
+        }
+    } else if (FEATURES_BENCH_CLUSTERED == run->pattern) {
+        for (i = 0; i < count; i += length) {
+            first = features_bench_random(&random_state) % count;
+            length = 1 + features_bench_random(&random_state) % FEATURES_BENCH_CLUSTER_RUN;
+
+            for (j = 0; j < length && i + j < count; ++j) {
+                numbers[i + j] = run->numbers->numbers[(first + j) % count];
+            }
+        }
+    }
+
+    if (FEATURES_BENCH_WARM == run->cache) {
+        samples = (run->options->ops + FEATURES_BENCH_BATCH - 1) / FEATURES_BENCH_BATCH;
+        // Touch every switch once before timing
+        state->sink += fn(run->data, numbers, count);
+    } else {
+        samples = FEATURES_BENCH_COLD_SAMPLES;
+    }
+
+    state->samples = malloc(samples * sizeof(double));
+
+    if (NULL == state->samples) {
+        state->failed = 1;
+        features_bench_gate_wait(run->gate);
+        free(numbers);
+        return NULL;
+    }
+
+    perf_fd = features_bench_perf_open();
+    state->cache_misses = perf_fd >= 0 ? 0 : -1;
+    pos = 0;
+
+    // Only the timed lookups count towards the hit rate
+    block_cache = features_block_cache_local();
+    block_cache->hits = 0;
+    block_cache->misses = 0;
+
+    if (0 != features_bench_gate_wait(run->gate)) {
+        if (perf_fd >= 0) {
+            close(perf_fd);
+        }
+
+        free(numbers);
+        return NULL;
+    }
+
+    for (s = 0; s < samples; ++s) {
+        if (FEATURES_BENCH_COLD == run->cache) {
+            // Push the switch file out of the caches between samples
+            evict_sink = 0;
+
+            for (i = 0; i < run->options->evict_bytes; i += 64) {
+                evict_sink += run->evict[i];
+            }
+
+            (void)evict_sink;
+        }
+
+        if (pos + FEATURES_BENCH_BATCH > count) {
+            pos = 0;
+        }
+
+        i = count < FEATURES_BENCH_BATCH ? count : FEATURES_BENCH_BATCH;
+
+        misses_before = features_bench_perf_read(perf_fd);
+        start = features_bench_now();
+        state->sink += fn(run->data, numbers + pos, i);
+        end = features_bench_now();
+
+        if (perf_fd >= 0) {
+            state->cache_misses += features_bench_perf_read(perf_fd) - misses_before;
+        }
+
+        state->samples[state->sample_count++] = (end - start) / i;
+        state->elapsed_ns += end - start;
+        state->ops += i;
+        pos += i;
+    }
+
+    if (perf_fd >= 0) {
+        close(perf_fd);
+    }
+
+    state->block_cache_hits = block_cache->hits;
+    state->block_cache_misses = block_cache->misses;
+
+    free(numbers);
+    return NULL;
+}
+
+// Non-zero if the run was aborted while waiting
+static int
+features_bench_gate_wait(features_bench_gate_t *gate) {
+    int aborted;
+
+    pthread_mutex_lock(&gate->mutex);
+
+    if (++gate->waiting >= gate->count) {
+        pthread_cond_broadcast(&gate->cond);
+    }
+
+    while (!gate->aborted && gate->waiting < gate->count) {
+        pthread_cond_wait(&gate->cond, &gate->mutex);
+    }
+
+    aborted = gate->aborted;
+    pthread_mutex_unlock(&gate->mutex);
+    return aborted;
+}
+
+static void
+features_bench_gate_abort(features_bench_gate_t *gate) {
+    pthread_mutex_lock(&gate->mutex);
+    gate->aborted = 1;
+    pthread_cond_broadcast(&gate->cond);
+    pthread_mutex_unlock(&gate->mutex);
+}
+
+static double
+features_bench_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int
+features_bench_compare_double(const void *a, const void *b) {
+    double da = *(const double *)a;
+    double db = *(const double *)b;
+
+    return (da > db) - (da < db);
+}
+
+// Counts last level cache misses of the calling thread, -1 when perf
+// counters are not available
+static int
+features_bench_perf_open(void) {
+#ifdef HAVE_LINUX_PERF_EVENT_H
+    struct perf_event_attr attr;
+    long fd;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    return (int)fd;
+#else
+    return -1;
+#endif
+}
+
+static int64_t
+features_bench_perf_read(int fd) {
+    uint64_t count;
+
+    if (fd < 0 || sizeof(count) != read(fd, &count, sizeof(count))) {
+        return 0;
+    }
+
+    return (int64_t)count;
+}
@@ -0,0 +1,599 @@
+#include "builder.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "byteorder.h"
+#include "checksum.h"
+#include "convert.h"
+#include "internal.h"
+
+enum {
+    FEATURES_BUILDER_CHUNK_PAGES = 64
+};
+
+// A page and which of its slots were set, whatever their properties
+typedef struct features_builder_page_t {
+    features_page_raw_t raw;
+    uint64_t set[FEATURES_BLOCKS_PER_PAGE][FEATURES_MAX_SWITCHES_PER_BLOCK / 64];
+} features_builder_page_t;
+
+struct features_builder_chunk_t {
+    features_builder_chunk_t *next;
+    features_builder_page_t pages[FEATURES_BUILDER_CHUNK_PAGES];
+};
+
+// builder->pages point at the raw member, the first one
+#define features_builder_slots(page) (((features_builder_page_t *)(page))->set)
+
+static features_err_t
+features_builder_page(
+        features_builder_t *builder,
+        uint32_t page_number,
+        features_page_raw_t **page);
+
+static features_switch_type_t
+features_builder_block_type(
+        const features_page_raw_t *page,
+        uint8_t block_number);
+
+static void
+features_builder_set_block_type(
+        features_page_raw_t *page,
+        uint8_t block_number,
+        features_switch_type_t type);
+
+static uint64_t
+features_builder_stored_total(const features_builder_t *builder);
+
+static uint64_t
+features_builder_directory_size(const features_builder_t *builder);
+
+void
+features_builder_init(features_builder_t *builder) {
+    int type;
+
+    memset(builder, 0, sizeof(features_builder_t));
+
+    // Block 0 of page 0 is the page header
+    for (type = 0; type <= FEATURES_SWITCH_TYPE_INVALID; ++type) {
+        builder->cursors[type] = FEATURES_MAX_SWITCHES_PER_BLOCK;
+    }
+}
+
+void
+features_builder_free(features_builder_t *builder) {
+    features_builder_chunk_t *chunk;
+
+    while (NULL != builder->chunks) {
+        chunk = builder->chunks;
+        builder->chunks = chunk->next;
+        free(chunk);
+    }
+
+    free(builder->pages);
+    memset(builder, 0, sizeof(features_builder_t));
+}
+
+features_err_t
+features_builder_set(
+        features_builder_t *builder,
+        features_switch_number_t switch_number,
+        const features_switch_value_t *value,
+        uint8_t properties) {
+    features_switch_id_t switch_id;
+    features_switch_type_t block_type;
+    features_page_raw_t *page;
+    features_err_t rc;
+    uint8_t *block;
+    uint8_t *data;
+    uint8_t *property_byte;
+    uint8_t shift;
+
+    switch_id = features_switch_id(switch_number);
+
+    if (0 == switch_id.block_number) {
+        return FEATURES_ERR_INVALID;
+    }
+
+    if (FEATURES_SWITCH_TYPE_DEPRECATED != value->type
+            && switch_id.switch_number >= features_block_capacity(value->type)) {
+        return FEATURES_ERR_INVALID;
+    }
+
+    rc = features_builder_page(builder, switch_id.page_number, &page);
+
+    if (FEATURES_OK != rc) {
+        return rc;
+    }
+
+    block_type = features_builder_block_type(page, switch_id.block_number);
+
+    if (FEATURES_SWITCH_TYPE_UNUSED == block_type) {
+        features_builder_set_block_type(page, switch_id.block_number, value->type);
+    } else if (value->type != block_type) {
+        return FEATURES_ERR_INCORRECT_TYPE;
+    }
+
+    if (FEATURES_SWITCH_TYPE_DEPRECATED == value->type) {
+        return FEATURES_OK;
+    }
+
+    // Taken even without property bits, features_builder_add() skips it
+    features_builder_slots(page)[switch_id.block_number][switch_id.switch_number / 64]
+        |= (uint64_t)1 << (switch_id.switch_number % 64);
+
+    block = ((features_block_raw_t *)page)[switch_id.block_number].data;
+
+    property_byte = block + switch_id.switch_number / 4;
+    shift = (switch_id.switch_number % 4) * 2;
+    *property_byte &= ~(0x3 << shift);
+    *property_byte |= (properties & 0x3) << shift;
+
+    data = block + features_block_properties_size(value->type);
+
+    switch (value->type) {
+        case FEATURES_SWITCH_TYPE_FLAG:
+            data += switch_id.switch_number / 8;
+
+            if (value->value.flag) {
+                *data |= 1 << (switch_id.switch_number % 8);
+            } else {
+                *data &= ~(1 << (switch_id.switch_number % 8));
+            }
+            break;
+        case FEATURES_SWITCH_TYPE_UINT8:
+            data[switch_id.switch_number] = value->value.uint8;
+            break;
+        case FEATURES_SWITCH_TYPE_UINT16:
+            features_write_uint16(data + switch_id.switch_number * 2, value->value.uint16);
+            break;
+        case FEATURES_SWITCH_TYPE_UINT32:
+            features_write_uint32(data + switch_id.switch_number * 4, value->value.uint32);
+            break;
+        case FEATURES_SWITCH_TYPE_UINT64:
+            features_write_uint64(data + switch_id.switch_number * 8, value->value.uint64);
+            break;
+        case FEATURES_SWITCH_TYPE_INT8:
+            data[switch_id.switch_number] = (uint8_t)value->value.int8;
+            break;
+        case FEATURES_SWITCH_TYPE_INT16:
+            features_write_int16(data + switch_id.switch_number * 2, value->value.int16);
+            break;
+        case FEATURES_SWITCH_TYPE_INT32:
+            features_write_int32(data + switch_id.switch_number * 4, value->value.int32);
+            break;
+        case FEATURES_SWITCH_TYPE_INT64:
+            features_write_int64(data + switch_id.switch_number * 8, value->value.int64);
+            break;
+        default:
+            return FEATURES_ERR_INVALID;
+    }
+
+    return FEATURES_OK;
+}
+
+features_err_t
+features_builder_add(
+        features_builder_t *builder,
+        const features_switch_value_t *value,
+        uint8_t properties,
+        features_switch_number_t *switch_number) {
+    features_switch_number_t cursor;
+    features_switch_id_t switch_id;
+    features_switch_type_t block_type;
+    const features_page_raw_t *page;
+    const uint8_t *block;
+    uint8_t capacity;
+    features_err_t rc;
+
+    capacity = features_block_capacity(value->type);
+
+    if (0 == capacity) {
+        return FEATURES_ERR_INVALID;
+    }
+
+    cursor = builder->cursors[value->type];
+
+    for (;;) {
+        switch_id = features_switch_id(cursor);
+
+        if (0 == switch_id.block_number || switch_id.switch_number >= capacity) {
+            // Move on to the start of the next block
+            cursor = (cursor / FEATURES_MAX_SWITCHES_PER_BLOCK + 1) * FEATURES_MAX_SWITCHES_PER_BLOCK;
+            continue;
+        }
+
+        page = switch_id.page_number < builder->page_capacity
+            ? builder->pages[switch_id.page_number]
+            : NULL;
+
+        if (NULL == page) {
+            break;
+        }
+
+        block_type = features_builder_block_type(page, switch_id.block_number);
+
+        if (FEATURES_SWITCH_TYPE_UNUSED == block_type) {
+            break;
+        }
+
+        if (value->type == block_type) {
+            block = ((const features_block_raw_t *)page)[switch_id.block_number].data;
+
+            // A slot is free while it was never set and, for slots copied
+            // in by features_builder_set_page(), none of its property bits
+            // are set
+            if (!((block[switch_id.switch_number / 4] >> ((switch_id.switch_number % 4) * 2)) & 0x3)
+                    && !((((const features_builder_page_t *)page)->set[switch_id.block_number]
+                            [switch_id.switch_number / 64] >> (switch_id.switch_number % 64)) & 1)) {
+                break;
+            }
+
+            ++cursor;
+        } else {
+            cursor = (cursor / FEATURES_MAX_SWITCHES_PER_BLOCK + 1) * FEATURES_MAX_SWITCHES_PER_BLOCK;
+        }
+    }
+
+    rc = features_builder_set(builder, cursor, value, properties | FEATURES_SWITCH_PROPERTY_USED);
+
+    if (FEATURES_OK != rc) {
+        return rc;
+    }
+
+    builder->cursors[value->type] = cursor + 1;
+    *switch_number = cursor;
+
+    return FEATURES_OK;
+}
+
+features_err_t
+features_builder_set_page(
+        features_builder_t *builder,
+        uint32_t page_number,
+        const features_page_raw_t *page) {
+    features_page_raw_t *dst;
+    features_err_t rc;
+
+    rc = features_builder_page(builder, page_number, &dst);
+
+    if (FEATURES_OK != rc) {
+        return rc;
+    }
+
+    // The rest of the header is filled in when the page is written out
+    memset(&dst->header, 0, sizeof(features_page_header_t));
+    memcpy(&dst->header.block_info, &page->header.block_info, sizeof(features_page_header_block_info_t));
+    memcpy(dst->blocks, page->blocks, sizeof(dst->blocks));
+    memset(features_builder_slots(dst), 0, sizeof(features_builder_slots(dst)));
+
+    return FEATURES_OK;
+}
+
+size_t
+features_builder_size(const features_builder_t *builder) {
+    return features_builder_stored_total(builder) * FEATURES_PAGE_SIZE
+        + features_builder_directory_size(builder);
+}
+
+void
+features_builder_write(
+        const features_builder_t *builder,
+        void *out) {
+    uint64_t stored;
+
+    stored = features_builder_write_pages(builder, 0, features_builder_page_total(builder), out);
+    features_builder_write_directory(builder, (features_page_raw_t *)out + stored);
+}
+
+features_err_t
+features_builder_save(
+        const features_builder_t *builder,
+        const char *path) {
+    features_page_raw_t *buf;
+    uint64_t total;
+    uint64_t first;
+    uint64_t count;
+    size_t offset;
+    size_t size;
+    ssize_t n;
+    int fd;
+
+    // Room for a chunk of pages or the directory
+    size = FEATURES_BUILDER_CHUNK_PAGES * sizeof(features_page_raw_t);
+
+    if (size < features_builder_directory_size(builder)) {
+        size = features_builder_directory_size(builder);
+    }
+
+    buf = malloc(size);
+
+    if (NULL == buf) {
+        return FEATURES_ERR_NOMEM;
+    }
+
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if (fd < 0) {
+        free(buf);
+        return FEATURES_ERR_IO;
+    }
+
+    total = features_builder_page_total(builder);
+
+    // One pass per chunk of page numbers and a last one for the directory
+    for (first = 0; first <= total; first += count) {
+        count = total - first;
+
+        if (count > FEATURES_BUILDER_CHUNK_PAGES) {
+            count = FEATURES_BUILDER_CHUNK_PAGES;
+        }
+
+        if (first < total) {
+            size = features_builder_write_pages(builder, first, count, buf) * sizeof(features_page_raw_t);
+        } else {
+            features_builder_write_directory(builder, buf);
+            size = features_builder_directory_size(builder);
+            count = 1;
+        }
+
+        for (offset = 0; offset < size; offset += (size_t)n) {
+            n = write(fd, (uint8_t *)buf + offset, size - offset);
+
+            if (n <= 0) {
+                close(fd);
+                free(buf);
+                return FEATURES_ERR_IO;
+            }
+        }
+    }
+
+    free(buf);
+
+    if (0 != close(fd)) {
+        return FEATURES_ERR_IO;
+    }
+
+    return FEATURES_OK;
+}
+
+static features_err_t
+features_builder_page(
+        features_builder_t *builder,
+        uint32_t page_number,
+        features_page_raw_t **page) {
+    features_builder_chunk_t *chunk;
+
+    if (page_number >= builder->page_capacity) {
+        features_page_raw_t **pages;
+        uint64_t capacity;
+
+        capacity = builder->page_capacity ? builder->page_capacity * 2 : 16;
+
+        if (capacity <= page_number) {
+            capacity = (uint64_t)page_number + 1;
+        }
+
+        pages = realloc(builder->pages, capacity * sizeof(features_page_raw_t *));
+
+        if (NULL == pages) {
+            return FEATURES_ERR_NOMEM;
+        }
+
+        memset(pages + builder->page_capacity, 0,
+                (capacity - builder->page_capacity) * sizeof(features_page_raw_t *));
+        builder->pages = pages;
+        builder->page_capacity = capacity;
+    }
+
+    if (NULL == builder->pages[page_number]) {
+        if (NULL == builder->chunks || FEATURES_BUILDER_CHUNK_PAGES == builder->chunk_used) {
+            chunk = calloc(1, sizeof(features_builder_chunk_t));
+
+            if (NULL == chunk) {
+                return FEATURES_ERR_NOMEM;
+            }
+
+            chunk->next = builder->chunks;
+            builder->chunks = chunk;
+            builder->chunk_used = 0;
+        }
+
+        builder->pages[page_number] = &builder->chunks->pages[builder->chunk_used++].raw;
+    }
+
+    if (page_number >= builder->page_count) {
+        builder->page_count = (uint64_t)page_number + 1;
+    }
+
+    *page = builder->pages[page_number];
+    return FEATURES_OK;
+}
+
+static features_switch_type_t
+features_builder_block_type(
+        const features_page_raw_t *page,
+        uint8_t block_number) {
+    uint8_t type_byte;
+
+    type_byte = page->header.block_info.data[block_number / 2];
+
+    if (block_number % 2) {
+        type_byte >>= 4;
+    }
+
+    return (features_switch_type_t)(type_byte & 0xf);
+}
+
+static void
+features_builder_set_block_type(
+        features_page_raw_t *page,
+        uint8_t block_number,
+        features_switch_type_t type) {
+    uint8_t *type_byte;
+
+    type_byte = &page->header.block_info.data[block_number / 2];
+
+    // Odd block numbers use the most significant nybble
+    if (block_number % 2) {
+        *type_byte = (*type_byte & 0x0f) | ((type & 0xf) << 4);
+    } else {
+        *type_byte = (*type_byte & 0xf0) | (type & 0xf);
+    }
+}
+
+uint64_t
+features_builder_page_total(const features_builder_t *builder) {
+    // Even an empty file has the first page holding the page count
+    if (builder->page_count <= builder->page_offset) {
+        return 1;
+    }
+
+    return builder->page_count - builder->page_offset;
+}
+
+int
+features_builder_page_stored(
+        const features_builder_t *builder,
+        uint64_t page) {
+    uint64_t page_number;
+
+    if (!(builder->flags & FEATURES_PAGE_FLAG_SPARSE) || 0 == page) {
+        return 1;
+    }
+
+    page_number = builder->page_offset + page;
+
+    return page_number < builder->page_capacity && NULL != builder->pages[page_number];
+}
+
+static uint64_t
+features_builder_stored_total(const features_builder_t *builder) {
+    uint64_t total;
+    uint64_t stored;
+    uint64_t i;
+
+    total = features_builder_page_total(builder);
+
+    if (!(builder->flags & FEATURES_PAGE_FLAG_SPARSE)) {
+        return total;
+    }
+
+    stored = 0;
+
+    for (i = 0; i < total; ++i) {
+        stored += features_builder_page_stored(builder, i);
+    }
+
+    return stored;
+}
+
+static uint64_t
+features_builder_directory_size(const features_builder_t *builder) {
+    uint64_t size;
+
+    if (!(builder->flags & FEATURES_PAGE_FLAG_SPARSE)) {
+        return 0;
+    }
+
+    size = (features_builder_page_total(builder) + 63) / 64 * sizeof(features_page_directory_t);
+
+    return (size + FEATURES_PAGE_SIZE - 1) / FEATURES_PAGE_SIZE * FEATURES_PAGE_SIZE;
+}
+
+uint64_t
+features_builder_write_pages(
+        const features_builder_t *builder,
+        uint64_t first,
+        uint64_t count,
+        features_page_raw_t *out) {
+    features_page_raw_t *page;
+    uint64_t page_number;
+    uint64_t stored;
+    uint64_t i;
+
+    stored = 0;
+
+    for (i = 0; i < count; ++i) {
+        if (!features_builder_page_stored(builder, first + i)) {
+            continue;
+        }
+
+        page_number = builder->page_offset + first + i;
+        page = out + stored++;
+
+        if (page_number < builder->page_capacity && NULL != builder->pages[page_number]) {
+            memcpy(page, builder->pages[page_number], sizeof(features_page_raw_t));
+        } else {
+            memset(page, 0, sizeof(features_page_raw_t));
+        }
+
+        memcpy(page->header.MAGIC, FEATURES_MAGIC_13_10, sizeof(page->header.MAGIC));
+        features_write_uint32(&page->header.page_number, (uint32_t)page_number);
+
+        page->header.flags = builder->flags & ~FEATURES_PAGE_FLAG_LITTLE_ENDIAN;
+
+        // Only the first page carries the page count, so growing the
+        // file leaves the headers of the other pages unchanged
+        if (0 == first + i) {
+            features_write_uint32(&page->header.page_count,
+                    (uint32_t)features_builder_stored_total(builder));
+
+            if (builder->flags & FEATURES_PAGE_FLAG_SPARSE) {
+                features_write_uint32(&page->header.page_span,
+                        (uint32_t)features_builder_page_total(builder));
+            }
+        }
+    }
+
+    // Pages are encoded big endian, features_convert() checksums the
+    // pages it converts
+    features_convert(out, stored, builder->flags);
+
+    if ((builder->flags & FEATURES_PAGE_FLAG_CHECKSUM)
+            && !(builder->flags & FEATURES_PAGE_FLAG_LITTLE_ENDIAN)) {
+        features_checksum(out, stored);
+    }
+
+    return stored;
+}
+
+void
+features_builder_write_directory(
+        const features_builder_t *builder,
+        void *out) {
+    features_page_directory_t *directory;
+    uint64_t present;
+    uint64_t rank;
+    uint64_t total;
+    uint64_t i;
+
+    if (!(builder->flags & FEATURES_PAGE_FLAG_SPARSE)) {
+        return;
+    }
+
+    memset(out, 0, features_builder_directory_size(builder));
+    directory = out;
+    total = features_builder_page_total(builder);
+    present = 0;
+    rank = 0;
+
+    for (i = 0; i < total; ++i) {
+        if (0 == i % 64) {
+            present = 0;
+        }
+
+        if (features_builder_page_stored(builder, i)) {
+            present |= (uint64_t)1 << (i % 64);
+        }
+
+        if (63 == i % 64 || total - 1 == i) {
+            features_write_uint64(&directory[i / 64].present, present);
+            features_write_uint64(&directory[i / 64].rank, rank);
+            rank += features_popcount64(present);
+        }
+    }
+}
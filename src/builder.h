@@ -0,0 +1,123 @@
+#ifndef FEATURES_BUILDER_H
+#define FEATURES_BUILDER_H
+
+#include <stddef.h>
+
+#include "memory.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct features_builder_chunk_t features_builder_chunk_t;
+
+// Encodes switches into pages in memory and writes them out as a switch
+// file. Pages are allocated from an arena and encoded in place, so
+// adding a switch is constant time and writing out is a copy.
+typedef struct features_builder_t {
+    // Indexed by page number, NULL for pages without any switch
+    features_page_raw_t **pages;
+    uint64_t page_capacity;
+    // One past the highest page number holding a switch
+    uint64_t page_count;
+    // First page written out, switches on earlier pages read back as
+    // deprecated
+    uint64_t page_offset;
+    // FEATURES_PAGE_FLAG_* of the pages written out, set to
+    // features_native_flags() to skip byte swapping on the readers and
+    // add FEATURES_PAGE_FLAG_SPARSE to leave out pages without switches
+    // or FEATURES_PAGE_FLAG_CHECKSUM to checksum every page
+    uint8_t flags;
+
+    features_builder_chunk_t *chunks;
+    size_t chunk_used;
+
+    // Where features_builder_add() looks for a free slot, per type
+    features_switch_number_t cursors[FEATURES_SWITCH_TYPE_INVALID + 1];
+} features_builder_t;
+
+void
+features_builder_init(features_builder_t *builder);
+
+void
+features_builder_free(features_builder_t *builder);
+
+// Sets the switch to value->type and value with the given
+// FEATURES_SWITCH_PROPERTY_* bits. The first switch set in a block
+// decides the type of the block, a value of type
+// FEATURES_SWITCH_TYPE_DEPRECATED marks the whole block deprecated.
+// Returns FEATURES_ERR_INCORRECT_TYPE if the block already has another
+// type and FEATURES_ERR_INVALID if the slot does not exist.
+features_err_t
+features_builder_set(
+        features_builder_t *builder,
+        features_switch_number_t switch_number,
+        const features_switch_value_t *value,
+        uint8_t properties);
+
+// Sets a switch in the first free slot of a block of value->type,
+// opening a new block when none has room, and returns its number
+features_err_t
+features_builder_add(
+        features_builder_t *builder,
+        const features_switch_value_t *value,
+        uint8_t properties,
+        features_switch_number_t *switch_number);
+
+// Copies the block types and blocks of a big endian page to page_number,
+// replacing whatever was set there before
+features_err_t
+features_builder_set_page(
+        features_builder_t *builder,
+        uint32_t page_number,
+        const features_page_raw_t *page);
+
+// Size in bytes of the encoded file
+size_t
+features_builder_size(const features_builder_t *builder);
+
+// Writes features_builder_size() bytes of pages to out
+void
+features_builder_write(
+        const features_builder_t *builder,
+        void *out);
+
+features_err_t
+features_builder_save(
+        const features_builder_t *builder,
+        const char *path);
+
+// Pages from page_offset up to the last page holding a switch, at least
+// one. Pages are counted from page_offset by the functions below.
+uint64_t
+features_builder_page_total(const features_builder_t *builder);
+
+// Whether page is written out. Sparse files leave out pages without
+// switches but always hold the first page.
+int
+features_builder_page_stored(
+        const features_builder_t *builder,
+        uint64_t page);
+
+// Encodes the stored pages among count pages from first to out and
+// returns how many were written. Encoding only reads the builder, so
+// disjoint ranges may be encoded by several threads at once.
+uint64_t
+features_builder_write_pages(
+        const features_builder_t *builder,
+        uint64_t first,
+        uint64_t count,
+        features_page_raw_t *out);
+
+// Writes the directory of a sparse file, which follows the stored pages
+// and takes up the rest of features_builder_size()
+void
+features_builder_write_directory(
+        const features_builder_t *builder,
+        void *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,187 @@
+#ifndef FEATURES_BYTEORDER_H
+#define FEATURES_BYTEORDER_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include "config.h"
+#include "memory.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Switch data is stored big endian unless the page header carries
+// FEATURES_PAGE_FLAG_LITTLE_ENDIAN. The read and write functions convert
+// big endian to and from host order, the load functions take the page
+// flags and only swap when the data is not already in host order.
+
+static inline uint16_t
+features_swap_endian_16(uint16_t val) {
+#ifdef __GNUC__
+    return __builtin_bswap16(val);
+#else
+    return (uint16_t)((val >> 8) | (val << 8));
+#endif
+}
+
+static inline uint32_t
+features_swap_endian_32(uint32_t val) {
+#ifdef __GNUC__
+    return __builtin_bswap32(val);
+#else
+    return ((val >> 24) & 0x000000ff)
+        | ((val >> 8) & 0x0000ff00)
+        | ((val << 8) & 0x00ff0000)
+        | ((val << 24) & 0xff000000);
+#endif
+}
+
+static inline uint64_t
+features_swap_endian_64(uint64_t val) {
+#ifdef __GNUC__
+    return __builtin_bswap64(val);
+#else
+    return ((uint64_t)features_swap_endian_32((uint32_t)val) << 32)
+        | features_swap_endian_32((uint32_t)(val >> 32));
+#endif
+}
+
+// Whether data stored with the given page flags needs swapping
+static inline int
+features_needs_swap(uint8_t flags) {
+#ifdef WORDS_BIGENDIAN
+    return 0 != (flags & FEATURES_PAGE_FLAG_LITTLE_ENDIAN);
+#else
+    return 0 == (flags & FEATURES_PAGE_FLAG_LITTLE_ENDIAN);
+#endif
+}
+
+static inline uint16_t
+features_read_uint16(const void *data) {
+    uint16_t val;
+    memcpy(&val, data, sizeof(uint16_t));
+#ifndef WORDS_BIGENDIAN
+    val = features_swap_endian_16(val);
+#endif
+    return val;
+}
+
+static inline void
+features_write_uint16(void *data, uint16_t value) {
+    uint16_t val = value;
+#ifndef WORDS_BIGENDIAN
+    val = features_swap_endian_16(val);
+#endif
+    memcpy(data, &val, sizeof(uint16_t));
+}
+
+static inline uint32_t
+features_read_uint32(const void *data) {
+    uint32_t val;
+    memcpy(&val, data, sizeof(uint32_t));
+#ifndef WORDS_BIGENDIAN
+    val = features_swap_endian_32(val);
+#endif
+    return val;
+}
+
+static inline void
+features_write_uint32(void *data, uint32_t value) {
+    uint32_t val = value;
+#ifndef WORDS_BIGENDIAN
+    val = features_swap_endian_32(val);
+#endif
+    memcpy(data, &val, sizeof(uint32_t));
+}
+
+static inline uint64_t
+features_read_uint64(const void *data) {
+    uint64_t val;
+    memcpy(&val, data, sizeof(uint64_t));
+#ifndef WORDS_BIGENDIAN
+    val = features_swap_endian_64(val);
+#endif
+    return val;
+}
+
+static inline void
+features_write_uint64(void *data, uint64_t value) {
+    uint64_t val = value;
+#ifndef WORDS_BIGENDIAN
+    val = features_swap_endian_64(val);
+#endif
+    memcpy(data, &val, sizeof(uint64_t));
+}
+
+static inline int16_t
+features_read_int16(const void *data) {
+    return (int16_t)features_read_uint16(data);
+}
+
+static inline void
+features_write_int16(void *data, int16_t value) {
+    features_write_uint16(data, (uint16_t)value);
+}
+
+static inline int32_t
+features_read_int32(const void *data) {
+    return (int32_t)features_read_uint32(data);
+}
+
+static inline void
+features_write_int32(void *data, int32_t value) {
+    features_write_uint32(data, (uint32_t)value);
+}
+
+static inline int64_t
+features_read_int64(const void *data) {
+    return (int64_t)features_read_uint64(data);
+}
+
+static inline void
+features_write_int64(void *data, int64_t value) {
+    features_write_uint64(data, (uint64_t)value);
+}
+
+static inline uint16_t
+features_load_uint16(const void *data, uint8_t flags) {
+    uint16_t val;
+    memcpy(&val, data, sizeof(uint16_t));
+    return features_needs_swap(flags) ? features_swap_endian_16(val) : val;
+}
+
+static inline uint32_t
+features_load_uint32(const void *data, uint8_t flags) {
+    uint32_t val;
+    memcpy(&val, data, sizeof(uint32_t));
+    return features_needs_swap(flags) ? features_swap_endian_32(val) : val;
+}
+
+static inline uint64_t
+features_load_uint64(const void *data, uint8_t flags) {
+    uint64_t val;
+    memcpy(&val, data, sizeof(uint64_t));
+    return features_needs_swap(flags) ? features_swap_endian_64(val) : val;
+}
+
+static inline int16_t
+features_load_int16(const void *data, uint8_t flags) {
+    return (int16_t)features_load_uint16(data, flags);
+}
+
+static inline int32_t
+features_load_int32(const void *data, uint8_t flags) {
+    return (int32_t)features_load_uint32(data, flags);
+}
+
+static inline int64_t
+features_load_int64(const void *data, uint8_t flags) {
+    return (int64_t)features_load_uint64(data, flags);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,182 @@
+#include "cache.h"
+
+#include <string.h>
+
+#include "internal.h"
+#include "replica.h"
+#include "stats.h"
+
+static _Thread_local features_block_cache_t features_block_cache_thread;
+
+// features_cached_switch_value() without the read counters
+static features_err_t
+features_cached_lookup(
+        features_block_cache_t *cache,
+        const features_snapshot_t *snapshot,
+        features_switch_number_t switch_number,
+        features_switch_value_t *value);
+
+void
+features_block_cache_init(features_block_cache_t *cache) {
+    memset(cache, 0, sizeof(features_block_cache_t));
+}
+
+features_block_cache_t *
+features_block_cache_local(void) {
+    return &features_block_cache_thread;
+}
+
+features_err_t
+features_cached_switch_value(
+        features_block_cache_t *cache,
+        const features_snapshot_t *snapshot,
+        features_switch_number_t switch_number,
+        features_switch_value_t *value) {
+    features_err_t rc;
+
+    rc = features_cached_lookup(cache, snapshot, switch_number, value);
+
+    if (NULL != snapshot->data.stats) {
+        features_stats_record(snapshot->data.stats, switch_number, rc);
+    }
+
+    return rc;
+}
+
+#define FEATURE_CACHED_RETURN_VALUE(expected_type, member)\
+    features_switch_value_t value;\
+    features_err_t rc;\
+    rc = features_cached_lookup(cache,snapshot,switch_number,&value);\
+    if (FEATURES_OK == rc){\
+        if (expected_type != value.type) {\
+            rc = FEATURES_ERR_INCORRECT_TYPE;\
+        } else {\
+            *val = value.value.member;\
+        }\
+    }\
+    if (NULL != snapshot->data.stats) {\
+        features_stats_record(snapshot->data.stats, switch_number, rc);\
+    }\
+    return rc
+
+features_err_t
+features_cached_switch_flag_value(
+        features_block_cache_t *cache,
+        const features_snapshot_t *snapshot,
+        features_switch_number_t switch_number,
+        char *val) {
+    FEATURE_CACHED_RETURN_VALUE(FEATURES_SWITCH_TYPE_FLAG, flag);
+}
+
+features_err_t
+features_cached_switch_uint8_value(
+        features_block_cache_t *cache,
+        const features_snapshot_t *snapshot,
+        features_switch_number_t switch_number,
+        uint8_t *val) {
+    FEATURE_CACHED_RETURN_VALUE(FEATURES_SWITCH_TYPE_UINT8, uint8);
+}
+
+features_err_t
+features_cached_switch_uint16_value(
+        features_block_cache_t *cache,
+        const features_snapshot_t *snapshot,
+        features_switch_number_t switch_number,
+        uint16_t *val) {
+    FEATURE_CACHED_RETURN_VALUE(FEATURES_SWITCH_TYPE_UINT16, uint16);
+}
+
+features_err_t
+features_cached_switch_uint32_value(
+        features_block_cache_t *cache,
+        const features_snapshot_t *snapshot,
+        features_switch_number_t switch_number,
+        uint32_t *val) {
+    FEATURE_CACHED_RETURN_VALUE(FEATURES_SWITCH_TYPE_UINT32, uint32);
+}
+
+features_err_t
+features_cached_switch_uint64_value(
+        features_block_cache_t *cache,
+        const features_snapshot_t *snapshot,
+        features_switch_number_t switch_number,
+        uint64_t *val) {
+    FEATURE_CACHED_RETURN_VALUE(FEATURES_SWITCH_TYPE_UINT64, uint64);
+}
+
+features_err_t
+features_cached_switch_int8_value(
+        features_block_cache_t *cache,
+        const features_snapshot_t *snapshot,
+        features_switch_number_t switch_number,
+        int8_t *val) {
+    FEATURE_CACHED_RETURN_VALUE(FEATURES_SWITCH_TYPE_INT8, int8);
+}
+
+features_err_t
+features_cached_switch_int16_value(
+        features_block_cache_t *cache,
+        const features_snapshot_t *snapshot,
+        features_switch_number_t switch_number,
+        int16_t *val) {
+    FEATURE_CACHED_RETURN_VALUE(FEATURES_SWITCH_TYPE_INT16, int16);
+}
+
+features_err_t
+features_cached_switch_int32_value(
+        features_block_cache_t *cache,
+        const features_snapshot_t *snapshot,
+        features_switch_number_t switch_number,
+        int32_t *val) {
+    FEATURE_CACHED_RETURN_VALUE(FEATURES_SWITCH_TYPE_INT32, int32);
+}
+
+features_err_t
+features_cached_switch_int64_value(
+        features_block_cache_t *cache,
+        const features_snapshot_t *snapshot,
+        features_switch_number_t switch_number,
+        int64_t *val) {
+    FEATURE_CACHED_RETURN_VALUE(FEATURES_SWITCH_TYPE_INT64, int64);
+}
+
+static features_err_t
+features_cached_lookup(
+        features_block_cache_t *cache,
+        const features_snapshot_t *snapshot,
+        features_switch_number_t switch_number,
+        features_switch_value_t *value) {
+    features_block_cache_entry_t *entry;
+    features_switch_info_t switch_info;
+    features_block_number_t block_number;
+    features_switch_id_t switch_id;
+    features_err_t rc;
+
+    block_number = switch_number / FEATURES_MAX_SWITCHES_PER_BLOCK;
+    entry = &cache->entries[block_number & (FEATURES_BLOCK_CACHE_ENTRIES - 1)];
+
+    if (entry->generation == snapshot->generation + 1 && entry->block_number == block_number) {
+        ++cache->hits;
+    } else {
+        ++cache->misses;
+
+        // From the copy on the calling thread's node, which the entry
+        // keeps reading until it is replaced
+        switch_id = features_switch_id(switch_number);
+        rc = features_switch_block(&entry->block, features_snapshot_local_data(snapshot), switch_id);
+
+        if (FEATURES_OK != rc) {
+            entry->generation = 0;
+            return rc;
+        }
+
+        entry->generation = snapshot->generation + 1;
+        entry->block_number = block_number;
+    }
+
+    features_block_switch_info(&switch_info, &entry->block,
+            (uint8_t)(switch_number % FEATURES_MAX_SWITCHES_PER_BLOCK));
+    switch_info.flags = snapshot->data.flags;
+
+    return features_switch_read(value, &switch_info);
+}
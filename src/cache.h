@@ -0,0 +1,127 @@
+#ifndef FEATURES_CACHE_H
+#define FEATURES_CACHE_H
+
+#include <stdint.h>
+
+#include "memory.h"
+#include "snapshot.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Decoded blocks of recent lookups, for callers whose lookups cluster on
+// a few blocks. A hit skips the page magic check and the block type
+// decoding and goes straight to the property bits and the value.
+//
+// Entries are keyed by snapshot generation as well as block number.
+// Generations are never reused, so publishing a new snapshot makes every
+// entry of the old one miss without the cache being told. A cache
+// belongs to one thread, features_block_cache_local() returns the
+// calling thread's own.
+//
+// Blocks of a replicated snapshot are decoded from the copy local to the
+// calling thread, see replica.h.
+
+enum {
+    // Direct mapped by block number, a power of 2
+    FEATURES_BLOCK_CACHE_ENTRIES = 16
+};
+
+typedef struct features_block_cache_entry_t {
+    // Generation of the snapshot + 1, 0 while the entry is empty
+    uint64_t generation;
+    features_block_number_t block_number;
+    features_block_t block;
+} features_block_cache_entry_t;
+
+typedef struct features_block_cache_t {
+    features_block_cache_entry_t entries[FEATURES_BLOCK_CACHE_ENTRIES];
+    uint64_t hits;
+    uint64_t misses;
+} features_block_cache_t;
+
+void
+features_block_cache_init(features_block_cache_t *cache);
+
+// The cache of the calling thread
+features_block_cache_t *
+features_block_cache_local(void);
+
+// features_switch_value() of the snapshot data, or of its local copy,
+// through the cache
+features_err_t
+features_cached_switch_value(
+        features_block_cache_t *cache,
+        const features_snapshot_t *snapshot,
+        features_switch_number_t switch_number,
+        features_switch_value_t *value);
+
+features_err_t
+features_cached_switch_flag_value(
+        features_block_cache_t *cache,
+        const features_snapshot_t *snapshot,
+        features_switch_number_t switch_number,
+        char *val);
+
+features_err_t
+features_cached_switch_uint8_value(
+        features_block_cache_t *cache,
+        const features_snapshot_t *snapshot,
+        features_switch_number_t switch_number,
+        uint8_t *val);
+
+features_err_t
+features_cached_switch_uint16_value(
+        features_block_cache_t *cache,
+        const features_snapshot_t *snapshot,
+        features_switch_number_t switch_number,
+        uint16_t *val);
+
+features_err_t
+features_cached_switch_uint32_value(
+        features_block_cache_t *cache,
+        const features_snapshot_t *snapshot,
+        features_switch_number_t switch_number,
+        uint32_t *val);
+
+features_err_t
+features_cached_switch_uint64_value(
+        features_block_cache_t *cache,
+        const features_snapshot_t *snapshot,
+        features_switch_number_t switch_number,
+        uint64_t *val);
+
+features_err_t
+features_cached_switch_int8_value(
+        features_block_cache_t *cache,
+        const features_snapshot_t *snapshot,
+        features_switch_number_t switch_number,
+        int8_t *val);
+
+features_err_t
+features_cached_switch_int16_value(
+        features_block_cache_t *cache,
+        const features_snapshot_t *snapshot,
+        features_switch_number_t switch_number,
+        int16_t *val);
+
+features_err_t
+features_cached_switch_int32_value(
+        features_block_cache_t *cache,
+        const features_snapshot_t *snapshot,
+        features_switch_number_t switch_number,
+        int32_t *val);
+
+features_err_t
+features_cached_switch_int64_value(
+        features_block_cache_t *cache,
+        const features_snapshot_t *snapshot,
+        features_switch_number_t switch_number,
+        int64_t *val);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,480 @@
+#include "checksum.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "byteorder.h"
+#include "internal.h"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define FEATURES_CHECKSUM_X86 1
+#include <immintrin.h>
+#endif
+
+enum {
+    // Checksums computed side by side, three chains keep the crc32
+    // instruction busy despite its latency
+    FEATURES_CHECKSUM_LANES = 3,
+    // Pages a verifying thread claims at a time
+    FEATURES_VERIFY_CHUNK_PAGES = 256
+};
+
+// Computes the checksums of count pages, at most FEATURES_CHECKSUM_LANES
+typedef void (*features_checksum_fn)(
+        const features_page_raw_t *const *pages,
+        int count,
+        uint32_t *out);
+
+typedef struct features_verify_job_t {
+    const features_data_t *data;
+    features_checksum_fn checksum_fn;
+    _Atomic uint64_t next_page;
+    // Lowest bad page found so far, pages after it are not checked
+    _Atomic uint64_t first_bad;
+
+    pthread_mutex_t lock;
+    features_verify_result_t result;
+} features_verify_job_t;
+
+static uint32_t features_crc32c_table[8][256];
+
+// Chosen once for the CPU, by features_checksum_init()
+static features_checksum_fn features_checksum_impl;
+
+static pthread_once_t features_checksum_once = PTHREAD_ONCE_INIT;
+
+static void
+features_crc32c_init(void);
+
+static uint32_t
+features_crc32c_update(
+        uint32_t crc,
+        const uint8_t *data,
+        size_t size);
+
+static void
+features_checksum_scalar(
+        const features_page_raw_t *const *pages,
+        int count,
+        uint32_t *out);
+
+static features_checksum_fn
+features_checksum_select(void);
+
+static void
+features_checksum_init(void);
+
+static void *
+features_verify_pages(void *arg);
+
+static int
+features_verify_page(
+        const features_data_t *data,
+        uint64_t page_index,
+        uint8_t *block);
+
+static void
+features_verify_report(
+        features_verify_job_t *job,
+        uint64_t page_index,
+        uint8_t block);
+
+#ifdef FEATURES_CHECKSUM_X86
+static void
+features_checksum_sse42(
+        const features_page_raw_t *const *pages,
+        int count,
+        uint32_t *out);
+#endif
+
+uint32_t
+features_page_checksum(const features_page_raw_t *page) {
+    uint32_t checksum;
+
+    features_checksum_select()(&page, 1, &checksum);
+    return checksum;
+}
+
+void
+features_checksum(
+        features_page_raw_t *pages,
+        uint64_t count) {
+    const features_page_raw_t *lanes[FEATURES_CHECKSUM_LANES];
+    uint32_t checksums[FEATURES_CHECKSUM_LANES];
+    features_checksum_fn checksum_fn;
+    uint64_t i;
+    int n;
+    int l;
+
+    checksum_fn = features_checksum_select();
+
+    for (i = 0; i < count; i += n) {
+        n = count - i < FEATURES_CHECKSUM_LANES ? (int)(count - i) : FEATURES_CHECKSUM_LANES;
+
+        for (l = 0; l < n; ++l) {
+            lanes[l] = pages + i + l;
+        }
+
+        checksum_fn(lanes, n, checksums);
+
+        for (l = 0; l < n; ++l) {
+            features_write_uint32(&pages[i + l].header.checksum, checksums[l]);
+        }
+    }
+}
+
+features_err_t
+features_verify(
+        const features_data_t *data,
+        unsigned threads,
+        features_verify_result_t *result) {
+    features_verify_job_t job;
+    pthread_t *thread_ids;
+    unsigned started;
+    unsigned t;
+
+    if (0 == threads) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (unsigned)cpus : 1;
+    }
+
+    if (threads > (data->page_count + FEATURES_VERIFY_CHUNK_PAGES - 1) / FEATURES_VERIFY_CHUNK_PAGES) {
+        threads = (unsigned)((data->page_count + FEATURES_VERIFY_CHUNK_PAGES - 1)
+                / FEATURES_VERIFY_CHUNK_PAGES);
+    }
+
+    if (0 == threads) {
+        threads = 1;
+    }
+
+    job.data = data;
+    job.checksum_fn = features_checksum_select();
+    atomic_init(&job.next_page, 0);
+    atomic_init(&job.first_bad, data->page_count);
+    pthread_mutex_init(&job.lock, NULL);
+    memset(&job.result, 0, sizeof(job.result));
+    job.result.page_index = data->page_count;
+
+    thread_ids = NULL;
+    started = 1;
+
+    if (threads > 1) {
+        thread_ids = malloc(threads * sizeof(pthread_t));
+    }
+
+    // Falls back to checking on the calling thread alone
+    if (NULL != thread_ids) {
+        for (started = 1; started < threads; ++started) {
+            if (0 != pthread_create(&thread_ids[started], NULL, features_verify_pages, &job)) {
+                break;
+            }
+        }
+    }
+
+    features_verify_pages(&job);
+
+    for (t = 1; t < started; ++t) {
+        pthread_join(thread_ids[t], NULL);
+    }
+
+    free(thread_ids);
+    pthread_mutex_destroy(&job.lock);
+
+    if (job.result.page_index < data->page_count) {
+        if (NULL != result) {
+            *result = job.result;
+        }
+
+        return FEATURES_ERR_INVALID;
+    }
+
+    return FEATURES_OK;
+}
+
+static void
+features_crc32c_init(void) {
+    uint32_t crc;
+    int i;
+    int j;
+
+    // Castagnoli polynomial, bit reflected
+    for (i = 0; i < 256; ++i) {
+        crc = (uint32_t)i;
+
+        for (j = 0; j < 8; ++j) {
+            crc = (crc >> 1) ^ (0x82f63b78 & -(crc & 1));
+        }
+
+        features_crc32c_table[0][i] = crc;
+    }
+
+    for (i = 0; i < 256; ++i) {
+        for (j = 1; j < 8; ++j) {
+            crc = features_crc32c_table[j - 1][i];
+            features_crc32c_table[j][i] = (crc >> 8) ^ features_crc32c_table[0][crc & 0xff];
+        }
+    }
+}
+
+// Slicing by 8, 8 bytes per step
+static uint32_t
+features_crc32c_update(
+        uint32_t crc,
+        const uint8_t *data,
+        size_t size) {
+    uint32_t lo;
+    uint32_t hi;
+
+    for (; size >= 8; size -= 8, data += 8) {
+        lo = crc ^ ((uint32_t)data[0] | (uint32_t)data[1] << 8
+                | (uint32_t)data[2] << 16 | (uint32_t)data[3] << 24);
+        hi = (uint32_t)data[4] | (uint32_t)data[5] << 8
+            | (uint32_t)data[6] << 16 | (uint32_t)data[7] << 24;
+
+        crc = features_crc32c_table[7][lo & 0xff]
+            ^ features_crc32c_table[6][(lo >> 8) & 0xff]
+            ^ features_crc32c_table[5][(lo >> 16) & 0xff]
+            ^ features_crc32c_table[4][lo >> 24]
+            ^ features_crc32c_table[3][hi & 0xff]
+            ^ features_crc32c_table[2][(hi >> 8) & 0xff]
+            ^ features_crc32c_table[1][(hi >> 16) & 0xff]
+            ^ features_crc32c_table[0][hi >> 24];
+    }
+
+    for (; size > 0; --size, ++data) {
+        crc = features_crc32c_table[0][(crc ^ *data) & 0xff] ^ (crc >> 8);
+    }
+
+    return crc;
+}
+
+static void
+features_checksum_scalar(
+        const features_page_raw_t *const *pages,
+        int count,
+        uint32_t *out) {
+    uint8_t header[FEATURES_BLOCK_SIZE];
+    uint32_t crc;
+    int l;
+
+    for (l = 0; l < count; ++l) {
+        memcpy(header, pages[l], sizeof(header));
+        memset(header + offsetof(features_page_header_t, checksum), 0, sizeof(uint32_t));
+
+        crc = features_crc32c_update(0xffffffff, header, sizeof(header));
+        crc = features_crc32c_update(crc, (const uint8_t *)pages[l] + sizeof(header),
+                FEATURES_PAGE_SIZE - sizeof(header));
+        out[l] = ~crc;
+    }
+}
+
+static features_checksum_fn
+features_checksum_select(void) {
+    pthread_once(&features_checksum_once, features_checksum_init);
+    return features_checksum_impl;
+}
+
+static void
+features_checksum_init(void) {
+#ifdef FEATURES_CHECKSUM_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("sse4.2")) {
+        features_checksum_impl = features_checksum_sse42;
+        return;
+    }
+#endif
+
+    features_crc32c_init();
+    features_checksum_impl = features_checksum_scalar;
+}
+
+static void *
+features_verify_pages(void *arg) {
+    const features_page_raw_t *lanes[FEATURES_CHECKSUM_LANES];
+    uint64_t lane_index[FEATURES_CHECKSUM_LANES];
+    uint32_t checksums[FEATURES_CHECKSUM_LANES];
+    const features_data_t *data;
+    features_verify_job_t *job;
+    uint64_t first;
+    uint64_t end;
+    uint64_t i;
+    uint8_t block;
+    int n;
+    int l;
+
+    job = arg;
+    data = job->data;
+
+    for (;;) {
+        first = atomic_fetch_add(&job->next_page, FEATURES_VERIFY_CHUNK_PAGES);
+
+        if (first >= data->page_count || first > atomic_load(&job->first_bad)) {
+            return NULL;
+        }
+
+        end = first + FEATURES_VERIFY_CHUNK_PAGES;
+
+        if (end > data->page_count) {
+            end = data->page_count;
+        }
+
+        n = 0;
+
+        for (i = first; i < end; ++i) {
+            if (!features_verify_page(data, i, &block)) {
+                features_verify_report(job, i, block);
+                break;
+            }
+
+            if (!(data->flags & FEATURES_PAGE_FLAG_CHECKSUM)) {
+                continue;
+            }
+
+            lanes[n] = data->pages + i;
+            lane_index[n++] = i;
+
+            if (FEATURES_CHECKSUM_LANES == n || end - 1 == i) {
+                job->checksum_fn(lanes, n, checksums);
+
+                for (l = 0; l < n; ++l) {
+                    if (checksums[l] != features_read_uint32(&lanes[l]->header.checksum)) {
+                        features_verify_report(job, lane_index[l], FEATURES_BLOCKS_PER_PAGE);
+                        break;
+                    }
+                }
+
+                n = 0;
+            }
+        }
+
+        // Pages left in the lanes when a header check stopped the chunk
+        // come before the bad page
+        if (n > 0) {
+            job->checksum_fn(lanes, n, checksums);
+
+            for (l = 0; l < n; ++l) {
+                if (checksums[l] != features_read_uint32(&lanes[l]->header.checksum)) {
+                    features_verify_report(job, lane_index[l], FEATURES_BLOCKS_PER_PAGE);
+                    break;
+                }
+            }
+        }
+    }
+}
+
+// Checks the header and block types of one page, setting block to the
+// first bad block
+static int
+features_verify_page(
+        const features_data_t *data,
+        uint64_t page_index,
+        uint8_t *block) {
+    const features_page_raw_t *page_raw;
+    features_page_t page;
+    features_page_t previous;
+    uint8_t type;
+    int b;
+
+    page_raw = data->pages + page_index;
+    *block = 0;
+
+    if (FEATURES_OK != features_page(&page, (features_page_raw_t *)page_raw)
+            || page_raw->header.flags != data->flags) {
+        return 0;
+    }
+
+    if (NULL == data->directory) {
+        if (page.page_number != data->page_offset + page_index) {
+            return 0;
+        }
+    } else {
+        // Rising page numbers, each where the directory puts it
+        if (page.page_number - data->page_offset >= data->page_span
+                || features_directory_find(data->directory, page.page_number - data->page_offset)
+                    != (int64_t)page_index) {
+            return 0;
+        }
+
+        if (page_index > 0
+                && (FEATURES_OK != features_page(&previous, (features_page_raw_t *)(page_raw - 1))
+                    || previous.page_number >= page.page_number)) {
+            return 0;
+        }
+    }
+
+    for (b = 1; b < FEATURES_BLOCKS_PER_PAGE; ++b) {
+        type = page_raw->header.block_info.data[b / 2];
+        type = (b % 2 ? type >> 4 : type) & 0xf;
+
+        if (type > FEATURES_SWITCH_TYPE_INT64) {
+            *block = (uint8_t)b;
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+static void
+features_verify_report(
+        features_verify_job_t *job,
+        uint64_t page_index,
+        uint8_t block) {
+    features_page_t page;
+
+    pthread_mutex_lock(&job->lock);
+
+    if (page_index < job->result.page_index) {
+        job->result.page_index = page_index;
+        job->result.block = block;
+        job->result.page_number = FEATURES_OK == features_page(&page, job->data->pages + page_index)
+            ? page.page_number
+            : 0;
+        atomic_store(&job->first_bad, page_index);
+    }
+
+    pthread_mutex_unlock(&job->lock);
+}
+
+#ifdef FEATURES_CHECKSUM_X86
+__attribute__((target("sse4.2")))
+static void
+features_checksum_sse42(
+        const features_page_raw_t *const *pages,
+        int count,
+        uint32_t *out) {
+    const uint8_t *data[FEATURES_CHECKSUM_LANES];
+    uint64_t crc[FEATURES_CHECKSUM_LANES];
+    uint64_t word;
+    size_t offset;
+    int l;
+
+    // Unused lanes repeat the first page so the loop has no branches
+    for (l = 0; l < FEATURES_CHECKSUM_LANES; ++l) {
+        data[l] = (const uint8_t *)pages[l < count ? l : 0];
+        crc[l] = 0xffffffff;
+    }
+
+    for (offset = 0; offset < FEATURES_PAGE_SIZE; offset += sizeof(uint64_t)) {
+        for (l = 0; l < FEATURES_CHECKSUM_LANES; ++l) {
+            memcpy(&word, data[l] + offset, sizeof(word));
+
+            // The checksum field counts as zero, x86 is little endian
+            if (offset == offsetof(features_page_header_t, checksum) / 8 * 8) {
+                word &= ~((uint64_t)0xffffffff << (offsetof(features_page_header_t, checksum) % 8 * 8));
+            }
+
+            crc[l] = _mm_crc32_u64(crc[l], word);
+        }
+    }
+
+    for (l = 0; l < count; ++l) {
+        out[l] = ~(uint32_t)crc[l];
+    }
+}
+#endif
@@ -0,0 +1,47 @@
+#ifndef FEATURES_CHECKSUM_H
+#define FEATURES_CHECKSUM_H
+
+#include "memory.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Files with FEATURES_PAGE_FLAG_CHECKSUM store the CRC32C of every page
+// in its header, computed over the final bytes of the page with the
+// checksum field taken as zero. Uses the SSE4.2 crc32 instruction where
+// the CPU has it.
+
+// Where features_verify() found the first bad page
+typedef struct features_verify_result_t {
+    // Position of the page in the file
+    uint64_t page_index;
+    uint32_t page_number;
+    // The bad block, 0 for the page header and FEATURES_BLOCKS_PER_PAGE
+    // when only the checksum tells the page is damaged
+    uint8_t block;
+} features_verify_result_t;
+
+uint32_t
+features_page_checksum(const features_page_raw_t *page);
+
+// Stores the checksum of each of count pages in its header
+void
+features_checksum(
+        features_page_raw_t *pages,
+        uint64_t count);
+
+// Checks every page header and block type, and the checksums of files
+// that have them, with threads threads, 0 for one per online CPU.
+// Returns FEATURES_ERR_INVALID and fills result with the lowest bad page.
+features_err_t
+features_verify(
+        const features_data_t *data,
+        unsigned threads,
+        features_verify_result_t *result);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
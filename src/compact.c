@@ -0,0 +1,160 @@
+#include "compact.h"
+
+#include <string.h>
+
+#include "byteorder.h"
+#include "convert.h"
+#include "internal.h"
+
+static int
+features_compact_page(
+        features_page_raw_t *page,
+        uint64_t *deprecated_blocks);
+
+static int
+features_compact_block_live(
+        const uint8_t *block,
+        features_switch_type_t type);
+
+features_err_t
+features_compact(
+        features_builder_t *builder,
+        const features_data_t *data,
+        features_compact_stats_t *stats) {
+    features_page_raw_t page;
+    features_page_t parsed;
+    features_err_t rc;
+    uint64_t deprecated_blocks;
+    uint64_t page_index;
+    uint64_t first_live;
+    uint32_t page_number;
+    size_t dense_size;
+    size_t sparse_size;
+
+    memset(stats, 0, sizeof(features_compact_stats_t));
+    stats->old_pages = data->page_count;
+    stats->old_size = features_data_size(data);
+    first_live = UINT64_MAX;
+
+    for (page_index = 0; page_index < data->page_count; ++page_index) {
+        rc = features_page(&parsed, data->pages + page_index);
+
+        if (FEATURES_OK != rc) {
+            return rc;
+        }
+
+        page_number = features_read_uint32(&data->pages[page_index].header.page_number);
+
+        // The builder encodes big endian pages
+        memcpy(&page, data->pages + page_index, sizeof(features_page_raw_t));
+        features_convert(&page, 1, 0);
+
+        deprecated_blocks = 0;
+
+        if (!features_compact_page(&page, &deprecated_blocks)) {
+            continue;
+        }
+
+        rc = features_builder_set_page(builder, page_number, &page);
+
+        if (FEATURES_OK != rc) {
+            return rc;
+        }
+
+        stats->deprecated_blocks += deprecated_blocks;
+
+        if (UINT64_MAX == first_live) {
+            first_live = page_number;
+        }
+    }
+
+    // Stored pages rise in page number, so the first live page is the
+    // lowest. A file without live switches is one empty page.
+    builder->page_offset = UINT64_MAX == first_live ? 0 : first_live;
+    builder->flags = data->flags & ~FEATURES_PAGE_FLAG_SPARSE;
+    dense_size = features_builder_size(builder);
+    builder->flags |= FEATURES_PAGE_FLAG_SPARSE;
+    sparse_size = features_builder_size(builder);
+
+    if (dense_size <= sparse_size) {
+        builder->flags &= ~FEATURES_PAGE_FLAG_SPARSE;
+    }
+
+    stats->new_size = features_builder_size(builder);
+    stats->page_offset = builder->page_offset;
+
+    for (page_index = 0; page_index < features_builder_page_total(builder); ++page_index) {
+        stats->new_pages += features_builder_page_stored(builder, page_index);
+    }
+
+    return FEATURES_OK;
+}
+
+// Turns the typed blocks of page without a live switch into deprecated
+// blocks, counting them in deprecated_blocks, and returns whether any
+// block is left with one
+static int
+features_compact_page(
+        features_page_raw_t *page,
+        uint64_t *deprecated_blocks) {
+    features_switch_type_t type;
+    uint8_t *type_byte;
+    int live;
+    int b;
+
+    live = 0;
+
+    for (b = 1; b < FEATURES_BLOCKS_PER_PAGE; ++b) {
+        type_byte = &page->header.block_info.data[b / 2];
+        // Odd block numbers use the most significant nybble
+        type = (features_switch_type_t)((b % 2 ? *type_byte >> 4 : *type_byte) & 0xf);
+
+        if (0 == features_block_capacity(type)) {
+            continue;
+        }
+
+        if (features_compact_block_live(page->blocks[b - 1].data, type)) {
+            live = 1;
+            continue;
+        }
+
+        if (b % 2) {
+            *type_byte = (*type_byte & 0x0f) | (FEATURES_SWITCH_TYPE_DEPRECATED << 4);
+        } else {
+            *type_byte = (*type_byte & 0xf0) | FEATURES_SWITCH_TYPE_DEPRECATED;
+        }
+
+        memset(page->blocks[b - 1].data, 0, FEATURES_BLOCK_SIZE);
+        ++*deprecated_blocks;
+    }
+
+    return live;
+}
+
+// Whether a slot of the block has USED without DEPRECATED
+static int
+features_compact_block_live(
+        const uint8_t *block,
+        features_switch_type_t type) {
+    uint8_t capacity;
+    uint8_t live;
+    uint8_t s;
+
+    capacity = features_block_capacity(type);
+
+    for (s = 0; s < capacity; s += 4) {
+        // The low bit of every pair is USED, the high bit DEPRECATED
+        live = block[s / 4] & ~(block[s / 4] >> 1) & 0x55;
+
+        // Slots past capacity in the last byte hold no switch
+        if (capacity - s < 4) {
+            live &= (1 << ((capacity - s) * 2)) - 1;
+        }
+
+        if (live) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,49 @@
+#ifndef FEATURES_COMPACT_H
+#define FEATURES_COMPACT_H
+
+#include "builder.h"
+#include "memory.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Compaction keeps every live switch, one that is used and not
+// deprecated, at its switch number and drops what no live switch needs.
+// Switches are never moved, since that would change their numbers, so
+// a half empty block keeps its slots:
+//
+//   - typed blocks without a live switch become deprecated blocks
+//   - pages without a live switch are left out, those before the first
+//     live page by raising page_offset, so they read as deprecated, and
+//     the others by ending the file early or making it sparse, so they
+//     read as unused
+//
+// Switches that are not live may read differently afterwards.
+
+typedef struct features_compact_stats_t {
+    // Stored pages and bytes of the file before and after
+    uint64_t old_pages;
+    uint64_t new_pages;
+    uint64_t old_size;
+    uint64_t new_size;
+    uint64_t page_offset;
+    // Typed blocks turned into deprecated blocks
+    uint64_t deprecated_blocks;
+} features_compact_stats_t;
+
+// Sets the live pages of data in builder, which must be freshly
+// initialised, and sets its page_offset and flags. The byte order and
+// checksums of data are kept, and the file is made sparse whenever that
+// is smaller. Write it out with features_builder_save().
+features_err_t
+features_compact(
+        features_builder_t *builder,
+        const features_data_t *data,
+        features_compact_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,966 @@
+// features-compile: compiles a text schema into a switch file
+//
+//     features-compile [options] -o OUTPUT SCHEMA
+//
+// Every line of the schema defines one switch,
+//
+//     NUMBER TYPE VALUE [PROPERTIES]
+//
+// where TYPE is a switch type name such as flag or uint16, VALUE a
+// number, true or false, or - for zero, and PROPERTIES used, the default,
+// deprecated or used,deprecated. This is what `features dump` prints, so
+// a dump compiles back into the same switches. A line
+//
+//     NUMBER deprecated
+//
+// marks the whole block holding NUMBER deprecated. Text after a # is
+// ignored. The first switch of a block decides its type.
+//
+// Pages are encoded by THREADS threads in chunks of pages. With
+// --incremental a hash of the definitions on every page is kept in
+// OUTPUT.state, and as long as the layout of the file is unchanged the
+// previous output is copied, sharing its blocks where the file system
+// can, and only the pages whose definitions changed are encoded over the
+// copy. Anything else encodes every page. Either way the new file
+// replaces the output by rename, so readers mapping the output never see
+// a page change under them.
+
+// copy_file_range()
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "builder.h"
+#include "convert.h"
+#include "hash.h"
+#include "internal.h"
+#include "memory.h"
+
+enum {
+    FEATURES_COMPILE_CHUNK_PAGES = 64
+};
+
+#define FEATURES_COMPILE_STATE_MAGIC "FEATCMP1"
+
+// Header of OUTPUT.state, followed by the hash of every page. Only read
+// back by the build that wrote it, so in host byte order.
+typedef struct features_compile_state_t {
+    char magic[8];
+    uint64_t flags;
+    uint64_t page_total;
+    // Of the output the hashes were written with
+    uint64_t size;
+    uint64_t dev;
+    uint64_t ino;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+} features_compile_state_t;
+
+typedef struct features_compile_t {
+    features_builder_t builder;
+    // Hash of the definitions on every page number, 0 for none
+    uint64_t *hashes;
+    uint64_t hash_capacity;
+    // Hashes of the previous build, NULL to encode every page
+    uint64_t *previous;
+    uint64_t page_total;
+    // Position in the file of the first stored page of every chunk
+    uint64_t *chunk_stored;
+    uint64_t chunk_count;
+    uint64_t stored_total;
+    int fd;
+
+    atomic_uint_fast64_t next_chunk;
+    atomic_uint_fast64_t encoded;
+    atomic_int failed;
+} features_compile_t;
+
+static void
+features_compile_usage(const char *program);
+
+static int
+features_compile_parse(
+        features_compile_t *compile,
+        const char *path);
+
+static const char *
+features_compile_line(
+        char *line,
+        features_switch_number_t *switch_number,
+        features_switch_value_t *value,
+        uint8_t *properties);
+
+static int
+features_compile_value(
+        const char *text,
+        features_switch_value_t *value);
+
+static features_err_t
+features_compile_hash(
+        features_compile_t *compile,
+        features_switch_number_t switch_number,
+        const features_switch_value_t *value,
+        uint8_t properties);
+
+static features_err_t
+features_compile_reserve(
+        features_compile_t *compile,
+        uint64_t page_count);
+
+static int
+features_compile_load_state(
+        features_compile_t *compile,
+        const char *state_path,
+        const char *output_path);
+
+static int
+features_compile_copy(
+        const char *path,
+        int out,
+        uint64_t size);
+
+static int
+features_compile_save_state(
+        const features_compile_t *compile,
+        const char *state_path);
+
+static features_err_t
+features_compile_encode(
+        features_compile_t *compile,
+        unsigned threads);
+
+static void *
+features_compile_worker(void *arg);
+
+static int
+features_compile_pwrite(
+        int fd,
+        const void *buf,
+        size_t size,
+        uint64_t offset);
+
+int
+main(int argc, char *argv[]) {
+    static const struct option long_options[] = {
+        {"output", required_argument, NULL, 'o'},
+        {"threads", required_argument, NULL, 'j'},
+        {"incremental", no_argument, NULL, 'i'},
+        {"little-endian", no_argument, NULL, 'l'},
+        {"native", no_argument, NULL, 'n'},
+        {"sparse", no_argument, NULL, 's'},
+        {"checksum", no_argument, NULL, 'c'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+    features_compile_t compile;
+    features_err_t rc;
+    const char *output;
+    char *state_path;
+    char *tmp_path;
+    unsigned threads;
+    size_t size;
+    long cpus;
+    int incremental;
+    int status;
+    int c;
+
+    memset(&compile, 0, sizeof(compile));
+    features_builder_init(&compile.builder);
+    compile.fd = -1;
+    output = NULL;
+    incremental = 0;
+    cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    threads = cpus > 0 ? (unsigned)cpus : 1;
+
+    while (-1 != (c = getopt_long(argc, argv, "o:j:ilnsch", long_options, NULL))) {
+        switch (c) {
+            case 'o':
+                output = optarg;
+                break;
+            case 'j':
+                threads = (unsigned)strtoul(optarg, NULL, 10);
+                break;
+            case 'i':
+                incremental = 1;
+                break;
+            case 'l':
+                compile.builder.flags |= FEATURES_PAGE_FLAG_LITTLE_ENDIAN;
+                break;
+            case 'n':
+                compile.builder.flags |= features_native_flags();
+                break;
+            case 's':
+                compile.builder.flags |= FEATURES_PAGE_FLAG_SPARSE;
+                break;
+            case 'c':
+                compile.builder.flags |= FEATURES_PAGE_FLAG_CHECKSUM;
+                break;
+            default:
+                features_compile_usage(argv[0]);
+                return 'h' == c ? 0 : 2;
+        }
+    }
+
+    if (argc - optind != 1 || NULL == output || 0 == threads) {
+        features_compile_usage(argv[0]);
+        return 2;
+    }
+
+    state_path = malloc(strlen(output) + sizeof(".state"));
+    tmp_path = malloc(strlen(output) + sizeof(".tmp"));
+
+    if (NULL == state_path || NULL == tmp_path) {
+        fprintf(stderr, "features-compile: %s\n", features_err_name(FEATURES_ERR_NOMEM));
+        return 1;
+    }
+
+    strcat(strcpy(state_path, output), ".state");
+    strcat(strcpy(tmp_path, output), ".tmp");
+    status = 1;
+
+    if (0 != features_compile_parse(&compile, argv[optind])) {
+        goto done;
+    }
+
+    compile.page_total = features_builder_page_total(&compile.builder);
+
+    // Pages without switches up to the page total have a hash too
+    if (FEATURES_OK != features_compile_reserve(&compile, compile.page_total)) {
+        fprintf(stderr, "features-compile: %s\n", features_err_name(FEATURES_ERR_NOMEM));
+        goto done;
+    }
+
+    size = features_builder_size(&compile.builder);
+    compile.fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if (compile.fd < 0) {
+        perror(tmp_path);
+        goto done;
+    }
+
+    if (incremental && 0 == features_compile_load_state(&compile, state_path, output)) {
+        if (0 != features_compile_copy(output, compile.fd, size)) {
+            perror(output);
+            goto done;
+        }
+    } else if (0 != ftruncate(compile.fd, (off_t)size)) {
+        perror(tmp_path);
+        goto done;
+    }
+
+    rc = features_compile_encode(&compile, threads);
+
+    if (FEATURES_OK != rc) {
+        fprintf(stderr, "features-compile: %s: %s\n", tmp_path, features_err_name(rc));
+        goto done;
+    }
+
+    // The state of the output being replaced is stale from here on
+    unlink(state_path);
+
+    if (0 != rename(tmp_path, output)) {
+        perror(output);
+        goto done;
+    }
+
+    if (0 != features_compile_save_state(&compile, state_path)) {
+        perror(state_path);
+        goto done;
+    }
+
+    printf("%s: encoded %llu of %llu pages, %zu bytes\n", output,
+            (unsigned long long)atomic_load(&compile.encoded),
+            (unsigned long long)compile.stored_total, size);
+    status = 0;
+
+done:
+    if (compile.fd >= 0) {
+        close(compile.fd);
+    }
+
+    if (0 != status) {
+        unlink(tmp_path);
+    }
+
+    features_builder_free(&compile.builder);
+    free(compile.hashes);
+    free(compile.previous);
+    free(compile.chunk_stored);
+    free(state_path);
+    free(tmp_path);
+
+    return status;
+}
+
+static void
+features_compile_usage(const char *program) {
+    fprintf(stderr,
+            "usage: %s [options] -o OUTPUT SCHEMA\n"
+            "options:\n"
+            "  -o, --output FILE     write the switch file to FILE\n"
+            "  -j, --threads N       encode with N threads (one per online CPU)\n"
+            "  -i, --incremental     only encode the pages whose definitions changed\n"
+            "                        since the build that wrote FILE.state\n"
+            "  -l, --little-endian   encode little endian pages\n"
+            "  -n, --native          encode pages in host byte order\n"
+            "  -s, --sparse          leave out pages without switches\n"
+            "  -c, --checksum        checksum every page\n",
+            program);
+}
+
+// Sets every switch of the schema, prints every bad line and returns -1
+// if there were any
+static int
+features_compile_parse(
+        features_compile_t *compile,
+        const char *path) {
+    features_switch_number_t switch_number;
+    features_switch_value_t value;
+    features_err_t rc;
+    const char *error;
+    unsigned long line_number;
+    uint8_t properties;
+    size_t capacity;
+    char *line;
+    FILE *in;
+    int errors;
+
+    in = fopen(path, "r");
+
+    if (NULL == in) {
+        perror(path);
+        return -1;
+    }
+
+    line = NULL;
+    capacity = 0;
+    line_number = 0;
+    errors = 0;
+
+    while (-1 != getline(&line, &capacity, in)) {
+        ++line_number;
+        error = features_compile_line(line, &switch_number, &value, &properties);
+
+        if (NULL != error) {
+            if ('\0' != *error) {
+                fprintf(stderr, "%s:%lu: %s\n", path, line_number, error);
+                ++errors;
+            }
+
+            continue;
+        }
+
+        rc = features_builder_set(&compile->builder, switch_number, &value, properties);
+
+        if (FEATURES_ERR_INCORRECT_TYPE == rc) {
+            fprintf(stderr, "%s:%lu: block of switch %llu already holds another type\n",
+                    path, line_number, (unsigned long long)switch_number);
+            ++errors;
+            continue;
+        }
+
+        if (FEATURES_ERR_INVALID == rc) {
+            fprintf(stderr, 0 == features_switch_id(switch_number).block_number
+                        ? "%s:%lu: %s switch %llu is in a page header\n"
+                        : "%s:%lu: %s blocks have no switch %llu\n",
+                    path, line_number, features_switch_type_name(value.type),
+                    (unsigned long long)switch_number);
+            ++errors;
+            continue;
+        }
+
+        if (FEATURES_OK == rc) {
+            rc = features_compile_hash(compile, switch_number, &value, properties);
+        }
+
+        if (FEATURES_OK != rc) {
+            fprintf(stderr, "%s:%lu: %s\n", path, line_number, features_err_name(rc));
+            ++errors;
+            break;
+        }
+    }
+
+    if (ferror(in)) {
+        perror(path);
+        ++errors;
+    }
+
+    free(line);
+    fclose(in);
+
+    return errors ? -1 : 0;
+}
+
+// Parses one line of the schema. Returns NULL for a switch, an empty
+// string for a blank line and otherwise what is wrong with it.
+static const char *
+features_compile_line(
+        char *line,
+        features_switch_number_t *switch_number,
+        features_switch_value_t *value,
+        uint8_t *properties) {
+    static const char *const separators = " \t\r\n";
+    char *fields[5];
+    char *save;
+    char *end;
+    int count;
+    int type;
+
+    end = strchr(line, '#');
+
+    if (NULL != end) {
+        *end = '\0';
+    }
+
+    for (count = 0; count < 5; ++count) {
+        fields[count] = strtok_r(0 == count ? line : NULL, separators, &save);
+
+        if (NULL == fields[count]) {
+            break;
+        }
+    }
+
+    if (0 == count) {
+        return "";
+    }
+
+    if (5 == count) {
+        return "too many fields";
+    }
+
+    if (count < 2) {
+        return "expected NUMBER TYPE VALUE [PROPERTIES]";
+    }
+
+    errno = 0;
+    *switch_number = strtoull(fields[0], &end, 10);
+
+    if (end == fields[0] || '\0' != *end || '-' == fields[0][0] || 0 != errno) {
+        return "bad switch number";
+    }
+
+    memset(value, 0, sizeof(features_switch_value_t));
+    value->type = FEATURES_SWITCH_TYPE_INVALID;
+
+    for (type = FEATURES_SWITCH_TYPE_DEPRECATED; type < FEATURES_SWITCH_TYPE_INVALID; ++type) {
+        if (0 == strcmp(fields[1], features_switch_type_name((features_switch_type_t)type))) {
+            value->type = (features_switch_type_t)type;
+            break;
+        }
+    }
+
+    if (FEATURES_SWITCH_TYPE_INVALID == value->type) {
+        return "unknown switch type";
+    }
+
+    *properties = 0;
+
+    if (FEATURES_SWITCH_TYPE_DEPRECATED == value->type) {
+        return 2 == count ? NULL : "deprecated blocks take no value";
+    }
+
+    if (count < 3) {
+        return "expected NUMBER TYPE VALUE [PROPERTIES]";
+    }
+
+    if (0 != features_compile_value(fields[2], value)) {
+        return "bad value for the type";
+    }
+
+    if (3 == count || 0 == strcmp(fields[3], "used")) {
+        *properties = FEATURES_SWITCH_PROPERTY_USED;
+    } else if (0 == strcmp(fields[3], "deprecated")) {
+        *properties = FEATURES_SWITCH_PROPERTY_DEPRECATED;
+    } else if (0 == strcmp(fields[3], "used,deprecated")) {
+        *properties = FEATURES_SWITCH_PROPERTY_USED | FEATURES_SWITCH_PROPERTY_DEPRECATED;
+    } else {
+        return "properties must be used, deprecated or used,deprecated";
+    }
+
+    return NULL;
+}
+
+// Parses text into value->value for value->type, returns -1 when it does
+// not fit
+static int
+features_compile_value(
+        const char *text,
+        features_switch_value_t *value) {
+    unsigned long long u;
+    long long i;
+    char *end;
+
+    // What `features dump` prints for switches it cannot read
+    if (0 == strcmp(text, "-")) {
+        return 0;
+    }
+
+    if (FEATURES_SWITCH_TYPE_FLAG == value->type) {
+        if (0 == strcmp(text, "true") || 0 == strcmp(text, "1")) {
+            value->value.flag = 1;
+        } else if (0 != strcmp(text, "false") && 0 != strcmp(text, "0")) {
+            return -1;
+        }
+
+        return 0;
+    }
+
+    errno = 0;
+
+    if (value->type >= FEATURES_SWITCH_TYPE_INT8) {
+        i = strtoll(text, &end, 10);
+        u = 0;
+    } else {
+        // strtoull() would take negative numbers modulo 2^64
+        if ('-' == text[0]) {
+            return -1;
+        }
+
+        u = strtoull(text, &end, 10);
+        i = 0;
+    }
+
+    if (end == text || '\0' != *end || 0 != errno) {
+        return -1;
+    }
+
+    switch (value->type) {
+        case FEATURES_SWITCH_TYPE_UINT8:
+            value->value.uint8 = (uint8_t)u;
+            return u > UINT8_MAX ? -1 : 0;
+        case FEATURES_SWITCH_TYPE_UINT16:
+            value->value.uint16 = (uint16_t)u;
+            return u > UINT16_MAX ? -1 : 0;
+        case FEATURES_SWITCH_TYPE_UINT32:
+            value->value.uint32 = (uint32_t)u;
+            return u > UINT32_MAX ? -1 : 0;
+        case FEATURES_SWITCH_TYPE_UINT64:
+            value->value.uint64 = u;
+            return 0;
+        case FEATURES_SWITCH_TYPE_INT8:
+            value->value.int8 = (int8_t)i;
+            return i < INT8_MIN || i > INT8_MAX ? -1 : 0;
+        case FEATURES_SWITCH_TYPE_INT16:
+            value->value.int16 = (int16_t)i;
+            return i < INT16_MIN || i > INT16_MAX ? -1 : 0;
+        case FEATURES_SWITCH_TYPE_INT32:
+            value->value.int32 = (int32_t)i;
+            return i < INT32_MIN || i > INT32_MAX ? -1 : 0;
+        case FEATURES_SWITCH_TYPE_INT64:
+            value->value.int64 = i;
+            return 0;
+        default:
+            return -1;
+    }
+}
+
+// Folds a definition into the hash of its page, in schema order since a
+// later definition of a switch replaces an earlier one
+static features_err_t
+features_compile_hash(
+        features_compile_t *compile,
+        features_switch_number_t switch_number,
+        const features_switch_value_t *value,
+        uint8_t properties) {
+    features_err_t rc;
+    uint64_t page_number;
+    uint64_t h;
+
+    page_number = features_switch_id(switch_number).page_number;
+    rc = features_compile_reserve(compile, page_number + 1);
+
+    if (FEATURES_OK != rc) {
+        return rc;
+    }
+
+    h = features_hash_mix(value->value.uint64);
+    h = features_hash_mix(h ^ ((uint64_t)value->type << 8 | properties));
+    h = features_hash_mix(h ^ switch_number);
+    h = features_hash_mix(compile->hashes[page_number] ^ h);
+
+    // 0 is kept for pages without definitions
+    compile->hashes[page_number] = h ? h : 1;
+
+    return FEATURES_OK;
+}
+
+// Grows compile->hashes to at least page_count pages
+static features_err_t
+features_compile_reserve(
+        features_compile_t *compile,
+        uint64_t page_count) {
+    uint64_t *hashes;
+    uint64_t capacity;
+
+    if (page_count <= compile->hash_capacity) {
+        return FEATURES_OK;
+    }
+
+    capacity = compile->hash_capacity ? compile->hash_capacity * 2 : 16;
+
+    if (capacity < page_count) {
+        capacity = page_count;
+    }
+
+    hashes = realloc(compile->hashes, capacity * sizeof(uint64_t));
+
+    if (NULL == hashes) {
+        return FEATURES_ERR_NOMEM;
+    }
+
+    memset(hashes + compile->hash_capacity, 0,
+            (capacity - compile->hash_capacity) * sizeof(uint64_t));
+    compile->hashes = hashes;
+    compile->hash_capacity = capacity;
+
+    return FEATURES_OK;
+}
+
+// Reads the hashes of the previous build into compile->previous. Returns
+// -1 unless they are for the output as it is and a file of the same
+// layout, in which case every page needs encoding anyway.
+static int
+features_compile_load_state(
+        features_compile_t *compile,
+        const char *state_path,
+        const char *output_path) {
+    features_compile_state_t state;
+    struct stat st;
+    uint64_t page;
+    FILE *in;
+
+    if (0 != stat(output_path, &st)) {
+        return -1;
+    }
+
+    in = fopen(state_path, "rb");
+
+    if (NULL == in) {
+        return -1;
+    }
+
+    if (1 != fread(&state, sizeof(state), 1, in)
+            || 0 != memcmp(state.magic, FEATURES_COMPILE_STATE_MAGIC, sizeof(state.magic))
+            || state.flags != compile->builder.flags
+            || state.page_total != compile->page_total
+            || state.size != features_builder_size(&compile->builder)
+            || state.size != (uint64_t)st.st_size
+            || state.dev != (uint64_t)st.st_dev
+            || state.ino != (uint64_t)st.st_ino
+            || state.mtime_sec != (int64_t)st.st_mtim.tv_sec
+            || state.mtime_nsec != (int64_t)st.st_mtim.tv_nsec) {
+        fclose(in);
+        return -1;
+    }
+
+    compile->previous = malloc(compile->page_total * sizeof(uint64_t));
+
+    if (NULL == compile->previous
+            || 1 != fread(compile->previous, compile->page_total * sizeof(uint64_t), 1, in)) {
+        fclose(in);
+        free(compile->previous);
+        compile->previous = NULL;
+        return -1;
+    }
+
+    fclose(in);
+
+    // Sparse files store the pages that hold switches, which is where
+    // there is a hash
+    if (compile->builder.flags & FEATURES_PAGE_FLAG_SPARSE) {
+        for (page = 1; page < compile->page_total; ++page) {
+            if (!compile->previous[page] != !compile->hashes[page]) {
+                free(compile->previous);
+                compile->previous = NULL;
+                return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+// Copies size bytes of the previous output at path to out, in the kernel
+// where it can
+static int
+features_compile_copy(
+        const char *path,
+        int out,
+        uint64_t size) {
+    uint8_t *buf;
+    uint64_t done;
+    ssize_t n;
+    int in;
+
+    in = open(path, O_RDONLY);
+
+    if (in < 0) {
+        return -1;
+    }
+
+    done = 0;
+
+#ifdef HAVE_COPY_FILE_RANGE
+    // Moves the offset of in, so copying through memory carries on where
+    // this stops, across file systems for one
+    while (done < size) {
+        n = copy_file_range(in, NULL, out, NULL, size - done, 0);
+
+        if (n <= 0) {
+            break;
+        }
+
+        done += (uint64_t)n;
+    }
+#endif
+
+    buf = done < size ? malloc(FEATURES_COMPILE_CHUNK_PAGES * FEATURES_PAGE_SIZE) : NULL;
+
+    while (done < size && NULL != buf) {
+        n = read(in, buf, FEATURES_COMPILE_CHUNK_PAGES * FEATURES_PAGE_SIZE);
+
+        if (n <= 0 || 0 != features_compile_pwrite(out, buf, (size_t)n, done)) {
+            break;
+        }
+
+        done += (uint64_t)n;
+    }
+
+    free(buf);
+    close(in);
+
+    return done == size ? 0 : -1;
+}
+
+static int
+features_compile_save_state(
+        const features_compile_t *compile,
+        const char *state_path) {
+    features_compile_state_t state;
+    struct stat st;
+    FILE *out;
+    int rc;
+
+    if (0 != fstat(compile->fd, &st)) {
+        return -1;
+    }
+
+    memset(&state, 0, sizeof(state));
+    memcpy(state.magic, FEATURES_COMPILE_STATE_MAGIC, sizeof(state.magic));
+    state.flags = compile->builder.flags;
+    state.page_total = compile->page_total;
+    state.size = (uint64_t)st.st_size;
+    state.dev = (uint64_t)st.st_dev;
+    state.ino = (uint64_t)st.st_ino;
+    state.mtime_sec = (int64_t)st.st_mtim.tv_sec;
+    state.mtime_nsec = (int64_t)st.st_mtim.tv_nsec;
+
+    out = fopen(state_path, "wb");
+
+    if (NULL == out) {
+        return -1;
+    }
+
+    rc = 1 == fwrite(&state, sizeof(state), 1, out)
+        && 1 == fwrite(compile->hashes, compile->page_total * sizeof(uint64_t), 1, out)
+        ? 0 : -1;
+
+    if (0 != fclose(out) || 0 != rc) {
+        unlink(state_path);
+        return -1;
+    }
+
+    return 0;
+}
+
+// Encodes the pages that changed, every page without compile->previous,
+// into compile->fd with threads threads, and the directory of a new
+// sparse file
+static features_err_t
+features_compile_encode(
+        features_compile_t *compile,
+        unsigned threads) {
+    features_page_raw_t *directory;
+    pthread_t *thread_ids;
+    uint64_t stored;
+    uint64_t page;
+    size_t size;
+    unsigned started;
+    unsigned t;
+
+    compile->chunk_count = (compile->page_total + FEATURES_COMPILE_CHUNK_PAGES - 1)
+        / FEATURES_COMPILE_CHUNK_PAGES;
+    compile->chunk_stored = malloc(compile->chunk_count * sizeof(uint64_t));
+
+    if (NULL == compile->chunk_stored) {
+        return FEATURES_ERR_NOMEM;
+    }
+
+    stored = 0;
+
+    for (page = 0; page < compile->page_total; ++page) {
+        if (0 == page % FEATURES_COMPILE_CHUNK_PAGES) {
+            compile->chunk_stored[page / FEATURES_COMPILE_CHUNK_PAGES] = stored;
+        }
+
+        stored += features_builder_page_stored(&compile->builder, page);
+    }
+
+    compile->stored_total = stored;
+
+    atomic_init(&compile->next_chunk, 0);
+    atomic_init(&compile->encoded, 0);
+    atomic_init(&compile->failed, 0);
+
+    if (threads > compile->chunk_count) {
+        threads = (unsigned)compile->chunk_count;
+    }
+
+    thread_ids = NULL;
+    started = 1;
+
+    if (threads > 1) {
+        thread_ids = malloc(threads * sizeof(pthread_t));
+    }
+
+    // Falls back to encoding on the calling thread alone
+    if (NULL != thread_ids) {
+        for (started = 1; started < threads; ++started) {
+            if (0 != pthread_create(&thread_ids[started], NULL, features_compile_worker, compile)) {
+                break;
+            }
+        }
+    }
+
+    features_compile_worker(compile);
+
+    for (t = 1; t < started; ++t) {
+        pthread_join(thread_ids[t], NULL);
+    }
+
+    free(thread_ids);
+
+    if (atomic_load(&compile->failed)) {
+        return atomic_load(&compile->failed) < 0 ? FEATURES_ERR_IO : FEATURES_ERR_NOMEM;
+    }
+
+    // The directory only changes with the layout
+    size = features_builder_size(&compile->builder) - stored * FEATURES_PAGE_SIZE;
+
+    if (NULL != compile->previous || 0 == size) {
+        return FEATURES_OK;
+    }
+
+    directory = malloc(size);
+
+    if (NULL == directory) {
+        return FEATURES_ERR_NOMEM;
+    }
+
+    features_builder_write_directory(&compile->builder, directory);
+
+    if (0 != features_compile_pwrite(compile->fd, directory, size, stored * FEATURES_PAGE_SIZE)) {
+        free(directory);
+        return FEATURES_ERR_IO;
+    }
+
+    free(directory);
+    return FEATURES_OK;
+}
+
+// Takes chunks of pages until there are none left and writes out every
+// run of pages whose hash changed. Sets compile->failed to -1 when a
+// write fails and 1 when out of memory.
+static void *
+features_compile_worker(void *arg) {
+    features_compile_t *compile;
+    features_page_raw_t *buf;
+    uint64_t chunk;
+    uint64_t stored;
+    uint64_t count;
+    uint64_t first;
+    uint64_t page;
+    uint64_t end;
+
+    compile = arg;
+    buf = malloc(FEATURES_COMPILE_CHUNK_PAGES * sizeof(features_page_raw_t));
+
+    if (NULL == buf) {
+        atomic_store(&compile->failed, 1);
+        return NULL;
+    }
+
+    while (!atomic_load(&compile->failed)) {
+        chunk = atomic_fetch_add(&compile->next_chunk, 1);
+
+        if (chunk >= compile->chunk_count) {
+            break;
+        }
+
+        page = chunk * FEATURES_COMPILE_CHUNK_PAGES;
+        end = page + FEATURES_COMPILE_CHUNK_PAGES;
+        end = end < compile->page_total ? end : compile->page_total;
+        stored = compile->chunk_stored[chunk];
+
+        while (page < end) {
+            first = page;
+
+            while (page < end
+                    && (NULL == compile->previous || compile->previous[page] != compile->hashes[page])) {
+                ++page;
+            }
+
+            if (first == page) {
+                stored += features_builder_page_stored(&compile->builder, page++);
+                continue;
+            }
+
+            count = features_builder_write_pages(&compile->builder, first, page - first, buf);
+
+            if (0 != features_compile_pwrite(compile->fd, buf, count * FEATURES_PAGE_SIZE,
+                        stored * FEATURES_PAGE_SIZE)) {
+                atomic_store(&compile->failed, -1);
+                break;
+            }
+
+            stored += count;
+            atomic_fetch_add(&compile->encoded, count);
+        }
+    }
+
+    free(buf);
+    return NULL;
+}
+
+static int
+features_compile_pwrite(
+        int fd,
+        const void *buf,
+        size_t size,
+        uint64_t offset) {
+    size_t done;
+    ssize_t n;
+
+    for (done = 0; done < size; done += (size_t)n) {
+        n = pwrite(fd, (const uint8_t *)buf + done, size - done, (off_t)(offset + done));
+
+        if (n <= 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,221 @@
+#include "convert.h"
+
+#include <pthread.h>
+
+#include "byteorder.h"
+#include "checksum.h"
+#include "internal.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define FEATURES_CONVERT_X86 1
+#include <immintrin.h>
+#endif
+
+// Swaps count values of width bytes starting at data
+typedef void (*features_convert_fn)(uint8_t *data, uint8_t width, uint8_t count);
+
+static void
+features_convert_scalar(uint8_t *data, uint8_t width, uint8_t count);
+
+static features_convert_fn
+features_convert_select(void);
+
+static void
+features_convert_init(void);
+
+// Chosen once for the CPU, by features_convert_init()
+static features_convert_fn features_convert_impl;
+
+static pthread_once_t features_convert_once = PTHREAD_ONCE_INIT;
+
+#ifdef FEATURES_CONVERT_X86
+// Byte shuffles reversing every 2, 4 and 8 byte element of a 32 byte lane pair
+static const uint8_t features_convert_masks[3][32] = {
+    {1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+     1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14},
+    {3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+     3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12},
+    {7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+     7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8}
+};
+
+static const uint8_t *
+features_convert_mask(uint8_t width);
+
+static void
+features_convert_ssse3(uint8_t *data, uint8_t width, uint8_t count);
+
+static void
+features_convert_avx2(uint8_t *data, uint8_t width, uint8_t count);
+#endif
+
+uint8_t
+features_native_flags(void) {
+#ifdef WORDS_BIGENDIAN
+    return 0;
+#else
+    return FEATURES_PAGE_FLAG_LITTLE_ENDIAN;
+#endif
+}
+
+void
+features_convert(
+        features_page_raw_t *pages,
+        uint64_t count,
+        uint8_t flags) {
+    features_convert_fn convert_fn;
+    features_switch_type_t type;
+    features_page_raw_t *page;
+    uint8_t type_byte;
+    uint8_t width;
+    uint64_t i;
+    int b;
+
+    convert_fn = features_convert_select();
+
+    flags &= FEATURES_PAGE_FLAG_LITTLE_ENDIAN;
+
+    for (i = 0; i < count; ++i) {
+        page = pages + i;
+
+        if ((page->header.flags & FEATURES_PAGE_FLAG_LITTLE_ENDIAN) == flags) {
+            continue;
+        }
+
+        for (b = 1; b < FEATURES_BLOCKS_PER_PAGE; ++b) {
+            type_byte = page->header.block_info.data[b / 2];
+
+            if (b % 2) {
+                type_byte >>= 4;
+            }
+
+            type = (features_switch_type_t)(type_byte & 0xf);
+            width = features_block_width(type);
+
+            // Single byte values and flags read the same in either order
+            if (width < 2) {
+                continue;
+            }
+
+            convert_fn(page->blocks[b - 1].data + features_block_properties_size(type),
+                    width, features_block_capacity(type));
+        }
+
+        page->header.flags ^= FEATURES_PAGE_FLAG_LITTLE_ENDIAN;
+
+        if (page->header.flags & FEATURES_PAGE_FLAG_CHECKSUM) {
+            features_checksum(page, 1);
+        }
+    }
+}
+
+static void
+features_convert_scalar(uint8_t *data, uint8_t width, uint8_t count) {
+    uint16_t val16;
+    uint32_t val32;
+    uint64_t val64;
+    uint8_t i;
+
+    for (i = 0; i < count; ++i, data += width) {
+        switch (width) {
+            case 2:
+                memcpy(&val16, data, sizeof(val16));
+                val16 = features_swap_endian_16(val16);
+                memcpy(data, &val16, sizeof(val16));
+                break;
+            case 4:
+                memcpy(&val32, data, sizeof(val32));
+                val32 = features_swap_endian_32(val32);
+                memcpy(data, &val32, sizeof(val32));
+                break;
+            case 8:
+                memcpy(&val64, data, sizeof(val64));
+                val64 = features_swap_endian_64(val64);
+                memcpy(data, &val64, sizeof(val64));
+                break;
+        }
+    }
+}
+
+static features_convert_fn
+features_convert_select(void) {
+    pthread_once(&features_convert_once, features_convert_init);
+    return features_convert_impl;
+}
+
+static void
+features_convert_init(void) {
+#ifdef FEATURES_CONVERT_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2")) {
+        features_convert_impl = features_convert_avx2;
+        return;
+    }
+
+    if (__builtin_cpu_supports("ssse3")) {
+        features_convert_impl = features_convert_ssse3;
+        return;
+    }
+#endif
+
+    features_convert_impl = features_convert_scalar;
+}
+
+#ifdef FEATURES_CONVERT_X86
+static const uint8_t *
+features_convert_mask(uint8_t width) {
+    switch (width) {
+        case 2:
+            return features_convert_masks[0];
+        case 4:
+            return features_convert_masks[1];
+        default:
+            return features_convert_masks[2];
+    }
+}
+
+// Every typed block holds at least 56 bytes of values. The values are
+// covered by 16 byte windows, the last one overlapping the one before
+// so it ends with the data. Windows start on a value boundary, and all
+// are loaded before any is stored, so the overlap is swapped once.
+__attribute__((target("ssse3")))
+static void
+features_convert_ssse3(uint8_t *data, uint8_t width, uint8_t count) {
+    __m128i mask;
+    __m128i v0, v1, v2, v3;
+    size_t last;
+
+    mask = _mm_loadu_si128((const __m128i *)features_convert_mask(width));
+    last = (size_t)width * count - 16;
+
+    v0 = _mm_loadu_si128((const __m128i *)data);
+    v1 = _mm_loadu_si128((const __m128i *)(data + 16));
+    v2 = _mm_loadu_si128((const __m128i *)(data + 32));
+    v3 = _mm_loadu_si128((const __m128i *)(data + last));
+
+    _mm_storeu_si128((__m128i *)data, _mm_shuffle_epi8(v0, mask));
+    _mm_storeu_si128((__m128i *)(data + 16), _mm_shuffle_epi8(v1, mask));
+    _mm_storeu_si128((__m128i *)(data + 32), _mm_shuffle_epi8(v2, mask));
+    _mm_storeu_si128((__m128i *)(data + last), _mm_shuffle_epi8(v3, mask));
+}
+
+// As above with two 32 byte windows, the shuffle works per 16 byte lane
+// and every lane starts on a value boundary
+__attribute__((target("avx2")))
+static void
+features_convert_avx2(uint8_t *data, uint8_t width, uint8_t count) {
+    __m256i mask;
+    __m256i v0, v1;
+    size_t last;
+
+    mask = _mm256_loadu_si256((const __m256i *)features_convert_mask(width));
+    last = (size_t)width * count - 32;
+
+    v0 = _mm256_loadu_si256((const __m256i *)data);
+    v1 = _mm256_loadu_si256((const __m256i *)(data + last));
+
+    _mm256_storeu_si256((__m256i *)data, _mm256_shuffle_epi8(v0, mask));
+    _mm256_storeu_si256((__m256i *)(data + last), _mm256_shuffle_epi8(v1, mask));
+}
+#endif
@@ -0,0 +1,29 @@
+#ifndef FEATURES_CONVERT_H
+#define FEATURES_CONVERT_H
+
+#include "memory.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// FEATURES_PAGE_FLAG_LITTLE_ENDIAN on little endian hosts, otherwise 0
+uint8_t
+features_native_flags(void);
+
+// Rewrites the switch data of count pages in place into the byte order
+// given by flags, FEATURES_PAGE_FLAG_LITTLE_ENDIAN or 0, and updates the
+// page header flags and checksum to match. Pages already in that order
+// are skipped.
+// Uses SSSE3 or AVX2 byte shuffles where the CPU has them.
+void
+features_convert(
+        features_page_raw_t *pages,
+        uint64_t count,
+        uint8_t flags);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,353 @@
+#include "delta.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
+
+#include "byteorder.h"
+#include "internal.h"
+
+static const features_page_raw_t *
+features_delta_base_page(
+        const features_data_t *data,
+        uint64_t page_number);
+
+static uint64_t
+features_delta_hash(const features_data_t *data);
+
+static features_err_t
+features_delta_map(
+        features_file_t *out,
+        const features_file_t *base,
+        uint64_t page_offset,
+        uint64_t page_count);
+
+static void
+features_delta_protect(features_file_t *out);
+
+features_err_t
+features_delta_create(
+        const features_data_t *base,
+        const features_data_t *target,
+        void **delta,
+        size_t *size) {
+    static const features_block_raw_t zero_block;
+    features_delta_header_t *header;
+    features_delta_page_t *record;
+    const features_block_raw_t *base_blocks;
+    const features_block_raw_t *target_blocks;
+    const features_page_raw_t *base_page;
+    uint64_t block_mask;
+    uint64_t page_number;
+    uint64_t records;
+    uint64_t i;
+    uint8_t *buf;
+    uint8_t *new_buf;
+    size_t capacity;
+    size_t used;
+    int b;
+
+    // Deltas address pages densely from page_offset
+    if (NULL != base->directory || NULL != target->directory) {
+        return FEATURES_ERR_INVALID;
+    }
+
+    capacity = sizeof(features_delta_header_t) + FEATURES_PAGE_SIZE;
+    buf = malloc(capacity);
+
+    if (NULL == buf) {
+        return FEATURES_ERR_NOMEM;
+    }
+
+    used = sizeof(features_delta_header_t);
+    records = 0;
+
+    for (i = 0; i < target->page_count; ++i) {
+        page_number = target->page_offset + i;
+        base_page = features_delta_base_page(base, page_number);
+        target_blocks = (const features_block_raw_t *)(target->pages + i);
+        base_blocks = (const features_block_raw_t *)base_page;
+
+        block_mask = 0;
+
+        for (b = 0; b < FEATURES_BLOCKS_PER_PAGE; ++b) {
+            if (0 != memcmp(target_blocks + b,
+                        NULL != base_blocks ? base_blocks + b : &zero_block,
+                        sizeof(features_block_raw_t))) {
+                block_mask |= (uint64_t)1 << b;
+            }
+        }
+
+        if (0 == block_mask) {
+            continue;
+        }
+
+        // Worst case the record holds every block of the page
+        if (capacity - used < sizeof(features_delta_page_t) + FEATURES_PAGE_SIZE) {
+            capacity *= 2;
+            new_buf = realloc(buf, capacity);
+
+            if (NULL == new_buf) {
+                free(buf);
+                return FEATURES_ERR_NOMEM;
+            }
+
+            buf = new_buf;
+        }
+
+        record = (features_delta_page_t *)(buf + used);
+        memset(record, 0, sizeof(features_delta_page_t));
+        features_write_uint32(&record->page_number, (uint32_t)page_number);
+        features_write_uint64(&record->block_mask, block_mask);
+        used += sizeof(features_delta_page_t);
+
+        for (b = 0; b < FEATURES_BLOCKS_PER_PAGE; ++b) {
+            if (block_mask & ((uint64_t)1 << b)) {
+                memcpy(buf + used, target_blocks + b, sizeof(features_block_raw_t));
+                used += sizeof(features_block_raw_t);
+            }
+        }
+
+        ++records;
+    }
+
+    header = (features_delta_header_t *)buf;
+    memset(header, 0, sizeof(features_delta_header_t));
+    memcpy(header->MAGIC, FEATURES_DELTA_MAGIC, sizeof(header->MAGIC));
+    features_write_uint32(&header->base_page_offset, (uint32_t)base->page_offset);
+    features_write_uint32(&header->base_page_count, (uint32_t)base->page_count);
+    features_write_uint32(&header->target_page_offset, (uint32_t)target->page_offset);
+    features_write_uint32(&header->target_page_count, (uint32_t)target->page_count);
+    features_write_uint32(&header->page_record_count, (uint32_t)records);
+    features_write_uint64(&header->base_hash, features_delta_hash(base));
+    features_write_uint64(&header->target_hash, features_delta_hash(target));
+
+    *delta = buf;
+    *size = used;
+    return FEATURES_OK;
+}
+
+features_err_t
+features_delta_apply(
+        features_file_t *out,
+        features_file_t *base,
+        const void *delta,
+        size_t size) {
+    const features_delta_header_t *header;
+    const features_delta_page_t *record;
+    const uint8_t *pos;
+    const uint8_t *end;
+    features_block_raw_t *out_blocks;
+    uint64_t target_offset;
+    uint64_t target_count;
+    uint64_t page_number;
+    uint64_t block_mask;
+    uint32_t records;
+    uint32_t r;
+    features_err_t rc;
+    int b;
+
+    memset(out, 0, sizeof(features_file_t));
+    out->fd = -1;
+
+    if (size < sizeof(features_delta_header_t)) {
+        return FEATURES_ERR_INVALID;
+    }
+
+    header = delta;
+
+    if (0 != memcmp(FEATURES_DELTA_MAGIC, header->MAGIC, sizeof(header->MAGIC))
+            || NULL != base->data.directory
+            || features_read_uint32(&header->base_page_offset) != base->data.page_offset
+            || features_read_uint32(&header->base_page_count) != base->data.page_count) {
+        return FEATURES_ERR_INVALID;
+    }
+
+    // The base must be exactly the one the delta was created against,
+    // hashing it in full only the first time
+    if (!base->hashed) {
+        base->hash = features_delta_hash(&base->data);
+        base->hashed = 1;
+    }
+
+    if (features_read_uint64(&header->base_hash) != base->hash) {
+        return FEATURES_ERR_INVALID;
+    }
+
+    target_offset = features_read_uint32(&header->target_page_offset);
+    target_count = features_read_uint32(&header->target_page_count);
+    records = features_read_uint32(&header->page_record_count);
+
+    if (0 == target_count) {
+        return FEATURES_ERR_INVALID;
+    }
+
+    rc = features_delta_map(out, base, target_offset, target_count);
+
+    if (FEATURES_OK != rc) {
+        return rc;
+    }
+
+    pos = (const uint8_t *)delta + sizeof(features_delta_header_t);
+    end = (const uint8_t *)delta + size;
+
+    for (r = 0; r < records; ++r) {
+        if ((size_t)(end - pos) < sizeof(features_delta_page_t)) {
+            rc = FEATURES_ERR_INVALID;
+            break;
+        }
+
+        record = (const features_delta_page_t *)pos;
+        pos += sizeof(features_delta_page_t);
+
+        page_number = features_read_uint32(&record->page_number);
+        block_mask = features_read_uint64(&record->block_mask);
+
+        if (page_number < target_offset || page_number - target_offset >= target_count
+                || (size_t)(end - pos) < (size_t)features_popcount64(block_mask) * FEATURES_BLOCK_SIZE) {
+            rc = FEATURES_ERR_INVALID;
+            break;
+        }
+
+        out_blocks = (features_block_raw_t *)((features_page_raw_t *)out->map
+                + (page_number - target_offset));
+
+        for (b = 0; b < FEATURES_BLOCKS_PER_PAGE; ++b) {
+            if (block_mask & ((uint64_t)1 << b)) {
+                memcpy(out_blocks + b, pos, FEATURES_BLOCK_SIZE);
+                pos += FEATURES_BLOCK_SIZE;
+            }
+        }
+    }
+
+    if (FEATURES_OK == rc) {
+        features_delta_protect(out);
+        rc = features_data(&out->data, out->map);
+    }
+
+    if (FEATURES_OK == rc
+            && (out->data.page_offset != target_offset || out->data.page_count != target_count
+                || NULL != out->data.directory)) {
+        rc = FEATURES_ERR_INVALID;
+    }
+
+    if (FEATURES_OK == rc) {
+        out->hash = features_read_uint64(&header->target_hash);
+        out->hashed = 1;
+    } else {
+        features_close(out);
+    }
+
+    return rc;
+}
+
+static const features_page_raw_t *
+features_delta_base_page(
+        const features_data_t *data,
+        uint64_t page_number) {
+    if (page_number < data->page_offset || page_number - data->page_offset >= data->page_count) {
+        return NULL;
+    }
+
+    return data->pages + (page_number - data->page_offset);
+}
+
+// 64 bit FNV-1a over the big endian words of every page, the same on
+// every host
+static uint64_t
+features_delta_hash(const features_data_t *data) {
+    const uint8_t *pos;
+    const uint8_t *end;
+    uint64_t hash;
+
+    pos = (const uint8_t *)data->pages;
+    end = pos + data->page_count * FEATURES_PAGE_SIZE;
+    hash = UINT64_C(0xcbf29ce484222325);
+
+    for (; pos < end; pos += sizeof(uint64_t)) {
+        hash ^= features_read_uint64(pos);
+        hash *= UINT64_C(0x100000001b3);
+    }
+
+    return hash;
+}
+
+// Sets up out->map with the target's pages as they are in the base,
+// pages the base does not have are zero
+static features_err_t
+features_delta_map(
+        features_file_t *out,
+        const features_file_t *base,
+        uint64_t page_offset,
+        uint64_t page_count) {
+    uint64_t first;
+    uint64_t last;
+    size_t size;
+    uint8_t *map;
+
+    size = page_count * FEATURES_PAGE_SIZE;
+
+    // The pages both files share
+    first = page_offset > base->data.page_offset ? page_offset : base->data.page_offset;
+    last = page_offset + page_count;
+
+    if (last > base->data.page_offset + base->data.page_count) {
+        last = base->data.page_offset + base->data.page_count;
+    }
+
+#ifdef HAVE_MMAP
+    map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (MAP_FAILED == map) {
+        return FEATURES_ERR_NOMEM;
+    }
+
+    if (first < last) {
+        uint8_t *dst;
+        off_t src;
+        long system_page_size;
+
+        dst = map + (first - page_offset) * FEATURES_PAGE_SIZE;
+        src = (off_t)((first - base->data.page_offset) * FEATURES_PAGE_SIZE);
+        system_page_size = sysconf(_SC_PAGESIZE);
+
+        // Map the shared pages copy-on-write from the base file when the
+        // system pages line up with ours, otherwise copy them
+        if (base->fd < 0 || system_page_size <= 0 || FEATURES_PAGE_SIZE % system_page_size
+                || MAP_FAILED == mmap(dst, (last - first) * FEATURES_PAGE_SIZE,
+                    PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, base->fd, src)) {
+            memcpy(dst, (const uint8_t *)base->data.pages + src,
+                    (last - first) * FEATURES_PAGE_SIZE);
+        }
+    }
+#else
+    map = calloc(1, size);
+
+    if (NULL == map) {
+        return FEATURES_ERR_NOMEM;
+    }
+
+    if (first < last) {
+        memcpy(map + (first - page_offset) * FEATURES_PAGE_SIZE,
+                base->data.pages + (first - base->data.page_offset),
+                (last - first) * FEATURES_PAGE_SIZE);
+    }
+#endif
+
+    out->map = map;
+    out->size = size;
+    return FEATURES_OK;
+}
+
+static void
+features_delta_protect(features_file_t *out) {
+#ifdef HAVE_MMAP
+    mprotect(out->map, out->size, PROT_READ);
+#else
+    (void)out;
+#endif
+}
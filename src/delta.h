@@ -0,0 +1,75 @@
+#ifndef FEATURES_DELTA_H
+#define FEATURES_DELTA_H
+
+#include <stddef.h>
+
+#include "file.h"
+#include "memory.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FEATURES_DELTA_MAGIC "FEATD003"
+
+// A delta records the 64 byte blocks, page headers included, that differ
+// between a base file and a target file. It is keyed by page number and
+// block number and checked against the page offset, page count and a
+// hash of the whole base, so it only applies to the base it was created
+// from, untouched pages included. It also carries the hash of the target,
+// so a file built by a delta can be the base of the next delta without
+// being hashed again.
+//
+// Layout, all integers big endian:
+//   features_delta_header_t
+//   features_delta_page_t followed by one block per bit of block_mask,
+//   repeated page_record_count times in ascending page number order
+
+typedef struct features_delta_header_t {
+    char MAGIC[8];
+    uint32_t base_page_offset;
+    uint32_t base_page_count;
+    uint32_t target_page_offset;
+    uint32_t target_page_count;
+    uint32_t page_record_count;
+    uint8_t unused[4];
+    // Hashes of every page of the base and of the target
+    uint64_t base_hash;
+    uint64_t target_hash;
+} features_delta_header_t;
+
+typedef struct features_delta_page_t {
+    uint32_t page_number;
+    uint8_t unused[4];
+    // Bit n is set when block n is in the record, block 0 is the header
+    uint64_t block_mask;
+} features_delta_page_t;
+
+// Creates the delta from base to target in a malloc()ed buffer. Sparse
+// files are not supported.
+features_err_t
+features_delta_create(
+        const features_data_t *base,
+        const features_data_t *target,
+        void **delta,
+        size_t *size);
+
+// Opens base with delta applied as a new private mapping. Pages the
+// delta does not touch are mapped copy-on-write from the base file, so
+// only the touched pages are copied. Without a base file descriptor the
+// base pages are copied instead.
+//
+// The base is hashed the first time it is used and the hash kept in it,
+// out takes the target hash from the delta.
+features_err_t
+features_delta_apply(
+        features_file_t *out,
+        features_file_t *base,
+        const void *delta,
+        size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,266 @@
+#include "diff.h"
+
+#include <string.h>
+
+#include "internal.h"
+
+static uint64_t
+features_diff_find_page(
+        const features_data_t *data,
+        uint64_t page_number);
+
+static features_page_raw_t *
+features_diff_next_page(
+        const features_data_t *data,
+        uint64_t page_index,
+        uint64_t *page_number);
+
+static features_err_t
+features_diff_page(
+        const features_data_t *old_data,
+        const features_data_t *new_data,
+        uint64_t page_number,
+        const features_page_raw_t *old_page,
+        const features_page_raw_t *new_page,
+        features_diff_fn fn,
+        void *ctx);
+
+static void
+features_diff_read(
+        features_err_t *rc,
+        features_switch_value_t *value,
+        const features_block_t *block,
+        uint8_t flags,
+        uint8_t switch_number);
+
+static int
+features_diff_value_equal(
+        const features_switch_value_t *a,
+        const features_switch_value_t *b);
+
+features_err_t
+features_diff(
+        const features_data_t *old_data,
+        const features_data_t *new_data,
+        features_diff_fn fn,
+        void *ctx) {
+    return features_diff_pages(old_data, new_data, 0, UINT64_MAX, fn, ctx);
+}
+
+features_err_t
+features_diff_pages(
+        const features_data_t *old_data,
+        const features_data_t *new_data,
+        uint64_t first_page,
+        uint64_t end_page,
+        features_diff_fn fn,
+        void *ctx) {
+    features_page_raw_t *old_page;
+    features_page_raw_t *new_page;
+    uint64_t old_page_number;
+    uint64_t new_page_number;
+    uint64_t old_index;
+    uint64_t new_index;
+    features_err_t rc;
+
+    old_index = features_diff_find_page(old_data, first_page);
+    new_index = features_diff_find_page(new_data, first_page);
+
+    // Both files store their pages in rising page number order, so one
+    // merge visits every page either stores
+    for (;;) {
+        old_page = features_diff_next_page(old_data, old_index, &old_page_number);
+        new_page = features_diff_next_page(new_data, new_index, &new_page_number);
+
+        if (old_page_number >= end_page && new_page_number >= end_page) {
+            return FEATURES_OK;
+        }
+
+        if (old_page_number < new_page_number) {
+            new_page = NULL;
+            ++old_index;
+        } else if (new_page_number < old_page_number) {
+            old_page = NULL;
+            ++new_index;
+        } else {
+            ++old_index;
+            ++new_index;
+        }
+
+        rc = features_diff_page(old_data, new_data,
+                old_page_number < new_page_number ? old_page_number : new_page_number,
+                old_page, new_page, fn, ctx);
+
+        if (FEATURES_OK != rc) {
+            return rc;
+        }
+    }
+}
+
+// Index of the first stored page numbered page_number or above
+static uint64_t
+features_diff_find_page(
+        const features_data_t *data,
+        uint64_t page_number) {
+    uint64_t low;
+    uint64_t high;
+    uint64_t mid;
+
+    low = 0;
+    high = data->page_count;
+
+    while (low < high) {
+        mid = low + (high - low) / 2;
+
+        if (features_read_uint32(&data->pages[mid].header.page_number) < page_number) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    return low;
+}
+
+// The stored page at page_index, NULL with page_number UINT64_MAX past
+// the last one
+static features_page_raw_t *
+features_diff_next_page(
+        const features_data_t *data,
+        uint64_t page_index,
+        uint64_t *page_number) {
+    if (page_index >= data->page_count) {
+        *page_number = UINT64_MAX;
+        return NULL;
+    }
+
+    *page_number = features_read_uint32(&data->pages[page_index].header.page_number);
+    return data->pages + page_index;
+}
+
+// Compares one page number, either page may be NULL when its file does
+// not store it
+static features_err_t
+features_diff_page(
+        const features_data_t *old_data,
+        const features_data_t *new_data,
+        uint64_t page_number,
+        const features_page_raw_t *old_page,
+        const features_page_raw_t *new_page,
+        features_diff_fn fn,
+        void *ctx) {
+    features_switch_change_t change;
+    features_switch_id_t switch_id;
+    features_block_t old_block;
+    features_block_t new_block;
+    features_err_t rc;
+    int same_layout;
+    int b;
+    int s;
+
+    if (page_number > FEATURES_MAX_PAGE) {
+        return FEATURES_ERR_INVALID;
+    }
+
+    same_layout = NULL != old_page && NULL != new_page && old_data->flags == new_data->flags;
+
+    // Untouched pages are the common case of a reload
+    if (same_layout
+            && 0 == memcmp(&old_page->header.block_info, &new_page->header.block_info,
+                sizeof(features_page_header_block_info_t))
+            && 0 == memcmp(old_page->blocks, new_page->blocks, sizeof(old_page->blocks))) {
+        return FEATURES_OK;
+    }
+
+    switch_id.page_number = (uint32_t)page_number;
+    switch_id.switch_number = 0;
+
+    // Block 0 is the page header and holds no switches
+    for (b = 1; b < FEATURES_BLOCKS_PER_PAGE; ++b) {
+        switch_id.block_number = (uint8_t)b;
+
+        rc = features_switch_block(&old_block, old_data, switch_id);
+
+        if (FEATURES_OK != rc) {
+            return rc;
+        }
+
+        rc = features_switch_block(&new_block, new_data, switch_id);
+
+        if (FEATURES_OK != rc) {
+            return rc;
+        }
+
+        if (old_block.type == new_block.type) {
+            // Every slot of an untyped block reads the same status
+            if (0 == features_block_capacity(old_block.type)) {
+                continue;
+            }
+
+            if (same_layout
+                    && 0 == memcmp(&old_page->blocks[b - 1], &new_page->blocks[b - 1],
+                        FEATURES_BLOCK_SIZE)) {
+                continue;
+            }
+        }
+
+        for (s = 0; s < FEATURES_MAX_SWITCHES_PER_BLOCK; ++s) {
+            features_diff_read(&change.old_rc, &change.old_value, &old_block, old_data->flags, (uint8_t)s);
+            features_diff_read(&change.new_rc, &change.new_value, &new_block, new_data->flags, (uint8_t)s);
+
+            if (change.old_rc == change.new_rc
+                    && (FEATURES_OK != change.old_rc
+                        || features_diff_value_equal(&change.old_value, &change.new_value))) {
+                continue;
+            }
+
+            change.switch_number = page_number * FEATURES_BLOCKS_PER_PAGE * FEATURES_MAX_SWITCHES_PER_BLOCK
+                + (uint64_t)b * FEATURES_MAX_SWITCHES_PER_BLOCK + (uint64_t)s;
+            fn(&change, ctx);
+        }
+    }
+
+    return FEATURES_OK;
+}
+
+static void
+features_diff_read(
+        features_err_t *rc,
+        features_switch_value_t *value,
+        const features_block_t *block,
+        uint8_t flags,
+        uint8_t switch_number) {
+    features_switch_info_t switch_info;
+
+    memset(value, 0, sizeof(features_switch_value_t));
+
+    features_block_switch_info(&switch_info, block, switch_number);
+    switch_info.flags = flags;
+    *rc = features_switch_read(value, &switch_info);
+}
+
+static int
+features_diff_value_equal(
+        const features_switch_value_t *a,
+        const features_switch_value_t *b) {
+    if (a->type != b->type) {
+        return 0;
+    }
+
+    switch (a->type) {
+        case FEATURES_SWITCH_TYPE_FLAG:
+            // Flags read as their bit within the byte
+            return !a->value.flag == !b->value.flag;
+        case FEATURES_SWITCH_TYPE_UINT8:
+        case FEATURES_SWITCH_TYPE_INT8:
+            return a->value.uint8 == b->value.uint8;
+        case FEATURES_SWITCH_TYPE_UINT16:
+        case FEATURES_SWITCH_TYPE_INT16:
+            return a->value.uint16 == b->value.uint16;
+        case FEATURES_SWITCH_TYPE_UINT32:
+        case FEATURES_SWITCH_TYPE_INT32:
+            return a->value.uint32 == b->value.uint32;
+        default:
+            return a->value.uint64 == b->value.uint64;
+    }
+}
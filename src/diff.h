@@ -0,0 +1,48 @@
+#ifndef FEATURES_DIFF_H
+#define FEATURES_DIFF_H
+
+#include "memory.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// A switch that reads differently in the new data, either its status
+// or its value changed
+typedef struct features_switch_change_t {
+    features_switch_number_t switch_number;
+    features_err_t old_rc;
+    features_switch_value_t old_value;
+    features_err_t new_rc;
+    features_switch_value_t new_value;
+} features_switch_change_t;
+
+typedef void (*features_diff_fn)(const features_switch_change_t *change, void *ctx);
+
+// Calls fn with every changed switch, in switch number order. Blocks
+// with the same type and bytes in both are skipped with a 64 byte
+// compare, only the others are decoded switch by switch. Switches on
+// pages neither data stores are not reported.
+features_err_t
+features_diff(
+        const features_data_t *old_data,
+        const features_data_t *new_data,
+        features_diff_fn fn,
+        void *ctx);
+
+// features_diff() of the page numbers from first_page up to but not
+// including end_page, for splitting a diff between threads
+features_err_t
+features_diff_pages(
+        const features_data_t *old_data,
+        const features_data_t *new_data,
+        uint64_t first_page,
+        uint64_t end_page,
+        features_diff_fn fn,
+        void *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
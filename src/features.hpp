@@ -0,0 +1,205 @@
+#ifndef FEATURES_HPP
+#define FEATURES_HPP
+
+// Typed C++ access to switches whose number and type are known at
+// compile time. The switch number is split into page, block and slot
+// when the program is compiled, the slot is checked against the
+// capacity of a block of the switch's type, and reads go straight to
+// the value without the type dispatch of features_switch_value().
+//
+//     // Page 75, block 22, slot 3
+//     typedef features::Switch<uint16_t, 1234435> RolloutPercent;
+//     uint16_t percent;
+//     features_err_t rc = RolloutPercent::value(data, percent);
+//
+// Reading a switch into a variable of another type does not compile.
+
+#include <stdint.h>
+#include <string.h>
+
+#include "byteorder.h"
+#include "memory.h"
+
+namespace features {
+
+// Block layout per switch type. Flags are read as bool.
+template <typename T>
+struct SwitchTraits {
+    static_assert(sizeof(T) == 0,
+            "switches are bool, int8_t to int64_t or uint8_t to uint64_t");
+};
+
+template <>
+struct SwitchTraits<bool> {
+    static const features_switch_type_t type = FEATURES_SWITCH_TYPE_FLAG;
+    static const unsigned capacity = FEATURES_FLAGS_PER_BLOCK;
+    static const unsigned properties_size = FEATURES_FLAG_PROPERTIES_SIZE;
+
+    static bool load(const uint8_t *block, unsigned slot, uint8_t) {
+        return 0 != (block[properties_size + slot / 8] & (1 << (slot % 8)));
+    }
+};
+
+template <>
+struct SwitchTraits<uint8_t> {
+    static const features_switch_type_t type = FEATURES_SWITCH_TYPE_UINT8;
+    static const unsigned capacity = FEATURES_UINT8_PER_BLOCK;
+    static const unsigned properties_size = FEATURES_UINT8_PROPERTIES_SIZE;
+
+    static uint8_t load(const uint8_t *block, unsigned slot, uint8_t) {
+        return block[properties_size + slot];
+    }
+};
+
+template <>
+struct SwitchTraits<int8_t> {
+    static const features_switch_type_t type = FEATURES_SWITCH_TYPE_INT8;
+    static const unsigned capacity = FEATURES_INT8_PER_BLOCK;
+    static const unsigned properties_size = FEATURES_INT8_PROPERTIES_SIZE;
+
+    static int8_t load(const uint8_t *block, unsigned slot, uint8_t) {
+        return (int8_t)block[properties_size + slot];
+    }
+};
+
+#define FEATURES_SWITCH_TRAITS(value_type, type_name, upper, bytes)\
+    template <>\
+    struct SwitchTraits<value_type> {\
+        static const features_switch_type_t type = FEATURES_SWITCH_TYPE_##upper;\
+        static const unsigned capacity = FEATURES_##upper##_PER_BLOCK;\
+        static const unsigned properties_size = FEATURES_##upper##_PROPERTIES_SIZE;\
+        static value_type load(const uint8_t *block, unsigned slot, uint8_t flags) {\
+            return features_load_##type_name(block + properties_size + slot * bytes, flags);\
+        }\
+    }
+
+FEATURES_SWITCH_TRAITS(uint16_t, uint16, UINT16, 2);
+FEATURES_SWITCH_TRAITS(uint32_t, uint32, UINT32, 4);
+FEATURES_SWITCH_TRAITS(uint64_t, uint64, UINT64, 8);
+FEATURES_SWITCH_TRAITS(int16_t, int16, INT16, 2);
+FEATURES_SWITCH_TRAITS(int32_t, int32, INT32, 4);
+FEATURES_SWITCH_TRAITS(int64_t, int64, INT64, 8);
+
+#undef FEATURES_SWITCH_TRAITS
+
+// The same decomposition as features_switch_id()
+template <features_switch_number_t Number>
+struct SwitchId {
+    static const uint32_t page_number = (uint32_t)(Number
+            / FEATURES_MAX_SWITCHES_PER_BLOCK / FEATURES_BLOCKS_PER_PAGE);
+    static const unsigned block_number = (unsigned)(Number
+            / FEATURES_MAX_SWITCHES_PER_BLOCK % FEATURES_BLOCKS_PER_PAGE);
+    static const unsigned switch_number = (unsigned)(Number
+            % FEATURES_MAX_SWITCHES_PER_BLOCK);
+};
+
+template <typename T, features_switch_number_t Number>
+class Switch {
+public:
+    typedef T value_type;
+    typedef SwitchTraits<T> traits;
+    typedef SwitchId<Number> id;
+
+    static_assert(0 != id::block_number,
+            "block 0 of every page holds the page header");
+    static_assert(id::switch_number < traits::capacity,
+            "switch number is past the last slot of a block of this type");
+
+    // Returns the same status as the typed features_switch_*_value()
+    // functions and stores the value in val when it is FEATURES_OK
+    static features_err_t value(const features_data_t &data, T &val) {
+        const features_page_raw_t *page;
+        const uint8_t *block;
+        unsigned block_type;
+        unsigned properties;
+
+        if (id::page_number < data.page_offset) {
+            return FEATURES_ERR_DEPRECATED;
+        }
+
+        if (id::page_number - data.page_offset >= data.page_span) {
+            return FEATURES_ERR_UNUSED;
+        }
+
+        if (NULL == data.directory) {
+            page = data.pages + (id::page_number - data.page_offset);
+        } else {
+            page = features_data_page(&data, id::page_number);
+
+            // Left out of the sparse file
+            if (NULL == page) {
+                return FEATURES_ERR_UNUSED;
+            }
+        }
+
+        if (0 != memcmp(FEATURES_MAGIC_13_10, page->header.MAGIC, sizeof(page->header.MAGIC))) {
+            return FEATURES_ERR_INVALID;
+        }
+
+        block_type = page->header.block_info.data[id::block_number / 2];
+        block_type = (block_type >> (id::block_number % 2 * 4)) & 0xf;
+
+        // As features_switch_status() does, the block and the property
+        // bits of the slot decide before the type asked for does
+        if (traits::type != block_type && id::switch_number >= block_capacity(block_type)) {
+            return block_error(block_type);
+        }
+
+        block = reinterpret_cast<const uint8_t *>(page) + id::block_number * FEATURES_BLOCK_SIZE;
+        properties = block[id::switch_number / 4] >> (id::switch_number % 4 * 2);
+
+        if (!(properties & FEATURES_SWITCH_PROPERTY_USED)) {
+            return FEATURES_ERR_UNUSED;
+        }
+
+        if (properties & FEATURES_SWITCH_PROPERTY_DEPRECATED) {
+            return FEATURES_ERR_DEPRECATED;
+        }
+
+        if (traits::type != block_type) {
+            return FEATURES_ERR_INCORRECT_TYPE;
+        }
+
+        val = traits::load(block, id::switch_number, data.flags);
+        return FEATURES_OK;
+    }
+
+private:
+    // Slots of a block of block_type, 0 for a block without switches
+    static unsigned block_capacity(unsigned block_type) {
+        switch (block_type) {
+            case FEATURES_SWITCH_TYPE_FLAG:
+                return FEATURES_FLAGS_PER_BLOCK;
+            case FEATURES_SWITCH_TYPE_UINT8:
+            case FEATURES_SWITCH_TYPE_INT8:
+                return FEATURES_UINT8_PER_BLOCK;
+            case FEATURES_SWITCH_TYPE_UINT16:
+            case FEATURES_SWITCH_TYPE_INT16:
+                return FEATURES_UINT16_PER_BLOCK;
+            case FEATURES_SWITCH_TYPE_UINT32:
+            case FEATURES_SWITCH_TYPE_INT32:
+                return FEATURES_UINT32_PER_BLOCK;
+            case FEATURES_SWITCH_TYPE_UINT64:
+            case FEATURES_SWITCH_TYPE_INT64:
+                return FEATURES_UINT64_PER_BLOCK;
+            default:
+                return 0;
+        }
+    }
+
+    // A block without the slot, as features_switch_info() reports it
+    static features_err_t block_error(unsigned block_type) {
+        switch (block_type) {
+            case FEATURES_SWITCH_TYPE_UNUSED:
+                return FEATURES_ERR_UNUSED;
+            case FEATURES_SWITCH_TYPE_DEPRECATED:
+                return FEATURES_ERR_DEPRECATED;
+            default:
+                return FEATURES_ERR_INVALID;
+        }
+    }
+};
+
+}
+
+#endif
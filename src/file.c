@@ -0,0 +1,162 @@
+#include "file.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
+
+#include "internal.h"
+
+static features_err_t
+features_file_map(
+        features_file_t *file,
+        int fd,
+        size_t size);
+
+static void
+features_file_unmap(features_file_t *file);
+
+features_err_t
+features_open(
+        features_file_t *file,
+        const char *path) {
+    features_err_t rc;
+    struct stat st;
+    int fd;
+
+    memset(file, 0, sizeof(features_file_t));
+    file->fd = -1;
+
+    fd = open(path, O_RDONLY);
+
+    if (fd < 0) {
+        return FEATURES_ERR_IO;
+    }
+
+    if (0 != fstat(fd, &st)) {
+        close(fd);
+        return FEATURES_ERR_IO;
+    }
+
+    // A valid file holds at least the first page header
+    if (st.st_size < FEATURES_PAGE_SIZE) {
+        close(fd);
+        return FEATURES_ERR_INVALID;
+    }
+
+    rc = features_file_map(file, fd, (size_t)st.st_size);
+
+    if (FEATURES_OK != rc) {
+        close(fd);
+        file->fd = -1;
+        return rc;
+    }
+
+    file->fd = fd;
+
+    rc = features_data(&file->data, file->map);
+
+    // The page count in the first header must be backed by the file,
+    // checking it once here keeps the lookup path free of bounds checks
+    if (FEATURES_OK == rc
+            && (0 == file->data.page_count
+                || file->data.page_count > file->size / FEATURES_PAGE_SIZE
+                || features_data_size(&file->data) > file->size)) {
+        rc = FEATURES_ERR_INVALID;
+    }
+
+    // As is every index the directory of a sparse file leads to
+    if (FEATURES_OK == rc) {
+        rc = features_directory_check(&file->data);
+    }
+
+    if (FEATURES_OK != rc) {
+        features_file_unmap(file);
+        close(fd);
+        memset(file, 0, sizeof(features_file_t));
+        file->fd = -1;
+    }
+
+    return rc;
+}
+
+void
+features_close(features_file_t *file) {
+    features_data_index_free(&file->data);
+
+    if (NULL != file->map) {
+        features_file_unmap(file);
+    }
+
+    if (file->fd >= 0) {
+        close(file->fd);
+    }
+
+    memset(file, 0, sizeof(features_file_t));
+    file->fd = -1;
+}
+
+#ifdef HAVE_MMAP
+static features_err_t
+features_file_map(
+        features_file_t *file,
+        int fd,
+        size_t size) {
+    void *map;
+
+    map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+
+    if (MAP_FAILED == map) {
+        return FEATURES_ERR_IO;
+    }
+
+    file->map = map;
+    file->size = size;
+    return FEATURES_OK;
+}
+
+static void
+features_file_unmap(features_file_t *file) {
+    munmap(file->map, file->size);
+}
+#else
+// Without mmap the file is read into the heap instead
+static features_err_t
+features_file_map(
+        features_file_t *file,
+        int fd,
+        size_t size) {
+    uint8_t *buf;
+    size_t offset;
+    ssize_t n;
+
+    buf = malloc(size);
+
+    if (NULL == buf) {
+        return FEATURES_ERR_IO;
+    }
+
+    for (offset = 0; offset < size; offset += (size_t)n) {
+        n = read(fd, buf + offset, size - offset);
+
+        if (n <= 0) {
+            free(buf);
+            return FEATURES_ERR_IO;
+        }
+    }
+
+    file->map = buf;
+    file->size = size;
+    return FEATURES_OK;
+}
+
+static void
+features_file_unmap(features_file_t *file) {
+    free(file->map);
+}
+#endif
@@ -0,0 +1,38 @@
+#ifndef FEATURES_FILE_H
+#define FEATURES_FILE_H
+
+#include <stddef.h>
+
+#include "memory.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// A switch file mapped read-only into memory. The mapping is shared with
+// the page cache so every process that opens the same file shares one copy.
+typedef struct features_file_t {
+    features_data_t data;
+    void *map;
+    size_t size;
+    // Kept open so the file can be mapped again, -1 if there is none
+    int fd;
+    // Hash of every page, filled in by features_delta_apply() when the
+    // file is first used as a base or is the result of a delta
+    uint64_t hash;
+    int hashed;
+} features_file_t;
+
+features_err_t
+features_open(
+        features_file_t *file,
+        const char *path);
+
+void
+features_close(features_file_t *file);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
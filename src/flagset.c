@@ -0,0 +1,214 @@
+#include "flagset.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "internal.h"
+
+static int
+features_flagset_compare(
+        const void *a,
+        const void *b);
+
+static void
+features_flagset_on(
+        const features_flagset_block_t *entry,
+        const features_block_t *block,
+        uint64_t *on);
+
+static uint64_t
+features_flagset_spread(uint64_t bits);
+
+static uint64_t
+features_flagset_compact(uint64_t bits);
+
+features_err_t
+features_flagset_compile(
+        features_flagset_t *set,
+        const features_switch_number_t *switch_numbers,
+        size_t count) {
+    features_flagset_block_t *entry;
+    features_switch_number_t *sorted;
+    features_block_number_t block_number;
+    uint8_t slot;
+    size_t i;
+    int k;
+
+    memset(set, 0, sizeof(features_flagset_t));
+
+    if (0 == count) {
+        return FEATURES_OK;
+    }
+
+    sorted = malloc(count * sizeof(features_switch_number_t));
+    set->blocks = malloc(count * sizeof(features_flagset_block_t));
+
+    if (NULL == sorted || NULL == set->blocks) {
+        free(sorted);
+        features_flagset_free(set);
+        return FEATURES_ERR_NOMEM;
+    }
+
+    memcpy(sorted, switch_numbers, count * sizeof(features_switch_number_t));
+    qsort(sorted, count, sizeof(features_switch_number_t), features_flagset_compare);
+
+    entry = NULL;
+
+    for (i = 0; i < count; ++i) {
+        block_number = sorted[i] / FEATURES_MAX_SWITCHES_PER_BLOCK;
+        slot = sorted[i] % FEATURES_MAX_SWITCHES_PER_BLOCK;
+
+        if (slot >= FEATURES_FLAGS_PER_BLOCK
+                || block_number / FEATURES_BLOCKS_PER_PAGE > FEATURES_MAX_PAGE) {
+            free(sorted);
+            features_flagset_free(set);
+            return FEATURES_ERR_INVALID;
+        }
+
+        if (NULL == entry || entry->block_number != block_number) {
+            entry = &set->blocks[set->block_count++];
+            memset(entry, 0, sizeof(features_flagset_block_t));
+            entry->block_number = block_number;
+        }
+
+        entry->mask[slot / 64] |= (uint64_t)1 << (slot % 64);
+    }
+
+    free(sorted);
+
+    for (i = 0; i < set->block_count; ++i) {
+        entry = &set->blocks[i];
+
+        for (k = 0; k < FEATURES_FLAGSET_PROPERTY_WORDS; ++k) {
+            entry->property_mask[k] = features_flagset_spread(
+                    (entry->mask[k / 2] >> ((k % 2) * 32)) & UINT32_MAX);
+        }
+    }
+
+    return FEATURES_OK;
+}
+
+void
+features_flagset_free(features_flagset_t *set) {
+    free(set->blocks);
+    set->blocks = NULL;
+    set->block_count = 0;
+}
+
+features_err_t
+features_flagset_test(
+        const features_flagset_t *set,
+        const features_data_t *data,
+        features_flagset_op_t op,
+        int *result) {
+    const features_flagset_block_t *entry;
+    uint64_t on[FEATURES_FLAGSET_WORDS];
+    features_switch_id_t switch_id;
+    features_block_t block;
+    features_err_t rc;
+    uint64_t any;
+    size_t i;
+    int w;
+
+    switch_id.switch_number = 0;
+
+    for (i = 0; i < set->block_count; ++i) {
+        entry = &set->blocks[i];
+
+        switch_id.page_number = (uint32_t)(entry->block_number / FEATURES_BLOCKS_PER_PAGE);
+        switch_id.block_number = entry->block_number % FEATURES_BLOCKS_PER_PAGE;
+
+        rc = features_switch_block(&block, data, switch_id);
+
+        if (FEATURES_OK != rc) {
+            return rc;
+        }
+
+        memset(on, 0, sizeof(on));
+
+        if (FEATURES_SWITCH_TYPE_FLAG == block.type) {
+            features_flagset_on(entry, &block, on);
+        }
+
+        any = 0;
+
+        for (w = 0; w < FEATURES_FLAGSET_WORDS; ++w) {
+            any |= FEATURES_FLAGSET_ALL == op ? on[w] ^ entry->mask[w] : on[w];
+        }
+
+        // A set flag settles ANY and NONE, an unset one ALL
+        if (0 != any) {
+            *result = FEATURES_FLAGSET_ANY == op;
+            return FEATURES_OK;
+        }
+    }
+
+    *result = FEATURES_FLAGSET_ANY != op;
+    return FEATURES_OK;
+}
+
+static int
+features_flagset_compare(
+        const void *a,
+        const void *b) {
+    features_switch_number_t na = *(const features_switch_number_t *)a;
+    features_switch_number_t nb = *(const features_switch_number_t *)b;
+
+    return (na > nb) - (na < nb);
+}
+
+// Sets the bits of on for the flags of entry that are used, not
+// deprecated and set in a flag block
+static void
+features_flagset_on(
+        const features_flagset_block_t *entry,
+        const features_block_t *block,
+        uint64_t *on) {
+    uint8_t flags[FEATURES_FLAGSET_WORDS * 8];
+    uint64_t properties;
+    int k;
+    int w;
+
+    // The properties fill the first 42 bytes of the 64 byte block, so
+    // whole words can be read. The flags are the last 21 and are copied.
+    for (k = 0; k < FEATURES_FLAGSET_PROPERTY_WORDS; ++k) {
+        if (0 == entry->property_mask[k]) {
+            continue;
+        }
+
+        properties = features_load_uint64(block->switch_properties + k * 8,
+                FEATURES_PAGE_FLAG_LITTLE_ENDIAN);
+        properties &= ~(properties >> 1) & entry->property_mask[k];
+        on[k / 2] |= features_flagset_compact(properties) << ((k % 2) * 32);
+    }
+
+    memset(flags, 0, sizeof(flags));
+    memcpy(flags, block->data.p8, FEATURES_FLAGS_PER_BLOCK / 8);
+
+    for (w = 0; w < FEATURES_FLAGSET_WORDS; ++w) {
+        on[w] &= features_load_uint64(flags + w * 8, FEATURES_PAGE_FLAG_LITTLE_ENDIAN);
+    }
+}
+
+// Moves bit i of the low 32 bits to bit 2i
+static uint64_t
+features_flagset_spread(uint64_t bits) {
+    bits = (bits | (bits << 16)) & UINT64_C(0x0000ffff0000ffff);
+    bits = (bits | (bits << 8)) & UINT64_C(0x00ff00ff00ff00ff);
+    bits = (bits | (bits << 4)) & UINT64_C(0x0f0f0f0f0f0f0f0f);
+    bits = (bits | (bits << 2)) & UINT64_C(0x3333333333333333);
+    bits = (bits | (bits << 1)) & UINT64_C(0x5555555555555555);
+    return bits;
+}
+
+// Moves bit 2i to bit i, the inverse of features_flagset_spread()
+static uint64_t
+features_flagset_compact(uint64_t bits) {
+    bits &= UINT64_C(0x5555555555555555);
+    bits = (bits | (bits >> 1)) & UINT64_C(0x3333333333333333);
+    bits = (bits | (bits >> 2)) & UINT64_C(0x0f0f0f0f0f0f0f0f);
+    bits = (bits | (bits >> 4)) & UINT64_C(0x00ff00ff00ff00ff);
+    bits = (bits | (bits >> 8)) & UINT64_C(0x0000ffff0000ffff);
+    bits = (bits | (bits >> 16)) & UINT64_C(0x00000000ffffffff);
+    return bits;
+}
@@ -0,0 +1,73 @@
+#ifndef FEATURES_FLAGSET_H
+#define FEATURES_FLAGSET_H
+
+#include <stddef.h>
+
+#include "memory.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum {
+    // 64 bit words covering the flags of one block
+    FEATURES_FLAGSET_WORDS = (FEATURES_FLAGS_PER_BLOCK + 63) / 64,
+    // 64 bit words covering the 2 bit properties of those flags
+    FEATURES_FLAGSET_PROPERTY_WORDS = (FEATURES_FLAGS_PER_BLOCK * 2 + 63) / 64
+};
+
+typedef enum features_flagset_op_t {
+    // At least one flag of the set is on
+    FEATURES_FLAGSET_ANY,
+    // Every flag of the set is on
+    FEATURES_FLAGSET_ALL,
+    // No flag of the set is on
+    FEATURES_FLAGSET_NONE
+} features_flagset_op_t;
+
+// The flags of a set that live in one block
+typedef struct features_flagset_block_t {
+    features_block_number_t block_number;
+    // Bit i for slot i
+    uint64_t mask[FEATURES_FLAGSET_WORDS];
+    // The same bits moved to the USED bit of each slot's properties
+    uint64_t property_mask[FEATURES_FLAGSET_PROPERTY_WORDS];
+} features_flagset_block_t;
+
+// A set of flag switches compiled for testing together. A test decodes
+// each block of the set once and checks all of its flags with a few word
+// wide ANDs of the property bits and the flag bits, instead of a lookup
+// per flag.
+typedef struct features_flagset_t {
+    // In block number order
+    features_flagset_block_t *blocks;
+    size_t block_count;
+} features_flagset_t;
+
+// Groups count switch numbers by block. Returns FEATURES_ERR_INVALID for
+// a slot no flag block has.
+features_err_t
+features_flagset_compile(
+        features_flagset_t *set,
+        const features_switch_number_t *switch_numbers,
+        size_t count);
+
+void
+features_flagset_free(features_flagset_t *set);
+
+// Sets result to whether the flags of the set in data satisfy op. A flag
+// is on when its switch is a used, not deprecated flag that is set, any
+// other switch counts as off, as features_switch_flag_value() failing
+// would. The tests are not counted by data->stats.
+features_err_t
+features_flagset_test(
+        const features_flagset_t *set,
+        const features_data_t *data,
+        features_flagset_op_t op,
+        int *result);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
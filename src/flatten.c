@@ -0,0 +1,358 @@
+#include "flatten.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "byteorder.h"
+#include "internal.h"
+
+typedef struct features_flatten_job_t {
+    features_flat_t *flat;
+    const features_data_t *data;
+    uint64_t first_page;
+    uint64_t end_page;
+} features_flatten_job_t;
+
+static void *
+features_flatten_pages(void *arg);
+
+static void
+features_flatten_block(
+        features_flat_t *flat,
+        const features_block_t *block,
+        uint64_t base,
+        uint8_t flags);
+
+features_err_t
+features_flatten(
+        features_flat_t *flat,
+        const features_data_t *data,
+        unsigned threads) {
+    features_flatten_job_t *jobs;
+    features_block_t block;
+    features_page_t page;
+    features_err_t rc;
+    pthread_t *thread_ids;
+    uint64_t chunk_pages;
+    uint64_t page_index;
+    uint64_t b;
+    unsigned started;
+    unsigned t;
+    uint8_t capacity;
+    uint8_t width;
+    int type;
+    int i;
+
+    memset(flat, 0, sizeof(features_flat_t));
+    flat->page_count = data->page_count;
+    flat->page_offset = data->page_offset;
+    flat->page_span = data->page_span;
+
+    // Nothing to split between threads
+    if (0 == data->page_count) {
+        return FEATURES_ERR_INVALID;
+    }
+
+    if (NULL != data->directory) {
+        size_t directory_size = (data->page_span + 63) / 64 * sizeof(features_page_directory_t);
+
+        flat->directory = malloc(directory_size);
+
+        if (NULL == flat->directory) {
+            return FEATURES_ERR_NOMEM;
+        }
+
+        memcpy(flat->directory, data->directory, directory_size);
+    }
+
+    if (0 == threads) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (unsigned)cpus : 1;
+    }
+
+    if (threads > data->page_count) {
+        threads = (unsigned)data->page_count;
+    }
+
+    chunk_pages = (data->page_count + threads - 1) / threads;
+
+    threads = (unsigned)((data->page_count + chunk_pages - 1) / chunk_pages);
+
+    flat->block_type = malloc(data->page_count * FEATURES_BLOCKS_PER_PAGE);
+    flat->block_base = malloc(data->page_count * FEATURES_BLOCKS_PER_PAGE * sizeof(uint64_t));
+
+    if (NULL == flat->block_type || NULL == flat->block_base) {
+        features_flat_free(flat);
+        return FEATURES_ERR_NOMEM;
+    }
+
+    // Lay out the arrays from the page headers alone
+    for (page_index = 0; page_index < data->page_count; ++page_index) {
+        rc = features_page(&page, data->pages + page_index);
+
+        if (FEATURES_OK != rc) {
+            features_flat_free(flat);
+            return rc;
+        }
+
+        if (0 == page_index % chunk_pages) {
+            // Each thread starts on a new bitmap word so no two threads
+            // write the same word
+            for (type = 0; type < FEATURES_SWITCH_TYPE_INVALID; ++type) {
+                flat->count[type] = (flat->count[type] + 63) & ~(uint64_t)63;
+            }
+        }
+
+        for (i = 0; i < FEATURES_BLOCKS_PER_PAGE; ++i) {
+            b = page_index * FEATURES_BLOCKS_PER_PAGE + i;
+
+            if (FEATURES_OK != features_block(&block, &page, i)) {
+                block.type = FEATURES_SWITCH_TYPE_INVALID;
+            }
+
+            flat->block_type[b] = block.type;
+            flat->block_base[b] = 0;
+            capacity = features_block_capacity(block.type);
+
+            if (capacity > 0) {
+                flat->block_base[b] = flat->count[block.type];
+                flat->count[block.type] += capacity;
+            }
+        }
+    }
+
+    for (type = 0; type < FEATURES_SWITCH_TYPE_INVALID; ++type) {
+        if (0 == flat->count[type]) {
+            continue;
+        }
+
+        width = features_block_width((features_switch_type_t)type);
+        flat->values[type].any = calloc(flat->count[type], width ? width : 1);
+        flat->valid[type] = calloc((flat->count[type] + 63) / 64, sizeof(uint64_t));
+        flat->deprecated[type] = calloc((flat->count[type] + 63) / 64, sizeof(uint64_t));
+
+        if (NULL == flat->values[type].any || NULL == flat->valid[type]
+                || NULL == flat->deprecated[type]) {
+            features_flat_free(flat);
+            return FEATURES_ERR_NOMEM;
+        }
+    }
+
+    jobs = calloc(threads, sizeof(features_flatten_job_t));
+    thread_ids = calloc(threads, sizeof(pthread_t));
+
+    if (NULL == jobs || NULL == thread_ids) {
+        free(jobs);
+        free(thread_ids);
+        features_flat_free(flat);
+        return FEATURES_ERR_NOMEM;
+    }
+
+    for (t = 0; t < threads; ++t) {
+        jobs[t].flat = flat;
+        jobs[t].data = data;
+        jobs[t].first_page = t * chunk_pages;
+        jobs[t].end_page = jobs[t].first_page + chunk_pages;
+
+        if (jobs[t].end_page > data->page_count) {
+            jobs[t].end_page = data->page_count;
+        }
+    }
+
+    // The calling thread takes the first range
+    for (started = 1; started < threads; ++started) {
+        if (0 != pthread_create(&thread_ids[started], NULL, features_flatten_pages, &jobs[started])) {
+            break;
+        }
+    }
+
+    features_flatten_pages(&jobs[0]);
+
+    for (t = started; t < threads; ++t) {
+        features_flatten_pages(&jobs[t]);
+    }
+
+    for (t = 1; t < started; ++t) {
+        pthread_join(thread_ids[t], NULL);
+    }
+
+    free(jobs);
+    free(thread_ids);
+
+    return FEATURES_OK;
+}
+
+void
+features_flat_free(features_flat_t *flat) {
+    int type;
+
+    free(flat->directory);
+    free(flat->block_type);
+    free(flat->block_base);
+
+    for (type = 0; type < FEATURES_SWITCH_TYPE_INVALID; ++type) {
+        free(flat->values[type].any);
+        free(flat->valid[type]);
+        free(flat->deprecated[type]);
+    }
+
+    memset(flat, 0, sizeof(features_flat_t));
+}
+
+features_err_t
+features_flat_index(
+        const features_flat_t *flat,
+        features_switch_number_t switch_number,
+        features_switch_type_t *type,
+        uint64_t *index) {
+    features_switch_id_t switch_id;
+    features_switch_type_t block_type;
+    int64_t page_index;
+    uint64_t b;
+    uint64_t i;
+
+    switch_id = features_switch_id(switch_number);
+
+    if (switch_id.page_number < flat->page_offset) {
+        return FEATURES_ERR_DEPRECATED;
+    }
+
+    if (switch_id.page_number - flat->page_offset >= flat->page_span) {
+        return FEATURES_ERR_UNUSED;
+    }
+
+    page_index = features_directory_find(flat->directory, switch_id.page_number - flat->page_offset);
+
+    // Pages left out of a sparse file read as empty pages
+    if (page_index < 0) {
+        return 0 == switch_id.block_number ? FEATURES_ERR_INVALID : FEATURES_ERR_UNUSED;
+    }
+
+    b = (uint64_t)page_index * FEATURES_BLOCKS_PER_PAGE + switch_id.block_number;
+    block_type = (features_switch_type_t)flat->block_type[b];
+
+    switch (block_type) {
+        case FEATURES_SWITCH_TYPE_UNUSED:
+            return FEATURES_ERR_UNUSED;
+        case FEATURES_SWITCH_TYPE_DEPRECATED:
+            return FEATURES_ERR_DEPRECATED;
+        default:
+            break;
+    }
+
+    if (switch_id.switch_number >= features_block_capacity(block_type)) {
+        return FEATURES_ERR_INVALID;
+    }
+
+    i = flat->block_base[b] + switch_id.switch_number;
+
+    if (!features_flat_bit(flat->valid[block_type], i)) {
+        return FEATURES_ERR_UNUSED;
+    }
+
+    if (features_flat_bit(flat->deprecated[block_type], i)) {
+        return FEATURES_ERR_DEPRECATED;
+    }
+
+    *type = block_type;
+    *index = i;
+
+    return FEATURES_OK;
+}
+
+static void *
+features_flatten_pages(void *arg) {
+    features_flatten_job_t *job;
+    features_block_t block;
+    features_page_t page;
+    uint64_t page_index;
+    uint64_t b;
+    int i;
+
+    job = arg;
+
+    for (page_index = job->first_page; page_index < job->end_page; ++page_index) {
+        // Validated by the header pass
+        features_page(&page, job->data->pages + page_index);
+
+        for (i = 1; i < FEATURES_BLOCKS_PER_PAGE; ++i) {
+            b = page_index * FEATURES_BLOCKS_PER_PAGE + i;
+
+            if (0 == features_block_capacity((features_switch_type_t)job->flat->block_type[b])) {
+                continue;
+            }
+
+            features_block(&block, &page, i);
+            features_flatten_block(job->flat, &block, job->flat->block_base[b], job->data->flags);
+        }
+    }
+
+    return NULL;
+}
+
+static void
+features_flatten_block(
+        features_flat_t *flat,
+        const features_block_t *block,
+        uint64_t base,
+        uint8_t flags) {
+    features_flat_values_t *values;
+    uint64_t *valid;
+    uint64_t *deprecated;
+    uint8_t capacity;
+    uint8_t properties;
+    uint64_t i;
+    int s;
+
+    values = &flat->values[block->type];
+    valid = flat->valid[block->type];
+    deprecated = flat->deprecated[block->type];
+    capacity = features_block_capacity(block->type);
+
+    for (s = 0; s < capacity; ++s) {
+        properties = block->switch_properties[s / 4] >> ((s % 4) * 2);
+        i = base + s;
+
+        if (properties & FEATURES_SWITCH_PROPERTY_USED) {
+            valid[i / 64] |= (uint64_t)1 << (i % 64);
+        }
+
+        if (properties & FEATURES_SWITCH_PROPERTY_DEPRECATED) {
+            deprecated[i / 64] |= (uint64_t)1 << (i % 64);
+        }
+    }
+
+    switch (block->type) {
+        case FEATURES_SWITCH_TYPE_FLAG:
+            for (s = 0; s < capacity; ++s) {
+                values->flag[base + s] = (block->data.p8[s / 8] >> (s % 8)) & 1;
+            }
+            break;
+        case FEATURES_SWITCH_TYPE_UINT8:
+        case FEATURES_SWITCH_TYPE_INT8:
+            memcpy(values->uint8 + base, block->data.p8, capacity);
+            break;
+        case FEATURES_SWITCH_TYPE_UINT16:
+        case FEATURES_SWITCH_TYPE_INT16:
+            for (s = 0; s < capacity; ++s) {
+                values->uint16[base + s] = features_load_uint16(block->data.p16 + s, flags);
+            }
+            break;
+        case FEATURES_SWITCH_TYPE_UINT32:
+        case FEATURES_SWITCH_TYPE_INT32:
+            for (s = 0; s < capacity; ++s) {
+                values->uint32[base + s] = features_load_uint32(block->data.p32 + s, flags);
+            }
+            break;
+        case FEATURES_SWITCH_TYPE_UINT64:
+        case FEATURES_SWITCH_TYPE_INT64:
+            for (s = 0; s < capacity; ++s) {
+                values->uint64[base + s] = features_load_uint64(block->data.p64 + s, flags);
+            }
+            break;
+        default:
+            break;
+    }
+}
@@ -0,0 +1,82 @@
+#ifndef FEATURES_FLATTEN_H
+#define FEATURES_FLATTEN_H
+
+#include "memory.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef union features_flat_values_t {
+    void *any;
+    // 0 or 1 per flag
+    char *flag;
+    uint8_t *uint8;
+    uint16_t *uint16;
+    uint32_t *uint32;
+    uint64_t *uint64;
+    int8_t *int8;
+    int16_t *int16;
+    int32_t *int32;
+    int64_t *int64;
+} features_flat_values_t;
+
+// Every switch slot of a features_data_t copied into one host order
+// array per switch type. A switch is found at
+//
+//     values[type].member[block_base[block] + slot]
+//
+// where block counts the blocks of every stored page, see
+// features_flat_index(). The valid and deprecated bitmaps hold the USED
+// and DEPRECATED property bits, bit i of word i / 64 for element i.
+// Elements of slots that are not valid hold whatever the file stored.
+typedef struct features_flat_t {
+    uint64_t page_count;
+    uint64_t page_offset;
+    uint64_t page_span;
+    // Copy of the directory of a sparse file, NULL otherwise
+    features_page_directory_t *directory;
+
+    // One per block of every stored page
+    uint8_t *block_type;
+    uint64_t *block_base;
+
+    // Indexed by switch type, empty for the untyped ones
+    uint64_t count[FEATURES_SWITCH_TYPE_INVALID];
+    features_flat_values_t values[FEATURES_SWITCH_TYPE_INVALID];
+    uint64_t *valid[FEATURES_SWITCH_TYPE_INVALID];
+    uint64_t *deprecated[FEATURES_SWITCH_TYPE_INVALID];
+} features_flat_t;
+
+// Decodes data into flat with threads threads working on separate page
+// ranges, 0 for one per online CPU. Only the page headers are read
+// before the single pass that copies the switch data. Data without
+// pages is FEATURES_ERR_INVALID.
+features_err_t
+features_flatten(
+        features_flat_t *flat,
+        const features_data_t *data,
+        unsigned threads);
+
+void
+features_flat_free(features_flat_t *flat);
+
+// Finds the array element of a switch. Returns the same errors as
+// features_switch_value() for switches that are not readable.
+features_err_t
+features_flat_index(
+        const features_flat_t *flat,
+        features_switch_number_t switch_number,
+        features_switch_type_t *type,
+        uint64_t *index);
+
+static inline int
+features_flat_bit(const uint64_t *bits, uint64_t index) {
+    return (int)((bits[index / 64] >> (index % 64)) & 1);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
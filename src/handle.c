@@ -0,0 +1,41 @@
+#include "handle.h"
+
+#include <string.h>
+
+#include "internal.h"
+
+features_err_t
+features_handle_resolve(
+        features_handle_t *handle,
+        const features_data_t *data,
+        features_switch_number_t switch_number,
+        features_switch_type_t expected_type) {
+    features_switch_info_t switch_info;
+    features_err_t rc;
+
+    memset(handle, 0, sizeof(features_handle_t));
+
+    rc = features_switch_info(&switch_info, data, switch_number);
+
+    if (FEATURES_OK == rc) {
+        rc = features_switch_status(&switch_info);
+    }
+
+    if (FEATURES_OK == rc && expected_type != switch_info.type) {
+        rc = FEATURES_ERR_INCORRECT_TYPE;
+    }
+
+    handle->type = switch_info.type;
+    handle->flags = data->flags;
+    handle->rc = rc;
+
+    if (FEATURES_OK == rc) {
+        handle->data = switch_info.data;
+
+        if (FEATURES_SWITCH_TYPE_FLAG == switch_info.type) {
+            handle->mask = 1 << (switch_info.switch_number % 8);
+        }
+    }
+
+    return rc;
+}
@@ -0,0 +1,148 @@
+#ifndef FEATURES_HANDLE_H
+#define FEATURES_HANDLE_H
+
+#include "byteorder.h"
+#include "memory.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// A switch resolved against one features_data_t. Page and block decoding,
+// the property bits and the type check are done once by
+// features_handle_resolve(), so a read is a status check plus a load.
+// A handle is valid for as long as the data it was resolved against,
+// resolve it again after switching to a new snapshot.
+typedef struct features_handle_t {
+    const uint8_t *data;
+    // Bit of the flag within its byte, 0 for integer switches
+    uint8_t mask;
+    // FEATURES_PAGE_FLAG_* deciding whether reads swap bytes
+    uint8_t flags;
+    features_switch_type_t type;
+    // Returned by every read of the handle
+    features_err_t rc;
+} features_handle_t;
+
+// Resolves switch_number as a switch of expected_type and returns the
+// status that reads of the handle will return
+features_err_t
+features_handle_resolve(
+        features_handle_t *handle,
+        const features_data_t *data,
+        features_switch_number_t switch_number,
+        features_switch_type_t expected_type);
+
+static inline features_err_t
+features_handle_flag_value(
+        const features_handle_t *handle,
+        char *val) {
+    if (FEATURES_OK != handle->rc) {
+        return handle->rc;
+    }
+
+    *val = (char)(*handle->data & handle->mask);
+    return FEATURES_OK;
+}
+
+static inline features_err_t
+features_handle_uint8_value(
+        const features_handle_t *handle,
+        uint8_t *val) {
+    if (FEATURES_OK != handle->rc) {
+        return handle->rc;
+    }
+
+    *val = *handle->data;
+    return FEATURES_OK;
+}
+
+static inline features_err_t
+features_handle_uint16_value(
+        const features_handle_t *handle,
+        uint16_t *val) {
+    if (FEATURES_OK != handle->rc) {
+        return handle->rc;
+    }
+
+    *val = features_load_uint16(handle->data, handle->flags);
+    return FEATURES_OK;
+}
+
+static inline features_err_t
+features_handle_uint32_value(
+        const features_handle_t *handle,
+        uint32_t *val) {
+    if (FEATURES_OK != handle->rc) {
+        return handle->rc;
+    }
+
+    *val = features_load_uint32(handle->data, handle->flags);
+    return FEATURES_OK;
+}
+
+static inline features_err_t
+features_handle_uint64_value(
+        const features_handle_t *handle,
+        uint64_t *val) {
+    if (FEATURES_OK != handle->rc) {
+        return handle->rc;
+    }
+
+    *val = features_load_uint64(handle->data, handle->flags);
+    return FEATURES_OK;
+}
+
+static inline features_err_t
+features_handle_int8_value(
+        const features_handle_t *handle,
+        int8_t *val) {
+    if (FEATURES_OK != handle->rc) {
+        return handle->rc;
+    }
+
+    *val = (int8_t)*handle->data;
+    return FEATURES_OK;
+}
+
+static inline features_err_t
+features_handle_int16_value(
+        const features_handle_t *handle,
+        int16_t *val) {
+    if (FEATURES_OK != handle->rc) {
+        return handle->rc;
+    }
+
+    *val = features_load_int16(handle->data, handle->flags);
+    return FEATURES_OK;
+}
+
+static inline features_err_t
+features_handle_int32_value(
+        const features_handle_t *handle,
+        int32_t *val) {
+    if (FEATURES_OK != handle->rc) {
+        return handle->rc;
+    }
+
+    *val = features_load_int32(handle->data, handle->flags);
+    return FEATURES_OK;
+}
+
+static inline features_err_t
+features_handle_int64_value(
+        const features_handle_t *handle,
+        int64_t *val) {
+    if (FEATURES_OK != handle->rc) {
+        return handle->rc;
+    }
+
+    *val = features_load_int64(handle->data, handle->flags);
+    return FEATURES_OK;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
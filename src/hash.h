@@ -0,0 +1,26 @@
+#ifndef FEATURES_HASH_H
+#define FEATURES_HASH_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// The MurmurHash3 64 bit finalizer, fmix64. Every bit of h affects
+// every bit of the result.
+static inline uint64_t
+features_hash_mix(uint64_t h) {
+    h ^= h >> 33;
+    h *= UINT64_C(0xff51afd7ed558ccd);
+    h ^= h >> 33;
+    h *= UINT64_C(0xc4ceb9fe1a85ec53);
+    h ^= h >> 33;
+    return h;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
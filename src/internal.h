@@ -0,0 +1,121 @@
+#ifndef FEATURES_INTERNAL_H
+#define FEATURES_INTERNAL_H
+
+#include "byteorder.h"
+#include "memory.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef __GNUC__
+#define FEATURES_PREFETCH(addr) __builtin_prefetch((addr), 0, 3)
+#else
+#define FEATURES_PREFETCH(addr) ((void)(addr))
+#endif
+
+static inline int
+features_popcount64(uint64_t bits) {
+#ifdef __GNUC__
+    return __builtin_popcountll(bits);
+#else
+    int count;
+
+    for (count = 0; bits; ++count) {
+        bits &= bits - 1;
+    }
+
+    return count;
+#endif
+}
+
+// Position in the stored pages of the page relative_page after
+// page_offset, -1 when a sparse file leaves it out. relative_page must
+// be inside the span.
+static inline int64_t
+features_directory_find(
+        const features_page_directory_t *directory,
+        uint64_t relative_page) {
+    uint64_t present;
+    uint64_t below;
+    int64_t index;
+
+    if (NULL == directory) {
+        return (int64_t)relative_page;
+    }
+
+    present = features_read_uint64(&directory[relative_page / 64].present);
+    below = present & (((uint64_t)1 << (relative_page % 64)) - 1);
+    index = (int64_t)(features_read_uint64(&directory[relative_page / 64].rank)
+            + features_popcount64(below));
+
+    // Selects without a branch on the present bit
+    return index | -(int64_t)(1 ^ ((present >> (relative_page % 64)) & 1));
+}
+
+// Checks that the directory of a sparse file only points at stored
+// pages: every rank counts the present bits before it, no bit is set
+// past page_span and page_count pages are present. Lookups trust the
+// directory, so loaders check it once.
+features_err_t
+features_directory_check(const features_data_t *data);
+
+// Location of a single switch, shared by the lookup paths of the library
+
+typedef struct features_switch_info_t {
+    features_switch_type_t type;
+    uint8_t switch_number;
+    // FEATURES_PAGE_FLAG_* of the data the switch is in
+    uint8_t flags;
+    uint8_t *switch_properties;
+    void *data;
+} features_switch_info_t;
+
+features_err_t
+features_switch_info(
+        features_switch_info_t *switch_info,
+        const features_data_t *data,
+        features_switch_number_t switch_number);
+
+// Decodes the block holding the switch, switches before page_offset
+// are reported as a deprecated block and those after the last page as
+// an unused block
+features_err_t
+features_switch_block(
+        features_block_t *block,
+        const features_data_t *data,
+        features_switch_id_t switch_id);
+
+void
+features_block_switch_info(
+        features_switch_info_t *switch_info,
+        const features_block_t *block,
+        uint8_t switch_number);
+
+// Checks the block type and the property bits of the switch
+features_err_t
+features_switch_status(const features_switch_info_t *switch_info);
+
+// Checks the status of the switch and reads its value
+features_err_t
+features_switch_read(
+        features_switch_value_t *value,
+        const features_switch_info_t *switch_info);
+
+// Number of switches a block of type can hold, 0 for untyped blocks
+uint8_t
+features_block_capacity(features_switch_type_t type);
+
+// Bytes of property bits at the start of a block of type
+uint8_t
+features_block_properties_size(features_switch_type_t type);
+
+// Bytes per switch value, 0 for flags and untyped blocks
+uint8_t
+features_block_width(features_switch_type_t type);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
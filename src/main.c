@@ -1,3 +1,751 @@
-int main(int argc, char *argv[]) {
+// features: inspects and compacts switch files
+//
+//     features [-j THREADS] dump FILE
+//     features [-j THREADS] stat FILE
+//     features [-j THREADS] diff OLD NEW
+//     features compact FILE OUT
+//
+// Pages are scanned by THREADS threads, one per online CPU by default, in
+// chunks of pages. Each chunk is written out as soon as every chunk
+// before it is, so output starts at once and only a few chunks per
+// thread are ever held in memory. compact runs on the calling thread,
+// see compact.h for what it leaves out.
+
+#include "config.h"
+
+#include <getopt.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "compact.h"
+#include "diff.h"
+#include "file.h"
+#include "internal.h"
+#include "memory.h"
+
+enum {
+    FEATURES_CLI_CHUNK_PAGES = 64,
+    // Chunks each thread may run ahead of the output
+    FEATURES_CLI_WINDOW = 4
+};
+
+typedef struct features_cli_t features_cli_t;
+
+// Writes the output of one chunk to out
+typedef features_err_t (*features_cli_chunk_fn)(
+        features_cli_t *cli,
+        uint64_t chunk,
+        FILE *out);
+
+typedef struct features_cli_chunk_t {
+    char *buf;
+    size_t size;
+    features_err_t rc;
+    int done;
+} features_cli_chunk_t;
+
+// Blocks and switches of one type, see features_cli_stat()
+typedef struct features_cli_counts_t {
+    uint64_t blocks[FEATURES_SWITCH_TYPE_INVALID + 1];
+    uint64_t used[FEATURES_SWITCH_TYPE_INVALID + 1];
+    uint64_t deprecated[FEATURES_SWITCH_TYPE_INVALID + 1];
+} features_cli_counts_t;
+
+struct features_cli_t {
+    features_file_t files[2];
+    unsigned threads;
+
+    features_cli_chunk_fn fn;
+    uint64_t chunk_count;
+    // Page numbers the diff chunks start at, chunk_count + 1 of them
+    uint64_t *boundaries;
+
+    // Guards everything below
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint64_t next_chunk;
+    uint64_t written;
+    int failed;
+    // FEATURES_CLI_WINDOW chunks per thread, chunk c in slot c % size
+    features_cli_chunk_t *window;
+    size_t window_size;
+    features_cli_counts_t counts;
+};
+
+static void
+features_cli_usage(const char *program);
+
+static int
+features_cli_load(
+        features_cli_t *cli,
+        char **paths,
+        int count);
+
+static features_err_t
+features_cli_scan(
+        features_cli_t *cli,
+        features_cli_chunk_fn fn,
+        uint64_t *bytes);
+
+static void *
+features_cli_worker(void *arg);
+
+static features_err_t
+features_cli_dump(
+        features_cli_t *cli,
+        uint64_t chunk,
+        FILE *out);
+
+static features_err_t
+features_cli_stat(
+        features_cli_t *cli,
+        uint64_t chunk,
+        FILE *out);
+
+static void
+features_cli_stat_print(const features_cli_t *cli, const char *path);
+
+static features_err_t
+features_cli_diff(
+        features_cli_t *cli,
+        uint64_t chunk,
+        FILE *out);
+
+static void
+features_cli_diff_print(
+        const features_switch_change_t *change,
+        void *ctx);
+
+static void
+features_cli_print_value(
+        FILE *out,
+        features_err_t rc,
+        const features_switch_value_t *value);
+
+static features_err_t
+features_cli_compact(
+        features_cli_t *cli,
+        const char *path);
+
+static uint64_t
+features_cli_chunks(uint64_t page_count);
+
+int
+main(int argc, char *argv[]) {
+    static const struct option long_options[] = {
+        {"threads", required_argument, NULL, 'j'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+    const features_data_t *larger;
+    features_cli_t cli;
+    features_err_t rc;
+    const char *command;
+    uint64_t bytes;
+    uint64_t k;
+    long cpus;
+    int files;
+    int c;
+
+    memset(&cli, 0, sizeof(cli));
+    cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    cli.threads = cpus > 0 ? (unsigned)cpus : 1;
+
+    // Options end at the command
+    while (-1 != (c = getopt_long(argc, argv, "+j:h", long_options, NULL))) {
+        switch (c) {
+            case 'j':
+                cli.threads = (unsigned)strtoul(optarg, NULL, 10);
+                break;
+            default:
+                features_cli_usage(argv[0]);
+                return 'h' == c ? 0 : 2;
+        }
+    }
+
+    if (optind >= argc || 0 == cli.threads) {
+        features_cli_usage(argv[0]);
+        return 2;
+    }
+
+    command = argv[optind++];
+    files = 0 == strcmp(command, "diff") || 0 == strcmp(command, "compact") ? 2 : 1;
+
+    if (argc - optind != files
+            || (0 != strcmp(command, "dump") && 0 != strcmp(command, "stat") && 2 != files)) {
+        features_cli_usage(argv[0]);
+        return 2;
+    }
+
+    // compact reads the first file and writes the second
+    if (0 != features_cli_load(&cli, argv + optind, 0 == strcmp(command, "compact") ? 1 : files)) {
+        return 2;
+    }
+
+    bytes = 0;
+
+    if (0 == strcmp(command, "compact")) {
+        rc = features_cli_compact(&cli, argv[optind + 1]);
+    } else if (0 == strcmp(command, "diff")) {
+        larger = cli.files[0].data.page_count > cli.files[1].data.page_count
+            ? &cli.files[0].data
+            : &cli.files[1].data;
+
+        // Chunks split the page numbers at every FEATURES_CLI_CHUNK_PAGES
+        // stored pages of the larger file
+        cli.chunk_count = features_cli_chunks(larger->page_count);
+        cli.boundaries = malloc((cli.chunk_count + 1) * sizeof(uint64_t));
+
+        if (NULL == cli.boundaries) {
+            fprintf(stderr, "features: %s\n", features_err_name(FEATURES_ERR_NOMEM));
+            return 2;
+        }
+
+        cli.boundaries[0] = 0;
+        cli.boundaries[cli.chunk_count] = UINT64_MAX;
+
+        for (k = 1; k < cli.chunk_count; ++k) {
+            cli.boundaries[k] = features_read_uint32(
+                    &larger->pages[k * FEATURES_CLI_CHUNK_PAGES].header.page_number);
+        }
+
+        rc = features_cli_scan(&cli, features_cli_diff, &bytes);
+    } else {
+        cli.chunk_count = features_cli_chunks(cli.files[0].data.page_count);
+        rc = features_cli_scan(&cli, 0 == strcmp(command, "dump")
+                ? features_cli_dump
+                : features_cli_stat, &bytes);
+
+        if (FEATURES_OK == rc && 0 == strcmp(command, "stat")) {
+            features_cli_stat_print(&cli, argv[optind]);
+        }
+    }
+
+    free(cli.boundaries);
+    features_close(&cli.files[0]);
+    features_close(&cli.files[1]);
+
+    if (FEATURES_OK != rc) {
+        fprintf(stderr, "features: %s\n", features_err_name(rc));
+        return 2;
+    }
+
+    // Like diff(1), 1 when the files differ
+    return bytes > 0 && 0 == strcmp(command, "diff") ? 1 : 0;
+}
+
+static void
+features_cli_usage(const char *program) {
+    fprintf(stderr,
+            "usage: %s [options] command file...\n"
+            "commands:\n"
+            "  dump FILE           print every used or deprecated switch, its type,\n"
+            "                      value and properties\n"
+            "  stat FILE           print the layout and per type block counts\n"
+            "  diff OLD NEW        print the switches that changed, exit 1 if any\n"
+            "  compact FILE OUT    write FILE without the pages and blocks that hold\n"
+            "                      no live switch to OUT\n"
+            "options:\n"
+            "  -j, --threads N     scan with N threads (one per online CPU)\n",
+            program);
+}
+
+static int
+features_cli_load(
+        features_cli_t *cli,
+        char **paths,
+        int count) {
+    features_err_t rc;
+    int i;
+
+    cli->files[0].fd = -1;
+    cli->files[1].fd = -1;
+
+    for (i = 0; i < count; ++i) {
+        rc = features_open(&cli->files[i], paths[i]);
+
+        if (FEATURES_OK != rc) {
+            fprintf(stderr, "features: %s: %s\n", paths[i], features_err_name(rc));
+            features_close(&cli->files[0]);
+            return -1;
+        }
+    }
+
     return 0;
 }
+
+// Runs fn over every chunk on cli->threads threads and writes the chunks
+// to stdout in order. Sets bytes to the bytes written.
+static features_err_t
+features_cli_scan(
+        features_cli_t *cli,
+        features_cli_chunk_fn fn,
+        uint64_t *bytes) {
+    features_cli_chunk_t *slot;
+    features_cli_chunk_t chunk;
+    features_err_t rc;
+    pthread_t *thread_ids;
+    unsigned started;
+    unsigned t;
+    uint64_t c;
+
+    *bytes = 0;
+    cli->fn = fn;
+    cli->window_size = (size_t)cli->threads * FEATURES_CLI_WINDOW;
+    cli->window = calloc(cli->window_size, sizeof(features_cli_chunk_t));
+    thread_ids = calloc(cli->threads, sizeof(pthread_t));
+
+    if (NULL == cli->window || NULL == thread_ids) {
+        free(cli->window);
+        free(thread_ids);
+        return FEATURES_ERR_NOMEM;
+    }
+
+    pthread_mutex_init(&cli->lock, NULL);
+    pthread_cond_init(&cli->cond, NULL);
+
+    rc = FEATURES_OK;
+
+    for (started = 0; started < cli->threads; ++started) {
+        if (0 != pthread_create(&thread_ids[started], NULL, features_cli_worker, cli)) {
+            break;
+        }
+    }
+
+    if (0 == started) {
+        rc = FEATURES_ERR_NOMEM;
+    }
+
+    for (c = 0; FEATURES_OK == rc && c < cli->chunk_count; ++c) {
+        slot = &cli->window[c % cli->window_size];
+
+        pthread_mutex_lock(&cli->lock);
+
+        while (!slot->done) {
+            pthread_cond_wait(&cli->cond, &cli->lock);
+        }
+
+        chunk = *slot;
+        memset(slot, 0, sizeof(features_cli_chunk_t));
+        pthread_mutex_unlock(&cli->lock);
+
+        rc = chunk.rc;
+
+        if (FEATURES_OK == rc && chunk.size > 0
+                && chunk.size != fwrite(chunk.buf, 1, chunk.size, stdout)) {
+            rc = FEATURES_ERR_IO;
+        }
+
+        *bytes += chunk.size;
+        free(chunk.buf);
+
+        pthread_mutex_lock(&cli->lock);
+        cli->written = c + 1;
+        cli->failed = FEATURES_OK != rc;
+        pthread_cond_broadcast(&cli->cond);
+        pthread_mutex_unlock(&cli->lock);
+    }
+
+    for (t = 0; t < started; ++t) {
+        pthread_join(thread_ids[t], NULL);
+    }
+
+    // Chunks finished after a failure
+    for (c = 0; c < cli->window_size; ++c) {
+        free(cli->window[c].buf);
+    }
+
+    if (FEATURES_OK == rc && 0 != fflush(stdout)) {
+        rc = FEATURES_ERR_IO;
+    }
+
+    pthread_cond_destroy(&cli->cond);
+    pthread_mutex_destroy(&cli->lock);
+    free(cli->window);
+    free(thread_ids);
+    cli->window = NULL;
+
+    return rc;
+}
+
+static void *
+features_cli_worker(void *arg) {
+    features_cli_chunk_t chunk;
+    features_cli_t *cli;
+    uint64_t c;
+    FILE *out;
+
+    cli = arg;
+
+    pthread_mutex_lock(&cli->lock);
+
+    for (;;) {
+        if (cli->failed || cli->next_chunk >= cli->chunk_count) {
+            break;
+        }
+
+        c = cli->next_chunk;
+
+        // Waits for the output to catch up before taking another slot
+        if (c >= cli->written + cli->window_size) {
+            pthread_cond_wait(&cli->cond, &cli->lock);
+            continue;
+        }
+
+        ++cli->next_chunk;
+        pthread_mutex_unlock(&cli->lock);
+
+        memset(&chunk, 0, sizeof(chunk));
+        out = open_memstream(&chunk.buf, &chunk.size);
+
+        if (NULL == out) {
+            chunk.rc = FEATURES_ERR_NOMEM;
+        } else {
+            chunk.rc = cli->fn(cli, c, out);
+
+            if (0 != fclose(out) && FEATURES_OK == chunk.rc) {
+                chunk.rc = FEATURES_ERR_NOMEM;
+            }
+        }
+
+        chunk.done = 1;
+
+        pthread_mutex_lock(&cli->lock);
+        cli->window[c % cli->window_size] = chunk;
+        pthread_cond_broadcast(&cli->cond);
+    }
+
+    pthread_mutex_unlock(&cli->lock);
+    return NULL;
+}
+
+static features_err_t
+features_cli_dump(
+        features_cli_t *cli,
+        uint64_t chunk,
+        FILE *out) {
+    const features_data_t *data;
+    features_switch_info_t switch_info;
+    features_switch_value_t value;
+    features_block_t block;
+    features_page_t page;
+    features_err_t rc;
+    uint64_t page_index;
+    uint64_t end;
+    uint8_t properties;
+    uint8_t capacity;
+    int b;
+    int s;
+
+    data = &cli->files[0].data;
+    end = (chunk + 1) * FEATURES_CLI_CHUNK_PAGES;
+    end = end < data->page_count ? end : data->page_count;
+
+    for (page_index = chunk * FEATURES_CLI_CHUNK_PAGES; page_index < end; ++page_index) {
+        rc = features_page(&page, data->pages + page_index);
+
+        if (FEATURES_OK != rc) {
+            return rc;
+        }
+
+        for (b = 1; b < FEATURES_BLOCKS_PER_PAGE; ++b) {
+            rc = features_block(&block, &page, (uint8_t)b);
+
+            if (FEATURES_OK != rc) {
+                return rc;
+            }
+
+            capacity = features_block_capacity(block.type);
+
+            for (s = 0; s < capacity; ++s) {
+                properties = block.switch_properties[s / 4] >> ((s % 4) * 2);
+                properties &= FEATURES_SWITCH_PROPERTY_USED | FEATURES_SWITCH_PROPERTY_DEPRECATED;
+
+                if (0 == properties) {
+                    continue;
+                }
+
+                features_block_switch_info(&switch_info, &block, (uint8_t)s);
+                switch_info.flags = data->flags;
+                rc = features_switch_read(&value, &switch_info);
+
+                fprintf(out, "%llu\t%s\t",
+                        (unsigned long long)((uint64_t)page.page_number * FEATURES_BLOCKS_PER_PAGE
+                            * FEATURES_MAX_SWITCHES_PER_BLOCK
+                            + (uint64_t)b * FEATURES_MAX_SWITCHES_PER_BLOCK + (uint64_t)s),
+                        features_switch_type_name(block.type));
+
+                if (FEATURES_OK == rc) {
+                    features_cli_print_value(out, rc, &value);
+                } else {
+                    fputc('-', out);
+                }
+
+                fprintf(out, "\t%s\n",
+                        FEATURES_SWITCH_PROPERTY_USED == properties ? "used"
+                        : FEATURES_SWITCH_PROPERTY_DEPRECATED == properties ? "deprecated"
+                        : "used,deprecated");
+            }
+        }
+    }
+
+    return FEATURES_OK;
+}
+
+static features_err_t
+features_cli_stat(
+        features_cli_t *cli,
+        uint64_t chunk,
+        FILE *out) {
+    const features_data_t *data;
+    features_cli_counts_t counts;
+    features_block_t block;
+    features_page_t page;
+    features_err_t rc;
+    uint64_t page_index;
+    uint64_t end;
+    uint8_t properties;
+    uint8_t capacity;
+    int type;
+    int b;
+    int s;
+
+    (void)out;
+
+    data = &cli->files[0].data;
+    end = (chunk + 1) * FEATURES_CLI_CHUNK_PAGES;
+    end = end < data->page_count ? end : data->page_count;
+    memset(&counts, 0, sizeof(counts));
+
+    for (page_index = chunk * FEATURES_CLI_CHUNK_PAGES; page_index < end; ++page_index) {
+        rc = features_page(&page, data->pages + page_index);
+
+        if (FEATURES_OK != rc) {
+            return rc;
+        }
+
+        for (b = 1; b < FEATURES_BLOCKS_PER_PAGE; ++b) {
+            rc = features_block(&block, &page, (uint8_t)b);
+
+            if (FEATURES_OK != rc) {
+                return rc;
+            }
+
+            ++counts.blocks[block.type];
+            capacity = features_block_capacity(block.type);
+
+            for (s = 0; s < capacity; ++s) {
+                properties = block.switch_properties[s / 4] >> ((s % 4) * 2);
+                counts.used[block.type] += properties & FEATURES_SWITCH_PROPERTY_USED;
+                counts.deprecated[block.type] += (properties & FEATURES_SWITCH_PROPERTY_DEPRECATED) >> 1;
+            }
+        }
+    }
+
+    pthread_mutex_lock(&cli->lock);
+
+    for (type = 0; type <= FEATURES_SWITCH_TYPE_INVALID; ++type) {
+        cli->counts.blocks[type] += counts.blocks[type];
+        cli->counts.used[type] += counts.used[type];
+        cli->counts.deprecated[type] += counts.deprecated[type];
+    }
+
+    pthread_mutex_unlock(&cli->lock);
+
+    return FEATURES_OK;
+}
+
+static void
+features_cli_stat_print(const features_cli_t *cli, const char *path) {
+    const features_data_t *data;
+    uint64_t blocks;
+    uint64_t used;
+    uint64_t deprecated;
+    int type;
+
+    data = &cli->files[0].data;
+
+    printf("file          %s\n", path);
+    printf("size          %llu bytes\n", (unsigned long long)cli->files[0].size);
+    printf("pages         %llu stored, %llu from page %llu\n",
+            (unsigned long long)data->page_count,
+            (unsigned long long)data->page_span,
+            (unsigned long long)data->page_offset);
+    printf("flags        %s%s%s%s\n",
+            0 == data->flags ? " none" : "",
+            data->flags & FEATURES_PAGE_FLAG_LITTLE_ENDIAN ? " little-endian" : "",
+            data->flags & FEATURES_PAGE_FLAG_SPARSE ? " sparse" : "",
+            data->flags & FEATURES_PAGE_FLAG_CHECKSUM ? " checksum" : "");
+    printf("\n%-12s %12s %12s %12s\n", "type", "blocks", "used", "deprecated");
+
+    blocks = 0;
+    used = 0;
+    deprecated = 0;
+
+    for (type = 0; type <= FEATURES_SWITCH_TYPE_INVALID; ++type) {
+        if (0 == cli->counts.blocks[type]) {
+            continue;
+        }
+
+        printf("%-12s %12llu %12llu %12llu\n",
+                features_switch_type_name((features_switch_type_t)type),
+                (unsigned long long)cli->counts.blocks[type],
+                (unsigned long long)cli->counts.used[type],
+                (unsigned long long)cli->counts.deprecated[type]);
+
+        blocks += cli->counts.blocks[type];
+        used += cli->counts.used[type];
+        deprecated += cli->counts.deprecated[type];
+    }
+
+    printf("%-12s %12llu %12llu %12llu\n", "total",
+            (unsigned long long)blocks,
+            (unsigned long long)used,
+            (unsigned long long)deprecated);
+}
+
+static features_err_t
+features_cli_diff(
+        features_cli_t *cli,
+        uint64_t chunk,
+        FILE *out) {
+    return features_diff_pages(&cli->files[0].data, &cli->files[1].data,
+            cli->boundaries[chunk], cli->boundaries[chunk + 1], features_cli_diff_print, out);
+}
+
+static void
+features_cli_diff_print(
+        const features_switch_change_t *change,
+        void *ctx) {
+    FILE *out;
+
+    out = ctx;
+
+    fprintf(out, "%llu\t", (unsigned long long)change->switch_number);
+
+    // A type changing matters as much as a value
+    if (FEATURES_OK == change->old_rc) {
+        fprintf(out, "%s ", features_switch_type_name(change->old_value.type));
+    }
+
+    features_cli_print_value(out, change->old_rc, &change->old_value);
+    fputc('\t', out);
+
+    if (FEATURES_OK == change->new_rc) {
+        fprintf(out, "%s ", features_switch_type_name(change->new_value.type));
+    }
+
+    features_cli_print_value(out, change->new_rc, &change->new_value);
+    fputc('\n', out);
+}
+
+// The value of a readable switch, the status otherwise
+static void
+features_cli_print_value(
+        FILE *out,
+        features_err_t rc,
+        const features_switch_value_t *value) {
+    if (FEATURES_OK != rc) {
+        fputs(features_err_name(rc), out);
+        return;
+    }
+
+    switch (value->type) {
+        case FEATURES_SWITCH_TYPE_FLAG:
+            fputs(value->value.flag ? "true" : "false", out);
+            break;
+        case FEATURES_SWITCH_TYPE_UINT8:
+            fprintf(out, "%u", (unsigned)value->value.uint8);
+            break;
+        case FEATURES_SWITCH_TYPE_UINT16:
+            fprintf(out, "%u", (unsigned)value->value.uint16);
+            break;
+        case FEATURES_SWITCH_TYPE_UINT32:
+            fprintf(out, "%lu", (unsigned long)value->value.uint32);
+            break;
+        case FEATURES_SWITCH_TYPE_UINT64:
+            fprintf(out, "%llu", (unsigned long long)value->value.uint64);
+            break;
+        case FEATURES_SWITCH_TYPE_INT8:
+            fprintf(out, "%d", (int)value->value.int8);
+            break;
+        case FEATURES_SWITCH_TYPE_INT16:
+            fprintf(out, "%d", (int)value->value.int16);
+            break;
+        case FEATURES_SWITCH_TYPE_INT32:
+            fprintf(out, "%ld", (long)value->value.int32);
+            break;
+        case FEATURES_SWITCH_TYPE_INT64:
+            fprintf(out, "%lld", (long long)value->value.int64);
+            break;
+        default:
+            fputs(features_err_name(FEATURES_ERR_INVALID), out);
+    }
+}
+
+// Writes the compacted file through a temporary file, so path may be the
+// file being compacted, and prints how much smaller it is
+static features_err_t
+features_cli_compact(
+        features_cli_t *cli,
+        const char *path) {
+    features_compact_stats_t stats;
+    features_builder_t builder;
+    features_err_t rc;
+    char *tmp_path;
+
+    tmp_path = malloc(strlen(path) + sizeof(".tmp"));
+
+    if (NULL == tmp_path) {
+        return FEATURES_ERR_NOMEM;
+    }
+
+    strcat(strcpy(tmp_path, path), ".tmp");
+    features_builder_init(&builder);
+
+    rc = features_compact(&builder, &cli->files[0].data, &stats);
+
+    if (FEATURES_OK == rc) {
+        rc = features_builder_save(&builder, tmp_path);
+    }
+
+    if (FEATURES_OK == rc && 0 != rename(tmp_path, path)) {
+        rc = FEATURES_ERR_IO;
+    }
+
+    if (FEATURES_OK != rc) {
+        unlink(tmp_path);
+    }
+
+    features_builder_free(&builder);
+    free(tmp_path);
+
+    if (FEATURES_OK != rc) {
+        return rc;
+    }
+
+    printf("pages         %llu stored, was %llu\n",
+            (unsigned long long)stats.new_pages,
+            (unsigned long long)stats.old_pages);
+    printf("size          %llu bytes, was %llu\n",
+            (unsigned long long)stats.new_size,
+            (unsigned long long)stats.old_size);
+    printf("page offset   %llu\n", (unsigned long long)stats.page_offset);
+    printf("deprecated    %llu blocks without live switches\n",
+            (unsigned long long)stats.deprecated_blocks);
+    printf("saved         %.1f%%\n", 0 == stats.old_size ? 0.0
+            : 100.0 * ((double)stats.old_size - (double)stats.new_size) / (double)stats.old_size);
+
+    return FEATURES_OK;
+}
+
+static uint64_t
+features_cli_chunks(uint64_t page_count) {
+    uint64_t chunks;
+
+    chunks = (page_count + FEATURES_CLI_CHUNK_PAGES - 1) / FEATURES_CLI_CHUNK_PAGES;
+    return chunks > 0 ? chunks : 1;
+}
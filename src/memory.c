@@ -1,64 +1,19 @@
 #include "memory.h"
 
 #include <assert.h>
+#include <stdlib.h>
+#include <string.h>
 
-typedef struct features_switch_info_t {
-    feature_switch_type_t type;
-    void *data;
-} features_switch_info_t;
-
-#ifndef WORDS_BIGENDIAN
-static uint16_t
-features_swap_endian_16(uint16_t val);
-
-static uint32_t
-features_swap_endian_32(uint32_t val);
-
-static uint64_t
-features_swap_endian_64(uint64_t val);
-#endif
-
-static uint16_t
-features_read_uint16(const void *data);
-
-static void
-features_write_uint16(void *data, uint16_t value);
-
-static uint32_t
-features_read_uint32(const void *data);
-
-static void
-features_write_uint32(void *data, uint32_t value);
-
-static uint64_t
-features_read_uint64(const void *data);
-
-static void
-features_write_uint64(void *data, uint64_t value);
-
-static int16_t
-features_read_int16(const void *data);
-
-static void
-features_write_int16(void *data, int16_t value);
-
-static int32_t
-features_read_int32(const void *data);
-
-static void
-features_write_int32(void *data, int32_t value);
-
-static int64_t
-features_read_int64(const void *data);
-
-static void
-features_write_int64(void *data, int64_t value);
+#include "byteorder.h"
+#include "internal.h"
+#include "stats.h"
 
+// features_switch_value() without the read counters
 static features_err_t
-features_switch_info(
-        features_switch_info_t *switch_info,
-        features_data_t *data,
-        features_switch_number_t switch_number);
+features_switch_lookup(
+        const features_data_t *data,
+        features_switch_number_t switch_number,
+        features_switch_value_t *value);
 
 features_switch_id_t
 features_switch_id(features_switch_number_t switch_number) {
@@ -76,6 +31,60 @@ features_switch_id(features_switch_number_t switch_number) {
     return switch_id;
 }
 
+const char *
+features_switch_type_name(features_switch_type_t type) {
+    switch (type) {
+        case FEATURES_SWITCH_TYPE_UNUSED:
+            return "unused";
+        case FEATURES_SWITCH_TYPE_DEPRECATED:
+            return "deprecated";
+        case FEATURES_SWITCH_TYPE_FLAG:
+            return "flag";
+        case FEATURES_SWITCH_TYPE_UINT8:
+            return "uint8";
+        case FEATURES_SWITCH_TYPE_UINT16:
+            return "uint16";
+        case FEATURES_SWITCH_TYPE_UINT32:
+            return "uint32";
+        case FEATURES_SWITCH_TYPE_UINT64:
+            return "uint64";
+        case FEATURES_SWITCH_TYPE_INT8:
+            return "int8";
+        case FEATURES_SWITCH_TYPE_INT16:
+            return "int16";
+        case FEATURES_SWITCH_TYPE_INT32:
+            return "int32";
+        case FEATURES_SWITCH_TYPE_INT64:
+            return "int64";
+        default:
+            return "invalid";
+    }
+}
+
+const char *
+features_err_name(features_err_t rc) {
+    switch (rc) {
+        case FEATURES_OK:
+            return "ok";
+        case FEATURES_ERR_UNINITIALISED:
+            return "uninitialised";
+        case FEATURES_ERR_INVALID:
+            return "invalid";
+        case FEATURES_ERR_UNUSED:
+            return "unused";
+        case FEATURES_ERR_DEPRECATED:
+            return "deprecated";
+        case FEATURES_ERR_INCORRECT_TYPE:
+            return "incorrect type";
+        case FEATURES_ERR_IO:
+            return "i/o error";
+        case FEATURES_ERR_NOMEM:
+            return "out of memory";
+        default:
+            return "unknown error";
+    }
+}
+
 features_err_t
 features_data(
         features_data_t *data,
@@ -94,13 +103,149 @@ features_data(
     }
 
     // The first page in the file contains the total page count
-    data->page_count = features_read_uint64(&page_raw->header.page_count);
+    data->page_count = features_read_uint32(&page_raw->header.page_count);
     data->page_offset = first_page.page_number;
     data->pages = page_raw;
+    data->flags = page_raw->header.flags;
+    data->page_span = data->page_count;
+    data->directory = NULL;
+    data->index = NULL;
+    data->stats = NULL;
+
+    if (data->flags & FEATURES_PAGE_FLAG_SPARSE) {
+        data->page_span = features_read_uint32(&page_raw->header.page_span);
+
+        if (data->page_span < data->page_count) {
+            return FEATURES_ERR_INVALID;
+        }
+
+        // The directory follows the last stored page
+        data->directory = (features_page_directory_t *)(page_raw + data->page_count);
+    }
+
+    return FEATURES_OK;
+}
+
+features_err_t
+features_data_index(features_data_t *data) {
+    features_index_entry_t *index;
+    features_index_entry_t *entry;
+    features_block_t block;
+    features_page_t page;
+    features_err_t rc;
+    uint64_t page_index;
+    void *mem;
+    int i;
+
+    if (0 != posix_memalign(&mem, FEATURES_BLOCK_SIZE,
+                data->page_count * FEATURES_BLOCKS_PER_PAGE * sizeof(features_index_entry_t))) {
+        return FEATURES_ERR_NOMEM;
+    }
+
+    index = mem;
+
+    for (page_index = 0; page_index < data->page_count; ++page_index) {
+        rc = features_page(&page, data->pages + page_index);
+
+        if (FEATURES_OK != rc) {
+            free(index);
+            return rc;
+        }
+
+        for (i = 0; i < FEATURES_BLOCKS_PER_PAGE; ++i) {
+            rc = features_block(&block, &page, i);
+
+            if (FEATURES_OK != rc) {
+                free(index);
+                return rc;
+            }
+
+            entry = index + page_index * FEATURES_BLOCKS_PER_PAGE + i;
+            memset(entry, 0, sizeof(features_index_entry_t));
+            entry->type = block.type;
+            entry->switch_properties = block.switch_properties;
+
+            if (NULL != block.data.p8) {
+                entry->data_offset = block.data.p8 - block.switch_properties;
+            }
+        }
+    }
+
+    features_data_index_free(data);
+    data->index = index;
 
     return FEATURES_OK;
 }
 
+void
+features_data_index_free(features_data_t *data) {
+    free(data->index);
+    data->index = NULL;
+}
+
+uint64_t
+features_data_size(const features_data_t *data) {
+    uint64_t directory_size;
+
+    if (NULL == data->directory) {
+        return data->page_count * FEATURES_PAGE_SIZE;
+    }
+
+    // The directory is padded to whole pages
+    directory_size = (data->page_span + 63) / 64 * sizeof(features_page_directory_t);
+    directory_size = (directory_size + FEATURES_PAGE_SIZE - 1) / FEATURES_PAGE_SIZE * FEATURES_PAGE_SIZE;
+
+    return data->page_count * FEATURES_PAGE_SIZE + directory_size;
+}
+
+features_err_t
+features_directory_check(const features_data_t *data) {
+    uint64_t present;
+    uint64_t rank;
+    uint64_t words;
+    uint64_t k;
+
+    if (NULL == data->directory) {
+        return FEATURES_OK;
+    }
+
+    words = (data->page_span + 63) / 64;
+    rank = 0;
+
+    for (k = 0; k < words; ++k) {
+        present = features_read_uint64(&data->directory[k].present);
+
+        if (features_read_uint64(&data->directory[k].rank) != rank) {
+            return FEATURES_ERR_INVALID;
+        }
+
+        // Pages past the span are never looked up, but must not count
+        if (k == words - 1 && 0 != data->page_span % 64
+                && 0 != present >> (data->page_span % 64)) {
+            return FEATURES_ERR_INVALID;
+        }
+
+        rank += features_popcount64(present);
+    }
+
+    return rank == data->page_count ? FEATURES_OK : FEATURES_ERR_INVALID;
+}
+
+features_page_raw_t *
+features_data_page(
+        const features_data_t *data,
+        uint64_t page_number) {
+    int64_t page_index;
+
+    if (page_number < data->page_offset || page_number - data->page_offset >= data->page_span) {
+        return NULL;
+    }
+
+    page_index = features_directory_find(data->directory, page_number - data->page_offset);
+
+    return page_index < 0 ? NULL : data->pages + page_index;
+}
+
 features_err_t
 features_page(
         features_page_t *page,
@@ -113,8 +258,9 @@ features_page(
         return FEATURES_ERR_INVALID;
     }
     
-    page->page_number = features_read_uint32(&raw->header.page_count);
-    page->blocks = raw->blocks;
+    page->page_number = features_read_uint32(&raw->header.page_number);
+    // Block 0 of every page is the page header itself
+    page->blocks = (features_block_raw_t *)raw;
     return FEATURES_OK;
 }
 
@@ -130,7 +276,7 @@ features_block(
 
     memset(block, 0, sizeof(features_block_t));
 
-    if (0 == page_block_number) {
+    if (0 == block_number) {
         // The first block on every page is reserved for the page header
         // it is not a valid block number
         block->type = FEATURES_SWITCH_TYPE_INVALID;
@@ -138,19 +284,19 @@ features_block(
     }
 
     page_header = (features_page_header_t*)page->blocks;
-    type_byte = page_header->block_info.data[page_block_number / 2];
+    type_byte = page_header->block_info.data[block_number / 2];
     
     // type byte has two block types packed into it
     // even block numbers have the least significant nybble
     // odd block number have the most significant nybble
 
-    if (page_block_number % 2) {
+    if (block_number % 2) {
         type_byte >>= 4;
     }
 
-    block->type = (feature_switch_type_t)(type_byte & 0xf);
+    block->type = (features_switch_type_t)(type_byte & 0xf);
     // The switch properties is at the start of the data block
-    block->properties = page->blocks + page_block_number;
+    block->switch_properties = page->blocks[block_number].data;
 
     switch (block->type) {
         case FEATURES_SWITCH_TYPE_UNUSED:
@@ -159,23 +305,23 @@ features_block(
             // Nothing more to do
             break;
         case FEATURES_SWITCH_TYPE_FLAG:
-            block->data.p8 = block->properties + FEATURES_FLAG_PROPERTIES_SIZE;
+            block->data.p8 = block->switch_properties + FEATURES_FLAG_PROPERTIES_SIZE;
             break;
         case FEATURES_SWITCH_TYPE_UINT8:
         case FEATURES_SWITCH_TYPE_INT8:
-            block->data.p8 = block->properties + FEATURES_UINT8_PROPERTIES_SIZE;
+            block->data.p8 = block->switch_properties + FEATURES_UINT8_PROPERTIES_SIZE;
             break;
         case FEATURES_SWITCH_TYPE_UINT16:
         case FEATURES_SWITCH_TYPE_INT16:
-            block->data.p16 = block->properties + FEATURES_UINT16_PROPERTIES_SIZE;
+            block->data.p16 = (uint16_t *)(block->switch_properties + FEATURES_UINT16_PROPERTIES_SIZE);
             break;
         case FEATURES_SWITCH_TYPE_UINT32:
         case FEATURES_SWITCH_TYPE_INT32:
-            block->data.p32 = block->properties + FEATURES_UINT32_PROPERTIES_SIZE;
+            block->data.p32 = (uint32_t *)(block->switch_properties + FEATURES_UINT32_PROPERTIES_SIZE);
             break;
         case FEATURES_SWITCH_TYPE_UINT64:
         case FEATURES_SWITCH_TYPE_INT64:
-            block->data.p64 = block->properties + FEATURES_UINT64_PROPERTIES_SIZE;
+            block->data.p64 = (uint64_t *)(block->switch_properties + FEATURES_UINT64_PROPERTIES_SIZE);
             break;
         default:
             return FEATURES_ERR_INVALID;
@@ -189,81 +335,31 @@ features_switch_value(
         const features_data_t *data,
         features_switch_number_t switch_number,
         features_switch_value_t *value) {
-    features_switch_info_t switch_info;
     features_err_t rc;
-    uint8_t switch_properties;
-
-    rc = features_switch_info(&switch_info, data, switch_number);
-
-    if (FEATURES_OK != rc) {
-        return rc;
-    }
-
-    value->type = switch_info.type;
-
-    switch (switch_info.type) {
-        case FEATURES_SWITCH_TYPE_UNUSED:
-            return FEATURES_ERR_UNUSED;
-        case FEATURES_SWITCH_TYPE_DEPRECATED:
-            return FEATURES_ERR_DEPRECATED;
-        case FEATURES_SWITCH_TYPE_FLAG:
-            memcpy(&value->data.flag, switch_info.data, 1);
-            value->data.flag &= (1 << (switch_number % 8));
-            break;
-        case FEATURES_SWITCH_TYPE_UINT8:
-            memcpy(&value->data.uint8, switch_info.data, 1);
-            break;
-        case FEATURES_SWITCH_TYPE_UINT16:
-            value->data.uint16 = features_read_uint16(switch_info->data);
-            break;
-        case FEATURES_SWITCH_TYPE_UINT32:
-            value->data.uint32 = features_read_uint32(switch_info->data);
-            break;
-        case FEATURES_SWITCH_TYPE_UINT64:
-            value->data.uint64 = features_read_uint64(switch_info->data);
-            break;
-        case FEATURES_SWITCH_TYPE_INT8:
-            memcpy(&value->data.int8, switch_info.data, 1);
-            break;
-        case FEATURES_SWITCH_TYPE_INT16:
-            value->data.int16 = features_read_int16(switch_info->data);
-            break;
-        case FEATURES_SWITCH_TYPE_INT32:
-            value->data.int32 = features_read_int32(switch_info->data);
-            break;
-        case FEATURES_SWITCH_TYPE_INT64:
-            value->data.int64 = features_read_int64(switch_info->data);
-            break;
-        case FEATURES_SWITCH_TYPE_INVALID:
-        default:
-            return FEATURES_ERR_INVALID;
-    }
-
-    switch_properties = value->switch_properties[switch_number / 4];
-    switch_properties >>= switch_number % 4;
 
-    if (!(switch_properties & 0x1)) {
-        return FEATURES_ERR_UNUSED;
-    }
+    rc = features_switch_lookup(data, switch_number, value);
 
-    if (switch_properties & 0x2) {
-        return FEATURES_ERR_DEPRECATED;
+    if (NULL != data->stats) {
+        features_stats_record(data->stats, switch_number, rc);
     }
 
-    return FEATURES_OK;
+    return rc;
 }
 
 #define FEATURE_RETURN_VALUE(expected_type, member)\
     features_switch_value_t value;\
     features_err_t rc;\
-    rc = features_switch_value(data,switch_number,value);\
+    rc = features_switch_lookup(data,switch_number,&value);\
     if (FEATURES_OK == rc){\
         if (expected_type != value.type) {\
             rc = FEATURES_ERR_INCORRECT_TYPE;\
         } else {\
-            *val = value.value.##member;\
+            *val = value.value.member;\
         }\
     }\
+    if (NULL != data->stats) {\
+        features_stats_record(data->stats, switch_number, rc);\
+    }\
     return rc
 
 features_err_t
@@ -338,219 +434,302 @@ features_switch_int64_value(
     FEATURE_RETURN_VALUE(FEATURES_SWITCH_TYPE_INT64, int64);
 }
 
-static uint16_t
-features_swap_endian_16(uint16_t val) {
-    uint16_t out_val;
-    uint8_t *in = (uint8_t *)&val;
-    uint8_t *out = (uint8_t *)&out_val;
+features_err_t
+features_switch_info(
+        features_switch_info_t *switch_info,
+        const features_data_t *data,
+        features_switch_number_t switch_number) {
+    features_switch_id_t switch_id;
+    features_block_t block;
+    features_err_t rc;
+
+    switch_id = features_switch_id(switch_number);
+
+    rc = features_switch_block(&block, data, switch_id);
 
-    out[0] = in[1];
-    out[1] = in[0];
+    if (FEATURES_OK != rc) {
+        return rc;
+    }
 
-    return out_val;
+    features_block_switch_info(switch_info, &block, switch_id.switch_number);
+    switch_info->flags = data->flags;
+    return FEATURES_OK;
 }
 
-static uint32_t
-features_swap_endian_32(uint32_t val) {
-    uint32_t out_val;
-    uint8_t *in = (uint8_t *)&val;
-    uint8_t *out = (uint8_t *)&out_val;
+features_err_t
+features_switch_block(
+        features_block_t *block,
+        const features_data_t *data,
+        features_switch_id_t switch_id) {
+    features_page_raw_t *page_raw;
+    features_page_t page;
+    features_err_t rc;
+    int64_t page_index;
 
-    out[0] = in[3];
-    out[1] = in[2];
-    out[2] = in[1];
-    out[3] = in[0];
+    if (switch_id.page_number < data->page_offset) {
+        memset(block, 0, sizeof(features_block_t));
+        block->type = FEATURES_SWITCH_TYPE_DEPRECATED;
+        return FEATURES_OK;
+    }
 
-    return out_val;
-}
+    if (switch_id.page_number - data->page_offset >= data->page_span) {
+        memset(block, 0, sizeof(features_block_t));
+        block->type = FEATURES_SWITCH_TYPE_UNUSED;
+        return FEATURES_OK;
+    }
 
-static uint64_t
-features_swap_endian_64(uint64_t val) {
-    uint64_t out_val;
-    uint8_t *in = (uint8_t *)&val;
-    uint8_t *out = (uint8_t *)&out_val;
-
-    out[0] = in[7];
-    out[1] = in[6];
-    out[2] = in[5];
-    out[3] = in[4];
-    out[4] = in[3];
-    out[5] = in[2];
-    out[6] = in[1];
-    out[7] = in[0];
-
-    return out_val;
-}
+    page_index = features_directory_find(data->directory, switch_id.page_number - data->page_offset);
 
-static uint16_t
-features_read_uint16(const void *data) {
-    uint16_t val = *(uint16_t *)data;
-#ifndef WORDS_BIGENDIAN
-    val = features_swap_endian_16(val);
-#endif
-    return val;
-}
+    // Pages left out of a sparse file read as empty pages
+    if (page_index < 0) {
+        memset(block, 0, sizeof(features_block_t));
+        block->type = 0 == switch_id.block_number
+            ? FEATURES_SWITCH_TYPE_INVALID
+            : FEATURES_SWITCH_TYPE_UNUSED;
+        return FEATURES_OK;
+    }
 
-static void
-features_write_uint16(void *data, uint16_t value) {
-    uint16_t val = value;
-#ifndef WORDS_BIGENDIAN
-    val = features_swap_endian_16(val);
-#endif
-    memcpy(data, &val, sizeof(uint16_t);
-}
+    if (NULL != data->index) {
+        const features_index_entry_t *entry;
 
-static uint32_t
-features_read_uint32(const void *data) {
-    uint32_t val = *(uint32_t *)data;
-#ifndef WORDS_BIGENDIAN
-    val = features_swap_endian_32(val);
-#endif
-    return val;
-}
+        entry = data->index + page_index * FEATURES_BLOCKS_PER_PAGE + switch_id.block_number;
 
-static void
-features_write_uint32(void *data, uint32_t value) {
-    uint32_t val = value;
-#ifndef WORDS_BIGENDIAN
-    val = features_swap_endian_32(val);
-#endif
-    memcpy(data, &val, sizeof(uint32_t));
-}
+        block->type = (features_switch_type_t)entry->type;
+        block->switch_properties = entry->switch_properties;
+        block->data.p8 = entry->switch_properties + entry->data_offset;
+        return FEATURES_OK;
+    }
 
-static uint64_t
-features_read_uint64(const void *data) {
-    uint64_t val = *(uint64_t *)data;
-#ifndef WORDS_BIGENDIAN
-    val = features_swap_endian_64(val);
-#endif
-    return val;
-}
+    page_raw = data->pages + page_index;
 
-static void
-features_write_uint64(void *data, uint64_t value) {
-    uint64_t val = value;
-#ifndef WORDS_BIGENDIAN
-    val = features_swap_endian_64(val);
-#endif
-    memcpy(data, &val, sizeof(uint64_t));
-}
+    rc = features_page(&page, page_raw);
 
-static int16_t
-features_read_int16(const void *data) {
-    return *(int16_t *)features_read_uint16(data);
-}
+    if (FEATURES_OK != rc) {
+        return rc;
+    }
 
-static void
-features_write_int16(void *data, int16_t value) {
-    features_write_uint16(data, *(uint16_t *)&value);
+    return features_block(block, &page, switch_id.block_number);
 }
 
-static int32_t
-features_read_int32(const void *data) {
-    return *(int32_t *)features_read_uint32(data);
-}
+void
+features_block_switch_info(
+        features_switch_info_t *switch_info,
+        const features_block_t *block,
+        uint8_t switch_number) {
+    memset(switch_info, 0, sizeof(features_switch_info_t));
 
-static void
-features_write_int32(void *data, int32_t value) {
-    return *(int32_t *)features_read_uint32(data);
-}
+    switch_info->type = block->type;
+    switch_info->switch_number = switch_number;
+    switch_info->switch_properties = block->switch_properties;
 
-static int64_t
-features_read_int64(const void *data) {
-    return *(int64_t *)features_read_uint64(data);
+    switch (block->type) {
+        case FEATURES_SWITCH_TYPE_UNUSED:
+        case FEATURES_SWITCH_TYPE_DEPRECATED:
+        case FEATURES_SWITCH_TYPE_INVALID:
+            break;
+        case FEATURES_SWITCH_TYPE_FLAG:
+            if (switch_number >= FEATURES_FLAGS_PER_BLOCK) {
+                switch_info->type = FEATURES_SWITCH_TYPE_INVALID;
+            } else {
+                uint8_t switch_offset = switch_number / 8;
+                switch_info->data = block->data.p8 + switch_offset;
+            }
+            break;
+        case FEATURES_SWITCH_TYPE_UINT8:
+        case FEATURES_SWITCH_TYPE_INT8:
+            if (switch_number >= FEATURES_UINT8_PER_BLOCK) {
+                switch_info->type = FEATURES_SWITCH_TYPE_INVALID;
+            } else {
+                switch_info->data = block->data.p8 + switch_number;
+            }
+            break;
+        case FEATURES_SWITCH_TYPE_UINT16:
+        case FEATURES_SWITCH_TYPE_INT16:
+            if (switch_number >= FEATURES_UINT16_PER_BLOCK) {
+                switch_info->type = FEATURES_SWITCH_TYPE_INVALID;
+            } else {
+                switch_info->data = block->data.p16 + switch_number;
+            }
+            break;
+        case FEATURES_SWITCH_TYPE_UINT32:
+        case FEATURES_SWITCH_TYPE_INT32:
+            if (switch_number >= FEATURES_UINT32_PER_BLOCK) {
+                switch_info->type = FEATURES_SWITCH_TYPE_INVALID;
+            } else {
+                switch_info->data = block->data.p32 + switch_number;
+            }
+            break;
+        case FEATURES_SWITCH_TYPE_UINT64:
+        case FEATURES_SWITCH_TYPE_INT64:
+            if (switch_number >= FEATURES_UINT64_PER_BLOCK) {
+                switch_info->type = FEATURES_SWITCH_TYPE_INVALID;
+            } else {
+                switch_info->data = block->data.p64 + switch_number;
+            }
+            break;
+        default:
+            switch_info->type = FEATURES_SWITCH_TYPE_INVALID;
+    }
 }
 
-static void
-features_write_int64(void *data, int64_t value) {
-    return *(int64_t *)features_read_uint64(data);
-}
+features_err_t
+features_switch_status(const features_switch_info_t *switch_info) {
+    uint8_t switch_properties;
 
-static features_err_t
-features_switch_info(
-        features_switch_info_t *switch_info,
-        features_data_t *data,
-        features_switch_number_t switch_number) {
-    features_switch_id_t switch_id;
+    switch (switch_info->type) {
+        case FEATURES_SWITCH_TYPE_UNUSED:
+            return FEATURES_ERR_UNUSED;
+        case FEATURES_SWITCH_TYPE_DEPRECATED:
+            return FEATURES_ERR_DEPRECATED;
+        case FEATURES_SWITCH_TYPE_INVALID:
+            return FEATURES_ERR_INVALID;
+        default:
+            break;
+    }
 
-    memset(switch_info, 0, sizeof(features_switch_info_t));
+    // Each switch has 2 property bits, 4 switches per byte
+    switch_properties = switch_info->switch_properties[switch_info->switch_number / 4];
+    switch_properties >>= (switch_info->switch_number % 4) * 2;
 
-    switch_id = features_switch_id(switch_number);
+    if (!(switch_properties & FEATURES_SWITCH_PROPERTY_USED)) {
+        return FEATURES_ERR_UNUSED;
+    }
 
-    if (switch_id.page_number < data->page_offset) {
-        switch_info->type = FEATURES_SWITCH_TYPE_DEPRECATED;
-    } else if (switch_id.page_number > data->page_count) {
-        switch_info->type = FEATURES_SWITCH_TYPE_UNUSED;
-    } else {
-        features_page_raw_t *page_raw;
-        features_page_t page;
-        features_block_t block;
-        features_err_t rc;
-
-        page_raw = data->pages + (switch_id.page_number - data->page_offset);
-        
-        rc = features_page(&page, page_raw);
+    if (switch_properties & FEATURES_SWITCH_PROPERTY_DEPRECATED) {
+        return FEATURES_ERR_DEPRECATED;
+    }
 
-        if (FEATURES_OK != rc) {
-            return rc;
-        }
+    return FEATURES_OK;
+}
 
-        rc = features_block(&block, page, switch_id.block_number);
+features_err_t
+features_switch_read(
+        features_switch_value_t *value,
+        const features_switch_info_t *switch_info) {
+    features_err_t rc;
 
-        if (FEATURES_OK != rc) {
-            return rc;
-        }
+    value->type = switch_info->type;
 
-        switch (block->type) {
-            case FEATURES_SWITCH_TYPE_UNUSED:
-            case FEATURES_SWITCH_TYPE_DEPRECATED:
-            case FEATURES_SWITCH_TYPE_INVALID:
-                switch_info->type = block->type;
-                break;
-            case FEATURES_SWITCH_TYPE_FLAG:
-                if (switch_info.switch_number > FEATURES_FLAGS_PER_BLOCK) {
-                    switch_info->type = FEATURES_SWITCH_TYPE_INVALID;
-                } else {
-                    uint8_t switch_offset = switch_info.switch_number / 8;
-                    switch_info->data = block->data.p8 + switch_offset;
-                }
-                break;
-            case FEATURES_SWITCH_TYPE_UINT8:
-            case FEATURES_SWITCH_TYPE_INT8:
-                if (switch_info.switch_number > FEATURES_UINT8_PER_BLOCK) {
-                    switch_info->type = FEATURES_SWITCH_TYPE_INVALID;
-                } else {
-                    switch_info->data = block->data.p8 + switch_info.switch_number;
-                }
-                break;
-            case FEATURES_SWITCH_TYPE_UINT16:
-            case FEATURES_SWITCH_TYPE_INT16:
-                if (switch_info.switch_number > FEATURES_UINT16_PER_BLOCK) {
-                    switch_info->type = FEATURES_SWITCH_TYPE_INVALID;
-                } else {
-                    switch_info->data = block->data.p16 + switch_info.switch_number;
-                }
-                break;
-            case FEATURES_SWITCH_TYPE_UINT32:
-            case FEATURES_SWITCH_TYPE_INT32:
-                if (switch_info.switch_number > FEATURES_UINT32_PER_BLOCK) {
-                    switch_info->type = FEATURES_SWITCH_TYPE_INVALID;
-                } else {
-                    switch_info->data = block->data.p32 + switch_info.switch_number;
-                }
-                break;
-            case FEATURES_SWITCH_TYPE_UINT64:
-            case FEATURES_SWITCH_TYPE_INT64:
-                if (switch_info.switch_number > FEATURES_UINT64_PER_BLOCK) {
-                    switch_info->type = FEATURES_SWITCH_TYPE_INVALID;
-                } else {
-                    switch_info->data = block->data.p64 + switch_info.switch_number;
-                }
-                break;
-            default:
-                switch_info->type = FEATURE_SWITCH_TYPE_INVALID;
-        }
+    rc = features_switch_status(switch_info);
+
+    if (FEATURES_OK != rc) {
+        return rc;
+    }
+
+    switch (switch_info->type) {
+        case FEATURES_SWITCH_TYPE_FLAG:
+            memcpy(&value->value.flag, switch_info->data, 1);
+            value->value.flag &= (1 << (switch_info->switch_number % 8));
+            break;
+        case FEATURES_SWITCH_TYPE_UINT8:
+            memcpy(&value->value.uint8, switch_info->data, 1);
+            break;
+        case FEATURES_SWITCH_TYPE_UINT16:
+            value->value.uint16 = features_load_uint16(switch_info->data, switch_info->flags);
+            break;
+        case FEATURES_SWITCH_TYPE_UINT32:
+            value->value.uint32 = features_load_uint32(switch_info->data, switch_info->flags);
+            break;
+        case FEATURES_SWITCH_TYPE_UINT64:
+            value->value.uint64 = features_load_uint64(switch_info->data, switch_info->flags);
+            break;
+        case FEATURES_SWITCH_TYPE_INT8:
+            memcpy(&value->value.int8, switch_info->data, 1);
+            break;
+        case FEATURES_SWITCH_TYPE_INT16:
+            value->value.int16 = features_load_int16(switch_info->data, switch_info->flags);
+            break;
+        case FEATURES_SWITCH_TYPE_INT32:
+            value->value.int32 = features_load_int32(switch_info->data, switch_info->flags);
+            break;
+        case FEATURES_SWITCH_TYPE_INT64:
+            value->value.int64 = features_load_int64(switch_info->data, switch_info->flags);
+            break;
+        default:
+            return FEATURES_ERR_INVALID;
     }
 
     return FEATURES_OK;
 }
+
+uint8_t
+features_block_capacity(features_switch_type_t type) {
+    switch (type) {
+        case FEATURES_SWITCH_TYPE_FLAG:
+            return FEATURES_FLAGS_PER_BLOCK;
+        case FEATURES_SWITCH_TYPE_UINT8:
+        case FEATURES_SWITCH_TYPE_INT8:
+            return FEATURES_UINT8_PER_BLOCK;
+        case FEATURES_SWITCH_TYPE_UINT16:
+        case FEATURES_SWITCH_TYPE_INT16:
+            return FEATURES_UINT16_PER_BLOCK;
+        case FEATURES_SWITCH_TYPE_UINT32:
+        case FEATURES_SWITCH_TYPE_INT32:
+            return FEATURES_UINT32_PER_BLOCK;
+        case FEATURES_SWITCH_TYPE_UINT64:
+        case FEATURES_SWITCH_TYPE_INT64:
+            return FEATURES_UINT64_PER_BLOCK;
+        default:
+            return 0;
+    }
+}
+
+uint8_t
+features_block_properties_size(features_switch_type_t type) {
+    switch (type) {
+        case FEATURES_SWITCH_TYPE_FLAG:
+            return FEATURES_FLAG_PROPERTIES_SIZE;
+        case FEATURES_SWITCH_TYPE_UINT8:
+        case FEATURES_SWITCH_TYPE_INT8:
+            return FEATURES_UINT8_PROPERTIES_SIZE;
+        case FEATURES_SWITCH_TYPE_UINT16:
+        case FEATURES_SWITCH_TYPE_INT16:
+            return FEATURES_UINT16_PROPERTIES_SIZE;
+        case FEATURES_SWITCH_TYPE_UINT32:
+        case FEATURES_SWITCH_TYPE_INT32:
+            return FEATURES_UINT32_PROPERTIES_SIZE;
+        case FEATURES_SWITCH_TYPE_UINT64:
+        case FEATURES_SWITCH_TYPE_INT64:
+            return FEATURES_UINT64_PROPERTIES_SIZE;
+        default:
+            return 0;
+    }
+}
+
+uint8_t
+features_block_width(features_switch_type_t type) {
+    switch (type) {
+        case FEATURES_SWITCH_TYPE_UINT8:
+        case FEATURES_SWITCH_TYPE_INT8:
+            return 1;
+        case FEATURES_SWITCH_TYPE_UINT16:
+        case FEATURES_SWITCH_TYPE_INT16:
+            return 2;
+        case FEATURES_SWITCH_TYPE_UINT32:
+        case FEATURES_SWITCH_TYPE_INT32:
+            return 4;
+        case FEATURES_SWITCH_TYPE_UINT64:
+        case FEATURES_SWITCH_TYPE_INT64:
+            return 8;
+        default:
+            // Flags are packed 8 to a byte
+            return 0;
+    }
+}
+
+static features_err_t
+features_switch_lookup(
+        const features_data_t *data,
+        features_switch_number_t switch_number,
+        features_switch_value_t *value) {
+    features_switch_info_t switch_info;
+    features_err_t rc;
+
+    rc = features_switch_info(&switch_info, data, switch_number);
+
+    if (FEATURES_OK != rc) {
+        return rc;
+    }
+
+    return features_switch_read(value, &switch_info);
+}
@@ -7,6 +7,10 @@
 
 #include "config.h"
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 enum {
     FEATURES_PAGE_SIZE = 4096,
     FEATURES_BLOCK_SIZE = 64,
@@ -24,7 +28,7 @@ enum {
     FEATURES_INT8_PER_BLOCK = FEATURES_UINT8_PER_BLOCK,
     FEATURES_INT16_PER_BLOCK = FEATURES_UINT16_PER_BLOCK,
     FEATURES_INT32_PER_BLOCK = FEATURES_UINT32_PER_BLOCK,
-    FEATURES_INT64_PER_BLOCK = FEATURES_UINT64_PER_BLOCK
+    FEATURES_INT64_PER_BLOCK = FEATURES_UINT64_PER_BLOCK,
 
     FEATURES_FLAG_PROPERTIES_SIZE = (FEATURES_FLAGS_PER_BLOCK * 2 - 1) / 8 + 1,
     FEATURES_UINT8_PROPERTIES_SIZE = (FEATURES_UINT8_PER_BLOCK * 2 - 1) / 8 + 1,
@@ -44,7 +48,9 @@ typedef enum features_err_t {
     FEATURES_ERR_INVALID,
     FEATURES_ERR_UNUSED,
     FEATURES_ERR_DEPRECATED,
-    FEATURES_ERR_INCORRECT_TYPE
+    FEATURES_ERR_INCORRECT_TYPE,
+    FEATURES_ERR_IO,
+    FEATURES_ERR_NOMEM
 } features_err_t;
 
 typedef enum features_switch_type_t {
@@ -58,10 +64,27 @@ typedef enum features_switch_type_t {
     FEATURES_SWITCH_TYPE_INT8 = 0x7,
     FEATURES_SWITCH_TYPE_INT16 = 0x8,
     FEATURES_SWITCH_TYPE_INT32 = 0x9,
-    FEATURES_SWITCH_TYPE_INT64 = 0xa
+    FEATURES_SWITCH_TYPE_INT64 = 0xa,
     FEATURES_SWITCH_TYPE_INVALID = 0xf
 } features_switch_type_t;
 
+enum {
+    // Switch data in the blocks is little endian instead of big endian,
+    // the page header fields are always big endian
+    FEATURES_PAGE_FLAG_LITTLE_ENDIAN = 0x1,
+    // Only pages holding switches are stored, followed by a
+    // features_page_directory_t entry per 64 page numbers of the span
+    FEATURES_PAGE_FLAG_SPARSE = 0x2,
+    // Every page header holds the CRC32C of its page, see checksum.h
+    FEATURES_PAGE_FLAG_CHECKSUM = 0x4
+};
+
+// Each switch has 2 property bits at the start of its block
+enum {
+    FEATURES_SWITCH_PROPERTY_USED = 0x1,
+    FEATURES_SWITCH_PROPERTY_DEPRECATED = 0x2
+};
+
 typedef uint64_t features_block_number_t;
 typedef uint32_t features_block_offset_t;
 typedef uint64_t features_switch_number_t;
@@ -109,10 +132,14 @@ typedef struct features_page_header_block_info_t {
 
 // Page header is a 64 byte value
 typedef struct features_page_header_t {
-    char *MAGIC[8];
+    char MAGIC[8];
     uint32_t page_number; // stored in big_endian
     uint32_t page_count; // stored in big_endian
-    uint8_t unused[16];
+    uint8_t flags; // FEATURES_PAGE_FLAG_*
+    uint8_t reserved[3];
+    uint32_t page_span; // stored in big_endian, sparse files only
+    uint32_t checksum; // stored in big_endian
+    uint8_t unused[4];
     features_page_header_block_info_t block_info;
 } features_page_header_t;
 
@@ -121,25 +148,82 @@ typedef struct features_page_raw_t {
     features_block_raw_t blocks[FEATURES_BLOCKS_PER_PAGE-1];
 } features_page_raw_t;
 
+// Directory entry of a sparse file, stored big endian. Bit i of present
+// is set when page number page_offset + 64 * entry + i is stored, rank
+// is the number of pages stored for the entries before.
+typedef struct features_page_directory_t {
+    uint64_t present;
+    uint64_t rank;
+} features_page_directory_t;
+
 typedef struct features_page_t {
     uint32_t page_number;
     features_block_raw_t *blocks;
 } features_page_t;
 
+// Decoded type and location of one block, see features_data_index()
+typedef struct features_index_entry_t {
+    uint8_t *switch_properties;
+    uint8_t type;
+    // The switch data starts data_offset bytes after the properties
+    uint8_t data_offset;
+    uint8_t padding[6];
+} features_index_entry_t;
+
+typedef struct features_stats_t features_stats_t;
+
 typedef struct features_data_t {
     uint64_t page_count;
     uint64_t page_offset;
+    // Page numbers covered from page_offset, page_count unless sparse
+    uint64_t page_span;
     features_page_raw_t *pages;
+    // Sparse files only, one entry per 64 page numbers of the span
+    features_page_directory_t *directory;
+    // FEATURES_PAGE_FLAG_* of the first page, shared by all pages
+    uint8_t flags;
+    // Optional, one entry per block of every page
+    features_index_entry_t *index;
+    // Optional, counts the lookups through this data, see stats.h
+    features_stats_t *stats;
 } features_data_t;
 
 features_switch_id_t
 features_switch_id(features_switch_number_t switch_number);
 
+// Lower case name of the type such as "uint16", "invalid" for unknown types
+const char *
+features_switch_type_name(features_switch_type_t type);
+
+// Lower case description of rc such as "unused"
+const char *
+features_err_name(features_err_t rc);
+
 features_err_t
 features_data(
         features_data_t *data,
         void *raw);
 
+// Builds a directory of decoded blocks for data so that lookups index
+// a single array instead of parsing the page header and block types.
+// The directory costs 1KiB per 4KiB page, 16 bytes per block, and is
+// freed by features_data_index_free().
+features_err_t
+features_data_index(features_data_t *data);
+
+// Bytes of the file data was loaded from, the pages and the directory
+uint64_t
+features_data_size(const features_data_t *data);
+
+// The stored page with page_number, NULL when the file does not hold it
+features_page_raw_t *
+features_data_page(
+        const features_data_t *data,
+        uint64_t page_number);
+
+void
+features_data_index_free(features_data_t *data);
+
 features_err_t
 features_page(
         features_page_t *page,
@@ -211,4 +295,8 @@ features_switch_int64_value(
         features_switch_number_t switch_number,
         int64_t *val);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif
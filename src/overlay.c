@@ -0,0 +1,207 @@
+#include "overlay.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "internal.h"
+
+enum {
+    FEATURES_OVERLAY_MAX_LAYERS = UINT8_MAX
+};
+
+static int
+features_overlay_present(
+        const features_block_t *block,
+        uint64_t *present);
+
+static features_overlay_block_t *
+features_overlay_find(
+        const features_overlay_t *overlay,
+        uint64_t block_number);
+
+static uint64_t
+features_overlay_hash(uint64_t block_number);
+
+features_err_t
+features_overlay_init(
+        features_overlay_t *overlay,
+        const features_data_t *base,
+        const features_data_t *layers,
+        size_t layer_count) {
+    uint64_t present[FEATURES_MAX_SWITCHES_PER_BLOCK / 64];
+    features_overlay_block_t *entry;
+    features_block_t block;
+    features_page_t page;
+    features_err_t rc;
+    uint64_t block_number;
+    uint64_t page_index;
+    size_t touched;
+    size_t layer;
+    size_t i;
+    int pass;
+    int b;
+    int s;
+
+    memset(overlay, 0, sizeof(features_overlay_t));
+    overlay->base = base;
+    overlay->layers = layers;
+    overlay->layer_count = layer_count;
+
+    if (layer_count > FEATURES_OVERLAY_MAX_LAYERS) {
+        return FEATURES_ERR_INVALID;
+    }
+
+    touched = 0;
+
+    // Counts the touched blocks, then fills a table at most half full
+    for (pass = 0; pass < 2; ++pass) {
+        if (1 == pass) {
+            overlay->block_capacity = 1;
+
+            while (overlay->block_capacity < touched * 2) {
+                overlay->block_capacity <<= 1;
+            }
+
+            overlay->blocks = malloc(overlay->block_capacity * sizeof(features_overlay_block_t));
+
+            if (NULL == overlay->blocks) {
+                return FEATURES_ERR_NOMEM;
+            }
+
+            for (i = 0; i < overlay->block_capacity; ++i) {
+                overlay->blocks[i].block_number = UINT64_MAX;
+            }
+        }
+
+        for (layer = 0; layer < layer_count; ++layer) {
+            for (page_index = 0; page_index < layers[layer].page_count; ++page_index) {
+                rc = features_page(&page, layers[layer].pages + page_index);
+
+                if (FEATURES_OK != rc) {
+                    features_overlay_free(overlay);
+                    return rc;
+                }
+
+                for (b = 1; b < FEATURES_BLOCKS_PER_PAGE; ++b) {
+                    if (FEATURES_OK != features_block(&block, &page, b)
+                            || !features_overlay_present(&block, present)) {
+                        continue;
+                    }
+
+                    if (0 == pass) {
+                        ++touched;
+                        continue;
+                    }
+
+                    block_number = (uint64_t)page.page_number * FEATURES_BLOCKS_PER_PAGE + b;
+                    entry = features_overlay_find(overlay, block_number);
+
+                    if (UINT64_MAX == entry->block_number) {
+                        memset(entry, 0, sizeof(features_overlay_block_t));
+                        entry->block_number = block_number;
+                    }
+
+                    for (s = 0; s < FEATURES_MAX_SWITCHES_PER_BLOCK; ++s) {
+                        if (present[s / 64] & ((uint64_t)1 << (s % 64))) {
+                            entry->present[s / 64] |= (uint64_t)1 << (s % 64);
+                            entry->layer[s] = (uint8_t)layer;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    return FEATURES_OK;
+}
+
+void
+features_overlay_free(features_overlay_t *overlay) {
+    free(overlay->blocks);
+    overlay->blocks = NULL;
+    overlay->block_capacity = 0;
+}
+
+features_err_t
+features_overlay_switch_value(
+        const features_overlay_t *overlay,
+        features_switch_number_t switch_number,
+        features_switch_value_t *value) {
+    const features_overlay_block_t *entry;
+    uint8_t slot;
+
+    entry = features_overlay_find(overlay, switch_number / FEATURES_MAX_SWITCHES_PER_BLOCK);
+    slot = switch_number % FEATURES_MAX_SWITCHES_PER_BLOCK;
+
+    if (UINT64_MAX != entry->block_number
+            && (entry->present[slot / 64] & ((uint64_t)1 << (slot % 64)))) {
+        return features_switch_value(&overlay->layers[entry->layer[slot]], switch_number, value);
+    }
+
+    return features_switch_value(overlay->base, switch_number, value);
+}
+
+// Sets the slots a layer answers for, used switches and every slot of
+// a deprecated block, and returns whether there are any
+static int
+features_overlay_present(
+        const features_block_t *block,
+        uint64_t *present) {
+    uint8_t capacity;
+    uint8_t properties;
+    int any;
+    int s;
+
+    memset(present, 0, FEATURES_MAX_SWITCHES_PER_BLOCK / 8);
+
+    if (FEATURES_SWITCH_TYPE_DEPRECATED == block->type) {
+        memset(present, 0xff, FEATURES_MAX_SWITCHES_PER_BLOCK / 8);
+        return 1;
+    }
+
+    capacity = features_block_capacity(block->type);
+    any = 0;
+
+    for (s = 0; s < capacity; ++s) {
+        properties = block->switch_properties[s / 4] >> ((s % 4) * 2);
+
+        if (properties & FEATURES_SWITCH_PROPERTY_USED) {
+            present[s / 64] |= (uint64_t)1 << (s % 64);
+            any = 1;
+        }
+    }
+
+    return any;
+}
+
+// The entry of block_number or the free entry where it would go. The
+// table always has a free entry, so probing ends.
+static features_overlay_block_t *
+features_overlay_find(
+        const features_overlay_t *overlay,
+        uint64_t block_number) {
+    static features_overlay_block_t empty = {UINT64_MAX, {0}, {0}};
+    features_overlay_block_t *entry;
+    size_t mask;
+    size_t i;
+
+    if (0 == overlay->block_capacity) {
+        return &empty;
+    }
+
+    mask = overlay->block_capacity - 1;
+
+    for (i = features_overlay_hash(block_number) & mask; ; i = (i + 1) & mask) {
+        entry = &overlay->blocks[i];
+
+        if (entry->block_number == block_number || UINT64_MAX == entry->block_number) {
+            return entry;
+        }
+    }
+}
+
+static uint64_t
+features_overlay_hash(uint64_t block_number) {
+    block_number *= UINT64_C(0x9e3779b97f4a7c15);
+    return block_number ^ (block_number >> 32);
+}
@@ -0,0 +1,62 @@
+#ifndef FEATURES_OVERLAY_H
+#define FEATURES_OVERLAY_H
+
+#include <stddef.h>
+
+#include "memory.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Slots of one block answered by an override layer
+typedef struct features_overlay_block_t {
+    // Switch number / FEATURES_MAX_SWITCHES_PER_BLOCK, UINT64_MAX while
+    // the entry is free
+    uint64_t block_number;
+    uint64_t present[FEATURES_MAX_SWITCHES_PER_BLOCK / 64];
+    // The topmost layer holding each present slot
+    uint8_t layer[FEATURES_MAX_SWITCHES_PER_BLOCK];
+} features_overlay_block_t;
+
+// Override layers stacked over a shared base. A switch is answered by
+// the topmost layer where it is used or its block is deprecated, and
+// by the base otherwise. Which layer answers is decided by one lookup
+// in a table of the blocks the layers touch, built once, so an overlay
+// costs memory in proportion to its overrides rather than the base.
+// Layers are usually small sparse files built with only the overridden
+// switches.
+typedef struct features_overlay_t {
+    const features_data_t *base;
+    const features_data_t *layers;
+    size_t layer_count;
+
+    // Open addressed, a power of 2 entries
+    features_overlay_block_t *blocks;
+    size_t block_capacity;
+} features_overlay_t;
+
+// Stacks layer_count layers, the last on top, over base. The base and
+// the layers are not copied and must outlive the overlay.
+features_err_t
+features_overlay_init(
+        features_overlay_t *overlay,
+        const features_data_t *base,
+        const features_data_t *layers,
+        size_t layer_count);
+
+void
+features_overlay_free(features_overlay_t *overlay);
+
+// features_switch_value() of the layer answering the switch
+features_err_t
+features_overlay_switch_value(
+        const features_overlay_t *overlay,
+        features_switch_number_t switch_number,
+        features_switch_value_t *value);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,291 @@
+// sched_getcpu()
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "replica.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "file.h"
+
+#ifdef HAVE_LIBNUMA
+#include <numa.h>
+#endif
+
+typedef struct features_replica_snapshot_t {
+    features_snapshot_t snapshot;
+    // One per node
+    features_data_t *replicas;
+    // Per node, NULL for nodes without memory that read another copy
+    void **copies;
+    unsigned node_count;
+    size_t size;
+    // Copies were allocated with libnuma
+    int numa;
+} features_replica_snapshot_t;
+
+static pthread_once_t features_numa_once = PTHREAD_ONCE_INIT;
+// Node of every CPU, NULL on a single node
+static unsigned *features_numa_cpu_node;
+static unsigned features_numa_cpu_count;
+static unsigned features_numa_node_count = 1;
+
+static void
+features_numa_init(void);
+
+static int
+features_numa_has_memory(unsigned node);
+
+static void *
+features_replica_alloc(
+        size_t size,
+        unsigned node,
+        int numa);
+
+static void
+features_replica_free(
+        void *copy,
+        size_t size,
+        int numa);
+
+static void
+features_replica_snapshot_release(features_snapshot_t *snapshot);
+
+features_err_t
+features_snapshot_replicate(
+        features_snapshot_t **snapshot,
+        const features_data_t *data) {
+    features_replica_snapshot_t *replica;
+    features_err_t rc;
+    uint64_t size;
+    unsigned shared;
+    unsigned node;
+
+    size = features_data_size(data);
+
+    if (size != (size_t)size) {
+        return FEATURES_ERR_NOMEM;
+    }
+
+    pthread_once(&features_numa_once, features_numa_init);
+
+    replica = calloc(1, sizeof(features_replica_snapshot_t));
+
+    if (NULL == replica) {
+        return FEATURES_ERR_NOMEM;
+    }
+
+    features_snapshot_init(&replica->snapshot, features_replica_snapshot_release);
+    replica->node_count = features_numa_node_count;
+    replica->size = (size_t)size;
+    replica->numa = features_numa_node_count > 1;
+    replica->replicas = calloc(replica->node_count, sizeof(features_data_t));
+    replica->copies = calloc(replica->node_count, sizeof(void *));
+
+    if (NULL == replica->replicas || NULL == replica->copies) {
+        features_replica_snapshot_release(&replica->snapshot);
+        return FEATURES_ERR_NOMEM;
+    }
+
+    shared = replica->node_count;
+
+    for (node = 0; node < replica->node_count; ++node) {
+        if (!features_numa_has_memory(node)) {
+            continue;
+        }
+
+        replica->copies[node] = features_replica_alloc(replica->size, node, replica->numa);
+
+        if (NULL == replica->copies[node]) {
+            features_replica_snapshot_release(&replica->snapshot);
+            return FEATURES_ERR_NOMEM;
+        }
+
+        // Written from here, but the pages are bound to the node
+        memcpy(replica->copies[node], data->pages, replica->size);
+
+        rc = features_data(&replica->replicas[node], replica->copies[node]);
+
+        if (FEATURES_OK != rc) {
+            features_replica_snapshot_release(&replica->snapshot);
+            return rc;
+        }
+
+        replica->replicas[node].stats = data->stats;
+
+        if (shared == replica->node_count) {
+            shared = node;
+        }
+    }
+
+    if (shared == replica->node_count) {
+        features_replica_snapshot_release(&replica->snapshot);
+        return FEATURES_ERR_NOMEM;
+    }
+
+    // Nodes without memory read the first copy
+    for (node = 0; node < replica->node_count; ++node) {
+        if (NULL == replica->copies[node]) {
+            replica->replicas[node] = replica->replicas[shared];
+        }
+    }
+
+    replica->snapshot.data = replica->replicas[shared];
+
+    if (replica->numa) {
+        replica->snapshot.replicas = replica->replicas;
+        replica->snapshot.replica_count = replica->node_count;
+    }
+
+    *snapshot = &replica->snapshot;
+    return FEATURES_OK;
+}
+
+features_err_t
+features_snapshot_open_replicated(
+        features_snapshot_t **snapshot,
+        const char *path) {
+    features_file_t file;
+    features_err_t rc;
+
+    rc = features_open(&file, path);
+
+    if (FEATURES_OK != rc) {
+        return rc;
+    }
+
+    rc = features_snapshot_replicate(snapshot, &file.data);
+    features_close(&file);
+
+    return rc;
+}
+
+unsigned
+features_numa_node(void) {
+    int cpu;
+
+    pthread_once(&features_numa_once, features_numa_init);
+
+    if (NULL == features_numa_cpu_node) {
+        return 0;
+    }
+
+    cpu = sched_getcpu();
+
+    if (cpu < 0 || (unsigned)cpu >= features_numa_cpu_count) {
+        return 0;
+    }
+
+    return features_numa_cpu_node[cpu];
+}
+
+static void
+features_numa_init(void) {
+#ifdef HAVE_LIBNUMA
+    unsigned *cpu_node;
+    int cpu_count;
+    int node;
+    int cpu;
+
+    if (numa_available() < 0 || numa_max_node() < 1) {
+        return;
+    }
+
+    cpu_count = numa_num_configured_cpus();
+
+    if (cpu_count <= 0) {
+        return;
+    }
+
+    cpu_node = malloc((size_t)cpu_count * sizeof(unsigned));
+
+    if (NULL == cpu_node) {
+        return;
+    }
+
+    for (cpu = 0; cpu < cpu_count; ++cpu) {
+        node = numa_node_of_cpu(cpu);
+        cpu_node[cpu] = node < 0 ? 0 : (unsigned)node;
+    }
+
+    features_numa_cpu_node = cpu_node;
+    features_numa_cpu_count = (unsigned)cpu_count;
+    features_numa_node_count = (unsigned)numa_max_node() + 1;
+#endif
+}
+
+static int
+features_numa_has_memory(unsigned node) {
+#ifdef HAVE_LIBNUMA
+    if (features_numa_node_count > 1) {
+        return numa_bitmask_isbitset(numa_all_nodes_ptr, node);
+    }
+#endif
+
+    return 0 == node;
+}
+
+static void *
+features_replica_alloc(
+        size_t size,
+        unsigned node,
+        int numa) {
+    void *copy;
+
+#ifdef HAVE_LIBNUMA
+    if (numa) {
+        return numa_alloc_onnode(size, (int)node);
+    }
+#else
+    (void)node;
+    (void)numa;
+#endif
+
+    if (0 != posix_memalign(&copy, FEATURES_PAGE_SIZE, size)) {
+        return NULL;
+    }
+
+    return copy;
+}
+
+static void
+features_replica_free(
+        void *copy,
+        size_t size,
+        int numa) {
+#ifdef HAVE_LIBNUMA
+    if (numa) {
+        numa_free(copy, size);
+        return;
+    }
+#else
+    (void)size;
+    (void)numa;
+#endif
+
+    free(copy);
+}
+
+static void
+features_replica_snapshot_release(features_snapshot_t *snapshot) {
+    features_replica_snapshot_t *replica;
+    unsigned node;
+
+    replica = (features_replica_snapshot_t *)snapshot;
+
+    if (NULL != replica->copies) {
+        for (node = 0; node < replica->node_count; ++node) {
+            if (NULL != replica->copies[node]) {
+                features_replica_free(replica->copies[node], replica->size, replica->numa);
+            }
+        }
+    }
+
+    free(replica->copies);
+    free(replica->replicas);
+    free(replica);
+}
@@ -0,0 +1,53 @@
+#ifndef FEATURES_REPLICA_H
+#define FEATURES_REPLICA_H
+
+#include "memory.h"
+#include "snapshot.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Snapshots holding one copy of the pages per NUMA node, so lookups from
+// every socket read local memory. Copies are placed with libnuma when it
+// is built in and the system has more than one node, otherwise a
+// replicated snapshot holds a single copy. A replicated snapshot is
+// published like any other, so a reload swaps every copy at once.
+
+// Copies the pages and directory of data onto every node. The index of
+// data is not copied, the stats of data are shared by the copies.
+features_err_t
+features_snapshot_replicate(
+        features_snapshot_t **snapshot,
+        const features_data_t *data);
+
+// features_snapshot_open() followed by features_snapshot_replicate(),
+// the file is closed once copied
+features_err_t
+features_snapshot_open_replicated(
+        features_snapshot_t **snapshot,
+        const char *path);
+
+// NUMA node of the CPU the calling thread runs on, 0 without NUMA
+unsigned
+features_numa_node(void);
+
+// The copy of the snapshot data local to the calling thread
+static inline const features_data_t *
+features_snapshot_local_data(const features_snapshot_t *snapshot) {
+    unsigned node;
+
+    if (NULL == snapshot->replicas) {
+        return &snapshot->data;
+    }
+
+    node = features_numa_node();
+
+    return &snapshot->replicas[node < snapshot->replica_count ? node : 0];
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
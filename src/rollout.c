@@ -0,0 +1,190 @@
+#include "rollout.h"
+
+#include <pthread.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define FEATURES_ROLLOUT_X86 1
+#include <immintrin.h>
+#endif
+
+// Sets bit i of the result when entity_ids[i] is in, for up to 64 entities
+typedef uint64_t (*features_rollout_word_fn)(
+        uint64_t seed,
+        uint64_t threshold,
+        const uint64_t *entity_ids,
+        size_t count);
+
+static uint64_t
+features_rollout_word(
+        uint64_t seed,
+        uint64_t threshold,
+        const uint64_t *entity_ids,
+        size_t count);
+
+static features_rollout_word_fn
+features_rollout_select(void);
+
+static void
+features_rollout_init(void);
+
+#ifdef FEATURES_ROLLOUT_X86
+static uint64_t
+features_rollout_word_avx2(
+        uint64_t seed,
+        uint64_t threshold,
+        const uint64_t *entity_ids,
+        size_t count);
+#endif
+
+// Chosen once for the CPU, by features_rollout_init()
+static features_rollout_word_fn features_rollout_impl;
+
+static pthread_once_t features_rollout_once = PTHREAD_ONCE_INIT;
+
+features_err_t
+features_rollout(
+        const features_data_t *data,
+        features_switch_number_t switch_number,
+        const uint64_t *entity_ids,
+        size_t count,
+        uint64_t *in) {
+    features_rollout_word_fn word_fn;
+    features_err_t rc;
+    uint64_t threshold;
+    uint64_t seed;
+    uint16_t basis_points;
+    size_t i;
+
+    memset(in, 0, (count + 63) / 64 * sizeof(uint64_t));
+
+    rc = features_switch_uint16_value(data, switch_number, &basis_points);
+
+    if (FEATURES_OK != rc) {
+        return rc;
+    }
+
+    if (0 == basis_points) {
+        return FEATURES_OK;
+    }
+
+    word_fn = features_rollout_select();
+    seed = features_rollout_seed(switch_number);
+    // Compared against the scaled high half of the hash directly, which
+    // is the bucket comparison without the multiply
+    threshold = basis_points >= FEATURES_ROLLOUT_SCALE
+        ? UINT64_MAX
+        : (uint64_t)basis_points << 32;
+
+    for (i = 0; i < count; i += 64) {
+        in[i / 64] = word_fn(seed, threshold, entity_ids + i,
+                count - i < 64 ? count - i : 64);
+    }
+
+    return FEATURES_OK;
+}
+
+// The portable version, one entity at a time without branches
+static uint64_t
+features_rollout_word(
+        uint64_t seed,
+        uint64_t threshold,
+        const uint64_t *entity_ids,
+        size_t count) {
+    uint64_t word;
+    uint64_t h;
+    size_t i;
+
+    word = 0;
+
+    for (i = 0; i < count; ++i) {
+        h = features_hash_mix(entity_ids[i] ^ seed);
+        word |= (uint64_t)((h >> 32) * FEATURES_ROLLOUT_SCALE < threshold) << i;
+    }
+
+    return word;
+}
+
+static features_rollout_word_fn
+features_rollout_select(void) {
+    pthread_once(&features_rollout_once, features_rollout_init);
+    return features_rollout_impl;
+}
+
+static void
+features_rollout_init(void) {
+#ifdef FEATURES_ROLLOUT_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2")) {
+        features_rollout_impl = features_rollout_word_avx2;
+        return;
+    }
+#endif
+
+    features_rollout_impl = features_rollout_word;
+}
+
+#ifdef FEATURES_ROLLOUT_X86
+// Low 64 bits of every lane of a times the lanes of b, whose high halves
+// are in b_high. AVX2 only multiplies 32 bit halves, and the product of
+// the two high halves falls out of the low 64 bits.
+__attribute__((target("avx2")))
+static inline __m256i
+features_rollout_mul64_avx2(__m256i a, __m256i b, __m256i b_high) {
+    __m256i cross;
+
+    cross = _mm256_add_epi64(
+            _mm256_mul_epu32(_mm256_srli_epi64(a, 32), b),
+            _mm256_mul_epu32(a, b_high));
+
+    return _mm256_add_epi64(_mm256_mul_epu32(a, b), _mm256_slli_epi64(cross, 32));
+}
+
+// features_hash_mix() of 4 entities per step
+__attribute__((target("avx2")))
+static uint64_t
+features_rollout_word_avx2(
+        uint64_t seed,
+        uint64_t threshold,
+        const uint64_t *entity_ids,
+        size_t count) {
+    const __m256i sign = _mm256_set1_epi64x((long long)UINT64_C(0x8000000000000000));
+    const __m256i m1 = _mm256_set1_epi64x((long long)UINT64_C(0xff51afd7ed558ccd));
+    const __m256i m1_high = _mm256_srli_epi64(m1, 32);
+    const __m256i m2 = _mm256_set1_epi64x((long long)UINT64_C(0xc4ceb9fe1a85ec53));
+    const __m256i m2_high = _mm256_srli_epi64(m2, 32);
+    const __m256i scale = _mm256_set1_epi64x(FEATURES_ROLLOUT_SCALE);
+    __m256i limit;
+    __m256i seeds;
+    __m256i h;
+    uint64_t word;
+    size_t i;
+
+    seeds = _mm256_set1_epi64x((long long)seed);
+    // Unsigned compares as signed ones with the sign bits flipped
+    limit = _mm256_xor_si256(_mm256_set1_epi64x((long long)threshold), sign);
+    word = 0;
+
+    for (i = 0; i + 4 <= count; i += 4) {
+        h = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(entity_ids + i)), seeds);
+        h = _mm256_xor_si256(h, _mm256_srli_epi64(h, 33));
+        h = features_rollout_mul64_avx2(h, m1, m1_high);
+        h = _mm256_xor_si256(h, _mm256_srli_epi64(h, 33));
+        h = features_rollout_mul64_avx2(h, m2, m2_high);
+        h = _mm256_xor_si256(h, _mm256_srli_epi64(h, 33));
+
+        // The high half times the scale fits the 32 bit multiply
+        h = _mm256_mul_epu32(_mm256_srli_epi64(h, 32), scale);
+        h = _mm256_cmpgt_epi64(limit, _mm256_xor_si256(h, sign));
+
+        word |= (uint64_t)_mm256_movemask_pd(_mm256_castsi256_pd(h)) << i;
+    }
+
+    if (i < count) {
+        word |= features_rollout_word(seed, threshold, entity_ids + i, count - i) << i;
+    }
+
+    return word;
+}
+#endif
@@ -0,0 +1,62 @@
+#ifndef FEATURES_ROLLOUT_H
+#define FEATURES_ROLLOUT_H
+
+#include <stddef.h>
+
+#include "hash.h"
+#include "memory.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Percentage rollouts held in uint16 switches as basis points. Every
+// entity gets a bucket in [0, FEATURES_ROLLOUT_SCALE) per rollout
+// switch and is in the rollout while its bucket is below the switch
+// value, so raising the value only ever adds entities. Values of
+// FEATURES_ROLLOUT_SCALE and above put every entity in.
+//
+// The bucket is fixed by the switch number and entity id alone, so
+// every service, host and release agrees on it. It is
+//
+//     h = fmix64(entity_id ^ fmix64(switch_number + 0x9e3779b97f4a7c15))
+//     bucket = ((h >> 32) * 10000) >> 32
+//
+// with fmix64 the MurmurHash3 64 bit finalizer, features_hash_mix().
+
+enum {
+    FEATURES_ROLLOUT_SCALE = 10000
+};
+
+static inline uint64_t
+features_rollout_seed(features_switch_number_t switch_number) {
+    return features_hash_mix(switch_number + UINT64_C(0x9e3779b97f4a7c15));
+}
+
+static inline uint32_t
+features_rollout_bucket(
+        features_switch_number_t switch_number,
+        uint64_t entity_id) {
+    uint64_t h;
+
+    h = features_hash_mix(entity_id ^ features_rollout_seed(switch_number));
+    return (uint32_t)(((h >> 32) * FEATURES_ROLLOUT_SCALE) >> 32);
+}
+
+// Reads the uint16 rollout switch once and sets bit i of in, word i / 64,
+// when entity_ids[i] is in the rollout. in needs (count + 63) / 64 words.
+// When the switch cannot be read every entity is out and the error of
+// features_switch_uint16_value() is returned.
+features_err_t
+features_rollout(
+        const features_data_t *data,
+        features_switch_number_t switch_number,
+        const uint64_t *entity_ids,
+        size_t count,
+        uint64_t *in);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
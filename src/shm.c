@@ -0,0 +1,382 @@
+#include "shm.h"
+
+#include <fcntl.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "internal.h"
+
+static features_err_t
+features_shm_map(
+        features_shm_t *shm,
+        int fd,
+        size_t size,
+        int writable);
+
+static void
+features_shm_write_begin(features_shm_t *shm);
+
+static void
+features_shm_write_end(features_shm_t *shm);
+
+static features_err_t
+features_shm_read(
+        const features_shm_t *shm,
+        features_switch_number_t switch_number,
+        features_switch_value_t *value);
+
+features_err_t
+features_shm_create(
+        features_shm_t *shm,
+        const char *name,
+        uint64_t capacity) {
+    features_shm_header_t *header;
+    features_err_t rc;
+    struct stat st;
+    uint64_t size;
+    int fd;
+
+    memset(shm, 0, sizeof(features_shm_t));
+
+    capacity = (capacity + FEATURES_PAGE_SIZE - 1) / FEATURES_PAGE_SIZE * FEATURES_PAGE_SIZE;
+
+    fd = shm_open(name, O_RDWR | O_CREAT, 0644);
+
+    if (fd < 0) {
+        return FEATURES_ERR_IO;
+    }
+
+    if (0 != fstat(fd, &st)) {
+        close(fd);
+        return FEATURES_ERR_IO;
+    }
+
+    // Workers of a previous agent may still map the segment, so it
+    // never shrinks under them
+    size = sizeof(features_shm_header_t) + capacity;
+
+    if ((uint64_t)st.st_size > size) {
+        size = (uint64_t)st.st_size;
+    }
+
+    if (size != (size_t)size || 0 != ftruncate(fd, (off_t)size)) {
+        close(fd);
+        return FEATURES_ERR_NOMEM;
+    }
+
+    rc = features_shm_map(shm, fd, (size_t)size, 1);
+    close(fd);
+
+    if (FEATURES_OK != rc) {
+        return rc;
+    }
+
+    header = shm->header;
+
+    // A segment left by a previous agent keeps its sequence so readers
+    // never see it repeat
+    if (0 != memcmp(header->MAGIC, FEATURES_SHM_MAGIC, sizeof(header->MAGIC))) {
+        atomic_init(&header->sequence, 0);
+        atomic_init(&header->size, 0);
+    }
+
+    // An agent that died mid-write leaves the sequence odd. Its data may
+    // be torn, so it is dropped before the sequence is made even again.
+    if (atomic_load_explicit(&header->sequence, memory_order_relaxed) & 1) {
+        atomic_store_explicit(&header->size, 0, memory_order_relaxed);
+        atomic_store_explicit(&header->sequence,
+                atomic_load_explicit(&header->sequence, memory_order_relaxed) + 1,
+                memory_order_release);
+    }
+
+    features_shm_write_begin(shm);
+    memcpy(header->MAGIC, FEATURES_SHM_MAGIC, sizeof(header->MAGIC));
+    header->capacity = size - sizeof(features_shm_header_t);
+    features_shm_write_end(shm);
+
+    return FEATURES_OK;
+}
+
+features_err_t
+features_shm_open(
+        features_shm_t *shm,
+        const char *name) {
+    features_err_t rc;
+    struct stat st;
+    int fd;
+
+    memset(shm, 0, sizeof(features_shm_t));
+
+    fd = shm_open(name, O_RDONLY, 0);
+
+    if (fd < 0) {
+        return FEATURES_ERR_IO;
+    }
+
+    if (0 != fstat(fd, &st)) {
+        close(fd);
+        return FEATURES_ERR_IO;
+    }
+
+    if ((uint64_t)st.st_size < sizeof(features_shm_header_t)) {
+        close(fd);
+        return FEATURES_ERR_INVALID;
+    }
+
+    rc = features_shm_map(shm, fd, (size_t)st.st_size, 0);
+    close(fd);
+
+    if (FEATURES_OK != rc) {
+        return rc;
+    }
+
+    if (0 != memcmp(shm->header->MAGIC, FEATURES_SHM_MAGIC, sizeof(shm->header->MAGIC))
+            || shm->header->capacity > shm->map_size - sizeof(features_shm_header_t)) {
+        features_shm_close(shm);
+        return FEATURES_ERR_INVALID;
+    }
+
+    return FEATURES_OK;
+}
+
+void
+features_shm_close(features_shm_t *shm) {
+    if (NULL != shm->header) {
+        munmap(shm->header, shm->map_size);
+    }
+
+    memset(shm, 0, sizeof(features_shm_t));
+}
+
+features_err_t
+features_shm_unlink(const char *name) {
+    return 0 == shm_unlink(name) ? FEATURES_OK : FEATURES_ERR_IO;
+}
+
+features_err_t
+features_shm_publish(
+        features_shm_t *shm,
+        const void *raw,
+        uint64_t size) {
+    features_data_t data;
+    features_err_t rc;
+
+    if (!shm->writable) {
+        return FEATURES_ERR_UNINITIALISED;
+    }
+
+    rc = features_data(&data, (void *)raw);
+
+    if (FEATURES_OK != rc) {
+        return rc;
+    }
+
+    if (features_data_size(&data) > size) {
+        return FEATURES_ERR_INVALID;
+    }
+
+    if (size > shm->header->capacity) {
+        return FEATURES_ERR_NOMEM;
+    }
+
+    features_shm_write_begin(shm);
+    memcpy(shm->pages, raw, (size_t)size);
+    atomic_store_explicit(&shm->header->size, size, memory_order_relaxed);
+    features_shm_write_end(shm);
+
+    return FEATURES_OK;
+}
+
+features_err_t
+features_shm_update_page(
+        features_shm_t *shm,
+        const features_page_raw_t *page) {
+    features_page_raw_t *target;
+    features_page_t parsed;
+    features_data_t data;
+    features_err_t rc;
+
+    if (!shm->writable) {
+        return FEATURES_ERR_UNINITIALISED;
+    }
+
+    // The only writer, so the data cannot change while it is parsed
+    if (0 == atomic_load_explicit(&shm->header->size, memory_order_relaxed)) {
+        return FEATURES_ERR_UNINITIALISED;
+    }
+
+    rc = features_data(&data, shm->pages);
+
+    if (FEATURES_OK != rc) {
+        return rc;
+    }
+
+    rc = features_page(&parsed, (features_page_raw_t *)page);
+
+    if (FEATURES_OK != rc) {
+        return rc;
+    }
+
+    target = features_data_page(&data, parsed.page_number);
+
+    if (NULL == target || page->header.flags != data.flags) {
+        return FEATURES_ERR_INVALID;
+    }
+
+    if (target == data.pages
+            && (page->header.page_count != target->header.page_count
+                || page->header.page_span != target->header.page_span)) {
+        return FEATURES_ERR_INVALID;
+    }
+
+    features_shm_write_begin(shm);
+    memcpy(target, page, FEATURES_PAGE_SIZE);
+    features_shm_write_end(shm);
+
+    return FEATURES_OK;
+}
+
+uint64_t
+features_shm_sequence(const features_shm_t *shm) {
+    return atomic_load_explicit(&shm->header->sequence, memory_order_acquire) & ~(uint64_t)1;
+}
+
+features_err_t
+features_shm_switch_value(
+        const features_shm_t *shm,
+        features_switch_number_t switch_number,
+        features_switch_value_t *value) {
+    features_err_t rc;
+    uint64_t sequence;
+
+    for (;;) {
+        sequence = atomic_load_explicit(&shm->header->sequence, memory_order_acquire);
+
+        if (sequence & 1) {
+            sched_yield();
+            continue;
+        }
+
+        rc = features_shm_read(shm, switch_number, value);
+
+        // Orders the reads of the data before the second load of the
+        // sequence, pairing with the fence in features_shm_write_begin()
+        atomic_thread_fence(memory_order_acquire);
+
+        if (sequence == atomic_load_explicit(&shm->header->sequence, memory_order_relaxed)) {
+            return rc;
+        }
+    }
+}
+
+static features_err_t
+features_shm_map(
+        features_shm_t *shm,
+        int fd,
+        size_t size,
+        int writable) {
+    void *map;
+
+    map = mmap(NULL, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+
+    if (MAP_FAILED == map) {
+        return FEATURES_ERR_IO;
+    }
+
+    shm->header = map;
+    shm->pages = (features_page_raw_t *)((uint8_t *)map + sizeof(features_shm_header_t));
+    shm->map_size = size;
+    shm->writable = writable;
+
+    return FEATURES_OK;
+}
+
+static void
+features_shm_write_begin(features_shm_t *shm) {
+    uint64_t sequence;
+
+    sequence = atomic_load_explicit(&shm->header->sequence, memory_order_relaxed);
+    atomic_store_explicit(&shm->header->sequence, sequence + 1, memory_order_relaxed);
+    // Keeps the writes to the data after the odd sequence
+    atomic_thread_fence(memory_order_release);
+}
+
+static void
+features_shm_write_end(features_shm_t *shm) {
+    uint64_t sequence;
+
+    sequence = atomic_load_explicit(&shm->header->sequence, memory_order_relaxed);
+    atomic_store_explicit(&shm->header->sequence, sequence + 1, memory_order_release);
+}
+
+// One lookup that may see a write in progress. Everything read from the
+// segment is bounds checked before it is followed, so a torn read gives
+// a wrong result, discarded by the caller, rather than a fault.
+static features_err_t
+features_shm_read(
+        const features_shm_t *shm,
+        features_switch_number_t switch_number,
+        features_switch_value_t *value) {
+    static const features_page_directory_t absent = {0, 0};
+    features_switch_id_t switch_id;
+    features_page_raw_t *page;
+    features_data_t data;
+    features_data_t view;
+    features_err_t rc;
+    uint64_t size;
+
+    size = atomic_load_explicit(&shm->header->size, memory_order_relaxed);
+
+    if (0 == size) {
+        return FEATURES_ERR_UNINITIALISED;
+    }
+
+    // An agent may have grown the segment since it was mapped here
+    if (size > shm->header->capacity || size > shm->map_size - sizeof(features_shm_header_t)) {
+        return FEATURES_ERR_INVALID;
+    }
+
+    rc = features_data(&data, shm->pages);
+
+    if (FEATURES_OK != rc) {
+        return rc;
+    }
+
+    if (features_data_size(&data) > size) {
+        return FEATURES_ERR_INVALID;
+    }
+
+    switch_id = features_switch_id(switch_number);
+
+    // Outside the span no page is read
+    if (switch_id.page_number < data.page_offset
+            || switch_id.page_number - data.page_offset >= data.page_span) {
+        return features_switch_value(&data, switch_number, value);
+    }
+
+    page = features_data_page(&data, switch_id.page_number);
+
+    if (NULL != page && page >= data.pages + data.page_count) {
+        return FEATURES_ERR_INVALID;
+    }
+
+    // Looks up in a view of the single page, so the directory is only
+    // read once
+    memset(&view, 0, sizeof(features_data_t));
+    view.page_offset = switch_id.page_number;
+    view.page_span = 1;
+    view.flags = data.flags;
+
+    if (NULL == page) {
+        view.pages = data.pages;
+        view.directory = (features_page_directory_t *)&absent;
+    } else {
+        view.page_count = 1;
+        view.pages = page;
+    }
+
+    return features_switch_value(&view, switch_number, value);
+}
@@ -0,0 +1,102 @@
+#ifndef FEATURES_SHM_H
+#define FEATURES_SHM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "atomics.h"
+#include "memory.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FEATURES_SHM_MAGIC "FEATSHM1"
+
+// Switch data shared by the processes of a host through a POSIX shared
+// memory segment. One agent process creates the segment and writes the
+// pages, any number of worker processes map it read-only and look up
+// switches in place, with no per-process copy of the file.
+//
+// The segment is a control page followed by the pages and directory of
+// a switch file, exactly as they are laid out on disk. The agent updates
+// them in place under a sequence lock: the sequence is odd while a write
+// is in progress and advances by 2 with every completed write. Readers
+// retry a lookup only when the sequence moved under them, which needs a
+// write to overlap the lookup.
+
+typedef struct features_shm_header_t {
+    char MAGIC[8];
+    // Bytes available for pages after the control page
+    uint64_t capacity;
+    FEATURES_ATOMIC(uint64_t) sequence;
+    // Bytes of the published file, 0 before the first publish
+    FEATURES_ATOMIC(uint64_t) size;
+    uint8_t unused[FEATURES_PAGE_SIZE - 32];
+} features_shm_header_t;
+
+typedef struct features_shm_t {
+    features_shm_header_t *header;
+    features_page_raw_t *pages;
+    size_t map_size;
+    int writable;
+} features_shm_t;
+
+// Creates or resizes the segment name, which is a shm_open() name such
+// as "/features", with room for capacity bytes of pages. The segment
+// holds no data until the first features_shm_publish().
+features_err_t
+features_shm_create(
+        features_shm_t *shm,
+        const char *name,
+        uint64_t capacity);
+
+// Maps an existing segment read-only
+features_err_t
+features_shm_open(
+        features_shm_t *shm,
+        const char *name);
+
+void
+features_shm_close(features_shm_t *shm);
+
+// Removes the segment name, mappings stay valid until closed
+features_err_t
+features_shm_unlink(const char *name);
+
+// Replaces the whole data with the size bytes of a switch file at raw.
+// Only one process may write to a segment.
+features_err_t
+features_shm_publish(
+        features_shm_t *shm,
+        const void *raw,
+        uint64_t size);
+
+// Overwrites the stored page with the page number of page. The page must
+// keep the flags of the data, and the first page its page count and
+// span, so the layout of the data does not change.
+features_err_t
+features_shm_update_page(
+        features_shm_t *shm,
+        const features_page_raw_t *page);
+
+// Sequence of the last completed write, readers can compare it to notice
+// updates
+uint64_t
+features_shm_sequence(const features_shm_t *shm);
+
+// features_switch_value() of the data in the segment, never mixing the
+// data of two writes. Returns FEATURES_ERR_INVALID while the published
+// data is larger than this mapping, after the agent grew the segment,
+// until the segment is opened again.
+features_err_t
+features_shm_switch_value(
+        const features_shm_t *shm,
+        features_switch_number_t switch_number,
+        features_switch_value_t *value);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
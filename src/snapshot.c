@@ -0,0 +1,240 @@
+#include "snapshot.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct features_file_snapshot_t {
+    features_snapshot_t snapshot;
+    features_file_t file;
+} features_file_snapshot_t;
+
+static _Atomic uint64_t features_snapshot_generation = 1;
+
+static void
+features_file_snapshot_release(features_snapshot_t *snapshot);
+
+static int
+features_live_quiescent(
+        features_live_t *live,
+        uint64_t epoch);
+
+void
+features_snapshot_init(
+        features_snapshot_t *snapshot,
+        features_snapshot_release_t release) {
+    snapshot->generation = atomic_fetch_add_explicit(
+            &features_snapshot_generation, 1, memory_order_relaxed);
+    snapshot->release = release;
+    snapshot->replicas = NULL;
+    snapshot->replica_count = 0;
+    snapshot->retired_next = NULL;
+    snapshot->retired_epoch = 0;
+}
+
+features_err_t
+features_snapshot_open(
+        features_snapshot_t **snapshot,
+        const char *path) {
+    features_file_t file;
+    features_err_t rc;
+
+    rc = features_open(&file, path);
+
+    if (FEATURES_OK != rc) {
+        return rc;
+    }
+
+    rc = features_snapshot_adopt(snapshot, &file);
+
+    if (FEATURES_OK != rc) {
+        features_close(&file);
+    }
+
+    return rc;
+}
+
+features_err_t
+features_snapshot_adopt(
+        features_snapshot_t **snapshot,
+        features_file_t *file) {
+    features_file_snapshot_t *file_snapshot;
+
+    file_snapshot = calloc(1, sizeof(features_file_snapshot_t));
+
+    if (NULL == file_snapshot) {
+        return FEATURES_ERR_NOMEM;
+    }
+
+    file_snapshot->file = *file;
+    features_snapshot_init(&file_snapshot->snapshot, features_file_snapshot_release);
+    file_snapshot->snapshot.data = file_snapshot->file.data;
+    // An index built on the file moves to the snapshot, which frees it
+    file_snapshot->file.data.index = NULL;
+
+    *snapshot = &file_snapshot->snapshot;
+    return FEATURES_OK;
+}
+
+void
+features_snapshot_release(features_snapshot_t *snapshot) {
+    if (NULL != snapshot && NULL != snapshot->release) {
+        snapshot->release(snapshot);
+    }
+}
+
+features_err_t
+features_live_init(
+        features_live_t *live,
+        size_t max_readers) {
+    void *slots;
+
+    memset(live, 0, sizeof(features_live_t));
+
+    if (0 != posix_memalign(&slots, FEATURES_CACHE_LINE_SIZE,
+                max_readers * sizeof(features_live_slot_t))) {
+        return FEATURES_ERR_NOMEM;
+    }
+
+    memset(slots, 0, max_readers * sizeof(features_live_slot_t));
+
+    live->slots = slots;
+    live->slot_count = max_readers;
+    live->retired = NULL;
+    atomic_init(&live->current, NULL);
+    // Epoch 0 marks a quiescent reader slot
+    atomic_init(&live->epoch, 1);
+    pthread_mutex_init(&live->lock, NULL);
+
+    return FEATURES_OK;
+}
+
+void
+features_live_destroy(features_live_t *live) {
+    features_snapshot_t *snapshot;
+
+    snapshot = atomic_exchange(&live->current, NULL);
+    features_snapshot_release(snapshot);
+
+    while (NULL != live->retired) {
+        snapshot = live->retired;
+        live->retired = snapshot->retired_next;
+        features_snapshot_release(snapshot);
+    }
+
+    pthread_mutex_destroy(&live->lock);
+    free(live->slots);
+    memset(live, 0, sizeof(features_live_t));
+}
+
+void
+features_live_publish(
+        features_live_t *live,
+        features_snapshot_t *snapshot) {
+    features_snapshot_t *old;
+
+    old = atomic_exchange(&live->current, snapshot);
+
+    if (NULL != old) {
+        pthread_mutex_lock(&live->lock);
+        // Readers that announced this epoch or earlier may hold old,
+        // later readers are guaranteed to load the new snapshot
+        old->retired_epoch = atomic_fetch_add(&live->epoch, 1);
+        old->retired_next = live->retired;
+        live->retired = old;
+        pthread_mutex_unlock(&live->lock);
+    }
+
+    features_live_reclaim(live);
+}
+
+void
+features_live_reclaim(features_live_t *live) {
+    features_snapshot_t **prev;
+    features_snapshot_t *snapshot;
+    features_snapshot_t *reclaimed;
+
+    reclaimed = NULL;
+
+    pthread_mutex_lock(&live->lock);
+
+    prev = &live->retired;
+
+    while (NULL != *prev) {
+        snapshot = *prev;
+
+        if (features_live_quiescent(live, snapshot->retired_epoch)) {
+            *prev = snapshot->retired_next;
+            snapshot->retired_next = reclaimed;
+            reclaimed = snapshot;
+        } else {
+            prev = &snapshot->retired_next;
+        }
+    }
+
+    pthread_mutex_unlock(&live->lock);
+
+    // Release outside the lock, unmapping can be slow
+    while (NULL != reclaimed) {
+        snapshot = reclaimed;
+        reclaimed = snapshot->retired_next;
+        features_snapshot_release(snapshot);
+    }
+}
+
+features_err_t
+features_live_register(
+        features_live_t *live,
+        features_reader_t *reader) {
+    size_t i;
+    int expected;
+
+    for (i = 0; i < live->slot_count; ++i) {
+        expected = 0;
+
+        if (atomic_compare_exchange_strong(&live->slots[i].in_use, &expected, 1)) {
+            atomic_store(&live->slots[i].epoch, 0);
+            reader->live = live;
+            reader->slot = &live->slots[i];
+            return FEATURES_OK;
+        }
+    }
+
+    // Every reader slot is taken
+    return FEATURES_ERR_NOMEM;
+}
+
+void
+features_live_unregister(features_reader_t *reader) {
+    atomic_store(&reader->slot->epoch, 0);
+    atomic_store(&reader->slot->in_use, 0);
+    reader->live = NULL;
+    reader->slot = NULL;
+}
+
+static void
+features_file_snapshot_release(features_snapshot_t *snapshot) {
+    features_file_snapshot_t *file_snapshot;
+
+    file_snapshot = (features_file_snapshot_t *)snapshot;
+    features_data_index_free(&snapshot->data);
+    features_close(&file_snapshot->file);
+    free(file_snapshot);
+}
+
+static int
+features_live_quiescent(
+        features_live_t *live,
+        uint64_t epoch) {
+    uint64_t reader_epoch;
+    size_t i;
+
+    for (i = 0; i < live->slot_count; ++i) {
+        reader_epoch = atomic_load(&live->slots[i].epoch);
+
+        if (0 != reader_epoch && reader_epoch <= epoch) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
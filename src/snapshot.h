@@ -0,0 +1,149 @@
+#ifndef FEATURES_SNAPSHOT_H
+#define FEATURES_SNAPSHOT_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+#include "atomics.h"
+#include "file.h"
+#include "memory.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum {
+    FEATURES_CACHE_LINE_SIZE = 64
+};
+
+typedef struct features_snapshot_t features_snapshot_t;
+
+typedef void (*features_snapshot_release_t)(features_snapshot_t *snapshot);
+
+// An immutable set of switch values. Snapshots are published to a
+// features_live_t and released once no reader can still see them.
+struct features_snapshot_t {
+    features_data_t data;
+    // Unique for the lifetime of the process, never reused
+    uint64_t generation;
+    features_snapshot_release_t release;
+
+    // Copies of data local to each NUMA node, NULL when data is the only
+    // copy, see replica.h
+    const features_data_t *replicas;
+    unsigned replica_count;
+
+    // Owned by the features_live_t the snapshot is retired from
+    features_snapshot_t *retired_next;
+    uint64_t retired_epoch;
+};
+
+// Each reader announces the epoch it pinned the current snapshot in.
+// Slots are cache line sized so readers never write a shared line.
+typedef struct features_live_slot_t {
+    FEATURES_ATOMIC(uint64_t) epoch; // 0 while the reader holds no snapshot
+    FEATURES_ATOMIC(int) in_use;
+    uint8_t padding[FEATURES_CACHE_LINE_SIZE - sizeof(uint64_t) - sizeof(int)];
+} features_live_slot_t;
+
+// The current snapshot plus epoch based reclamation of replaced ones.
+// Readers pin and unpin without locks, writers publish with a single
+// atomic exchange and free retired snapshots once every reader that
+// could still see them has moved on.
+typedef struct features_live_t {
+    FEATURES_ATOMIC(features_snapshot_t *) current;
+    uint8_t padding0[FEATURES_CACHE_LINE_SIZE - sizeof(void *)];
+    FEATURES_ATOMIC(uint64_t) epoch;
+    uint8_t padding1[FEATURES_CACHE_LINE_SIZE - sizeof(uint64_t)];
+
+    features_live_slot_t *slots;
+    size_t slot_count;
+
+    // Writers only
+    pthread_mutex_t lock;
+    features_snapshot_t *retired;
+} features_live_t;
+
+// A registered reader, owned by a single thread
+typedef struct features_reader_t {
+    features_live_t *live;
+    features_live_slot_t *slot;
+} features_reader_t;
+
+void
+features_snapshot_init(
+        features_snapshot_t *snapshot,
+        features_snapshot_release_t release);
+
+// Opens a switch file into a heap allocated snapshot that unmaps the
+// file and frees itself when released
+features_err_t
+features_snapshot_open(
+        features_snapshot_t **snapshot,
+        const char *path);
+
+// Moves an open file into a heap allocated snapshot that closes it when
+// released. On failure the file is left open.
+features_err_t
+features_snapshot_adopt(
+        features_snapshot_t **snapshot,
+        features_file_t *file);
+
+void
+features_snapshot_release(features_snapshot_t *snapshot);
+
+features_err_t
+features_live_init(
+        features_live_t *live,
+        size_t max_readers);
+
+// Releases the current and all retired snapshots. No reader may be
+// registered.
+void
+features_live_destroy(features_live_t *live);
+
+// Makes snapshot current and retires the previous one. The live
+// manager takes ownership of snapshot.
+void
+features_live_publish(
+        features_live_t *live,
+        features_snapshot_t *snapshot);
+
+// Releases retired snapshots no reader can still hold
+void
+features_live_reclaim(features_live_t *live);
+
+features_err_t
+features_live_register(
+        features_live_t *live,
+        features_reader_t *reader);
+
+void
+features_live_unregister(features_reader_t *reader);
+
+// Returns the current snapshot, which stays valid until the matching
+// features_live_unpin(). Pins do not nest. Returns NULL before the
+// first publish.
+static inline const features_snapshot_t *
+features_live_pin(features_reader_t *reader) {
+    uint64_t epoch;
+
+    epoch = atomic_load_explicit(&reader->live->epoch, memory_order_relaxed);
+    atomic_store_explicit(&reader->slot->epoch, epoch, memory_order_relaxed);
+    // Orders the announcement before the load of current, pairing with
+    // the exchange and epoch increment in features_live_publish()
+    atomic_thread_fence(memory_order_seq_cst);
+
+    return atomic_load_explicit(&reader->live->current, memory_order_acquire);
+}
+
+static inline void
+features_live_unpin(features_reader_t *reader) {
+    atomic_store_explicit(&reader->slot->epoch, 0, memory_order_release);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
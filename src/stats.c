@@ -0,0 +1,350 @@
+#include "stats.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+static features_stats_shard_t *
+features_stats_shard(features_stats_t *stats);
+
+static void
+features_stats_shard_exit(void *shard);
+
+static size_t
+features_stats_merge(
+        features_stats_t *stats,
+        features_stats_entry_t **entries);
+
+static int
+features_stats_compare_number(const void *a, const void *b);
+
+static int
+features_stats_compare_reads(const void *a, const void *b);
+
+features_err_t
+features_stats_init(
+        features_stats_t *stats,
+        size_t capacity) {
+    stats->capacity = 1;
+
+    while (stats->capacity < capacity) {
+        stats->capacity <<= 1;
+    }
+
+    if (0 != pthread_key_create(&stats->key, features_stats_shard_exit)) {
+        return FEATURES_ERR_NOMEM;
+    }
+
+    pthread_mutex_init(&stats->lock, NULL);
+    stats->shards = NULL;
+
+    return FEATURES_OK;
+}
+
+void
+features_stats_destroy(features_stats_t *stats) {
+    features_stats_shard_t *shard;
+    features_stats_shard_t *next;
+
+    pthread_key_delete(stats->key);
+    pthread_mutex_destroy(&stats->lock);
+
+    for (shard = stats->shards; NULL != shard; shard = next) {
+        next = shard->next;
+        free(shard);
+    }
+
+    stats->shards = NULL;
+}
+
+void
+features_stats_record(
+        features_stats_t *stats,
+        features_switch_number_t switch_number,
+        features_err_t rc) {
+    features_stats_shard_t *shard;
+    features_stats_slot_t *slot;
+    uint64_t key;
+    size_t mask;
+    size_t i;
+    size_t probe;
+    int counter;
+
+    shard = pthread_getspecific(stats->key);
+
+    if (NULL == shard) {
+        shard = features_stats_shard(stats);
+
+        if (NULL == shard) {
+            return;
+        }
+    }
+
+    switch (rc) {
+        case FEATURES_ERR_UNUSED:
+            counter = FEATURES_STATS_UNUSED;
+            break;
+        case FEATURES_ERR_DEPRECATED:
+            counter = FEATURES_STATS_DEPRECATED;
+            break;
+        case FEATURES_ERR_INCORRECT_TYPE:
+            counter = FEATURES_STATS_INCORRECT_TYPE;
+            break;
+        default:
+            counter = -1;
+            break;
+    }
+
+    key = switch_number + 1;
+    mask = stats->capacity - 1;
+    i = (size_t)((switch_number * UINT64_C(0x9e3779b97f4a7c15)) >> 32) & mask;
+
+    // Only this thread writes the shard so plain load and store pairs
+    // are enough, the atomics keep the merging readers well defined
+    for (probe = 0; probe <= mask && probe < FEATURES_STATS_MAX_PROBES; ++probe, i = (i + 1) & mask) {
+        slot = &shard->slots[i];
+
+        if (atomic_load_explicit(&slot->key, memory_order_relaxed) != key) {
+            if (0 != atomic_load_explicit(&slot->key, memory_order_relaxed)) {
+                continue;
+            }
+
+            atomic_store_explicit(&slot->key, key, memory_order_release);
+        }
+
+        atomic_store_explicit(&slot->counts[FEATURES_STATS_READS],
+                atomic_load_explicit(&slot->counts[FEATURES_STATS_READS], memory_order_relaxed) + 1,
+                memory_order_relaxed);
+
+        if (counter >= 0) {
+            atomic_store_explicit(&slot->counts[counter],
+                    atomic_load_explicit(&slot->counts[counter], memory_order_relaxed) + 1,
+                    memory_order_relaxed);
+        }
+
+        return;
+    }
+
+    atomic_store_explicit(&shard->dropped,
+            atomic_load_explicit(&shard->dropped, memory_order_relaxed) + 1,
+            memory_order_relaxed);
+}
+
+features_err_t
+features_stats_top(
+        features_stats_t *stats,
+        features_stats_entry_t *entries,
+        size_t n,
+        size_t *count) {
+    features_stats_entry_t *merged;
+    size_t merged_count;
+
+    merged_count = features_stats_merge(stats, &merged);
+
+    if (NULL == merged) {
+        return FEATURES_ERR_NOMEM;
+    }
+
+    qsort(merged, merged_count, sizeof(features_stats_entry_t), features_stats_compare_reads);
+
+    *count = merged_count < n ? merged_count : n;
+    memcpy(entries, merged, *count * sizeof(features_stats_entry_t));
+    free(merged);
+
+    return FEATURES_OK;
+}
+
+uint64_t
+features_stats_dropped(features_stats_t *stats) {
+    features_stats_shard_t *shard;
+    uint64_t dropped;
+
+    dropped = 0;
+    pthread_mutex_lock(&stats->lock);
+
+    for (shard = stats->shards; NULL != shard; shard = shard->next) {
+        dropped += atomic_load_explicit(&shard->dropped, memory_order_relaxed);
+    }
+
+    pthread_mutex_unlock(&stats->lock);
+
+    return dropped;
+}
+
+features_err_t
+features_stats_dump(
+        features_stats_t *stats,
+        FILE *out,
+        size_t n) {
+    features_stats_entry_t *entries;
+    features_err_t rc;
+    size_t count;
+    size_t i;
+
+    entries = malloc((n ? n : 1) * sizeof(features_stats_entry_t));
+
+    if (NULL == entries) {
+        return FEATURES_ERR_NOMEM;
+    }
+
+    rc = features_stats_top(stats, entries, n, &count);
+
+    if (FEATURES_OK != rc) {
+        free(entries);
+        return rc;
+    }
+
+    fprintf(out, "%-20s %12s %12s %12s %14s\n",
+            "switch", "reads", "unused", "deprecated", "incorrect_type");
+
+    for (i = 0; i < count; ++i) {
+        fprintf(out, "%-20" PRIu64 " %12" PRIu64 " %12" PRIu64 " %12" PRIu64 " %14" PRIu64 "\n",
+                entries[i].switch_number,
+                entries[i].counts[FEATURES_STATS_READS],
+                entries[i].counts[FEATURES_STATS_UNUSED],
+                entries[i].counts[FEATURES_STATS_DEPRECATED],
+                entries[i].counts[FEATURES_STATS_INCORRECT_TYPE]);
+    }
+
+    free(entries);
+
+    return ferror(out) ? FEATURES_ERR_IO : FEATURES_OK;
+}
+
+// Claims the shard of an exited thread or adds a new one
+static features_stats_shard_t *
+features_stats_shard(features_stats_t *stats) {
+    features_stats_shard_t *shard;
+    void *mem;
+    int expected;
+
+    pthread_mutex_lock(&stats->lock);
+
+    for (shard = stats->shards; NULL != shard; shard = shard->next) {
+        expected = 0;
+
+        if (atomic_compare_exchange_strong(&shard->in_use, &expected, 1)) {
+            break;
+        }
+    }
+
+    if (NULL == shard) {
+        // Cache line aligned so no two shards share a line
+        if (0 != posix_memalign(&mem, FEATURES_BLOCK_SIZE, sizeof(features_stats_shard_t)
+                    + stats->capacity * sizeof(features_stats_slot_t))) {
+            pthread_mutex_unlock(&stats->lock);
+            return NULL;
+        }
+
+        shard = mem;
+        memset(shard, 0, sizeof(features_stats_shard_t)
+                + stats->capacity * sizeof(features_stats_slot_t));
+        atomic_init(&shard->in_use, 1);
+        shard->next = stats->shards;
+        stats->shards = shard;
+    }
+
+    pthread_mutex_unlock(&stats->lock);
+    pthread_setspecific(stats->key, shard);
+
+    return shard;
+}
+
+static void
+features_stats_shard_exit(void *shard) {
+    atomic_store(&((features_stats_shard_t *)shard)->in_use, 0);
+}
+
+// Sums the counters of every shard into one entry per switch, sorted by
+// switch number. Sets entries to NULL when out of memory.
+static size_t
+features_stats_merge(
+        features_stats_t *stats,
+        features_stats_entry_t **entries) {
+    features_stats_shard_t *shard;
+    features_stats_entry_t *merged;
+    features_stats_entry_t *entry;
+    features_stats_slot_t *slot;
+    uint64_t key;
+    size_t shard_count;
+    size_t count;
+    size_t out;
+    size_t i;
+    int c;
+
+    pthread_mutex_lock(&stats->lock);
+
+    shard_count = 0;
+
+    for (shard = stats->shards; NULL != shard; shard = shard->next) {
+        ++shard_count;
+    }
+
+    merged = malloc((shard_count ? shard_count : 1) * stats->capacity * sizeof(features_stats_entry_t));
+
+    if (NULL == merged) {
+        pthread_mutex_unlock(&stats->lock);
+        *entries = NULL;
+        return 0;
+    }
+
+    count = 0;
+
+    for (shard = stats->shards; NULL != shard; shard = shard->next) {
+        for (i = 0; i < stats->capacity; ++i) {
+            slot = &shard->slots[i];
+            key = atomic_load_explicit(&slot->key, memory_order_acquire);
+
+            if (0 == key) {
+                continue;
+            }
+
+            entry = &merged[count++];
+            entry->switch_number = key - 1;
+
+            for (c = 0; c < FEATURES_STATS_COUNTERS; ++c) {
+                entry->counts[c] = atomic_load_explicit(&slot->counts[c], memory_order_relaxed);
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&stats->lock);
+
+    qsort(merged, count, sizeof(features_stats_entry_t), features_stats_compare_number);
+
+    out = 0;
+
+    for (i = 0; i < count; ++i) {
+        if (out > 0 && merged[out - 1].switch_number == merged[i].switch_number) {
+            for (c = 0; c < FEATURES_STATS_COUNTERS; ++c) {
+                merged[out - 1].counts[c] += merged[i].counts[c];
+            }
+        } else {
+            merged[out++] = merged[i];
+        }
+    }
+
+    *entries = merged;
+    return out;
+}
+
+static int
+features_stats_compare_number(const void *a, const void *b) {
+    const features_stats_entry_t *ea = a;
+    const features_stats_entry_t *eb = b;
+
+    return (ea->switch_number > eb->switch_number) - (ea->switch_number < eb->switch_number);
+}
+
+// Most reads first, ties by switch number
+static int
+features_stats_compare_reads(const void *a, const void *b) {
+    const features_stats_entry_t *ea = a;
+    const features_stats_entry_t *eb = b;
+
+    if (ea->counts[FEATURES_STATS_READS] != eb->counts[FEATURES_STATS_READS]) {
+        return ea->counts[FEATURES_STATS_READS] < eb->counts[FEATURES_STATS_READS] ? 1 : -1;
+    }
+
+    return features_stats_compare_number(a, b);
+}
@@ -0,0 +1,115 @@
+#ifndef FEATURES_STATS_H
+#define FEATURES_STATS_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "atomics.h"
+#include "memory.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Read counters for the switch lookups of a features_data_t. Attach a
+// features_stats_t by setting data->stats, every features_switch_value()
+// and typed features_switch_*_value() call through that data is then
+// counted against its switch number.
+//
+// Each thread counts into its own shard so the lookup path never writes
+// a cache line another thread writes. Shards are merged when the
+// counters are read.
+
+enum {
+    // Slots a lookup probes for its switch before its read is dropped,
+    // which bounds the cost of a lookup once a shard fills up
+    FEATURES_STATS_MAX_PROBES = 16
+};
+
+typedef enum features_stats_counter_t {
+    FEATURES_STATS_READS,
+    FEATURES_STATS_UNUSED,
+    FEATURES_STATS_DEPRECATED,
+    FEATURES_STATS_INCORRECT_TYPE,
+    FEATURES_STATS_COUNTERS
+} features_stats_counter_t;
+
+typedef struct features_stats_slot_t {
+    // switch number + 1, 0 while the slot is free
+    FEATURES_ATOMIC(uint64_t) key;
+    FEATURES_ATOMIC(uint64_t) counts[FEATURES_STATS_COUNTERS];
+} features_stats_slot_t;
+
+// Open addressed table of the switches read by one thread. Only the
+// owning thread writes, readers merging the shards load the counters
+// with relaxed atomics.
+typedef struct features_stats_shard_t {
+    struct features_stats_shard_t *next;
+    FEATURES_ATOMIC(int) in_use;
+    // Reads of switches that found no slot within
+    // FEATURES_STATS_MAX_PROBES
+    FEATURES_ATOMIC(uint64_t) dropped;
+    features_stats_slot_t slots[];
+} features_stats_shard_t;
+
+struct features_stats_t {
+    // Slots per shard, a power of 2
+    size_t capacity;
+    pthread_key_t key;
+
+    // Guards the shard list
+    pthread_mutex_t lock;
+    features_stats_shard_t *shards;
+};
+
+typedef struct features_stats_entry_t {
+    features_switch_number_t switch_number;
+    uint64_t counts[FEATURES_STATS_COUNTERS];
+} features_stats_entry_t;
+
+// Every thread counts up to capacity distinct switches, rounded up to a
+// power of 2, fewer when the switches crowd one part of the shard.
+// Shards of exited threads keep their counts and are reused by new
+// threads.
+features_err_t
+features_stats_init(
+        features_stats_t *stats,
+        size_t capacity);
+
+// No thread may be counting into stats
+void
+features_stats_destroy(features_stats_t *stats);
+
+// Counts one lookup of switch_number that returned rc
+void
+features_stats_record(
+        features_stats_t *stats,
+        features_switch_number_t switch_number,
+        features_err_t rc);
+
+// Fills entries with up to n of the most read switches, most reads
+// first, and sets count to the number filled
+features_err_t
+features_stats_top(
+        features_stats_t *stats,
+        features_stats_entry_t *entries,
+        size_t n,
+        size_t *count);
+
+// Reads not counted because a shard was full around the switch
+uint64_t
+features_stats_dropped(features_stats_t *stats);
+
+// Writes the n most read switches to out, one per line
+features_err_t
+features_stats_dump(
+        features_stats_t *stats,
+        FILE *out,
+        size_t n);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
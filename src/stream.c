@@ -0,0 +1,361 @@
+#include "stream.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "checksum.h"
+#include "internal.h"
+
+static uint8_t *
+features_stream_tail(
+        features_stream_t *stream,
+        size_t *space);
+
+static features_err_t
+features_stream_commit(
+        features_stream_t *stream,
+        size_t n);
+
+static features_err_t
+features_stream_start(features_stream_t *stream);
+
+static features_err_t
+features_stream_check_page(
+        features_stream_t *stream,
+        uint64_t page_index);
+
+static features_err_t
+features_stream_check_directory(features_stream_t *stream);
+
+void
+features_stream_init(features_stream_t *stream) {
+    memset(stream, 0, sizeof(features_stream_t));
+    atomic_init(&stream->ready, 0);
+    atomic_init(&stream->complete, 0);
+}
+
+void
+features_stream_free(features_stream_t *stream) {
+    free(stream->buf);
+    features_stream_init(stream);
+}
+
+features_err_t
+features_stream_feed(
+        features_stream_t *stream,
+        const void *buf,
+        size_t size) {
+    const uint8_t *pos;
+    features_err_t rc;
+    uint8_t *tail;
+    size_t space;
+    size_t n;
+
+    pos = buf;
+
+    while (size > 0) {
+        if (FEATURES_OK != stream->rc) {
+            return stream->rc;
+        }
+
+        tail = features_stream_tail(stream, &space);
+
+        // More bytes than the header promised
+        if (0 == space) {
+            stream->rc = FEATURES_ERR_INVALID;
+            return stream->rc;
+        }
+
+        n = size < space ? size : space;
+        memcpy(tail, pos, n);
+
+        rc = features_stream_commit(stream, n);
+
+        if (FEATURES_OK != rc) {
+            return rc;
+        }
+
+        pos += n;
+        size -= n;
+    }
+
+    return stream->rc;
+}
+
+features_err_t
+features_stream_read(
+        features_stream_t *stream,
+        int fd) {
+    features_err_t rc;
+    uint8_t *tail;
+    size_t space;
+    ssize_t n;
+
+    for (;;) {
+        if (FEATURES_OK != stream->rc) {
+            return stream->rc;
+        }
+
+        tail = features_stream_tail(stream, &space);
+
+        if (0 == space) {
+            return features_stream_finish(stream);
+        }
+
+        n = read(fd, tail, space);
+
+        if (n < 0 && EINTR == errno) {
+            continue;
+        }
+
+        if (n < 0) {
+            return FEATURES_ERR_IO;
+        }
+
+        // The file ended early
+        if (0 == n) {
+            return FEATURES_ERR_INVALID;
+        }
+
+        rc = features_stream_commit(stream, (size_t)n);
+
+        if (FEATURES_OK != rc) {
+            return rc;
+        }
+    }
+}
+
+features_err_t
+features_stream_finish(features_stream_t *stream) {
+    if (FEATURES_OK != stream->rc) {
+        return stream->rc;
+    }
+
+    if (!atomic_load(&stream->complete)) {
+        return FEATURES_ERR_UNINITIALISED;
+    }
+
+    return FEATURES_OK;
+}
+
+features_err_t
+features_stream_switch_value(
+        features_stream_t *stream,
+        features_switch_number_t switch_number,
+        features_switch_value_t *value) {
+    features_switch_id_t switch_id;
+    uint64_t ready;
+
+    ready = atomic_load_explicit(&stream->ready, memory_order_acquire);
+
+    // Nothing below is set before the first page is published
+    if (0 == ready) {
+        return FEATURES_ERR_UNINITIALISED;
+    }
+
+    if (atomic_load_explicit(&stream->complete, memory_order_acquire)) {
+        return features_switch_value(&stream->data, switch_number, value);
+    }
+
+    switch_id = features_switch_id(switch_number);
+
+    if (switch_id.page_number < stream->data.page_offset) {
+        return FEATURES_ERR_DEPRECATED;
+    }
+
+    if (switch_id.page_number - stream->data.page_offset >= stream->data.page_span) {
+        return FEATURES_ERR_UNUSED;
+    }
+
+    // Pages of a sparse file can only be found through the directory
+    if (NULL != stream->data.directory
+            || switch_id.page_number - stream->data.page_offset >= ready) {
+        return FEATURES_ERR_UNINITIALISED;
+    }
+
+    return features_switch_value(&stream->data, switch_number, value);
+}
+
+// Where the next bytes go and how many are still expected
+static uint8_t *
+features_stream_tail(
+        features_stream_t *stream,
+        size_t *space) {
+    if (NULL == stream->buf) {
+        *space = FEATURES_PAGE_SIZE - stream->received;
+        return (uint8_t *)&stream->first + stream->received;
+    }
+
+    *space = stream->size - stream->received;
+    return stream->buf + stream->received;
+}
+
+// Accounts for n bytes written at the tail, checking and publishing
+// every page they complete
+static features_err_t
+features_stream_commit(
+        features_stream_t *stream,
+        size_t n) {
+    uint64_t complete_pages;
+    uint64_t page_index;
+    features_err_t rc;
+
+    stream->received += n;
+
+    if (NULL == stream->buf) {
+        if (stream->received < FEATURES_PAGE_SIZE) {
+            return FEATURES_OK;
+        }
+
+        rc = features_stream_start(stream);
+
+        if (FEATURES_OK != rc) {
+            stream->rc = rc;
+            return rc;
+        }
+    }
+
+    complete_pages = stream->received / FEATURES_PAGE_SIZE;
+
+    if (complete_pages > stream->data.page_count) {
+        complete_pages = stream->data.page_count;
+    }
+
+    page_index = atomic_load_explicit(&stream->ready, memory_order_relaxed);
+
+    for (; page_index < complete_pages; ++page_index) {
+        rc = features_stream_check_page(stream, page_index);
+
+        if (FEATURES_OK != rc) {
+            stream->rc = rc;
+            return rc;
+        }
+
+        atomic_store_explicit(&stream->ready, page_index + 1, memory_order_release);
+    }
+
+    if (stream->received == stream->size) {
+        if (NULL != stream->data.directory) {
+            rc = features_stream_check_directory(stream);
+
+            if (FEATURES_OK != rc) {
+                stream->rc = rc;
+                return rc;
+            }
+        }
+
+        atomic_store_explicit(&stream->complete, 1, memory_order_release);
+    }
+
+    return FEATURES_OK;
+}
+
+// Sizes the page buffer from the complete first page and moves the
+// page into it
+static features_err_t
+features_stream_start(features_stream_t *stream) {
+    features_data_t data;
+    features_err_t rc;
+    uint64_t size;
+    void *mem;
+
+    rc = features_data(&data, &stream->first);
+
+    if (FEATURES_OK != rc) {
+        return rc;
+    }
+
+    if (0 == data.page_count) {
+        return FEATURES_ERR_INVALID;
+    }
+
+    size = features_data_size(&data);
+
+    if (size != (size_t)size || 0 != posix_memalign(&mem, FEATURES_PAGE_SIZE, (size_t)size)) {
+        return FEATURES_ERR_NOMEM;
+    }
+
+    memcpy(mem, &stream->first, FEATURES_PAGE_SIZE);
+
+    stream->buf = mem;
+    stream->size = (size_t)size;
+    stream->data = data;
+    stream->data.pages = mem;
+    stream->last_page_number = data.page_offset;
+
+    if (NULL != data.directory) {
+        stream->data.directory = (features_page_directory_t *)(stream->data.pages + data.page_count);
+    }
+
+    return FEATURES_OK;
+}
+
+static features_err_t
+features_stream_check_page(
+        features_stream_t *stream,
+        uint64_t page_index) {
+    features_page_raw_t *page_raw;
+    features_page_t page;
+    features_err_t rc;
+
+    page_raw = stream->data.pages + page_index;
+
+    if ((stream->data.flags & FEATURES_PAGE_FLAG_CHECKSUM)
+            && features_page_checksum(page_raw)
+                != features_read_uint32(&page_raw->header.checksum)) {
+        return FEATURES_ERR_INVALID;
+    }
+
+    if (0 == page_index) {
+        return FEATURES_OK;
+    }
+
+    rc = features_page(&page, page_raw);
+
+    if (FEATURES_OK != rc) {
+        return rc;
+    }
+
+    if (page_raw->header.flags != stream->data.flags) {
+        return FEATURES_ERR_INVALID;
+    }
+
+    // Dense files hold every page in order, sparse ones a rising subset
+    if (NULL == stream->data.directory) {
+        if (page.page_number != stream->data.page_offset + page_index) {
+            return FEATURES_ERR_INVALID;
+        }
+    } else if (page.page_number <= stream->last_page_number
+            || page.page_number - stream->data.page_offset >= stream->data.page_span) {
+        return FEATURES_ERR_INVALID;
+    }
+
+    stream->last_page_number = page.page_number;
+
+    return FEATURES_OK;
+}
+
+// The directory must count exactly the stored pages, and every stored
+// page must be where the directory says it is
+static features_err_t
+features_stream_check_directory(features_stream_t *stream) {
+    features_page_t page;
+    uint64_t page_index;
+
+    if (FEATURES_OK != features_directory_check(&stream->data)) {
+        return FEATURES_ERR_INVALID;
+    }
+
+    for (page_index = 0; page_index < stream->data.page_count; ++page_index) {
+        features_page(&page, stream->data.pages + page_index);
+
+        if (features_directory_find(stream->data.directory, page.page_number - stream->data.page_offset)
+                != (int64_t)page_index) {
+            return FEATURES_ERR_INVALID;
+        }
+    }
+
+    return FEATURES_OK;
+}
@@ -0,0 +1,79 @@
+#ifndef FEATURES_STREAM_H
+#define FEATURES_STREAM_H
+
+#include <stddef.h>
+
+#include "atomics.h"
+#include "memory.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Loads a switch file as it arrives, for example over a pipe. Bytes are
+// written straight into the final page buffer, which is allocated once
+// the first page header gives the file size, and every page is checked
+// and made readable as soon as it is complete.
+//
+// One thread feeds the stream while any number of threads look switches
+// up through features_stream_switch_value(). Switches on pages that
+// have not arrived yet return FEATURES_ERR_UNINITIALISED, in sparse
+// files that is every switch until the directory at the end arrives.
+typedef struct features_stream_t {
+    // Usable for lookups once the stream is complete, see
+    // features_stream_finish()
+    features_data_t data;
+
+    // Writer only
+    uint8_t *buf;
+    size_t size;
+    size_t received;
+    uint64_t last_page_number;
+    features_err_t rc;
+    // Holds the first page until its header gives the file size
+    features_page_raw_t first;
+
+    // Pages checked and readable
+    FEATURES_ATOMIC(uint64_t) ready;
+    FEATURES_ATOMIC(int) complete;
+} features_stream_t;
+
+void
+features_stream_init(features_stream_t *stream);
+
+// No thread may be reading from stream
+void
+features_stream_free(features_stream_t *stream);
+
+// Copies size bytes into the stream. Returns FEATURES_ERR_INVALID for a
+// malformed page, after which the stream takes no more data.
+features_err_t
+features_stream_feed(
+        features_stream_t *stream,
+        const void *buf,
+        size_t size);
+
+// Reads from fd into the stream until the file is complete or fd ends
+// and returns the result of features_stream_finish()
+features_err_t
+features_stream_read(
+        features_stream_t *stream,
+        int fd);
+
+// FEATURES_OK once the whole file arrived and stream->data can be used
+// like any other data, FEATURES_ERR_UNINITIALISED while it is partial
+features_err_t
+features_stream_finish(features_stream_t *stream);
+
+// features_switch_value() on the pages that have arrived so far
+features_err_t
+features_stream_switch_value(
+        features_stream_t *stream,
+        features_switch_number_t switch_number,
+        features_switch_value_t *value);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
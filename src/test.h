@@ -0,0 +1,227 @@
+#ifndef FEATURES_TEST_H
+#define FEATURES_TEST_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "builder.h"
+#include "internal.h"
+#include "memory.h"
+
+// Helpers of the programs run by make check. A failed check prints
+// where it failed and the program carries on, returning
+// features_test_result() from main().
+
+enum {
+    // Typed blocks features_test_fill() sets on every page, from block 1
+    FEATURES_TEST_BLOCKS_PER_PAGE = 9,
+    // Switches it sets in each of those blocks
+    FEATURES_TEST_SWITCHES_PER_BLOCK = 3
+};
+
+// A switch set by features_test_fill() and how it reads back
+typedef struct features_test_switch_t {
+    features_switch_number_t switch_number;
+    features_switch_value_t value;
+    uint8_t properties;
+} features_test_switch_t;
+
+static int features_test_failures;
+
+#define FEATURES_CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            ++features_test_failures; \
+        } \
+    } while (0)
+
+static inline int
+features_test_result(void) {
+    return 0 == features_test_failures ? 0 : 1;
+}
+
+// A file name under TMPDIR unique to this process
+static inline void
+features_test_path(
+        char *path,
+        size_t size,
+        const char *name) {
+    const char *dir;
+
+    dir = getenv("TMPDIR");
+    snprintf(path, size, "%s/features-test-%ld-%s",
+            NULL != dir ? dir : "/tmp", (long)getpid(), name);
+}
+
+// splitmix64, so every run checks the same switches
+static inline uint64_t
+features_test_random(uint64_t *state) {
+    uint64_t z;
+
+    z = (*state += UINT64_C(0x9e3779b97f4a7c15));
+    z = (z ^ (z >> 30)) * UINT64_C(0xbf58476d1ce4e5b9);
+    z = (z ^ (z >> 27)) * UINT64_C(0x94d049bb133111eb);
+    return z ^ (z >> 31);
+}
+
+// A value of type that fits the type, from r
+static inline features_switch_value_t
+features_test_value(
+        features_switch_type_t type,
+        uint64_t r) {
+    features_switch_value_t value;
+
+    memset(&value, 0, sizeof(features_switch_value_t));
+    value.type = type;
+
+    switch (type) {
+        case FEATURES_SWITCH_TYPE_FLAG:
+            value.value.flag = (char)(r & 1);
+            break;
+        case FEATURES_SWITCH_TYPE_UINT8:
+            value.value.uint8 = (uint8_t)r;
+            break;
+        case FEATURES_SWITCH_TYPE_UINT16:
+            value.value.uint16 = (uint16_t)r;
+            break;
+        case FEATURES_SWITCH_TYPE_UINT32:
+            value.value.uint32 = (uint32_t)r;
+            break;
+        case FEATURES_SWITCH_TYPE_INT8:
+            value.value.int8 = (int8_t)r;
+            break;
+        case FEATURES_SWITCH_TYPE_INT16:
+            value.value.int16 = (int16_t)r;
+            break;
+        case FEATURES_SWITCH_TYPE_INT32:
+            value.value.int32 = (int32_t)r;
+            break;
+        default:
+            value.value.uint64 = r;
+            break;
+    }
+
+    return value;
+}
+
+static inline int
+features_test_value_equal(
+        const features_switch_value_t *a,
+        const features_switch_value_t *b) {
+    if (a->type != b->type) {
+        return 0;
+    }
+
+    switch (a->type) {
+        // A set flag reads back as its bit within the byte
+        case FEATURES_SWITCH_TYPE_FLAG:
+            return !a->value.flag == !b->value.flag;
+        case FEATURES_SWITCH_TYPE_UINT8:
+        case FEATURES_SWITCH_TYPE_INT8:
+            return a->value.uint8 == b->value.uint8;
+        case FEATURES_SWITCH_TYPE_UINT16:
+        case FEATURES_SWITCH_TYPE_INT16:
+            return a->value.uint16 == b->value.uint16;
+        case FEATURES_SWITCH_TYPE_UINT32:
+        case FEATURES_SWITCH_TYPE_INT32:
+            return a->value.uint32 == b->value.uint32;
+        default:
+            return a->value.uint64 == b->value.uint64;
+    }
+}
+
+// Sets the first, second and last slot of a block of every type on each
+// of the page_count pages, the second one deprecated, and records them in
+// switches, which needs room for page_count * FEATURES_TEST_BLOCKS_PER_PAGE
+// * FEATURES_TEST_SWITCHES_PER_BLOCK entries. Returns the number recorded.
+static inline size_t
+features_test_fill(
+        features_builder_t *builder,
+        const uint32_t *pages,
+        size_t page_count,
+        uint64_t seed,
+        features_test_switch_t *switches) {
+    features_switch_type_t type;
+    features_test_switch_t *s;
+    uint8_t slots[FEATURES_TEST_SWITCHES_PER_BLOCK];
+    size_t count;
+    size_t i;
+    int b;
+    int k;
+
+    count = 0;
+
+    for (i = 0; i < page_count; ++i) {
+        for (b = 1; b <= FEATURES_TEST_BLOCKS_PER_PAGE; ++b) {
+            type = (features_switch_type_t)(FEATURES_SWITCH_TYPE_FLAG + b - 1);
+            slots[0] = 0;
+            slots[1] = 1;
+            slots[2] = features_block_capacity(type) - 1;
+
+            for (k = 0; k < FEATURES_TEST_SWITCHES_PER_BLOCK; ++k) {
+                s = switches + count++;
+                s->switch_number = (features_switch_number_t)pages[i] * FEATURES_BLOCKS_PER_PAGE
+                    * FEATURES_MAX_SWITCHES_PER_BLOCK
+                    + (features_switch_number_t)b * FEATURES_MAX_SWITCHES_PER_BLOCK + slots[k];
+                s->value = features_test_value(type, features_test_random(&seed));
+                s->properties = 1 == k
+                    ? FEATURES_SWITCH_PROPERTY_USED | FEATURES_SWITCH_PROPERTY_DEPRECATED
+                    : FEATURES_SWITCH_PROPERTY_USED;
+                FEATURES_CHECK(FEATURES_OK == features_builder_set(builder,
+                        s->switch_number, &s->value, s->properties));
+            }
+        }
+    }
+
+    return count;
+}
+
+// Checks that every switch of features_test_fill() reads back from data
+static inline void
+features_test_check_switches(
+        const features_data_t *data,
+        const features_test_switch_t *switches,
+        size_t count) {
+    features_switch_value_t value;
+    features_err_t rc;
+    size_t i;
+
+    for (i = 0; i < count; ++i) {
+        rc = features_switch_value(data, switches[i].switch_number, &value);
+
+        if (switches[i].properties & FEATURES_SWITCH_PROPERTY_DEPRECATED) {
+            FEATURES_CHECK(FEATURES_ERR_DEPRECATED == rc);
+        } else {
+            FEATURES_CHECK(FEATURES_OK == rc);
+            FEATURES_CHECK(FEATURES_OK != rc || features_test_value_equal(&value, &switches[i].value));
+        }
+    }
+}
+
+// Encodes builder into a malloc()ed buffer and parses it into data
+static inline void *
+features_test_encode(
+        const features_builder_t *builder,
+        features_data_t *data) {
+    void *raw;
+
+    raw = malloc(features_builder_size(builder));
+
+    if (NULL == raw) {
+        return NULL;
+    }
+
+    features_builder_write(builder, raw);
+
+    if (FEATURES_OK != features_data(data, raw)) {
+        free(raw);
+        return NULL;
+    }
+
+    return raw;
+}
+
+#endif
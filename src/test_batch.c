@@ -0,0 +1,127 @@
+#include "batch.h"
+#include "test.h"
+
+// A batch reads every switch as one lookup at a time does, in and out of
+// order, with repeats, and past the pages of the file
+
+static const uint32_t features_test_pages[] = {0, 1, 3, 70};
+
+#define FEATURES_TEST_PAGE_COUNT (sizeof(features_test_pages) / sizeof(features_test_pages[0]))
+
+#define FEATURES_TEST_SWITCH_COUNT (FEATURES_TEST_PAGE_COUNT * FEATURES_TEST_BLOCKS_PER_PAGE \
+        * FEATURES_TEST_SWITCHES_PER_BLOCK)
+
+enum {
+    FEATURES_TEST_MAX_BATCH = 1000
+};
+
+// Batches sorted on the stack and on the heap
+static const size_t features_test_sizes[] = {1, 2, 17, 128, 129, FEATURES_TEST_MAX_BATCH};
+
+static const uint8_t features_test_flags[] = {
+    0,
+    FEATURES_PAGE_FLAG_SPARSE,
+    FEATURES_PAGE_FLAG_LITTLE_ENDIAN | FEATURES_PAGE_FLAG_CHECKSUM
+};
+
+#define FEATURES_TEST_COUNT(array) (sizeof(array) / sizeof((array)[0]))
+
+static void
+features_test_batch(
+        const features_data_t *data,
+        const features_switch_number_t *nums,
+        size_t n);
+
+int
+main(void) {
+    static features_switch_number_t nums[FEATURES_TEST_MAX_BATCH];
+    features_test_switch_t switches[FEATURES_TEST_SWITCH_COUNT];
+    features_builder_t builder;
+    features_data_t data;
+    uint64_t random_state;
+    void *raw;
+    size_t f;
+    size_t s;
+    size_t i;
+
+    random_state = 47;
+
+    for (f = 0; f < FEATURES_TEST_COUNT(features_test_flags); ++f) {
+        features_builder_init(&builder);
+        builder.flags = features_test_flags[f];
+        features_test_fill(&builder, features_test_pages, FEATURES_TEST_PAGE_COUNT, 53, switches);
+        raw = features_test_encode(&builder, &data);
+        features_builder_free(&builder);
+        FEATURES_CHECK(NULL != raw);
+
+        if (NULL == raw) {
+            continue;
+        }
+
+        FEATURES_CHECK(FEATURES_OK == features_switch_values_batch(&data, nums, 0, NULL, NULL));
+
+        for (s = 0; s < FEATURES_TEST_COUNT(features_test_sizes); ++s) {
+            // Mostly the switches that are set, their neighbours and
+            // pages the file does not hold
+            for (i = 0; i < features_test_sizes[s]; ++i) {
+                nums[i] = switches[features_test_random(&random_state) % FEATURES_TEST_SWITCH_COUNT]
+                    .switch_number;
+
+                switch (features_test_random(&random_state) % 4) {
+                    case 0:
+                        nums[i] += features_test_random(&random_state) % 3;
+                        break;
+                    case 1:
+                        nums[i] = features_test_random(&random_state) % (80 * 16384);
+                        break;
+                    default:
+                        break;
+                }
+            }
+
+            features_test_batch(&data, nums, features_test_sizes[s]);
+
+            // Already in order, which is not sorted again
+            for (i = 0; i < features_test_sizes[s]; ++i) {
+                nums[i] = (features_switch_number_t)i * 16384 * 80 / features_test_sizes[s];
+            }
+
+            features_test_batch(&data, nums, features_test_sizes[s]);
+
+            for (i = 0; i < features_test_sizes[s]; ++i) {
+                nums[i] = switches[i % FEATURES_TEST_SWITCH_COUNT].switch_number;
+            }
+
+            features_test_batch(&data, nums, features_test_sizes[s]);
+        }
+
+        free(raw);
+    }
+
+    return features_test_result();
+}
+
+static void
+features_test_batch(
+        const features_data_t *data,
+        const features_switch_number_t *nums,
+        size_t n) {
+    static features_switch_value_t out[FEATURES_TEST_MAX_BATCH];
+    static features_err_t errs[FEATURES_TEST_MAX_BATCH];
+    features_switch_value_t value;
+    features_err_t rc;
+    size_t i;
+
+    memset(out, 0, sizeof(out));
+    memset(errs, 0xff, sizeof(errs));
+    FEATURES_CHECK(FEATURES_OK == features_switch_values_batch(data, nums, n, out, errs));
+
+    for (i = 0; i < n; ++i) {
+        rc = features_switch_value(data, nums[i], &value);
+        FEATURES_CHECK(rc == errs[i]);
+
+        if (FEATURES_OK == rc && FEATURES_OK == errs[i]) {
+            FEATURES_CHECK(features_test_value_equal(&value, &out[i]));
+        }
+    }
+}
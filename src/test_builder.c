@@ -0,0 +1,60 @@
+#include "builder.h"
+#include "test.h"
+
+// features_builder_add() only takes slots that were never set, whatever
+// properties they were set with
+
+int
+main(void) {
+    features_switch_value_t value;
+    features_switch_number_t switch_number;
+    features_builder_t builder;
+    features_data_t data;
+    uint16_t val16;
+    void *raw;
+    int i;
+
+    features_builder_init(&builder);
+
+    value = features_test_value(FEATURES_SWITCH_TYPE_DEPRECATED, 0);
+    FEATURES_CHECK(FEATURES_OK == features_builder_set(&builder, 2 * 256, &value, 0));
+
+    // A slot set without property bits reads as unused but stays taken
+    value = features_test_value(FEATURES_SWITCH_TYPE_UINT16, 7);
+    FEATURES_CHECK(FEATURES_OK == features_builder_set(&builder, 256 + 2, &value, 0));
+    FEATURES_CHECK(FEATURES_OK == features_builder_set(&builder, 256 + 4, &value,
+            FEATURES_SWITCH_PROPERTY_USED));
+
+    // Adds fill slots 0, 1 and 3 around the set ones, then skip the
+    // deprecated block 2 for block 3
+    value = features_test_value(FEATURES_SWITCH_TYPE_UINT16, 1);
+    FEATURES_CHECK(FEATURES_OK == features_builder_add(&builder, &value, 0, &switch_number)
+            && 256 == switch_number);
+    FEATURES_CHECK(FEATURES_OK == features_builder_add(&builder, &value, 0, &switch_number)
+            && 256 + 1 == switch_number);
+    FEATURES_CHECK(FEATURES_OK == features_builder_add(&builder, &value, 0, &switch_number)
+            && 256 + 3 == switch_number);
+
+    for (i = 5; i < FEATURES_UINT16_PER_BLOCK; ++i) {
+        FEATURES_CHECK(FEATURES_OK == features_builder_add(&builder, &value, 0, &switch_number)
+                && (features_switch_number_t)256 + i == switch_number);
+    }
+
+    FEATURES_CHECK(FEATURES_OK == features_builder_add(&builder, &value, 0, &switch_number)
+            && 3 * 256 == switch_number);
+
+    raw = features_test_encode(&builder, &data);
+    features_builder_free(&builder);
+    FEATURES_CHECK(NULL != raw);
+
+    if (NULL != raw) {
+        FEATURES_CHECK(FEATURES_ERR_UNUSED == features_switch_uint16_value(&data, 256 + 2, &val16));
+        FEATURES_CHECK(FEATURES_OK == features_switch_uint16_value(&data, 256 + 4, &val16)
+                && 7 == val16);
+        FEATURES_CHECK(FEATURES_OK == features_switch_uint16_value(&data, 3 * 256, &val16)
+                && 1 == val16);
+        free(raw);
+    }
+
+    return features_test_result();
+}
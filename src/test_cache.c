@@ -0,0 +1,205 @@
+#include "cache.h"
+#include "replica.h"
+#include "snapshot.h"
+#include "test.h"
+
+// Lookups through a block cache read what plain lookups read, also when
+// lookups alternate between snapshots, when a new snapshot reuses the
+// memory of the one before and in the local copy of a replicated snapshot
+
+static const uint32_t features_test_pages[] = {0, 1, 2};
+
+#define FEATURES_TEST_PAGE_COUNT (sizeof(features_test_pages) / sizeof(features_test_pages[0]))
+
+#define FEATURES_TEST_SWITCH_COUNT (FEATURES_TEST_PAGE_COUNT * FEATURES_TEST_BLOCKS_PER_PAGE \
+        * FEATURES_TEST_SWITCHES_PER_BLOCK)
+
+enum {
+    FEATURES_TEST_LOOKUPS = 20000,
+    // Lookups stay in a run of nearby switches for a while
+    FEATURES_TEST_RUN = 16
+};
+
+static void *
+features_test_build(
+        uint64_t seed,
+        int retype,
+        features_data_t *data);
+
+static void
+features_test_lookup(
+        features_block_cache_t *cache,
+        const features_snapshot_t *snapshot,
+        features_switch_number_t switch_number);
+
+int
+main(void) {
+    features_test_switch_t switches[FEATURES_TEST_SWITCH_COUNT];
+    features_snapshot_t replicated;
+    features_block_cache_t cache;
+    features_snapshot_t first;
+    features_snapshot_t second;
+    features_builder_t builder;
+    features_data_t data;
+    uint64_t random_state;
+    uint64_t lookups;
+    uint64_t generation;
+    void *first_raw;
+    void *second_raw;
+    size_t size;
+    size_t pos;
+    int i;
+    int k;
+
+    features_builder_init(&builder);
+    features_test_fill(&builder, features_test_pages, FEATURES_TEST_PAGE_COUNT, 37, switches);
+    features_builder_free(&builder);
+
+    first_raw = features_test_build(37, 0, &data);
+    features_snapshot_init(&first, NULL);
+    first.data = data;
+
+    second_raw = features_test_build(41, 1, &data);
+    features_snapshot_init(&second, NULL);
+    second.data = data;
+
+    FEATURES_CHECK(NULL != first_raw && NULL != second_raw);
+
+    if (NULL == first_raw || NULL == second_raw) {
+        return features_test_result();
+    }
+
+    // Runs of lookups near one switch, on either snapshot, which share
+    // switch numbers but not values or block types
+    features_block_cache_init(&cache);
+    random_state = 43;
+    lookups = 0;
+
+    for (i = 0; i < FEATURES_TEST_LOOKUPS / FEATURES_TEST_RUN; ++i) {
+        pos = features_test_random(&random_state) % FEATURES_TEST_SWITCH_COUNT;
+
+        for (k = 0; k < FEATURES_TEST_RUN; ++k) {
+            features_test_lookup(&cache, i % 3 ? &first : &second,
+                    switches[pos].switch_number + features_test_random(&random_state) % 4);
+            ++lookups;
+        }
+    }
+
+    // Clustered runs mostly hit, and every lookup counts once per accessor
+    FEATURES_CHECK(cache.hits > cache.misses);
+    FEATURES_CHECK(10 * lookups == cache.hits + cache.misses);
+
+    // A replicated snapshot whose only copy, the local one, holds other
+    // switches than its data
+    features_snapshot_init(&replicated, NULL);
+    replicated.data = second.data;
+    replicated.replicas = &first.data;
+    replicated.replica_count = 1;
+    FEATURES_CHECK(&first.data == features_snapshot_local_data(&replicated));
+
+    for (pos = 0; pos < FEATURES_TEST_SWITCH_COUNT; ++pos) {
+        features_test_lookup(&cache, &replicated, switches[pos].switch_number);
+    }
+
+    // A new snapshot over the same memory, as when a buffer is reused
+    size = (size_t)features_data_size(&first.data);
+    FEATURES_CHECK(size == features_data_size(&second.data));
+    memcpy(first_raw, second_raw, size);
+    generation = first.generation;
+    features_snapshot_init(&first, NULL);
+    FEATURES_CHECK(FEATURES_OK == features_data(&first.data, first_raw));
+    FEATURES_CHECK(generation != first.generation);
+
+    for (pos = 0; pos < FEATURES_TEST_SWITCH_COUNT; ++pos) {
+        features_test_lookup(&cache, &first, switches[pos].switch_number);
+    }
+
+    free(first_raw);
+    free(second_raw);
+
+    return features_test_result();
+}
+
+// The switches of features_test_fill() with the given seed. With retype,
+// the blocks of the second page hold the next type of each and the first
+// block of the third page is deprecated.
+static void *
+features_test_build(
+        uint64_t seed,
+        int retype,
+        features_data_t *data) {
+    features_test_switch_t switches[FEATURES_TEST_SWITCH_COUNT];
+    features_switch_value_t value;
+    features_builder_t builder;
+    uint32_t pages[FEATURES_TEST_PAGE_COUNT];
+    void *raw;
+    size_t i;
+
+    features_builder_init(&builder);
+    memcpy(pages, features_test_pages, sizeof(pages));
+
+    if (retype) {
+        // Page 1 is filled in below, page 2 keeps page 1's place
+        pages[1] = 2;
+        features_test_fill(&builder, pages, 2, seed, switches);
+
+        for (i = 1; i <= FEATURES_TEST_BLOCKS_PER_PAGE; ++i) {
+            value = features_test_value((features_switch_type_t)(FEATURES_SWITCH_TYPE_FLAG
+                        + i % FEATURES_TEST_BLOCKS_PER_PAGE), seed + i);
+            FEATURES_CHECK(FEATURES_OK == features_builder_set(&builder, 16384 + i * 256, &value,
+                    FEATURES_SWITCH_PROPERTY_USED));
+        }
+
+        value = features_test_value(FEATURES_SWITCH_TYPE_DEPRECATED, 0);
+        FEATURES_CHECK(FEATURES_OK == features_builder_set(&builder, 2 * 16384 + 10 * 256, &value, 0));
+    } else {
+        features_test_fill(&builder, pages, FEATURES_TEST_PAGE_COUNT, seed, switches);
+    }
+
+    raw = features_test_encode(&builder, data);
+    features_builder_free(&builder);
+
+    return raw;
+}
+
+#define FEATURES_TEST_TYPED(type_name, value_type) \
+    do { \
+        value_type cached; \
+        value_type plain; \
+        features_err_t cached_rc; \
+        features_err_t plain_rc; \
+        \
+        cached_rc = features_cached_switch_##type_name##_value(cache, snapshot, switch_number, &cached); \
+        plain_rc = features_switch_##type_name##_value(features_snapshot_local_data(snapshot), \
+                switch_number, &plain); \
+        FEATURES_CHECK(plain_rc == cached_rc); \
+        FEATURES_CHECK(FEATURES_OK != plain_rc || FEATURES_OK != cached_rc || plain == cached); \
+    } while (0)
+
+// Every accessor, cached and plain on the copy local to the thread
+static void
+features_test_lookup(
+        features_block_cache_t *cache,
+        const features_snapshot_t *snapshot,
+        features_switch_number_t switch_number) {
+    features_switch_value_t cached;
+    features_switch_value_t plain;
+    features_err_t cached_rc;
+    features_err_t plain_rc;
+
+    cached_rc = features_cached_switch_value(cache, snapshot, switch_number, &cached);
+    plain_rc = features_switch_value(features_snapshot_local_data(snapshot), switch_number, &plain);
+    FEATURES_CHECK(plain_rc == cached_rc);
+    FEATURES_CHECK(FEATURES_OK != plain_rc || FEATURES_OK != cached_rc
+            || features_test_value_equal(&plain, &cached));
+
+    FEATURES_TEST_TYPED(flag, char);
+    FEATURES_TEST_TYPED(uint8, uint8_t);
+    FEATURES_TEST_TYPED(uint16, uint16_t);
+    FEATURES_TEST_TYPED(uint32, uint32_t);
+    FEATURES_TEST_TYPED(uint64, uint64_t);
+    FEATURES_TEST_TYPED(int8, int8_t);
+    FEATURES_TEST_TYPED(int16, int16_t);
+    FEATURES_TEST_TYPED(int32, int32_t);
+    FEATURES_TEST_TYPED(int64, int64_t);
+}
@@ -0,0 +1,151 @@
+#include "checksum.h"
+#include "test.h"
+
+// Page checksums are the CRC32C of the page with the checksum field taken
+// as zero, whichever implementation the CPU selects, and features_verify()
+// reports the lowest bad page for any number of threads
+
+enum {
+    // More than two of features_verify()'s chunks of 256 pages
+    FEATURES_TEST_PAGES = 600
+};
+
+static const unsigned features_test_threads[] = {0, 1, 2, 3, 8};
+
+#define FEATURES_TEST_COUNT(array) (sizeof(array) / sizeof((array)[0]))
+
+static uint32_t
+features_test_crc32c(
+        uint32_t crc,
+        const uint8_t *data,
+        size_t size);
+
+static uint32_t
+features_test_page_checksum(const features_page_raw_t *page);
+
+static void
+features_test_verify(
+        const features_data_t *data,
+        uint64_t page_index,
+        uint8_t block);
+
+int
+main(void) {
+    features_switch_value_t value;
+    features_builder_t builder;
+    features_page_raw_t *pages;
+    features_data_t data;
+    uint8_t saved;
+    uint64_t i;
+
+    // The check value of the CRC32C
+    FEATURES_CHECK(0xe3069283 == ~features_test_crc32c(0xffffffff, (const uint8_t *)"123456789", 9));
+
+    features_builder_init(&builder);
+    builder.flags = FEATURES_PAGE_FLAG_CHECKSUM;
+
+    for (i = 0; i < FEATURES_TEST_PAGES; ++i) {
+        value = features_test_value(FEATURES_SWITCH_TYPE_UINT64, i * UINT64_C(0x9e3779b97f4a7c15));
+        FEATURES_CHECK(FEATURES_OK == features_builder_set(&builder,
+                i * 16384 + 256 + i % FEATURES_UINT64_PER_BLOCK, &value, FEATURES_SWITCH_PROPERTY_USED));
+    }
+
+    pages = features_test_encode(&builder, &data);
+    features_builder_free(&builder);
+    FEATURES_CHECK(NULL != pages);
+
+    if (NULL == pages) {
+        return features_test_result();
+    }
+
+    for (i = 0; i < FEATURES_TEST_PAGES; ++i) {
+        FEATURES_CHECK(features_test_page_checksum(pages + i) == features_page_checksum(pages + i));
+        FEATURES_CHECK(features_test_page_checksum(pages + i)
+                == features_read_uint32(&pages[i].header.checksum));
+    }
+
+    // Runs shorter and longer than the lanes checksummed together
+    for (i = 1; i <= 7; ++i) {
+        memset(&pages[FEATURES_TEST_PAGES - i].header.checksum, 0, sizeof(uint32_t));
+        features_checksum(pages + FEATURES_TEST_PAGES - i, i);
+        FEATURES_CHECK(features_test_page_checksum(pages + FEATURES_TEST_PAGES - i)
+                == features_read_uint32(&pages[FEATURES_TEST_PAGES - i].header.checksum));
+    }
+
+    features_test_verify(&data, FEATURES_TEST_PAGES, 0);
+
+    // A damaged value in the last chunk, then a bad block type and a bad
+    // header before it, each the lowest bad page in turn
+    pages[550].blocks[0].data[40] ^= 0x10;
+    features_test_verify(&data, 550, FEATURES_BLOCKS_PER_PAGE);
+
+    pages[300].header.block_info.data[3] |= 0xc0;
+    features_test_verify(&data, 300, 7);
+
+    saved = pages[299].header.MAGIC[0];
+    pages[299].header.MAGIC[0] = 'X';
+    features_test_verify(&data, 299, 0);
+    pages[299].header.MAGIC[0] = saved;
+
+    features_checksum(pages + 300, 1);
+    features_test_verify(&data, 300, 7);
+
+    free(pages);
+
+    return features_test_result();
+}
+
+// Bit at a time, the reference the table and instruction based versions
+// must agree with
+static uint32_t
+features_test_crc32c(
+        uint32_t crc,
+        const uint8_t *data,
+        size_t size) {
+    size_t i;
+    int k;
+
+    for (i = 0; i < size; ++i) {
+        crc ^= data[i];
+
+        for (k = 0; k < 8; ++k) {
+            crc = (crc >> 1) ^ (0x82f63b78 & -(crc & 1));
+        }
+    }
+
+    return crc;
+}
+
+static uint32_t
+features_test_page_checksum(const features_page_raw_t *page) {
+    features_page_raw_t copy;
+
+    memcpy(&copy, page, sizeof(copy));
+    memset(&copy.header.checksum, 0, sizeof(copy.header.checksum));
+
+    return ~features_test_crc32c(0xffffffff, (const uint8_t *)&copy, sizeof(copy));
+}
+
+// page_index FEATURES_TEST_PAGES when every page is good
+static void
+features_test_verify(
+        const features_data_t *data,
+        uint64_t page_index,
+        uint8_t block) {
+    features_verify_result_t result;
+    features_err_t rc;
+    size_t t;
+
+    for (t = 0; t < FEATURES_TEST_COUNT(features_test_threads); ++t) {
+        memset(&result, 0xff, sizeof(result));
+        rc = features_verify(data, features_test_threads[t], &result);
+
+        if (FEATURES_TEST_PAGES == page_index) {
+            FEATURES_CHECK(FEATURES_OK == rc);
+        } else {
+            FEATURES_CHECK(FEATURES_ERR_INVALID == rc);
+            FEATURES_CHECK(page_index == result.page_index);
+            FEATURES_CHECK(block == result.block);
+        }
+    }
+}
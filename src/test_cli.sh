@@ -0,0 +1,93 @@
+#!/bin/sh
+# features dump prints every switch in order and compiles back into the
+# same switches, stat counts them, and diff prints the switches that
+# changed in order and exits 1 when there are any, all with one thread or
+# several running ahead of the output
+
+compile=./features-compile
+features=./features
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+failed=0
+
+fail() {
+    echo "test_cli.sh: $*" >&2
+    failed=1
+}
+
+# Switches in two blocks of every third of 200 pages, which is several
+# chunks of pages. Writes the schema to $1 and what features dump prints
+# for it to $2, one switch in five deprecated.
+schema() {
+    awk -v schema="$1" -v dump="$2" 'BEGIN {
+        split("flag uint8 uint16 uint32 uint64 int8 int16 int32 int64", types, " ")
+        for (page = 0; page < 200; page += 3) {
+            for (block = 1; block <= 2; ++block) {
+                type = types[1 + (page + block) % 9]
+                for (slot = 0; slot < 3; ++slot) {
+                    number = page * 16384 + block * 256 + slot
+                    value = (page * 7 + block * 3 + slot) % 100
+                    if ("flag" == type) {
+                        value = value % 2 ? "true" : "false"
+                    } else if ("int" == substr(type, 1, 3)) {
+                        value = -value
+                    }
+                    deprecated = 0 == (page + block + slot) % 5
+                    printf "%d %s %s%s\n", number, type, value,
+                        deprecated ? " used,deprecated" : "" > schema
+                    printf "%d\t%s\t%s\t%s\n", number, type, deprecated ? "-" : value,
+                        deprecated ? "used,deprecated" : "used" > dump
+                }
+            }
+        }
+    }'
+}
+
+schema "$dir/schema" "$dir/expected"
+$compile -o "$dir/base" "$dir/schema" > /dev/null || fail "the schema does not compile"
+$compile -s -o "$dir/sparse" "$dir/schema" > /dev/null || fail "the schema does not compile sparse"
+
+switches=$(wc -l < "$dir/expected")
+deprecated=$(grep -c deprecated "$dir/expected")
+
+for threads in 1 4; do
+    for file in base sparse; do
+        # Every switch in order of switch number
+        $features -j $threads dump "$dir/$file" > "$dir/dump" || fail "-j $threads: dump of $file failed"
+        cmp -s "$dir/dump" "$dir/expected" || fail "-j $threads: dump of $file is not the schema in order"
+
+        # Which compiles back into a file that dumps the same
+        $compile -o "$dir/again" "$dir/dump" > /dev/null || fail "-j $threads: dump of $file does not compile"
+        $features -j $threads dump "$dir/again" > "$dir/dump" || fail "-j $threads: dump of the dump failed"
+        cmp -s "$dir/dump" "$dir/expected" || fail "-j $threads: dump of $file does not compile back"
+
+        # Every block of every stored page, and every used and deprecated
+        # switch
+        pages=$($features -j $threads stat "$dir/$file" | awk '"pages" == $1 { print $2 }')
+        total=$($features -j $threads stat "$dir/$file" | awk '"total" == $1 { print $2, $3, $4 }')
+        [ "$total" = "$((pages * 63)) $switches $deprecated" ] \
+            || fail "-j $threads: stat of $file totals $total for $pages pages"
+
+        # The same switches
+        $features -j $threads diff "$dir/base" "$dir/$file" > "$dir/diff"
+        [ 0 = $? ] || fail "-j $threads: diff of base and $file does not exit 0"
+        [ -s "$dir/diff" ] && fail "-j $threads: diff of base and $file prints changes"
+    done
+
+    # New values on the first and the last page and a switch added to the
+    # last block
+    sed -e 's/^257 uint8 4$/257 uint8 5/' -e 's/^3244546 uint16 94$/3244546 uint16 95/' \
+        "$dir/schema" > "$dir/changed"
+    echo "3244547 uint16 7" >> "$dir/changed"
+    $compile -o "$dir/new" "$dir/changed" > /dev/null || fail "the changed schema does not compile"
+
+    $features -j $threads diff "$dir/base" "$dir/new" > "$dir/diff"
+    [ 1 = $? ] || fail "-j $threads: diff of changed files does not exit 1"
+    printf '%s\t%s\t%s\n' \
+        257 "uint8 4" "uint8 5" \
+        3244546 "uint16 94" "uint16 95" \
+        3244547 unused "uint16 7" > "$dir/expected_diff"
+    cmp -s "$dir/diff" "$dir/expected_diff" || fail "-j $threads: diff prints $(cat "$dir/diff")"
+done
+
+exit $failed
@@ -0,0 +1,108 @@
+#include "checksum.h"
+#include "compact.h"
+#include "test.h"
+
+// Compaction keeps every live switch of every page at its number with
+// its value, whatever it drops around them
+
+static void
+features_test_compact(uint8_t flags);
+
+// Live pages far apart, so the compacted file is sparse
+static const uint32_t features_test_pages[] = {2, 70};
+
+#define FEATURES_TEST_PAGE_COUNT (sizeof(features_test_pages) / sizeof(features_test_pages[0]))
+
+int
+main(void) {
+    features_test_compact(0);
+    features_test_compact(FEATURES_PAGE_FLAG_LITTLE_ENDIAN | FEATURES_PAGE_FLAG_CHECKSUM);
+
+    return features_test_result();
+}
+
+static void
+features_test_compact(uint8_t flags) {
+    features_test_switch_t switches[FEATURES_TEST_PAGE_COUNT * FEATURES_TEST_BLOCKS_PER_PAGE
+        * FEATURES_TEST_SWITCHES_PER_BLOCK];
+    features_switch_value_t old_value;
+    features_switch_value_t new_value;
+    features_verify_result_t result;
+    features_compact_stats_t stats;
+    features_switch_number_t switch_number;
+    features_builder_t builder;
+    features_data_t old_data;
+    features_data_t new_data;
+    features_err_t old_rc;
+    features_err_t new_rc;
+    uint64_t live;
+    size_t count;
+    void *old_raw;
+    void *new_raw;
+
+    features_builder_init(&builder);
+    builder.flags = flags;
+    count = features_test_fill(&builder, features_test_pages, FEATURES_TEST_PAGE_COUNT, 5, switches);
+
+    // Pages and blocks with nothing live: a deprecated switch on page 0,
+    // a deprecated block on page 1 and a block of page 2 holding only a
+    // deprecated switch
+    old_value = features_test_value(FEATURES_SWITCH_TYPE_UINT32, 1);
+    features_builder_set(&builder, 3 * 256 + 1, &old_value,
+            FEATURES_SWITCH_PROPERTY_USED | FEATURES_SWITCH_PROPERTY_DEPRECATED);
+    features_builder_set(&builder, 2 * 16384 + 20 * 256 + 1, &old_value,
+            FEATURES_SWITCH_PROPERTY_USED | FEATURES_SWITCH_PROPERTY_DEPRECATED);
+    old_value = features_test_value(FEATURES_SWITCH_TYPE_DEPRECATED, 0);
+    features_builder_set(&builder, 16384 + 256, &old_value, 0);
+
+    old_raw = features_test_encode(&builder, &old_data);
+    features_builder_free(&builder);
+    FEATURES_CHECK(NULL != old_raw);
+
+    if (NULL == old_raw) {
+        return;
+    }
+
+    features_builder_init(&builder);
+    FEATURES_CHECK(FEATURES_OK == features_compact(&builder, &old_data, &stats));
+    new_raw = features_test_encode(&builder, &new_data);
+    features_builder_free(&builder);
+    FEATURES_CHECK(NULL != new_raw);
+
+    if (NULL == new_raw) {
+        free(old_raw);
+        return;
+    }
+
+    FEATURES_CHECK(2 == stats.page_offset);
+    FEATURES_CHECK(2 == stats.new_pages);
+    FEATURES_CHECK(1 == stats.deprecated_blocks);
+    FEATURES_CHECK(stats.new_size < stats.old_size);
+    FEATURES_CHECK(stats.new_size == features_data_size(&new_data));
+    FEATURES_CHECK(FEATURES_PAGE_FLAG_SPARSE == (new_data.flags & ~flags));
+    FEATURES_CHECK(FEATURES_OK == features_verify(&new_data, 1, &result));
+
+    features_test_check_switches(&new_data, switches, count);
+
+    // Every switch number of every page, not only the ones set
+    live = 0;
+
+    for (switch_number = 0; switch_number < 71 * 16384; ++switch_number) {
+        old_rc = features_switch_value(&old_data, switch_number, &old_value);
+
+        if (FEATURES_OK != old_rc) {
+            continue;
+        }
+
+        ++live;
+        new_rc = features_switch_value(&new_data, switch_number, &new_value);
+        FEATURES_CHECK(FEATURES_OK == new_rc);
+        FEATURES_CHECK(FEATURES_OK != new_rc || features_test_value_equal(&old_value, &new_value));
+    }
+
+    // Two of the three switches of every block of features_test_fill()
+    FEATURES_CHECK(2 * FEATURES_TEST_PAGE_COUNT * FEATURES_TEST_BLOCKS_PER_PAGE == live);
+
+    free(old_raw);
+    free(new_raw);
+}
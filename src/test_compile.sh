@@ -0,0 +1,77 @@
+#!/bin/sh
+# An incremental features-compile writes the same file as a full build of
+# the same schema, and encodes only the pages whose definitions changed
+
+compile=./features-compile
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+failed=0
+
+fail() {
+    echo "test_compile.sh: $*" >&2
+    failed=1
+}
+
+# A few switches in four blocks of each of 200 pages, values from seed $1
+schema() {
+    awk -v seed="$1" 'BEGIN {
+        split("flag uint8 uint16 uint32 uint64 int8 int16 int32 int64", types, " ")
+        for (page = 0; page < 200; ++page) {
+            for (block = 1; block <= 4; ++block) {
+                type = types[1 + (page + block) % 9]
+                for (slot = 0; slot < 3; ++slot) {
+                    value = (page * 7 + block * 3 + slot + seed) % 100
+                    if ("flag" == type) {
+                        value = value % 2 ? "true" : "false"
+                    }
+                    printf "%d %s %s%s\n", page * 16384 + block * 256 + slot, type, value,
+                        1 == slot ? " used,deprecated" : ""
+                }
+            }
+        }
+        print (9 * 16384 + 10 * 256) " deprecated"
+    }'
+}
+
+# Builds $2 incrementally over the build of $1, then checks it against a
+# full build and that $3 pages were encoded, all for every page, with
+# compile options $4
+check() {
+    rm -f "$dir/out" "$dir/out.state"
+    $compile $4 -j 3 -i -o "$dir/out" "$1" > /dev/null || fail "$4: $1 does not compile"
+    result=$($compile $4 -j 3 -i -o "$dir/out" "$2") || fail "$4: $2 does not compile"
+    $compile $4 -j 1 -o "$dir/full" "$2" > /dev/null || fail "$4: $2 does not compile"
+    cmp -s "$dir/out" "$dir/full" || fail "$4: incremental build of $2 differs from a full build"
+
+    encoded=$(echo "$result" | sed -n 's/.*: encoded \([0-9]*\) of \([0-9]*\) pages.*/\1 \2/p')
+    expected=$3
+
+    if [ all = "$expected" ]; then
+        expected=${encoded#* }
+    fi
+
+    [ "${encoded% *}" = "$expected" ] || fail "$4: expected $expected pages encoded: $result"
+}
+
+schema 0 > "$dir/base"
+
+# New values on two pages, in different chunks of pages
+awk '(3 == int($1 / 16384) || 150 == int($1 / 16384)) && "flag" != $2 { $3 = 99 } { print }' \
+    "$dir/base" > "$dir/values"
+
+# A switch dropped from one page and a block deprecated on another
+awk '$1 != 70 * 16384 + 257 { print }' "$dir/base" > "$dir/dropped"
+echo "$((150 * 16384 + 12 * 256)) deprecated" >> "$dir/dropped"
+
+# A page past the last one, which changes the layout
+cp "$dir/base" "$dir/grown"
+echo "$((230 * 16384 + 256)) uint32 5" >> "$dir/grown"
+
+for options in "" "-c" "-s" "-l -c" "-n -s -c"; do
+    check "$dir/base" "$dir/base" 0 "$options"
+    check "$dir/base" "$dir/values" 2 "$options"
+    check "$dir/base" "$dir/dropped" 2 "$options"
+    check "$dir/base" "$dir/grown" all "$options"
+done
+
+exit $failed
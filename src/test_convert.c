@@ -0,0 +1,163 @@
+#include "checksum.h"
+#include "convert.h"
+#include "test.h"
+
+// features_convert() swaps every multi byte value exactly as swapping
+// them one at a time does, and converting back restores the pages
+
+static const uint32_t features_test_pages[] = {0, 1, 2};
+
+#define FEATURES_TEST_PAGE_COUNT (sizeof(features_test_pages) / sizeof(features_test_pages[0]))
+
+static void
+features_test_scramble(
+        features_page_raw_t *page,
+        uint64_t *seed);
+
+static void
+features_test_swap(features_page_raw_t *page);
+
+int
+main(void) {
+    features_test_switch_t switches[FEATURES_TEST_PAGE_COUNT * FEATURES_TEST_BLOCKS_PER_PAGE
+        * FEATURES_TEST_SWITCHES_PER_BLOCK];
+    features_verify_result_t result;
+    features_builder_t builder;
+    features_page_raw_t *original;
+    features_page_raw_t *expected;
+    features_page_raw_t *pages;
+    features_data_t data;
+    uint64_t seed;
+    size_t count;
+    size_t size;
+    size_t i;
+
+    features_builder_init(&builder);
+    builder.flags = FEATURES_PAGE_FLAG_CHECKSUM;
+    count = features_test_fill(&builder, features_test_pages, FEATURES_TEST_PAGE_COUNT, 17, switches);
+    size = features_builder_size(&builder);
+    pages = features_test_encode(&builder, &data);
+    features_builder_free(&builder);
+    original = malloc(size);
+    expected = malloc(size);
+    FEATURES_CHECK(NULL != pages && NULL != original && NULL != expected);
+
+    if (NULL == pages || NULL == original || NULL == expected) {
+        free(pages);
+        free(original);
+        free(expected);
+        return features_test_result();
+    }
+
+    // Every value byte differs, so a value swapped with the wrong width
+    // or at the wrong offset shows
+    seed = 23;
+
+    for (i = 0; i < FEATURES_TEST_PAGE_COUNT; ++i) {
+        features_test_scramble(pages + i, &seed);
+    }
+
+    features_checksum(pages, FEATURES_TEST_PAGE_COUNT);
+    memcpy(original, pages, size);
+    memcpy(expected, pages, size);
+
+    for (i = 0; i < FEATURES_TEST_PAGE_COUNT; ++i) {
+        features_test_swap(expected + i);
+    }
+
+    features_checksum(expected, FEATURES_TEST_PAGE_COUNT);
+
+    features_convert(pages, FEATURES_TEST_PAGE_COUNT, FEATURES_PAGE_FLAG_LITTLE_ENDIAN);
+    FEATURES_CHECK(0 == memcmp(expected, pages, size));
+
+    FEATURES_CHECK(FEATURES_OK == features_data(&data, pages));
+    FEATURES_CHECK(FEATURES_OK == features_verify(&data, 1, &result));
+
+    // Pages already in the order asked for are left alone
+    features_convert(pages, FEATURES_TEST_PAGE_COUNT, FEATURES_PAGE_FLAG_LITTLE_ENDIAN);
+    FEATURES_CHECK(0 == memcmp(expected, pages, size));
+
+    features_convert(pages, FEATURES_TEST_PAGE_COUNT, 0);
+    FEATURES_CHECK(0 == memcmp(original, pages, size));
+
+    // Unscrambled switches read the same in either order
+    features_builder_init(&builder);
+    features_test_fill(&builder, features_test_pages, FEATURES_TEST_PAGE_COUNT, 17, switches);
+    features_builder_write(&builder, pages);
+    features_builder_free(&builder);
+    features_convert(pages, FEATURES_TEST_PAGE_COUNT, FEATURES_PAGE_FLAG_LITTLE_ENDIAN);
+    FEATURES_CHECK(FEATURES_OK == features_data(&data, pages));
+    features_test_check_switches(&data, switches, count);
+
+    free(pages);
+    free(original);
+    free(expected);
+
+    return features_test_result();
+}
+
+// Fills the values of every typed block with random bytes
+static void
+features_test_scramble(
+        features_page_raw_t *page,
+        uint64_t *seed) {
+    features_switch_type_t type;
+    uint8_t type_byte;
+    uint8_t *data;
+    size_t size;
+    size_t k;
+    int b;
+
+    for (b = 1; b < FEATURES_BLOCKS_PER_PAGE; ++b) {
+        type_byte = page->header.block_info.data[b / 2];
+        type = (features_switch_type_t)((b % 2 ? type_byte >> 4 : type_byte) & 0xf);
+
+        if (0 == features_block_width(type)) {
+            continue;
+        }
+
+        data = page->blocks[b - 1].data + features_block_properties_size(type);
+        size = FEATURES_BLOCK_SIZE - features_block_properties_size(type);
+
+        for (k = 0; k < size; ++k) {
+            data[k] = (uint8_t)features_test_random(seed);
+        }
+    }
+}
+
+// Reverses the bytes of one value at a time and flips the page flag
+static void
+features_test_swap(features_page_raw_t *page) {
+    features_switch_type_t type;
+    uint8_t type_byte;
+    uint8_t width;
+    uint8_t *value;
+    uint8_t tmp;
+    unsigned capacity;
+    unsigned i;
+    unsigned k;
+    int b;
+
+    for (b = 1; b < FEATURES_BLOCKS_PER_PAGE; ++b) {
+        type_byte = page->header.block_info.data[b / 2];
+        type = (features_switch_type_t)((b % 2 ? type_byte >> 4 : type_byte) & 0xf);
+        width = features_block_width(type);
+        capacity = features_block_capacity(type);
+
+        if (width < 2) {
+            continue;
+        }
+
+        value = page->blocks[b - 1].data + features_block_properties_size(type);
+
+        for (i = 0; i < capacity; ++i, value += width) {
+            for (k = 0; k < width / 2u; ++k) {
+                tmp = value[k];
+                value[k] = value[width - 1 - k];
+                value[width - 1 - k] = tmp;
+            }
+        }
+    }
+
+    page->header.flags ^= FEATURES_PAGE_FLAG_LITTLE_ENDIAN;
+}
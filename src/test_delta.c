@@ -0,0 +1,206 @@
+#include "checksum.h"
+#include "delta.h"
+#include "file.h"
+#include "test.h"
+
+// A delta applied to its base reads exactly as the target it was created
+// from, refuses any other base, and the result of one delta is the base
+// of the next
+
+static void
+features_test_delta(uint8_t flags);
+
+static void
+features_test_untouched(void);
+
+static const uint32_t features_test_pages[] = {0, 1, 5};
+
+#define FEATURES_TEST_PAGE_COUNT (sizeof(features_test_pages) / sizeof(features_test_pages[0]))
+
+#define FEATURES_TEST_SWITCH_COUNT (FEATURES_TEST_PAGE_COUNT * FEATURES_TEST_BLOCKS_PER_PAGE \
+        * FEATURES_TEST_SWITCHES_PER_BLOCK)
+
+int
+main(void) {
+    features_test_delta(0);
+    features_test_delta(FEATURES_PAGE_FLAG_LITTLE_ENDIAN | FEATURES_PAGE_FLAG_CHECKSUM);
+    features_test_untouched();
+
+    return features_test_result();
+}
+
+static void
+features_test_delta(uint8_t flags) {
+    features_test_switch_t switches[FEATURES_TEST_SWITCH_COUNT + 1];
+    features_verify_result_t result;
+    features_builder_t builder;
+    features_file_t target;
+    features_file_t back;
+    features_file_t base;
+    features_file_t out;
+    char target_path[256];
+    char base_path[256];
+    size_t back_size;
+    size_t count;
+    size_t size;
+    void *back_delta;
+    void *delta;
+
+    features_test_path(base_path, sizeof(base_path), "base.bin");
+    features_test_path(target_path, sizeof(target_path), "target.bin");
+
+    features_builder_init(&builder);
+    builder.flags = flags;
+    count = features_test_fill(&builder, features_test_pages, FEATURES_TEST_PAGE_COUNT, 7, switches);
+    FEATURES_CHECK(FEATURES_OK == features_builder_save(&builder, base_path));
+
+    // The target changes a value on page 1, marks a switch on page 5
+    // deprecated and adds a page
+    switches[30].value = features_test_value(switches[30].value.type,
+            switches[30].value.value.uint64 + 1);
+    FEATURES_CHECK(FEATURES_OK == features_builder_set(&builder,
+            switches[30].switch_number, &switches[30].value, switches[30].properties));
+
+    switches[60].properties |= FEATURES_SWITCH_PROPERTY_DEPRECATED;
+    FEATURES_CHECK(FEATURES_OK == features_builder_set(&builder,
+            switches[60].switch_number, &switches[60].value, switches[60].properties));
+
+    switches[count].switch_number = 8 * 16384 + 3 * 256 + 4;
+    switches[count].value = features_test_value(FEATURES_SWITCH_TYPE_UINT16, 4242);
+    switches[count].properties = FEATURES_SWITCH_PROPERTY_USED;
+    FEATURES_CHECK(FEATURES_OK == features_builder_set(&builder,
+            switches[count].switch_number, &switches[count].value, switches[count].properties));
+    ++count;
+
+    FEATURES_CHECK(FEATURES_OK == features_builder_save(&builder, target_path));
+    features_builder_free(&builder);
+
+    FEATURES_CHECK(FEATURES_OK == features_open(&base, base_path));
+    FEATURES_CHECK(FEATURES_OK == features_open(&target, target_path));
+
+    if (NULL == base.map || NULL == target.map) {
+        unlink(base_path);
+        unlink(target_path);
+        return;
+    }
+
+    delta = NULL;
+    FEATURES_CHECK(FEATURES_OK == features_delta_create(&base.data, &target.data, &delta, &size));
+
+    if (NULL != delta) {
+        // Much smaller than the 9 page target
+        FEATURES_CHECK(size < 2 * FEATURES_PAGE_SIZE);
+
+        FEATURES_CHECK(FEATURES_OK == features_delta_apply(&out, &base, delta, size));
+        FEATURES_CHECK(base.hashed && out.hashed);
+
+        if (NULL != out.map) {
+            FEATURES_CHECK(target.data.page_count == out.data.page_count);
+            FEATURES_CHECK(target.data.flags == out.data.flags);
+            FEATURES_CHECK(0 == memcmp(target.data.pages, out.data.pages,
+                    (size_t)features_data_size(&target.data)));
+            features_test_check_switches(&out.data, switches, count);
+            FEATURES_CHECK(FEATURES_OK == features_verify(&out.data, 1, &result));
+
+            // Back to the base from the result, which carries the hash of
+            // the target rather than hashing itself
+            back_delta = NULL;
+            FEATURES_CHECK(FEATURES_OK == features_delta_create(&target.data, &base.data,
+                    &back_delta, &back_size));
+
+            if (NULL != back_delta) {
+                FEATURES_CHECK(FEATURES_OK == features_delta_apply(&back, &out, back_delta, back_size));
+
+                if (NULL != back.map) {
+                    FEATURES_CHECK(back.hashed && base.hash == back.hash);
+                    FEATURES_CHECK(0 == memcmp(base.data.pages, back.data.pages,
+                            (size_t)features_data_size(&base.data)));
+                    features_close(&back);
+                }
+
+                // As does the target hashed itself
+                FEATURES_CHECK(FEATURES_OK == features_delta_apply(&back, &target, back_delta, back_size));
+                FEATURES_CHECK(target.hashed && out.hash == target.hash);
+                features_close(&back);
+                free(back_delta);
+            }
+
+            features_close(&out);
+        }
+
+        // The target is not the base the delta was created from
+        FEATURES_CHECK(FEATURES_OK != features_delta_apply(&out, &target, delta, size));
+
+        free(delta);
+    }
+
+    features_close(&base);
+    features_close(&target);
+    unlink(base_path);
+    unlink(target_path);
+}
+
+// A base that differs from the delta's only in a page the delta does not
+// touch is refused
+static void
+features_test_untouched(void) {
+    features_test_switch_t switches[FEATURES_TEST_SWITCH_COUNT];
+    features_switch_value_t value;
+    features_builder_t builder;
+    features_file_t target;
+    features_file_t other;
+    features_file_t base;
+    features_file_t out;
+    char target_path[256];
+    char other_path[256];
+    char base_path[256];
+    size_t size;
+    void *delta;
+
+    features_test_path(base_path, sizeof(base_path), "base.bin");
+    features_test_path(target_path, sizeof(target_path), "target.bin");
+    features_test_path(other_path, sizeof(other_path), "other.bin");
+
+    features_builder_init(&builder);
+    features_test_fill(&builder, features_test_pages, FEATURES_TEST_PAGE_COUNT, 7, switches);
+    FEATURES_CHECK(FEATURES_OK == features_builder_save(&builder, base_path));
+
+    // The target changes a value on page 1 only
+    value = features_test_value(switches[30].value.type, switches[30].value.value.uint64 + 1);
+    FEATURES_CHECK(FEATURES_OK == features_builder_set(&builder,
+            switches[30].switch_number, &value, switches[30].properties));
+    FEATURES_CHECK(FEATURES_OK == features_builder_save(&builder, target_path));
+
+    // The other base has page 1 as the base has it, and a change on page 0
+    FEATURES_CHECK(FEATURES_OK == features_builder_set(&builder,
+            switches[30].switch_number, &switches[30].value, switches[30].properties));
+    value = features_test_value(switches[0].value.type, switches[0].value.value.uint64 + 1);
+    FEATURES_CHECK(FEATURES_OK == features_builder_set(&builder,
+            switches[0].switch_number, &value, switches[0].properties));
+    FEATURES_CHECK(FEATURES_OK == features_builder_save(&builder, other_path));
+    features_builder_free(&builder);
+
+    FEATURES_CHECK(FEATURES_OK == features_open(&base, base_path));
+    FEATURES_CHECK(FEATURES_OK == features_open(&target, target_path));
+    FEATURES_CHECK(FEATURES_OK == features_open(&other, other_path));
+
+    delta = NULL;
+
+    if (NULL != base.map && NULL != target.map && NULL != other.map) {
+        FEATURES_CHECK(FEATURES_OK == features_delta_create(&base.data, &target.data, &delta, &size));
+    }
+
+    if (NULL != delta) {
+        FEATURES_CHECK(FEATURES_ERR_INVALID == features_delta_apply(&out, &other, delta, size));
+        FEATURES_CHECK(FEATURES_OK == features_delta_apply(&out, &base, delta, size));
+        features_close(&out);
+        free(delta);
+    }
+
+    features_close(&base);
+    features_close(&target);
+    features_close(&other);
+    unlink(base_path);
+    unlink(target_path);
+    unlink(other_path);
+}
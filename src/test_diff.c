@@ -0,0 +1,125 @@
+#include "diff.h"
+#include "test.h"
+
+// features_diff() reports every switch that reads differently, and only
+// those
+
+enum {
+    FEATURES_TEST_MAX_CHANGES = 16
+};
+
+typedef struct features_test_changes_t {
+    features_switch_change_t changes[FEATURES_TEST_MAX_CHANGES];
+    size_t count;
+} features_test_changes_t;
+
+static void
+features_test_collect(
+        const features_switch_change_t *change,
+        void *ctx);
+
+static const uint32_t features_test_pages[] = {0, 2};
+
+#define FEATURES_TEST_PAGE_COUNT (sizeof(features_test_pages) / sizeof(features_test_pages[0]))
+
+int
+main(void) {
+    features_test_switch_t switches[FEATURES_TEST_PAGE_COUNT * FEATURES_TEST_BLOCKS_PER_PAGE
+        * FEATURES_TEST_SWITCHES_PER_BLOCK];
+    features_test_changes_t changes;
+    features_test_changes_t split;
+    features_switch_value_t value;
+    features_builder_t builder;
+    features_data_t old_data;
+    features_data_t new_data;
+    void *old_raw;
+    void *new_raw;
+    size_t i;
+
+    features_builder_init(&builder);
+    features_test_fill(&builder, features_test_pages, FEATURES_TEST_PAGE_COUNT, 3, switches);
+    old_raw = features_test_encode(&builder, &old_data);
+
+    // A changed value, a deprecated switch, a removed switch and a new
+    // switch in a free slot, in switch number order. A new block would
+    // also change its slots past the capacity from unused to invalid.
+    value = features_test_value(switches[6].value.type, switches[6].value.value.uint64 + 1);
+    FEATURES_CHECK(FEATURES_OK == features_builder_set(&builder,
+            switches[6].switch_number, &value, switches[6].properties));
+    FEATURES_CHECK(FEATURES_OK == features_builder_set(&builder,
+            switches[9].switch_number, &switches[9].value,
+            FEATURES_SWITCH_PROPERTY_USED | FEATURES_SWITCH_PROPERTY_DEPRECATED));
+    FEATURES_CHECK(FEATURES_OK == features_builder_set(&builder,
+            switches[14].switch_number, &switches[14].value, 0));
+    FEATURES_CHECK(FEATURES_OK == features_builder_set(&builder, 2 * 16384 + 3 * 256 + 2, &value, 1));
+    new_raw = features_test_encode(&builder, &new_data);
+    features_builder_free(&builder);
+
+    FEATURES_CHECK(NULL != old_raw && NULL != new_raw);
+
+    if (NULL == old_raw || NULL == new_raw) {
+        free(old_raw);
+        free(new_raw);
+        return features_test_result();
+    }
+
+    changes.count = 0;
+    FEATURES_CHECK(FEATURES_OK == features_diff(&old_data, &old_data, features_test_collect, &changes));
+    FEATURES_CHECK(0 == changes.count);
+
+    changes.count = 0;
+    FEATURES_CHECK(FEATURES_OK == features_diff(&old_data, &new_data, features_test_collect, &changes));
+    FEATURES_CHECK(4 == changes.count);
+
+    if (4 == changes.count) {
+        FEATURES_CHECK(switches[6].switch_number == changes.changes[0].switch_number);
+        FEATURES_CHECK(FEATURES_OK == changes.changes[0].old_rc);
+        FEATURES_CHECK(FEATURES_OK == changes.changes[0].new_rc);
+        FEATURES_CHECK(features_test_value_equal(&changes.changes[0].old_value, &switches[6].value));
+        FEATURES_CHECK(features_test_value_equal(&changes.changes[0].new_value, &value));
+
+        FEATURES_CHECK(switches[9].switch_number == changes.changes[1].switch_number);
+        FEATURES_CHECK(FEATURES_OK == changes.changes[1].old_rc);
+        FEATURES_CHECK(FEATURES_ERR_DEPRECATED == changes.changes[1].new_rc);
+
+        FEATURES_CHECK(switches[14].switch_number == changes.changes[2].switch_number);
+        FEATURES_CHECK(FEATURES_OK == changes.changes[2].old_rc);
+        FEATURES_CHECK(FEATURES_ERR_UNUSED == changes.changes[2].new_rc);
+
+        FEATURES_CHECK(2 * 16384 + 3 * 256 + 2 == changes.changes[3].switch_number);
+        FEATURES_CHECK(FEATURES_ERR_UNUSED == changes.changes[3].old_rc);
+        FEATURES_CHECK(FEATURES_OK == changes.changes[3].new_rc);
+    }
+
+    // A diff split by page range reports the same changes
+    split.count = 0;
+    FEATURES_CHECK(FEATURES_OK == features_diff_pages(&old_data, &new_data, 0, 1,
+            features_test_collect, &split));
+    FEATURES_CHECK(FEATURES_OK == features_diff_pages(&old_data, &new_data, 1, 3,
+            features_test_collect, &split));
+    FEATURES_CHECK(changes.count == split.count);
+
+    for (i = 0; i < changes.count && i < split.count && i < FEATURES_TEST_MAX_CHANGES; ++i) {
+        FEATURES_CHECK(changes.changes[i].switch_number == split.changes[i].switch_number);
+    }
+
+    free(old_raw);
+    free(new_raw);
+
+    return features_test_result();
+}
+
+static void
+features_test_collect(
+        const features_switch_change_t *change,
+        void *ctx) {
+    features_test_changes_t *changes;
+
+    changes = ctx;
+
+    if (changes->count < FEATURES_TEST_MAX_CHANGES) {
+        changes->changes[changes->count] = *change;
+    }
+
+    ++changes->count;
+}
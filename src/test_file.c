@@ -0,0 +1,157 @@
+#include "builder.h"
+#include "checksum.h"
+#include "file.h"
+#include "test.h"
+
+// Builder to file to lookups, for every layout a file can have
+
+static void
+features_test_round_trip(uint8_t flags);
+
+static void
+features_test_corrupt(
+        const char *path,
+        const char *corrupt_path,
+        uint64_t offset,
+        const void *bytes,
+        size_t size);
+
+// Pages with gaps between them, the last one in the third directory entry
+// of a sparse file
+static const uint32_t features_test_pages[] = {0, 1, 5, 70, 130};
+
+#define FEATURES_TEST_PAGE_COUNT (sizeof(features_test_pages) / sizeof(features_test_pages[0]))
+
+int
+main(void) {
+    features_test_round_trip(0);
+    features_test_round_trip(FEATURES_PAGE_FLAG_SPARSE);
+    features_test_round_trip(FEATURES_PAGE_FLAG_LITTLE_ENDIAN | FEATURES_PAGE_FLAG_CHECKSUM);
+    features_test_round_trip(FEATURES_PAGE_FLAG_SPARSE | FEATURES_PAGE_FLAG_LITTLE_ENDIAN
+            | FEATURES_PAGE_FLAG_CHECKSUM);
+
+    return features_test_result();
+}
+
+static void
+features_test_round_trip(uint8_t flags) {
+    features_test_switch_t switches[FEATURES_TEST_PAGE_COUNT * FEATURES_TEST_BLOCKS_PER_PAGE
+        * FEATURES_TEST_SWITCHES_PER_BLOCK];
+    features_verify_result_t result;
+    features_switch_value_t value;
+    features_builder_t builder;
+    features_file_t file;
+    char corrupt_path[256];
+    char path[256];
+    uint64_t stored;
+    uint64_t rank;
+    uint8_t byte;
+    size_t count;
+
+    features_test_path(path, sizeof(path), "file.bin");
+    features_test_path(corrupt_path, sizeof(corrupt_path), "corrupt.bin");
+
+    features_builder_init(&builder);
+    builder.flags = flags;
+    count = features_test_fill(&builder, features_test_pages, FEATURES_TEST_PAGE_COUNT, flags,
+            switches);
+    FEATURES_CHECK(FEATURES_OK == features_builder_save(&builder, path));
+    features_builder_free(&builder);
+
+    FEATURES_CHECK(FEATURES_OK == features_open(&file, path));
+
+    if (NULL == file.map) {
+        unlink(path);
+        return;
+    }
+
+    stored = flags & FEATURES_PAGE_FLAG_SPARSE ? FEATURES_TEST_PAGE_COUNT : 131;
+    FEATURES_CHECK(flags == file.data.flags);
+    FEATURES_CHECK(stored == file.data.page_count);
+    FEATURES_CHECK(131 == file.data.page_span);
+
+    features_test_check_switches(&file.data, switches, count);
+
+    // A slot left empty in a typed block, a page without switches and a
+    // page past the end
+    FEATURES_CHECK(FEATURES_ERR_UNUSED == features_switch_value(&file.data, 1 * 256 + 2, &value));
+    FEATURES_CHECK(FEATURES_ERR_UNUSED == features_switch_value(&file.data, 3 * 16384 + 256, &value));
+    FEATURES_CHECK(FEATURES_ERR_UNUSED == features_switch_value(&file.data, 131 * 16384 + 256, &value));
+
+    // Lookups through the block index read the same
+    FEATURES_CHECK(FEATURES_OK == features_data_index(&file.data));
+    features_test_check_switches(&file.data, switches, count);
+
+    FEATURES_CHECK(FEATURES_OK == features_verify(&file.data, 2, &result));
+    features_close(&file);
+
+    if (flags & FEATURES_PAGE_FLAG_CHECKSUM) {
+        // A flipped bit in the last block of the second stored page
+        byte = 0x5a;
+        features_test_corrupt(path, corrupt_path, 2 * FEATURES_PAGE_SIZE - 1, &byte, 1);
+        FEATURES_CHECK(FEATURES_OK == features_open(&file, corrupt_path));
+
+        if (NULL != file.map) {
+            FEATURES_CHECK(FEATURES_ERR_INVALID == features_verify(&file.data, 2, &result));
+            FEATURES_CHECK(1 == result.page_index);
+            FEATURES_CHECK(1 == result.page_number);
+            features_close(&file);
+        }
+    }
+
+    if (flags & FEATURES_PAGE_FLAG_SPARSE) {
+        // A rank of the second directory entry that points past the pages
+        rank = UINT64_C(0x0900000000000000);
+        features_test_corrupt(path, corrupt_path,
+                stored * FEATURES_PAGE_SIZE + sizeof(features_page_directory_t) + sizeof(uint64_t),
+                &rank, sizeof(rank));
+        FEATURES_CHECK(FEATURES_ERR_INVALID == features_open(&file, corrupt_path));
+    }
+
+    unlink(corrupt_path);
+    unlink(path);
+}
+
+// Copies path to corrupt_path with size bytes at offset replaced
+static void
+features_test_corrupt(
+        const char *path,
+        const char *corrupt_path,
+        uint64_t offset,
+        const void *bytes,
+        size_t size) {
+    uint8_t *buf;
+    FILE *f;
+    long n;
+
+    f = fopen(path, "rb");
+    FEATURES_CHECK(NULL != f);
+
+    if (NULL == f) {
+        return;
+    }
+
+    fseek(f, 0, SEEK_END);
+    n = ftell(f);
+    rewind(f);
+
+    buf = malloc((size_t)n);
+    FEATURES_CHECK(NULL != buf && (size_t)n == fread(buf, 1, (size_t)n, f));
+    fclose(f);
+
+    if (NULL == buf) {
+        return;
+    }
+
+    FEATURES_CHECK(offset + size <= (uint64_t)n);
+    memcpy(buf + offset, bytes, size);
+
+    f = fopen(corrupt_path, "wb");
+    FEATURES_CHECK(NULL != f && (size_t)n == fwrite(buf, 1, (size_t)n, f));
+
+    if (NULL != f) {
+        fclose(f);
+    }
+
+    free(buf);
+}
@@ -0,0 +1,169 @@
+#include "flagset.h"
+#include "test.h"
+
+// Every subset of a few flags, including deprecated ones, unused ones and
+// switches that are not flags, tests as testing the flags one at a time
+// would
+
+static void
+features_test_flagset(uint8_t flags);
+
+static int
+features_test_flag_on(
+        const features_data_t *data,
+        features_switch_number_t switch_number);
+
+enum {
+    // On, on, off, on but deprecated and never set, in one block
+    FEATURES_TEST_ON = 256,
+    FEATURES_TEST_ON_2 = 256 + 1,
+    FEATURES_TEST_OFF = 256 + 2,
+    FEATURES_TEST_DEPRECATED = 256 + 3,
+    FEATURES_TEST_UNUSED = 256 + 4,
+    // On, in a second block
+    FEATURES_TEST_OTHER_BLOCK = 2 * 256 + 167,
+    // In a deprecated block
+    FEATURES_TEST_DEPRECATED_BLOCK = 3 * 256 + 5,
+    // A uint8 switch of value 1
+    FEATURES_TEST_NOT_FLAG = 4 * 256,
+    // On a page without switches and on a page past the end
+    FEATURES_TEST_EMPTY_PAGE = 16384 + 256,
+    FEATURES_TEST_PAST_END = 4 * 16384 + 256,
+    // On, on the last page
+    FEATURES_TEST_LAST_PAGE = 2 * 16384 + 5 * 256 + 100
+};
+
+static const features_switch_number_t features_test_switches[] = {
+    FEATURES_TEST_ON,
+    FEATURES_TEST_ON_2,
+    FEATURES_TEST_OFF,
+    FEATURES_TEST_DEPRECATED,
+    FEATURES_TEST_UNUSED,
+    FEATURES_TEST_OTHER_BLOCK,
+    FEATURES_TEST_DEPRECATED_BLOCK,
+    FEATURES_TEST_NOT_FLAG,
+    FEATURES_TEST_EMPTY_PAGE,
+    FEATURES_TEST_PAST_END,
+    FEATURES_TEST_LAST_PAGE
+};
+
+#define FEATURES_TEST_SWITCH_COUNT (sizeof(features_test_switches) / sizeof(features_test_switches[0]))
+
+int
+main(void) {
+    features_test_flagset(0);
+    features_test_flagset(FEATURES_PAGE_FLAG_LITTLE_ENDIAN | FEATURES_PAGE_FLAG_SPARSE);
+
+    return features_test_result();
+}
+
+static void
+features_test_flagset(uint8_t flags) {
+    features_switch_number_t numbers[FEATURES_TEST_SWITCH_COUNT];
+    features_switch_number_t swap;
+    features_switch_value_t value;
+    features_builder_t builder;
+    features_flagset_t set;
+    features_data_t data;
+    size_t count;
+    size_t i;
+    void *raw;
+    int result;
+    int any;
+    int all;
+    int on;
+    unsigned subset;
+
+    features_builder_init(&builder);
+    builder.flags = flags;
+
+    value = features_test_value(FEATURES_SWITCH_TYPE_FLAG, 1);
+    features_builder_set(&builder, FEATURES_TEST_ON, &value, FEATURES_SWITCH_PROPERTY_USED);
+    features_builder_set(&builder, FEATURES_TEST_ON_2, &value, FEATURES_SWITCH_PROPERTY_USED);
+    features_builder_set(&builder, FEATURES_TEST_DEPRECATED, &value,
+            FEATURES_SWITCH_PROPERTY_USED | FEATURES_SWITCH_PROPERTY_DEPRECATED);
+    features_builder_set(&builder, FEATURES_TEST_OTHER_BLOCK, &value, FEATURES_SWITCH_PROPERTY_USED);
+    features_builder_set(&builder, FEATURES_TEST_LAST_PAGE, &value, FEATURES_SWITCH_PROPERTY_USED);
+
+    value = features_test_value(FEATURES_SWITCH_TYPE_FLAG, 0);
+    features_builder_set(&builder, FEATURES_TEST_OFF, &value, FEATURES_SWITCH_PROPERTY_USED);
+
+    value = features_test_value(FEATURES_SWITCH_TYPE_DEPRECATED, 0);
+    features_builder_set(&builder, FEATURES_TEST_DEPRECATED_BLOCK, &value, 0);
+
+    value = features_test_value(FEATURES_SWITCH_TYPE_UINT8, 1);
+    features_builder_set(&builder, FEATURES_TEST_NOT_FLAG, &value, FEATURES_SWITCH_PROPERTY_USED);
+
+    raw = features_test_encode(&builder, &data);
+    features_builder_free(&builder);
+    FEATURES_CHECK(NULL != raw);
+
+    if (NULL == raw) {
+        return;
+    }
+
+    FEATURES_CHECK(features_test_flag_on(&data, FEATURES_TEST_ON));
+    FEATURES_CHECK(!features_test_flag_on(&data, FEATURES_TEST_DEPRECATED));
+
+    for (subset = 1; subset < 1u << FEATURES_TEST_SWITCH_COUNT; ++subset) {
+        count = 0;
+        any = 0;
+        all = 1;
+
+        for (i = 0; i < FEATURES_TEST_SWITCH_COUNT; ++i) {
+            if (subset & (1u << i)) {
+                numbers[count++] = features_test_switches[i];
+                on = features_test_flag_on(&data, features_test_switches[i]);
+                any |= on;
+                all &= on;
+            }
+        }
+
+        // Compiled in reverse order, which the set sorts by block
+        for (i = 0; i < count / 2; ++i) {
+            swap = numbers[i];
+            numbers[i] = numbers[count - 1 - i];
+            numbers[count - 1 - i] = swap;
+        }
+
+        FEATURES_CHECK(FEATURES_OK == features_flagset_compile(&set, numbers, count));
+
+        result = -1;
+        FEATURES_CHECK(FEATURES_OK == features_flagset_test(&set, &data, FEATURES_FLAGSET_ANY, &result));
+        FEATURES_CHECK(any == result);
+
+        result = -1;
+        FEATURES_CHECK(FEATURES_OK == features_flagset_test(&set, &data, FEATURES_FLAGSET_ALL, &result));
+        FEATURES_CHECK(all == result);
+
+        result = -1;
+        FEATURES_CHECK(FEATURES_OK == features_flagset_test(&set, &data, FEATURES_FLAGSET_NONE, &result));
+        FEATURES_CHECK(result == !any);
+
+        features_flagset_free(&set);
+    }
+
+    // A deprecated flag spoils ALL even though it is set
+    numbers[0] = FEATURES_TEST_ON;
+    numbers[1] = FEATURES_TEST_DEPRECATED;
+    FEATURES_CHECK(FEATURES_OK == features_flagset_compile(&set, numbers, 2));
+    FEATURES_CHECK(FEATURES_OK == features_flagset_test(&set, &data, FEATURES_FLAGSET_ALL, &result));
+    FEATURES_CHECK(0 == result);
+    features_flagset_free(&set);
+
+    // No flag block has slot 200
+    numbers[0] = 5 * 256 + 200;
+    FEATURES_CHECK(FEATURES_ERR_INVALID == features_flagset_compile(&set, numbers, 1));
+
+    free(raw);
+}
+
+// Whether the switch reads as a set flag one lookup at a time
+static int
+features_test_flag_on(
+        const features_data_t *data,
+        features_switch_number_t switch_number) {
+    char flag;
+
+    return FEATURES_OK == features_switch_flag_value(data, switch_number, &flag) && 0 != flag;
+}
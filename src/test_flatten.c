@@ -0,0 +1,166 @@
+#include "flatten.h"
+#include "test.h"
+
+// The flat arrays hold what a lookup reads for every switch number, for
+// any split of the pages between threads, and data without pages is
+// refused
+
+static void
+features_test_flatten(
+        const uint32_t *pages,
+        size_t page_count,
+        uint8_t flags);
+
+static void
+features_test_compare(
+        const features_flat_t *flat,
+        const features_data_t *data);
+
+static features_switch_value_t
+features_test_flat_value(
+        const features_flat_t *flat,
+        features_switch_type_t type,
+        uint64_t index);
+
+static const uint32_t features_test_one_page[] = {0};
+
+static const uint32_t features_test_five_pages[] = {0, 1, 2, 3, 4};
+
+// Stored pages of a sparse file, with pages left out between them
+static const uint32_t features_test_gappy_pages[] = {0, 5, 70};
+
+// Thread counts below, at and above the page count, 0 for one per CPU
+static const unsigned features_test_threads[] = {0, 1, 2, 3, 4, 5, 7, 16};
+
+#define FEATURES_TEST_COUNT(array) (sizeof(array) / sizeof((array)[0]))
+
+int
+main(void) {
+    features_test_flatten(features_test_one_page, FEATURES_TEST_COUNT(features_test_one_page), 0);
+    features_test_flatten(features_test_five_pages, FEATURES_TEST_COUNT(features_test_five_pages), 0);
+    features_test_flatten(features_test_five_pages, FEATURES_TEST_COUNT(features_test_five_pages),
+            FEATURES_PAGE_FLAG_LITTLE_ENDIAN);
+    features_test_flatten(features_test_gappy_pages, FEATURES_TEST_COUNT(features_test_gappy_pages),
+            FEATURES_PAGE_FLAG_SPARSE | FEATURES_PAGE_FLAG_LITTLE_ENDIAN);
+
+    return features_test_result();
+}
+
+static void
+features_test_flatten(
+        const uint32_t *pages,
+        size_t page_count,
+        uint8_t flags) {
+    features_test_switch_t *switches;
+    features_builder_t builder;
+    features_flat_t flat;
+    features_data_t data;
+    size_t t;
+    void *raw;
+
+    switches = malloc(page_count * FEATURES_TEST_BLOCKS_PER_PAGE * FEATURES_TEST_SWITCHES_PER_BLOCK
+            * sizeof(features_test_switch_t));
+    FEATURES_CHECK(NULL != switches);
+
+    if (NULL == switches) {
+        return;
+    }
+
+    features_builder_init(&builder);
+    builder.flags = flags;
+    features_test_fill(&builder, pages, page_count, page_count, switches);
+    raw = features_test_encode(&builder, &data);
+    features_builder_free(&builder);
+    free(switches);
+    FEATURES_CHECK(NULL != raw);
+
+    if (NULL == raw) {
+        return;
+    }
+
+    for (t = 0; t < FEATURES_TEST_COUNT(features_test_threads); ++t) {
+        FEATURES_CHECK(FEATURES_OK == features_flatten(&flat, &data, features_test_threads[t]));
+        features_test_compare(&flat, &data);
+        features_flat_free(&flat);
+    }
+
+    data.page_count = 0;
+    FEATURES_CHECK(FEATURES_ERR_INVALID == features_flatten(&flat, &data, 0));
+    features_flat_free(&flat);
+
+    free(raw);
+}
+
+// Every switch number of every page and of the page after the last
+static void
+features_test_compare(
+        const features_flat_t *flat,
+        const features_data_t *data) {
+    features_switch_number_t switch_number;
+    features_switch_number_t end;
+    features_switch_value_t expected;
+    features_switch_value_t value;
+    features_switch_type_t type;
+    features_err_t expected_rc;
+    features_err_t rc;
+    uint64_t index;
+
+    end = (features_switch_number_t)(data->page_offset + data->page_span + 1)
+        * FEATURES_BLOCKS_PER_PAGE * FEATURES_MAX_SWITCHES_PER_BLOCK;
+
+    for (switch_number = 0; switch_number < end; ++switch_number) {
+        expected_rc = features_switch_value(data, switch_number, &expected);
+        rc = features_flat_index(flat, switch_number, &type, &index);
+        FEATURES_CHECK(expected_rc == rc);
+
+        if (FEATURES_OK == rc && FEATURES_OK == expected_rc) {
+            value = features_test_flat_value(flat, type, index);
+            FEATURES_CHECK(features_test_value_equal(&expected, &value));
+        }
+    }
+}
+
+static features_switch_value_t
+features_test_flat_value(
+        const features_flat_t *flat,
+        features_switch_type_t type,
+        uint64_t index) {
+    features_switch_value_t value;
+
+    memset(&value, 0, sizeof(features_switch_value_t));
+    value.type = type;
+
+    switch (type) {
+        case FEATURES_SWITCH_TYPE_FLAG:
+            value.value.flag = flat->values[type].flag[index];
+            break;
+        case FEATURES_SWITCH_TYPE_UINT8:
+            value.value.uint8 = flat->values[type].uint8[index];
+            break;
+        case FEATURES_SWITCH_TYPE_UINT16:
+            value.value.uint16 = flat->values[type].uint16[index];
+            break;
+        case FEATURES_SWITCH_TYPE_UINT32:
+            value.value.uint32 = flat->values[type].uint32[index];
+            break;
+        case FEATURES_SWITCH_TYPE_UINT64:
+            value.value.uint64 = flat->values[type].uint64[index];
+            break;
+        case FEATURES_SWITCH_TYPE_INT8:
+            value.value.int8 = flat->values[type].int8[index];
+            break;
+        case FEATURES_SWITCH_TYPE_INT16:
+            value.value.int16 = flat->values[type].int16[index];
+            break;
+        case FEATURES_SWITCH_TYPE_INT32:
+            value.value.int32 = flat->values[type].int32[index];
+            break;
+        case FEATURES_SWITCH_TYPE_INT64:
+            value.value.int64 = flat->values[type].int64[index];
+            break;
+        default:
+            break;
+    }
+
+    return value;
+}
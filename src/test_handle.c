@@ -0,0 +1,112 @@
+#include "byteorder.h"
+#include "handle.h"
+#include "test.h"
+
+// A resolved handle reads what a lookup reads, and carries the status of
+// a switch that cannot be read
+
+enum {
+    FEATURES_TEST_UINT16_BLOCK = 1,
+    FEATURES_TEST_FLAG_BLOCK = 2
+};
+
+static void
+features_test_page(
+        features_page_raw_t *page,
+        uint32_t page_number,
+        uint32_t page_count);
+
+static void
+features_test_property(
+        uint8_t *block,
+        uint8_t slot,
+        uint8_t properties);
+
+int
+main(void) {
+    static features_page_raw_t pages[1];
+    features_handle_t handle;
+    features_data_t data;
+    uint8_t *block;
+    uint16_t val16;
+    uint16_t lookup16;
+    char flag;
+
+    // A uint16 block with slot 3 set, slot 4 deprecated, and a flag
+    // block with slot 9 on and slot 10 off
+    features_test_page(&pages[0], 0, 1);
+
+    block = pages[0].blocks[FEATURES_TEST_UINT16_BLOCK - 1].data;
+    features_test_property(block, 3, 1);
+    features_write_uint16(block + FEATURES_UINT16_PROPERTIES_SIZE + 3 * 2, 0x1234);
+    features_test_property(block, 4, 3);
+
+    block = pages[0].blocks[FEATURES_TEST_FLAG_BLOCK - 1].data;
+    features_test_property(block, 9, 1);
+    block[FEATURES_FLAG_PROPERTIES_SIZE + 1] |= 1 << 1;
+    features_test_property(block, 10, 1);
+
+    FEATURES_CHECK(FEATURES_OK == features_data(&data, pages));
+
+    FEATURES_CHECK(FEATURES_OK == features_handle_resolve(&handle, &data, 256 + 3,
+            FEATURES_SWITCH_TYPE_UINT16));
+    FEATURES_CHECK(FEATURES_OK == features_handle_uint16_value(&handle, &val16));
+    FEATURES_CHECK(FEATURES_OK == features_switch_uint16_value(&data, 256 + 3, &lookup16));
+    FEATURES_CHECK(0x1234 == val16 && lookup16 == val16);
+
+    FEATURES_CHECK(FEATURES_OK == features_handle_resolve(&handle, &data, 2 * 256 + 9,
+            FEATURES_SWITCH_TYPE_FLAG));
+    FEATURES_CHECK(FEATURES_OK == features_handle_flag_value(&handle, &flag) && 0 != flag);
+
+    FEATURES_CHECK(FEATURES_OK == features_handle_resolve(&handle, &data, 2 * 256 + 10,
+            FEATURES_SWITCH_TYPE_FLAG));
+    FEATURES_CHECK(FEATURES_OK == features_handle_flag_value(&handle, &flag) && 0 == flag);
+
+    // Every read of a handle that did not resolve returns its status
+    FEATURES_CHECK(FEATURES_ERR_DEPRECATED == features_handle_resolve(&handle, &data, 256 + 4,
+            FEATURES_SWITCH_TYPE_UINT16));
+    FEATURES_CHECK(FEATURES_ERR_DEPRECATED == features_handle_uint16_value(&handle, &val16));
+
+    FEATURES_CHECK(FEATURES_ERR_UNUSED == features_handle_resolve(&handle, &data, 256 + 5,
+            FEATURES_SWITCH_TYPE_UINT16));
+    FEATURES_CHECK(FEATURES_ERR_UNUSED == features_handle_uint16_value(&handle, &val16));
+
+    FEATURES_CHECK(FEATURES_ERR_INCORRECT_TYPE == features_handle_resolve(&handle, &data, 256 + 3,
+            FEATURES_SWITCH_TYPE_UINT32));
+    FEATURES_CHECK(FEATURES_ERR_INCORRECT_TYPE == features_handle_uint16_value(&handle, &val16));
+
+    // An unused block, a page past the end and the page header
+    FEATURES_CHECK(FEATURES_ERR_UNUSED == features_handle_resolve(&handle, &data, 3 * 256,
+            FEATURES_SWITCH_TYPE_UINT16));
+    FEATURES_CHECK(FEATURES_ERR_UNUSED == features_handle_resolve(&handle, &data, 16384 + 256,
+            FEATURES_SWITCH_TYPE_UINT16));
+    FEATURES_CHECK(FEATURES_OK != features_handle_resolve(&handle, &data, 5,
+            FEATURES_SWITCH_TYPE_UINT16));
+    FEATURES_CHECK(handle.rc == features_handle_uint16_value(&handle, &val16));
+
+    return features_test_result();
+}
+
+// An empty page with a uint16 and a flag block
+static void
+features_test_page(
+        features_page_raw_t *page,
+        uint32_t page_number,
+        uint32_t page_count) {
+    memset(page, 0, sizeof(features_page_raw_t));
+    memcpy(page->header.MAGIC, FEATURES_MAGIC_13_10, sizeof(page->header.MAGIC));
+    features_write_uint32(&page->header.page_number, page_number);
+    features_write_uint32(&page->header.page_count, page_count);
+
+    // Odd block numbers in the high nybble
+    page->header.block_info.data[FEATURES_TEST_UINT16_BLOCK / 2] |= FEATURES_SWITCH_TYPE_UINT16 << 4;
+    page->header.block_info.data[FEATURES_TEST_FLAG_BLOCK / 2] |= FEATURES_SWITCH_TYPE_FLAG;
+}
+
+static void
+features_test_property(
+        uint8_t *block,
+        uint8_t slot,
+        uint8_t properties) {
+    block[slot / 4] |= (uint8_t)(properties << ((slot % 4) * 2));
+}
@@ -0,0 +1,153 @@
+#include "test.h"
+
+// Lookups through the block index read what lookups parsing the pages
+// read, for every switch of every page the file covers and around it
+
+static const uint32_t features_test_pages[] = {2, 3, 9, 40};
+
+#define FEATURES_TEST_PAGE_COUNT (sizeof(features_test_pages) / sizeof(features_test_pages[0]))
+
+#define FEATURES_TEST_PAGE_OFFSET 2
+
+static const uint8_t features_test_flags[] = {
+    0,
+    FEATURES_PAGE_FLAG_SPARSE,
+    FEATURES_PAGE_FLAG_LITTLE_ENDIAN,
+    FEATURES_PAGE_FLAG_SPARSE | FEATURES_PAGE_FLAG_LITTLE_ENDIAN | FEATURES_PAGE_FLAG_CHECKSUM
+};
+
+#define FEATURES_TEST_COUNT(array) (sizeof(array) / sizeof((array)[0]))
+
+static void
+features_test_same(
+        const features_data_t *indexed,
+        const features_data_t *plain,
+        features_switch_number_t switch_number);
+
+int
+main(void) {
+    features_test_switch_t switches[FEATURES_TEST_PAGE_COUNT * FEATURES_TEST_BLOCKS_PER_PAGE
+        * FEATURES_TEST_SWITCHES_PER_BLOCK];
+    features_switch_number_t switch_number;
+    features_switch_number_t end;
+    features_builder_t builder;
+    features_data_t indexed;
+    features_data_t plain;
+    void *raw;
+    size_t count;
+    size_t f;
+
+    for (f = 0; f < FEATURES_TEST_COUNT(features_test_flags); ++f) {
+        features_builder_init(&builder);
+        builder.flags = features_test_flags[f];
+        builder.page_offset = FEATURES_TEST_PAGE_OFFSET;
+        count = features_test_fill(&builder, features_test_pages, FEATURES_TEST_PAGE_COUNT, 59, switches);
+        raw = features_test_encode(&builder, &plain);
+        features_builder_free(&builder);
+        FEATURES_CHECK(NULL != raw);
+
+        if (NULL == raw) {
+            continue;
+        }
+
+        indexed = plain;
+        FEATURES_CHECK(NULL == plain.index);
+        FEATURES_CHECK(FEATURES_OK == features_data_index(&indexed));
+        FEATURES_CHECK(NULL != indexed.index);
+        FEATURES_CHECK(0 == (uintptr_t)indexed.index % FEATURES_BLOCK_SIZE);
+
+        features_test_check_switches(&indexed, switches, count);
+
+        // From the page before the offset to the page after the span
+        end = (features_switch_number_t)(plain.page_offset + plain.page_span + 1)
+            * FEATURES_BLOCKS_PER_PAGE * FEATURES_MAX_SWITCHES_PER_BLOCK;
+
+        for (switch_number = (plain.page_offset - 1) * FEATURES_BLOCKS_PER_PAGE
+                    * FEATURES_MAX_SWITCHES_PER_BLOCK;
+                switch_number < end;
+                ++switch_number) {
+            features_test_same(&indexed, &plain, switch_number);
+        }
+
+        // Building it again replaces it
+        FEATURES_CHECK(FEATURES_OK == features_data_index(&indexed));
+        features_test_check_switches(&indexed, switches, count);
+
+        features_data_index_free(&indexed);
+        FEATURES_CHECK(NULL == indexed.index);
+        features_test_check_switches(&indexed, switches, count);
+
+        free(raw);
+    }
+
+    return features_test_result();
+}
+
+#define FEATURES_TEST_TYPED(type_name, value_type) \
+    do { \
+        value_type indexed_value; \
+        value_type plain_value; \
+        features_err_t indexed_rc; \
+        features_err_t plain_rc; \
+        \
+        indexed_rc = features_switch_##type_name##_value(indexed, switch_number, &indexed_value); \
+        plain_rc = features_switch_##type_name##_value(plain, switch_number, &plain_value); \
+        FEATURES_CHECK(plain_rc == indexed_rc); \
+        FEATURES_CHECK(FEATURES_OK != plain_rc || FEATURES_OK != indexed_rc \
+                || plain_value == indexed_value); \
+    } while (0)
+
+// The generic lookup and the one of the block's type
+static void
+features_test_same(
+        const features_data_t *indexed,
+        const features_data_t *plain,
+        features_switch_number_t switch_number) {
+    features_switch_value_t indexed_value;
+    features_switch_value_t plain_value;
+    features_err_t indexed_rc;
+    features_err_t plain_rc;
+
+    indexed_rc = features_switch_value(indexed, switch_number, &indexed_value);
+    plain_rc = features_switch_value(plain, switch_number, &plain_value);
+    FEATURES_CHECK(plain_rc == indexed_rc);
+
+    if (FEATURES_OK != plain_rc || FEATURES_OK != indexed_rc) {
+        return;
+    }
+
+    FEATURES_CHECK(features_test_value_equal(&plain_value, &indexed_value));
+
+    switch (plain_value.type) {
+        case FEATURES_SWITCH_TYPE_FLAG:
+            FEATURES_TEST_TYPED(flag, char);
+            break;
+        case FEATURES_SWITCH_TYPE_UINT8:
+            FEATURES_TEST_TYPED(uint8, uint8_t);
+            break;
+        case FEATURES_SWITCH_TYPE_UINT16:
+            FEATURES_TEST_TYPED(uint16, uint16_t);
+            break;
+        case FEATURES_SWITCH_TYPE_UINT32:
+            FEATURES_TEST_TYPED(uint32, uint32_t);
+            break;
+        case FEATURES_SWITCH_TYPE_UINT64:
+            FEATURES_TEST_TYPED(uint64, uint64_t);
+            break;
+        case FEATURES_SWITCH_TYPE_INT8:
+            FEATURES_TEST_TYPED(int8, int8_t);
+            break;
+        case FEATURES_SWITCH_TYPE_INT16:
+            FEATURES_TEST_TYPED(int16, int16_t);
+            break;
+        case FEATURES_SWITCH_TYPE_INT32:
+            FEATURES_TEST_TYPED(int32, int32_t);
+            break;
+        case FEATURES_SWITCH_TYPE_INT64:
+            FEATURES_TEST_TYPED(int64, int64_t);
+            break;
+        default:
+            FEATURES_CHECK(0);
+            break;
+    }
+}
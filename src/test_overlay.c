@@ -0,0 +1,172 @@
+#include "overlay.h"
+#include "test.h"
+
+// An overlay answers every switch as the topmost layer using it or
+// deprecating its block does, and as the base otherwise
+
+static const uint32_t features_test_pages[] = {0, 1, 5};
+
+#define FEATURES_TEST_PAGE_COUNT (sizeof(features_test_pages) / sizeof(features_test_pages[0]))
+
+enum {
+    FEATURES_TEST_LAYERS = 3,
+    FEATURES_TEST_OVERRIDES = 300,
+    // Layers also override the page after the base's last one
+    FEATURES_TEST_PAGE_END = 7
+};
+
+// Each layer stored differently
+static const uint8_t features_test_layer_flags[FEATURES_TEST_LAYERS] = {
+    FEATURES_PAGE_FLAG_SPARSE,
+    FEATURES_PAGE_FLAG_SPARSE | FEATURES_PAGE_FLAG_LITTLE_ENDIAN,
+    0
+};
+
+static void
+features_test_layer(
+        features_builder_t *builder,
+        size_t layer,
+        uint64_t *seed);
+
+static void
+features_test_expected(
+        const features_data_t *base,
+        const features_data_t *layers,
+        size_t layer_count,
+        features_switch_number_t switch_number,
+        features_err_t *rc,
+        features_switch_value_t *value);
+
+int
+main(void) {
+    features_test_switch_t switches[FEATURES_TEST_PAGE_COUNT * FEATURES_TEST_BLOCKS_PER_PAGE
+        * FEATURES_TEST_SWITCHES_PER_BLOCK];
+    features_data_t layers[FEATURES_TEST_LAYERS];
+    void *layer_raw[FEATURES_TEST_LAYERS];
+    features_switch_number_t switch_number;
+    features_switch_value_t expected;
+    features_switch_value_t value;
+    features_builder_t builder;
+    features_overlay_t overlay;
+    features_data_t base;
+    features_err_t expected_rc;
+    features_err_t rc;
+    uint64_t seed;
+    void *base_raw;
+    size_t count;
+    size_t n;
+    size_t l;
+
+    features_builder_init(&builder);
+    count = features_test_fill(&builder, features_test_pages, FEATURES_TEST_PAGE_COUNT, 29, switches);
+    base_raw = features_test_encode(&builder, &base);
+    features_builder_free(&builder);
+    FEATURES_CHECK(NULL != base_raw);
+
+    seed = 31;
+
+    for (l = 0; l < FEATURES_TEST_LAYERS; ++l) {
+        features_builder_init(&builder);
+        builder.flags = features_test_layer_flags[l];
+        features_test_layer(&builder, l, &seed);
+        layer_raw[l] = features_test_encode(&builder, &layers[l]);
+        features_builder_free(&builder);
+        FEATURES_CHECK(NULL != layer_raw[l]);
+    }
+
+    if (NULL == base_raw || NULL == layer_raw[0] || NULL == layer_raw[1] || NULL == layer_raw[2]) {
+        return features_test_result();
+    }
+
+    // No layers reads as the base, then each layer stacked on the ones
+    // below it
+    for (n = 0; n <= FEATURES_TEST_LAYERS; ++n) {
+        FEATURES_CHECK(FEATURES_OK == features_overlay_init(&overlay, &base, layers, n));
+
+        if (0 == n) {
+            features_test_check_switches(&base, switches, count);
+        }
+
+        for (switch_number = 0;
+                switch_number < (features_switch_number_t)FEATURES_TEST_PAGE_END * 16384;
+                ++switch_number) {
+            features_test_expected(&base, layers, n, switch_number, &expected_rc, &expected);
+            rc = features_overlay_switch_value(&overlay, switch_number, &value);
+            FEATURES_CHECK(expected_rc == rc);
+
+            if (FEATURES_OK == rc && FEATURES_OK == expected_rc) {
+                FEATURES_CHECK(features_test_value_equal(&expected, &value));
+            }
+        }
+
+        features_overlay_free(&overlay);
+    }
+
+    free(base_raw);
+
+    for (l = 0; l < FEATURES_TEST_LAYERS; ++l) {
+        free(layer_raw[l]);
+    }
+
+    return features_test_result();
+}
+
+// Random overrides in the blocks the base uses and the ones after them,
+// with every combination of properties, and a deprecated block of the
+// base
+static void
+features_test_layer(
+        features_builder_t *builder,
+        size_t layer,
+        uint64_t *seed) {
+    static const uint8_t properties[] = {
+        FEATURES_SWITCH_PROPERTY_USED,
+        FEATURES_SWITCH_PROPERTY_USED | FEATURES_SWITCH_PROPERTY_DEPRECATED,
+        FEATURES_SWITCH_PROPERTY_DEPRECATED,
+        0
+    };
+    features_switch_value_t value;
+    features_switch_type_t type;
+    uint64_t page;
+    uint64_t block;
+    uint64_t slot;
+    int i;
+
+    value = features_test_value(FEATURES_SWITCH_TYPE_DEPRECATED, 0);
+    features_builder_set(builder, features_test_pages[layer] * 16384 + (layer + 2) * 256, &value, 0);
+
+    for (i = 0; i < FEATURES_TEST_OVERRIDES; ++i) {
+        page = features_test_random(seed) % FEATURES_TEST_PAGE_END;
+        block = 1 + features_test_random(seed) % 12;
+        // Lower layers sometimes disagree with the base on a block's type
+        type = (features_switch_type_t)(FEATURES_SWITCH_TYPE_FLAG + (block - 1 + layer % 2) % 9);
+        slot = features_test_random(seed) % features_block_capacity(type);
+        value = features_test_value(type, features_test_random(seed));
+
+        // Clashes with the deprecated block are left out
+        features_builder_set(builder, page * 16384 + block * 256 + slot, &value,
+                properties[features_test_random(seed) % 4]);
+    }
+}
+
+// Topmost layer reading the switch as set or deprecated, else the base
+static void
+features_test_expected(
+        const features_data_t *base,
+        const features_data_t *layers,
+        size_t layer_count,
+        features_switch_number_t switch_number,
+        features_err_t *rc,
+        features_switch_value_t *value) {
+    size_t l;
+
+    for (l = layer_count; l > 0; --l) {
+        *rc = features_switch_value(&layers[l - 1], switch_number, value);
+
+        if (FEATURES_OK == *rc || FEATURES_ERR_DEPRECATED == *rc) {
+            return;
+        }
+    }
+
+    *rc = features_switch_value(base, switch_number, value);
+}
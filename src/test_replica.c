@@ -0,0 +1,147 @@
+#include "replica.h"
+#include "stats.h"
+#include "test.h"
+
+// Every copy of a replicated snapshot reads as the data it was copied
+// from, owns its pages, and counts lookups in the stats of that data
+
+static const uint32_t features_test_pages[] = {1, 2, 70};
+
+#define FEATURES_TEST_PAGE_COUNT (sizeof(features_test_pages) / sizeof(features_test_pages[0]))
+
+static const uint8_t features_test_flags[] = {
+    0,
+    FEATURES_PAGE_FLAG_SPARSE,
+    FEATURES_PAGE_FLAG_LITTLE_ENDIAN | FEATURES_PAGE_FLAG_CHECKSUM
+};
+
+#define FEATURES_TEST_COUNT(array) (sizeof(array) / sizeof((array)[0]))
+
+static void
+features_test_same(
+        const features_data_t *replica,
+        const features_data_t *data);
+
+int
+main(void) {
+    features_test_switch_t switches[FEATURES_TEST_PAGE_COUNT * FEATURES_TEST_BLOCKS_PER_PAGE
+        * FEATURES_TEST_SWITCHES_PER_BLOCK];
+    features_stats_entry_t entry;
+    features_switch_value_t value;
+    const features_data_t *local;
+    features_snapshot_t *snapshot;
+    features_builder_t builder;
+    features_stats_t stats;
+    features_data_t data;
+    features_live_t live;
+    features_err_t rc;
+    char path[256];
+    size_t count;
+    size_t found;
+    size_t f;
+    unsigned node;
+    void *raw;
+
+    features_test_path(path, sizeof(path), "replica.bin");
+
+    for (f = 0; f < FEATURES_TEST_COUNT(features_test_flags); ++f) {
+        features_builder_init(&builder);
+        builder.flags = features_test_flags[f];
+        count = features_test_fill(&builder, features_test_pages, FEATURES_TEST_PAGE_COUNT, 79, switches);
+        raw = features_test_encode(&builder, &data);
+        FEATURES_CHECK(FEATURES_OK == features_builder_save(&builder, path));
+        features_builder_free(&builder);
+        FEATURES_CHECK(NULL != raw);
+
+        if (NULL == raw) {
+            continue;
+        }
+
+        FEATURES_CHECK(FEATURES_OK == features_stats_init(&stats, 16));
+        data.stats = &stats;
+
+        rc = features_snapshot_replicate(&snapshot, &data);
+        FEATURES_CHECK(FEATURES_OK == rc);
+
+        if (FEATURES_OK != rc) {
+            features_stats_destroy(&stats);
+            free(raw);
+            continue;
+        }
+
+        // Copies of every byte, which do not change with the original
+        FEATURES_CHECK(snapshot->data.pages != data.pages);
+        FEATURES_CHECK(features_data_size(&snapshot->data) == features_data_size(&data));
+        FEATURES_CHECK(0 == memcmp(snapshot->data.pages, data.pages, (size_t)features_data_size(&data)));
+        FEATURES_CHECK(NULL == snapshot->replicas || snapshot->replica_count > 1);
+
+        data.stats = NULL;
+        features_test_same(&snapshot->data, &data);
+
+        for (node = 0; node < snapshot->replica_count; ++node) {
+            FEATURES_CHECK(snapshot->replicas[node].pages != data.pages);
+            features_test_same(&snapshot->replicas[node], &data);
+        }
+
+        local = features_snapshot_local_data(snapshot);
+        node = features_numa_node();
+        FEATURES_CHECK(NULL == snapshot->replicas
+                ? &snapshot->data == local
+                : snapshot->replicas + (node < snapshot->replica_count ? node : 0) == local);
+        features_test_check_switches(local, switches, count);
+
+        memset(data.pages, 0, (size_t)features_data_size(&data));
+        features_test_check_switches(local, switches, count);
+
+        // Lookups through the copy count in the stats of the original,
+        // counted from zero again here
+        FEATURES_CHECK(&stats == local->stats);
+        features_stats_destroy(&stats);
+        FEATURES_CHECK(FEATURES_OK == features_stats_init(&stats, 16));
+        features_switch_value(local, switches[0].switch_number, &value);
+        features_switch_value(local, switches[0].switch_number, &value);
+        FEATURES_CHECK(FEATURES_OK == features_stats_top(&stats, &entry, 1, &found));
+        FEATURES_CHECK(1 == found && switches[0].switch_number == entry.switch_number);
+        FEATURES_CHECK(2 == entry.counts[FEATURES_STATS_READS]);
+
+        // Published and released like any snapshot
+        FEATURES_CHECK(FEATURES_OK == features_live_init(&live, 1));
+        features_live_publish(&live, snapshot);
+        features_live_destroy(&live);
+
+        // From the saved file
+        FEATURES_CHECK(FEATURES_OK == features_snapshot_open_replicated(&snapshot, path));
+        features_test_check_switches(features_snapshot_local_data(snapshot), switches, count);
+        features_snapshot_release(snapshot);
+
+        features_stats_destroy(&stats);
+        free(raw);
+    }
+
+    unlink(path);
+    FEATURES_CHECK(FEATURES_OK != features_snapshot_open_replicated(&snapshot, path));
+
+    return features_test_result();
+}
+
+// Every switch number of the pages and around them reads the same
+static void
+features_test_same(
+        const features_data_t *replica,
+        const features_data_t *data) {
+    features_switch_number_t switch_number;
+    features_switch_value_t replica_value;
+    features_switch_value_t value;
+    features_err_t replica_rc;
+    features_err_t rc;
+
+    for (switch_number = 0; switch_number < 72 * 16384; switch_number += 5) {
+        replica_rc = features_switch_value(replica, switch_number, &replica_value);
+        rc = features_switch_value(data, switch_number, &value);
+        FEATURES_CHECK(rc == replica_rc);
+
+        if (FEATURES_OK == rc && FEATURES_OK == replica_rc) {
+            FEATURES_CHECK(features_test_value_equal(&value, &replica_value));
+        }
+    }
+}
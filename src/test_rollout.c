@@ -0,0 +1,107 @@
+#include "rollout.h"
+#include "test.h"
+
+// Raising a rollout only ever adds entities, and the batch, whichever
+// implementation the CPU gets, agrees with features_rollout_bucket()
+
+enum {
+    // Not a multiple of 64, so the last word is partly filled
+    FEATURES_TEST_ENTITIES = 10007,
+    FEATURES_TEST_WORDS = (FEATURES_TEST_ENTITIES + 63) / 64,
+    FEATURES_TEST_SWITCH = 16384 + 2 * 256 + 3
+};
+
+static const uint16_t features_test_values[] = {
+    0, 1, 100, 2500, 5000, 5001, 9999, 10000, 12000, 65535
+};
+
+#define FEATURES_TEST_VALUE_COUNT (sizeof(features_test_values) / sizeof(features_test_values[0]))
+
+int
+main(void) {
+    static uint64_t ids[FEATURES_TEST_ENTITIES];
+    static uint64_t previous[FEATURES_TEST_WORDS];
+    static uint64_t in[FEATURES_TEST_WORDS];
+    features_switch_value_t value;
+    features_builder_t builder;
+    features_data_t data;
+    uint64_t seed;
+    uint64_t total;
+    uint64_t expected;
+    uint32_t rollout;
+    size_t i;
+    size_t v;
+    void *raw;
+    int bit;
+
+    seed = 1;
+
+    for (i = 0; i < FEATURES_TEST_ENTITIES; ++i) {
+        // Sequential ids as well as random ones
+        ids[i] = i % 2 ? features_test_random(&seed) : i;
+    }
+
+    memset(previous, 0, sizeof(previous));
+
+    for (v = 0; v < FEATURES_TEST_VALUE_COUNT; ++v) {
+        rollout = features_test_values[v];
+
+        features_builder_init(&builder);
+        value = features_test_value(FEATURES_SWITCH_TYPE_UINT16, rollout);
+        features_builder_set(&builder, FEATURES_TEST_SWITCH, &value, FEATURES_SWITCH_PROPERTY_USED);
+        raw = features_test_encode(&builder, &data);
+        features_builder_free(&builder);
+        FEATURES_CHECK(NULL != raw);
+
+        if (NULL == raw) {
+            continue;
+        }
+
+        memset(in, 0xff, sizeof(in));
+        FEATURES_CHECK(FEATURES_OK == features_rollout(&data, FEATURES_TEST_SWITCH, ids,
+                FEATURES_TEST_ENTITIES, in));
+
+        total = 0;
+
+        for (i = 0; i < FEATURES_TEST_ENTITIES; ++i) {
+            bit = (int)((in[i / 64] >> (i % 64)) & 1);
+            FEATURES_CHECK(bit == (features_rollout_bucket(FEATURES_TEST_SWITCH, ids[i]) < rollout));
+            total += (uint64_t)bit;
+        }
+
+        // Bits past the last entity are cleared
+        FEATURES_CHECK(0 == in[FEATURES_TEST_WORDS - 1] >> (FEATURES_TEST_ENTITIES % 64));
+
+        for (i = 0; i < FEATURES_TEST_WORDS; ++i) {
+            FEATURES_CHECK(0 == (previous[i] & ~in[i]));
+        }
+
+        // Within 5 standard deviations of the share asked for
+        expected = (uint64_t)(rollout < FEATURES_ROLLOUT_SCALE ? rollout : FEATURES_ROLLOUT_SCALE)
+            * FEATURES_TEST_ENTITIES / FEATURES_ROLLOUT_SCALE;
+        FEATURES_CHECK(total + 250 >= expected && total <= expected + 250);
+
+        if (0 == rollout) {
+            FEATURES_CHECK(0 == total);
+        }
+
+        if (rollout >= FEATURES_ROLLOUT_SCALE) {
+            FEATURES_CHECK(FEATURES_TEST_ENTITIES == total);
+        }
+
+        memcpy(previous, in, sizeof(in));
+
+        // A switch that cannot be read puts every entity out
+        memset(in, 0xff, sizeof(in));
+        FEATURES_CHECK(FEATURES_ERR_UNUSED == features_rollout(&data, FEATURES_TEST_SWITCH + 1, ids,
+                FEATURES_TEST_ENTITIES, in));
+
+        for (i = 0; i < FEATURES_TEST_WORDS; ++i) {
+            FEATURES_CHECK(0 == in[i]);
+        }
+
+        free(raw);
+    }
+
+    return features_test_result();
+}
@@ -0,0 +1,236 @@
+#include <pthread.h>
+
+#include "shm.h"
+#include "test.h"
+
+// Lookups in a shared segment read the published data, and while the
+// agent rewrites a page back and forth every lookup reads either version
+// of it, never a mix of the two
+
+// Page 1 is filled by features_test_version()
+static const uint32_t features_test_pages[] = {0, 2};
+
+#define FEATURES_TEST_PAGE_COUNT (sizeof(features_test_pages) / sizeof(features_test_pages[0]))
+
+#define FEATURES_TEST_SWITCH_COUNT (FEATURES_TEST_PAGE_COUNT * FEATURES_TEST_BLOCKS_PER_PAGE \
+        * FEATURES_TEST_SWITCHES_PER_BLOCK)
+
+enum {
+    FEATURES_TEST_UPDATES = 1000000,
+    FEATURES_TEST_PAGES = 3,
+    // Room for the file and no more
+    FEATURES_TEST_CAPACITY = FEATURES_TEST_PAGES * FEATURES_PAGE_SIZE,
+    FEATURES_TEST_GROWN_SIZE = FEATURES_TEST_CAPACITY + FEATURES_PAGE_SIZE
+};
+
+typedef struct features_test_writer_t {
+    features_shm_t *shm;
+    const features_page_raw_t *versions[2];
+    atomic_int done;
+} features_test_writer_t;
+
+static void *
+features_test_writer(void *arg);
+
+static void
+features_test_version(
+        features_builder_t *builder,
+        uint64_t version);
+
+static void
+features_test_same(
+        const features_shm_t *shm,
+        const features_data_t *data);
+
+int
+main(void) {
+    features_test_switch_t switches[FEATURES_TEST_SWITCH_COUNT];
+    features_switch_number_t switch_number;
+    features_switch_value_t expected[2];
+    features_switch_value_t value;
+    features_test_writer_t writer;
+    features_builder_t builder;
+    features_data_t versions[2];
+    features_err_t expected_rc[2];
+    features_err_t rc;
+    features_shm_t agent;
+    features_shm_t worker;
+    pthread_t thread;
+    uint64_t sequence;
+    uint64_t lookups;
+    void *raw[2];
+    void *grown;
+    char name[64];
+    int v;
+
+    snprintf(name, sizeof(name), "/features-test-%ld", (long)getpid());
+
+    // The same layout with different values and block types on page 1
+    for (v = 0; v < 2; ++v) {
+        features_builder_init(&builder);
+        features_test_fill(&builder, features_test_pages, FEATURES_TEST_PAGE_COUNT, 71, switches);
+        features_test_version(&builder, (uint64_t)v);
+        raw[v] = features_test_encode(&builder, &versions[v]);
+        features_builder_free(&builder);
+        FEATURES_CHECK(NULL != raw[v]);
+    }
+
+    if (NULL == raw[0] || NULL == raw[1]) {
+        free(raw[0]);
+        free(raw[1]);
+        return features_test_result();
+    }
+
+    if (FEATURES_OK != features_shm_create(&agent, name, FEATURES_TEST_CAPACITY)) {
+        FEATURES_CHECK(0);
+        free(raw[0]);
+        free(raw[1]);
+        return features_test_result();
+    }
+
+    FEATURES_CHECK(FEATURES_OK == features_shm_open(&worker, name));
+    FEATURES_CHECK(FEATURES_ERR_UNINITIALISED == features_shm_switch_value(&worker, 256, &value));
+    FEATURES_CHECK(FEATURES_ERR_UNINITIALISED == features_shm_update_page(&agent, versions[1].pages + 1));
+
+    sequence = features_shm_sequence(&worker);
+    FEATURES_CHECK(FEATURES_OK == features_shm_publish(&agent, raw[0],
+                features_data_size(&versions[0])));
+    FEATURES_CHECK(sequence + 2 == features_shm_sequence(&worker));
+    features_test_same(&worker, &versions[0]);
+
+    // Workers cannot write, and page updates keep the layout
+    FEATURES_CHECK(FEATURES_OK != features_shm_publish(&worker, raw[0], features_data_size(&versions[0])));
+    FEATURES_CHECK(FEATURES_OK != features_shm_update_page(&worker, versions[1].pages + 1));
+    versions[1].pages[1].header.flags ^= FEATURES_PAGE_FLAG_LITTLE_ENDIAN;
+    FEATURES_CHECK(FEATURES_ERR_INVALID == features_shm_update_page(&agent, versions[1].pages + 1));
+    versions[1].pages[1].header.flags ^= FEATURES_PAGE_FLAG_LITTLE_ENDIAN;
+    FEATURES_CHECK(sequence + 2 == features_shm_sequence(&worker));
+
+    FEATURES_CHECK(FEATURES_OK == features_shm_update_page(&agent, versions[1].pages + 1));
+    FEATURES_CHECK(sequence + 4 == features_shm_sequence(&worker));
+    features_test_same(&worker, &versions[1]);
+
+    // Lookups on the page the agent keeps rewriting
+    writer.shm = &agent;
+    writer.versions[0] = versions[0].pages + 1;
+    writer.versions[1] = versions[1].pages + 1;
+    atomic_init(&writer.done, 0);
+    lookups = 0;
+
+    if (0 != pthread_create(&thread, NULL, features_test_writer, &writer)) {
+        FEATURES_CHECK(0);
+        atomic_store(&writer.done, 1);
+    }
+
+    while (!atomic_load(&writer.done)) {
+        switch_number = 16384 + 256 + lookups++ % (FEATURES_TEST_BLOCKS_PER_PAGE * 256);
+        rc = features_shm_switch_value(&worker, switch_number, &value);
+
+        for (v = 0; v < 2; ++v) {
+            expected_rc[v] = features_switch_value(&versions[v], switch_number, &expected[v]);
+        }
+
+        FEATURES_CHECK((rc == expected_rc[0]
+                    && (FEATURES_OK != rc || features_test_value_equal(&expected[0], &value)))
+                || (rc == expected_rc[1]
+                    && (FEATURES_OK != rc || features_test_value_equal(&expected[1], &value))));
+    }
+
+    pthread_join(thread, NULL);
+    FEATURES_CHECK(lookups > 0);
+
+    // A larger file than the worker mapped, until it opens the segment
+    // again
+    grown = malloc(FEATURES_TEST_GROWN_SIZE);
+    features_builder_init(&builder);
+    features_test_fill(&builder, features_test_pages, FEATURES_TEST_PAGE_COUNT, 71, switches);
+    features_test_version(&builder, 0);
+    value = features_test_value(FEATURES_SWITCH_TYPE_UINT8, 5);
+    FEATURES_CHECK(FEATURES_OK == features_builder_set(&builder, 3 * 16384 + 256, &value,
+            FEATURES_SWITCH_PROPERTY_USED));
+    FEATURES_CHECK(FEATURES_TEST_GROWN_SIZE == features_builder_size(&builder));
+
+    if (NULL != grown) {
+        features_builder_write(&builder, grown);
+        features_shm_close(&agent);
+        FEATURES_CHECK(FEATURES_OK == features_shm_create(&agent, name, FEATURES_TEST_GROWN_SIZE));
+        FEATURES_CHECK(FEATURES_OK == features_shm_publish(&agent, grown, FEATURES_TEST_GROWN_SIZE));
+        FEATURES_CHECK(FEATURES_ERR_INVALID == features_shm_switch_value(&worker, 3 * 16384 + 256, &value));
+        features_shm_close(&worker);
+        FEATURES_CHECK(FEATURES_OK == features_shm_open(&worker, name));
+        FEATURES_CHECK(FEATURES_OK == features_shm_switch_value(&worker, 3 * 16384 + 256, &value));
+        FEATURES_CHECK(FEATURES_SWITCH_TYPE_UINT8 == value.type && 5 == value.value.uint8);
+        features_test_same(&worker, &versions[0]);
+    }
+
+    features_builder_free(&builder);
+    features_shm_close(&worker);
+    features_shm_close(&agent);
+    FEATURES_CHECK(FEATURES_OK == features_shm_unlink(name));
+    FEATURES_CHECK(FEATURES_OK != features_shm_open(&worker, name));
+
+    free(grown);
+    free(raw[0]);
+    free(raw[1]);
+
+    return features_test_result();
+}
+
+static void *
+features_test_writer(void *arg) {
+    features_test_writer_t *writer;
+    int i;
+
+    writer = arg;
+
+    for (i = 0; i < FEATURES_TEST_UPDATES; ++i) {
+        FEATURES_CHECK(FEATURES_OK == features_shm_update_page(writer->shm, writer->versions[i % 2]));
+    }
+
+    atomic_store(&writer->done, 1);
+
+    return NULL;
+}
+
+// Fills every slot of the first blocks of page 1, version 1 with the
+// next type of each block of version 0 and other values
+static void
+features_test_version(
+        features_builder_t *builder,
+        uint64_t version) {
+    features_switch_value_t value;
+    features_switch_type_t type;
+    uint64_t seed;
+    uint8_t slot;
+    int b;
+
+    seed = 73 + version;
+
+    for (b = 1; b <= FEATURES_TEST_BLOCKS_PER_PAGE; ++b) {
+        type = (features_switch_type_t)(FEATURES_SWITCH_TYPE_FLAG
+                + (b - 1 + version) % FEATURES_TEST_BLOCKS_PER_PAGE);
+
+        for (slot = 0; slot < features_block_capacity(type); ++slot) {
+            value = features_test_value(type, features_test_random(&seed));
+            FEATURES_CHECK(FEATURES_OK == features_builder_set(builder,
+                    16384 + (features_switch_number_t)b * 256 + slot, &value, FEATURES_SWITCH_PROPERTY_USED));
+        }
+    }
+}
+
+// Every switch of the pages of data reads from the segment as from data
+static void
+features_test_same(
+        const features_shm_t *shm,
+        const features_data_t *data) {
+    features_switch_number_t switch_number;
+    features_switch_value_t expected;
+    features_switch_value_t value;
+    features_err_t rc;
+
+    for (switch_number = 0; switch_number < FEATURES_TEST_PAGES * 16384; ++switch_number) {
+        rc = features_shm_switch_value(shm, switch_number, &value);
+        FEATURES_CHECK(features_switch_value(data, switch_number, &expected) == rc);
+        FEATURES_CHECK(FEATURES_OK != rc || features_test_value_equal(&expected, &value));
+    }
+}
@@ -0,0 +1,180 @@
+#include "snapshot.h"
+#include "test.h"
+
+// A replaced snapshot is released once no reader pins it and never
+// while one does, readers never see snapshots go back in time, and every
+// snapshot published is released exactly once
+
+enum {
+    FEATURES_TEST_READERS = 4,
+    FEATURES_TEST_PUBLISHES = 2000
+};
+
+typedef struct features_test_snapshot_t {
+    features_snapshot_t snapshot;
+    uint64_t index;
+    atomic_int released;
+} features_test_snapshot_t;
+
+typedef struct features_test_reader_t {
+    pthread_t thread;
+    features_live_t *live;
+    uint64_t pins;
+} features_test_reader_t;
+
+static features_test_snapshot_t features_test_snapshots[FEATURES_TEST_PUBLISHES + 1];
+
+static atomic_int features_test_done;
+
+static void
+features_test_release(features_snapshot_t *snapshot);
+
+static void *
+features_test_reader(void *arg);
+
+static void
+features_test_init(size_t index);
+
+int
+main(void) {
+    features_test_reader_t readers[FEATURES_TEST_READERS];
+    const features_snapshot_t *pinned;
+    features_reader_t reader;
+    features_reader_t extra;
+    features_live_t live;
+    size_t started;
+    size_t i;
+
+    for (i = 0; i <= FEATURES_TEST_PUBLISHES; ++i) {
+        features_test_init(i);
+    }
+
+    // One reader slot, which a second reader does not get
+    FEATURES_CHECK(FEATURES_OK == features_live_init(&live, 1));
+    FEATURES_CHECK(FEATURES_OK == features_live_register(&live, &reader));
+    FEATURES_CHECK(FEATURES_ERR_NOMEM == features_live_register(&live, &extra));
+    FEATURES_CHECK(NULL == features_live_pin(&reader));
+    features_live_unpin(&reader);
+
+    features_live_publish(&live, &features_test_snapshots[0].snapshot);
+    pinned = features_live_pin(&reader);
+    FEATURES_CHECK(&features_test_snapshots[0].snapshot == pinned);
+
+    // Held through two publishes and reclaims, as is the one published
+    // in between, which a reader of the same epoch may have loaded
+    features_live_publish(&live, &features_test_snapshots[1].snapshot);
+    features_live_publish(&live, &features_test_snapshots[2].snapshot);
+    features_live_reclaim(&live);
+    FEATURES_CHECK(0 == atomic_load(&features_test_snapshots[0].released));
+    FEATURES_CHECK(0 == atomic_load(&features_test_snapshots[1].released));
+
+    // Both released once the reader moves on, then its slot reused
+    features_live_unpin(&reader);
+    features_live_reclaim(&live);
+    FEATURES_CHECK(1 == atomic_load(&features_test_snapshots[0].released));
+    FEATURES_CHECK(1 == atomic_load(&features_test_snapshots[1].released));
+    FEATURES_CHECK(&features_test_snapshots[2].snapshot == features_live_pin(&reader));
+    features_live_unpin(&reader);
+    features_live_unregister(&reader);
+    FEATURES_CHECK(FEATURES_OK == features_live_register(&live, &extra));
+    features_live_unregister(&extra);
+
+    features_live_destroy(&live);
+    FEATURES_CHECK(1 == atomic_load(&features_test_snapshots[2].released));
+
+    // Readers pinning while every snapshot is published in turn
+    for (i = 0; i <= FEATURES_TEST_PUBLISHES; ++i) {
+        features_test_init(i);
+    }
+
+    FEATURES_CHECK(FEATURES_OK == features_live_init(&live, FEATURES_TEST_READERS));
+    features_live_publish(&live, &features_test_snapshots[0].snapshot);
+    atomic_init(&features_test_done, 0);
+
+    for (started = 0; started < FEATURES_TEST_READERS; ++started) {
+        readers[started].live = &live;
+        readers[started].pins = 0;
+
+        if (0 != pthread_create(&readers[started].thread, NULL, features_test_reader, readers + started)) {
+            FEATURES_CHECK(0);
+            break;
+        }
+    }
+
+    for (i = 1; i <= FEATURES_TEST_PUBLISHES; ++i) {
+        features_live_publish(&live, &features_test_snapshots[i].snapshot);
+
+        if (0 == i % 16) {
+            features_live_reclaim(&live);
+        }
+    }
+
+    atomic_store(&features_test_done, 1);
+
+    for (i = 0; i < started; ++i) {
+        pthread_join(readers[i].thread, NULL);
+        FEATURES_CHECK(readers[i].pins > 0);
+    }
+
+    // Nobody holds a snapshot, so only the current one is left
+    features_live_reclaim(&live);
+
+    for (i = 0; i < FEATURES_TEST_PUBLISHES; ++i) {
+        FEATURES_CHECK(1 == atomic_load(&features_test_snapshots[i].released));
+    }
+
+    FEATURES_CHECK(0 == atomic_load(&features_test_snapshots[FEATURES_TEST_PUBLISHES].released));
+    features_live_destroy(&live);
+    FEATURES_CHECK(1 == atomic_load(&features_test_snapshots[FEATURES_TEST_PUBLISHES].released));
+
+    return features_test_result();
+}
+
+// Counts releases, more than one shows as a value other than 1
+static void
+features_test_release(features_snapshot_t *snapshot) {
+    atomic_fetch_add(&((features_test_snapshot_t *)snapshot)->released, 1);
+}
+
+// Pins until the last snapshot is current, checking that what it pins is
+// not released under it and is never older than what it pinned before
+static void *
+features_test_reader(void *arg) {
+    const features_test_snapshot_t *snapshot;
+    features_test_reader_t *test_reader;
+    features_reader_t reader;
+    uint64_t last;
+
+    test_reader = arg;
+    last = 0;
+
+    if (FEATURES_OK != features_live_register(test_reader->live, &reader)) {
+        FEATURES_CHECK(0);
+        return NULL;
+    }
+
+    while (!atomic_load(&features_test_done) || last < FEATURES_TEST_PUBLISHES) {
+        snapshot = (const features_test_snapshot_t *)features_live_pin(&reader);
+        FEATURES_CHECK(0 == atomic_load(&snapshot->released));
+        FEATURES_CHECK(snapshot->index >= last);
+        last = snapshot->index;
+        FEATURES_CHECK(0 == atomic_load(&snapshot->released));
+        features_live_unpin(&reader);
+        ++test_reader->pins;
+    }
+
+    features_live_unregister(&reader);
+
+    return NULL;
+}
+
+static void
+features_test_init(size_t index) {
+    features_test_snapshot_t *snapshot;
+
+    snapshot = features_test_snapshots + index;
+    memset(snapshot, 0, sizeof(features_test_snapshot_t));
+    features_snapshot_init(&snapshot->snapshot, features_test_release);
+    snapshot->index = index;
+    atomic_init(&snapshot->released, 0);
+}
@@ -0,0 +1,155 @@
+#include "test.h"
+
+// A sparse file stores only the pages holding switches and reads as the
+// dense file of the same switches, and a directory that points anywhere
+// but at its stored pages is refused
+
+// Either side of the directory word boundaries, from page offset 2, with
+// the last word only partly inside the span
+static const uint32_t features_test_pages[] = {2, 3, 65, 66, 67, 129, 130, 200, 250};
+
+#define FEATURES_TEST_PAGE_COUNT (sizeof(features_test_pages) / sizeof(features_test_pages[0]))
+
+#define FEATURES_TEST_PAGE_OFFSET 2
+
+static void
+features_test_same(
+        const features_data_t *sparse,
+        const features_data_t *dense);
+
+static features_err_t
+features_test_check(
+        features_data_t *data,
+        uint64_t word,
+        uint64_t present,
+        uint64_t rank);
+
+int
+main(void) {
+    features_test_switch_t switches[FEATURES_TEST_PAGE_COUNT * FEATURES_TEST_BLOCKS_PER_PAGE
+        * FEATURES_TEST_SWITCHES_PER_BLOCK];
+    features_builder_t builder;
+    features_page_raw_t *page;
+    features_data_t sparse;
+    features_data_t dense;
+    void *sparse_raw;
+    void *dense_raw;
+    uint64_t relative;
+    uint64_t present;
+    uint64_t rank;
+    size_t count;
+    size_t stored;
+    size_t i;
+
+    features_builder_init(&builder);
+    builder.page_offset = FEATURES_TEST_PAGE_OFFSET;
+    count = features_test_fill(&builder, features_test_pages, FEATURES_TEST_PAGE_COUNT, 19, switches);
+    dense_raw = features_test_encode(&builder, &dense);
+    builder.flags = FEATURES_PAGE_FLAG_SPARSE;
+    sparse_raw = features_test_encode(&builder, &sparse);
+    features_builder_free(&builder);
+    FEATURES_CHECK(NULL != dense_raw && NULL != sparse_raw);
+
+    if (NULL == dense_raw || NULL == sparse_raw) {
+        free(dense_raw);
+        free(sparse_raw);
+        return features_test_result();
+    }
+
+    FEATURES_CHECK(NULL == dense.directory && NULL != sparse.directory);
+    FEATURES_CHECK(FEATURES_TEST_PAGE_OFFSET == sparse.page_offset);
+    FEATURES_CHECK(FEATURES_TEST_PAGE_COUNT == sparse.page_count);
+    FEATURES_CHECK(dense.page_span == sparse.page_span);
+    FEATURES_CHECK(dense.page_count == sparse.page_span);
+    FEATURES_CHECK(FEATURES_OK == features_directory_check(&sparse));
+
+    // The directory finds every stored page in order and nothing else
+    stored = 0;
+
+    for (relative = 0; relative < sparse.page_span; ++relative) {
+        page = features_data_page(&sparse, sparse.page_offset + relative);
+
+        if (stored < FEATURES_TEST_PAGE_COUNT
+                && features_test_pages[stored] == sparse.page_offset + relative) {
+            FEATURES_CHECK(sparse.pages + stored == page);
+            FEATURES_CHECK((int64_t)stored == features_directory_find(sparse.directory, relative));
+            ++stored;
+        } else {
+            FEATURES_CHECK(NULL == page);
+            FEATURES_CHECK(-1 == features_directory_find(sparse.directory, relative));
+        }
+    }
+
+    FEATURES_CHECK(FEATURES_TEST_PAGE_COUNT == stored);
+
+    features_test_check_switches(&sparse, switches, count);
+    features_test_same(&sparse, &dense);
+
+    // A present bit past the span, a page that is not stored, and ranks
+    // that do not count the bits before them
+    i = (sparse.page_span - 1) / 64;
+    present = features_read_uint64(&sparse.directory[i].present);
+    rank = features_read_uint64(&sparse.directory[i].rank);
+    FEATURES_CHECK(FEATURES_ERR_INVALID == features_test_check(&sparse, i,
+            present | (UINT64_C(1) << 63), rank));
+    FEATURES_CHECK(FEATURES_ERR_INVALID == features_test_check(&sparse, 0,
+            features_read_uint64(&sparse.directory[0].present) | (UINT64_C(1) << 10),
+            features_read_uint64(&sparse.directory[0].rank)));
+    FEATURES_CHECK(FEATURES_ERR_INVALID == features_test_check(&sparse, i, present, rank + 1));
+    FEATURES_CHECK(FEATURES_ERR_INVALID == features_test_check(&sparse, 1,
+            features_read_uint64(&sparse.directory[1].present), 0));
+    FEATURES_CHECK(FEATURES_OK == features_directory_check(&sparse));
+
+    free(dense_raw);
+    free(sparse_raw);
+
+    return features_test_result();
+}
+
+// Every switch number of the span and the page after it reads the same
+static void
+features_test_same(
+        const features_data_t *sparse,
+        const features_data_t *dense) {
+    features_switch_number_t switch_number;
+    features_switch_number_t end;
+    features_switch_value_t sparse_value;
+    features_switch_value_t dense_value;
+    features_err_t sparse_rc;
+    features_err_t dense_rc;
+
+    end = (features_switch_number_t)(sparse->page_offset + sparse->page_span + 1)
+        * FEATURES_BLOCKS_PER_PAGE * FEATURES_MAX_SWITCHES_PER_BLOCK;
+
+    for (switch_number = 0; switch_number < end; switch_number += 7) {
+        sparse_rc = features_switch_value(sparse, switch_number, &sparse_value);
+        dense_rc = features_switch_value(dense, switch_number, &dense_value);
+        FEATURES_CHECK(sparse_rc == dense_rc);
+
+        if (FEATURES_OK == sparse_rc && FEATURES_OK == dense_rc) {
+            FEATURES_CHECK(features_test_value_equal(&sparse_value, &dense_value));
+        }
+    }
+}
+
+// features_directory_check() with directory word replaced, which is put
+// back before returning
+static features_err_t
+features_test_check(
+        features_data_t *data,
+        uint64_t word,
+        uint64_t present,
+        uint64_t rank) {
+    features_page_directory_t saved;
+    features_page_directory_t *directory;
+    features_err_t rc;
+
+    directory = (features_page_directory_t *)data->directory;
+    saved = directory[word];
+    features_write_uint64(&directory[word].present, present);
+    features_write_uint64(&directory[word].rank, rank);
+    rc = features_directory_check(data);
+    directory[word] = saved;
+
+    return rc;
+}
@@ -0,0 +1,252 @@
+#include "stats.h"
+#include "test.h"
+
+// Lookups from many threads are each counted once against their switch
+// and result, threads started later reuse the shards of exited ones, and
+// reads of switches that do not fit a shard, or find no slot near where
+// they hash to, are counted as dropped
+
+enum {
+    FEATURES_TEST_THREADS = 4,
+    FEATURES_TEST_READS = 1000
+};
+
+typedef enum features_test_lookup_t {
+    FEATURES_TEST_LOOKUP_VALUE,
+    FEATURES_TEST_LOOKUP_UINT8,
+    FEATURES_TEST_LOOKUP_UINT16
+} features_test_lookup_t;
+
+// One switch read each way a lookup can go
+static const struct {
+    features_switch_number_t switch_number;
+    features_test_lookup_t lookup;
+    features_stats_counter_t counter;
+} features_test_reads[] = {
+    {2 * 256, FEATURES_TEST_LOOKUP_VALUE, FEATURES_STATS_READS},
+    {2 * 256 + 1, FEATURES_TEST_LOOKUP_VALUE, FEATURES_STATS_DEPRECATED},
+    {2 * 256 + 5, FEATURES_TEST_LOOKUP_UINT8, FEATURES_STATS_UNUSED},
+    {16384 + 2 * 256, FEATURES_TEST_LOOKUP_UINT16, FEATURES_STATS_INCORRECT_TYPE},
+    {16384 + 3 * 256, FEATURES_TEST_LOOKUP_UINT16, FEATURES_STATS_READS}
+};
+
+static const uint32_t features_test_pages[] = {0, 1};
+
+#define FEATURES_TEST_COUNT(array) (sizeof(array) / sizeof((array)[0]))
+
+typedef struct features_test_thread_t {
+    pthread_t thread;
+    const features_data_t *data;
+    uint64_t index;
+} features_test_thread_t;
+
+static void *
+features_test_thread(void *arg);
+
+static uint64_t
+features_test_expected_reads(size_t read);
+
+static void
+features_test_run(const features_data_t *data);
+
+static void
+features_test_counts(features_stats_t *stats, uint64_t rounds);
+
+int
+main(void) {
+    features_test_switch_t switches[2 * FEATURES_TEST_BLOCKS_PER_PAGE * FEATURES_TEST_SWITCHES_PER_BLOCK];
+    features_stats_entry_t entries[8];
+    features_switch_number_t switch_number;
+    features_stats_shard_t *shard;
+    features_switch_value_t value;
+    features_builder_t builder;
+    features_stats_t stats;
+    features_data_t data;
+    size_t shard_count;
+    size_t count;
+    size_t i;
+    FILE *out;
+    void *raw;
+    int c;
+
+    features_builder_init(&builder);
+    features_test_fill(&builder, features_test_pages, 2, 61, switches);
+    raw = features_test_encode(&builder, &data);
+    features_builder_free(&builder);
+    FEATURES_CHECK(NULL != raw);
+
+    if (NULL == raw) {
+        return features_test_result();
+    }
+
+    FEATURES_CHECK(FEATURES_OK == features_stats_init(&stats, 30));
+    FEATURES_CHECK(32 == stats.capacity);
+    data.stats = &stats;
+
+    features_test_run(&data);
+    features_test_counts(&stats, 1);
+
+    // The second threads take over the shards of the first ones, so there
+    // are never more shards than threads running at once
+    features_test_run(&data);
+    features_test_counts(&stats, 2);
+    shard_count = 0;
+
+    for (shard = stats.shards; NULL != shard; shard = shard->next) {
+        ++shard_count;
+    }
+
+    FEATURES_CHECK(shard_count > 0 && shard_count <= FEATURES_TEST_THREADS);
+    FEATURES_CHECK(0 == features_stats_dropped(&stats));
+
+    // A header and a line per switch
+    out = tmpfile();
+    FEATURES_CHECK(NULL != out);
+
+    if (NULL != out) {
+        FEATURES_CHECK(FEATURES_OK == features_stats_dump(&stats, out, 3));
+        rewind(out);
+        count = 0;
+
+        while (EOF != (c = fgetc(out))) {
+            count += '\n' == c;
+        }
+
+        FEATURES_CHECK(4 == count);
+        fclose(out);
+    }
+
+    // Lookups without stats attached are not counted
+    data.stats = NULL;
+    features_switch_value(&data, features_test_reads[0].switch_number, &value);
+    features_test_counts(&stats, 2);
+    features_stats_destroy(&stats);
+
+    // Four slots for six switches
+    FEATURES_CHECK(FEATURES_OK == features_stats_init(&stats, 3));
+    data.stats = &stats;
+
+    for (i = 0; i < 6; ++i) {
+        features_switch_value(&data, switches[i].switch_number, &value);
+        features_switch_value(&data, switches[i].switch_number, &value);
+    }
+
+    FEATURES_CHECK(4 == features_stats_dropped(&stats));
+    FEATURES_CHECK(FEATURES_OK == features_stats_top(&stats, entries, 8, &count));
+    FEATURES_CHECK(4 == count);
+
+    for (i = 0; i < count; ++i) {
+        FEATURES_CHECK(2 == entries[i].counts[FEATURES_STATS_READS]);
+    }
+
+    features_stats_destroy(&stats);
+
+    // Switches that all hash to slot 0 of a mostly empty shard, where the
+    // ones past FEATURES_STATS_MAX_PROBES are not looked for any further
+    FEATURES_CHECK(FEATURES_OK == features_stats_init(&stats, 1024));
+    count = 0;
+
+    for (switch_number = 0; count < FEATURES_STATS_MAX_PROBES + 2; ++switch_number) {
+        if (0 == (((switch_number * UINT64_C(0x9e3779b97f4a7c15)) >> 32) & (stats.capacity - 1))) {
+            features_stats_record(&stats, switch_number, FEATURES_OK);
+            ++count;
+        }
+    }
+
+    FEATURES_CHECK(2 == features_stats_dropped(&stats));
+    FEATURES_CHECK(FEATURES_OK == features_stats_top(&stats, entries, 8, &count));
+    FEATURES_CHECK(8 == count);
+    features_stats_destroy(&stats);
+    free(raw);
+
+    return features_test_result();
+}
+
+// Reads every switch of features_test_reads a different number of times
+static void *
+features_test_thread(void *arg) {
+    features_test_thread_t *thread;
+    features_switch_value_t value;
+    uint16_t val16;
+    uint8_t val8;
+    uint64_t reads;
+    uint64_t n;
+    size_t r;
+
+    thread = arg;
+
+    for (r = 0; r < FEATURES_TEST_COUNT(features_test_reads); ++r) {
+        reads = (r + 1) * FEATURES_TEST_READS + thread->index;
+
+        for (n = 0; n < reads; ++n) {
+            switch (features_test_reads[r].lookup) {
+                case FEATURES_TEST_LOOKUP_VALUE:
+                    features_switch_value(thread->data, features_test_reads[r].switch_number, &value);
+                    break;
+                case FEATURES_TEST_LOOKUP_UINT8:
+                    features_switch_uint8_value(thread->data, features_test_reads[r].switch_number, &val8);
+                    break;
+                case FEATURES_TEST_LOOKUP_UINT16:
+                    features_switch_uint16_value(thread->data, features_test_reads[r].switch_number, &val16);
+                    break;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+// Reads of one switch by every thread of one run
+static uint64_t
+features_test_expected_reads(size_t read) {
+    return FEATURES_TEST_THREADS * (read + 1) * FEATURES_TEST_READS
+        + FEATURES_TEST_THREADS * (FEATURES_TEST_THREADS - 1) / 2;
+}
+
+static void
+features_test_run(const features_data_t *data) {
+    features_test_thread_t threads[FEATURES_TEST_THREADS];
+    size_t started;
+    size_t t;
+
+    for (started = 0; started < FEATURES_TEST_THREADS; ++started) {
+        threads[started].data = data;
+        threads[started].index = started;
+
+        if (0 != pthread_create(&threads[started].thread, NULL, features_test_thread, threads + started)) {
+            FEATURES_CHECK(0);
+            break;
+        }
+    }
+
+    for (t = 0; t < started; ++t) {
+        pthread_join(threads[t].thread, NULL);
+    }
+}
+
+// The switches in order of reads, each counted under its result
+static void
+features_test_counts(
+        features_stats_t *stats,
+        uint64_t rounds) {
+    features_stats_entry_t entries[FEATURES_TEST_COUNT(features_test_reads) + 1];
+    const features_stats_entry_t *entry;
+    size_t count;
+    size_t r;
+    int c;
+
+    FEATURES_CHECK(FEATURES_OK == features_stats_top(stats, entries,
+            FEATURES_TEST_COUNT(features_test_reads) + 1, &count));
+    FEATURES_CHECK(FEATURES_TEST_COUNT(features_test_reads) == count);
+
+    for (r = 0; r < count; ++r) {
+        entry = entries + count - 1 - r;
+        FEATURES_CHECK(features_test_reads[r].switch_number == entry->switch_number);
+        FEATURES_CHECK(rounds * features_test_expected_reads(r) == entry->counts[FEATURES_STATS_READS]);
+
+        for (c = FEATURES_STATS_UNUSED; c < FEATURES_STATS_COUNTERS; ++c) {
+            FEATURES_CHECK((c == (int)features_test_reads[r].counter
+                        ? entry->counts[FEATURES_STATS_READS] : 0) == entry->counts[c]);
+        }
+    }
+}
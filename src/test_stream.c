@@ -0,0 +1,134 @@
+#include "byteorder.h"
+#include "stream.h"
+#include "test.h"
+
+// A file fed to a stream in pieces reads, page by page as it arrives,
+// what the whole file reads, and a malformed file is refused
+
+static void
+features_test_stream(uint8_t flags);
+
+static void
+features_test_partial(
+        features_stream_t *stream,
+        const features_test_switch_t *switches,
+        size_t count);
+
+static const uint32_t features_test_pages[] = {0, 1, 5, 70};
+
+#define FEATURES_TEST_PAGE_COUNT (sizeof(features_test_pages) / sizeof(features_test_pages[0]))
+
+// Not a divisor of the page size, so pages complete mid-feed
+#define FEATURES_TEST_CHUNK 1000
+
+int
+main(void) {
+    features_test_stream(0);
+    features_test_stream(FEATURES_PAGE_FLAG_SPARSE | FEATURES_PAGE_FLAG_LITTLE_ENDIAN);
+
+    return features_test_result();
+}
+
+static void
+features_test_stream(uint8_t flags) {
+    features_test_switch_t switches[FEATURES_TEST_PAGE_COUNT * FEATURES_TEST_BLOCKS_PER_PAGE
+        * FEATURES_TEST_SWITCHES_PER_BLOCK];
+    features_builder_t builder;
+    features_stream_t stream;
+    features_data_t data;
+    uint8_t *directory;
+    uint64_t present;
+    uint8_t *raw;
+    size_t offset;
+    size_t count;
+    size_t size;
+    size_t n;
+
+    features_builder_init(&builder);
+    builder.flags = flags;
+    count = features_test_fill(&builder, features_test_pages, FEATURES_TEST_PAGE_COUNT, 11, switches);
+    size = features_builder_size(&builder);
+    raw = features_test_encode(&builder, &data);
+    features_builder_free(&builder);
+    FEATURES_CHECK(NULL != raw);
+
+    if (NULL == raw) {
+        return;
+    }
+
+    features_stream_init(&stream);
+
+    for (offset = 0; offset < size; offset += n) {
+        n = size - offset < FEATURES_TEST_CHUNK ? size - offset : FEATURES_TEST_CHUNK;
+        FEATURES_CHECK(FEATURES_OK == features_stream_feed(&stream, raw + offset, n));
+
+        if (offset + n < size) {
+            FEATURES_CHECK(FEATURES_ERR_UNINITIALISED == features_stream_finish(&stream));
+        }
+
+        features_test_partial(&stream, switches, count);
+    }
+
+    FEATURES_CHECK(FEATURES_OK == features_stream_finish(&stream));
+    features_test_check_switches(&stream.data, switches, count);
+
+    // Bytes past the end of the file
+    FEATURES_CHECK(FEATURES_ERR_INVALID == features_stream_feed(&stream, raw, 1));
+    features_stream_free(&stream);
+
+    // A file cut short is never complete
+    features_stream_init(&stream);
+    FEATURES_CHECK(FEATURES_OK == features_stream_feed(&stream, raw, size - 1));
+    FEATURES_CHECK(FEATURES_ERR_UNINITIALISED == features_stream_finish(&stream));
+    features_stream_free(&stream);
+
+    // A directory that counts a page that is not stored
+    if (flags & FEATURES_PAGE_FLAG_SPARSE) {
+        directory = raw + FEATURES_TEST_PAGE_COUNT * FEATURES_PAGE_SIZE;
+        present = features_read_uint64(directory);
+        features_write_uint64(directory, present | (UINT64_C(1) << 7));
+        features_stream_init(&stream);
+        FEATURES_CHECK(FEATURES_ERR_INVALID == features_stream_feed(&stream, raw, size));
+        FEATURES_CHECK(FEATURES_ERR_INVALID == features_stream_finish(&stream));
+        features_stream_free(&stream);
+        features_write_uint64(directory, present);
+    }
+
+    // A stored page that is not a page
+    memset(raw + FEATURES_PAGE_SIZE, 0, 8);
+    features_stream_init(&stream);
+    FEATURES_CHECK(FEATURES_ERR_INVALID == features_stream_feed(&stream, raw, size));
+    FEATURES_CHECK(FEATURES_ERR_INVALID == features_stream_finish(&stream));
+    features_stream_free(&stream);
+
+    free(raw);
+}
+
+// Lookups during the load either wait for the page or read it as the
+// whole file would
+static void
+features_test_partial(
+        features_stream_t *stream,
+        const features_test_switch_t *switches,
+        size_t count) {
+    features_switch_value_t value;
+    features_err_t rc;
+    uint64_t ready;
+    size_t i;
+
+    ready = atomic_load(&stream->ready);
+
+    for (i = 0; i < count; ++i) {
+        rc = features_stream_switch_value(stream, switches[i].switch_number, &value);
+
+        if (FEATURES_ERR_UNINITIALISED == rc) {
+            // Only pages of a dense file are readable before the end
+            FEATURES_CHECK(NULL != stream->data.directory || 0 == ready
+                    || features_switch_id(switches[i].switch_number).page_number >= ready);
+        } else if (switches[i].properties & FEATURES_SWITCH_PROPERTY_DEPRECATED) {
+            FEATURES_CHECK(FEATURES_ERR_DEPRECATED == rc);
+        } else {
+            FEATURES_CHECK(FEATURES_OK == rc && features_test_value_equal(&value, &switches[i].value));
+        }
+    }
+}
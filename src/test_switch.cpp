@@ -0,0 +1,154 @@
+#include <type_traits>
+#include <utility>
+
+#include "features.hpp"
+#include "test.h"
+
+// Typed switches read what the C lookup reads, and do not compile for a
+// variable of another type
+
+// The switch of the example in features.hpp
+typedef features::Switch<uint16_t, 1234435> RolloutPercent;
+
+// Whether Switch S can be read into a V
+template <typename S, typename V, typename = void>
+struct Reads : std::false_type {
+};
+
+template <typename S, typename V>
+struct Reads<S, V, decltype((void)S::value(std::declval<const features_data_t &>(),
+            std::declval<V &>()))> : std::true_type {
+};
+
+static_assert(Reads<RolloutPercent, uint16_t>::value, "a uint16 switch reads into a uint16_t");
+static_assert(!Reads<RolloutPercent, uint32_t>::value, "a uint16 switch does not read into a uint32_t");
+static_assert(!Reads<RolloutPercent, int16_t>::value, "a uint16 switch does not read into an int16_t");
+static_assert(!Reads<features::Switch<bool, 256>, char>::value, "a flag does not read into a char");
+
+static const uint32_t features_test_pages[] = {0, 75};
+
+#define FEATURES_TEST_PAGE_COUNT (sizeof(features_test_pages) / sizeof(features_test_pages[0]))
+
+// features_test_fill() sets blocks 1 to 9 of page 75 to the types in
+// enum order from flag, and slots 0, 1 and the last one of each
+#define FEATURES_TEST_SWITCH(block, slot) ((features_switch_number_t)75 * 16384 + (block) * 256 + (slot))
+
+static void
+features_test_switches(uint8_t flags);
+
+template <typename T, features_switch_number_t Number>
+static void
+features_test_switch(const features_data_t &data);
+
+static bool
+features_test_same(bool val, const features_switch_value_t &expected);
+
+template <typename T>
+static bool
+features_test_same(T val, const features_switch_value_t &expected);
+
+int
+main(void) {
+    features_test_switches(0);
+    features_test_switches(FEATURES_PAGE_FLAG_SPARSE | FEATURES_PAGE_FLAG_LITTLE_ENDIAN);
+
+    return features_test_result();
+}
+
+static void
+features_test_switches(uint8_t flags) {
+    features_test_switch_t switches[FEATURES_TEST_PAGE_COUNT * FEATURES_TEST_BLOCKS_PER_PAGE
+        * FEATURES_TEST_SWITCHES_PER_BLOCK];
+    features_switch_value_t value;
+    features_builder_t builder;
+    features_data_t data;
+    uint16_t percent;
+    void *raw;
+
+    features_builder_init(&builder);
+    builder.flags = flags;
+    features_test_fill(&builder, features_test_pages, FEATURES_TEST_PAGE_COUNT, 13, switches);
+    value = features_test_value(FEATURES_SWITCH_TYPE_UINT16, 42);
+    FEATURES_CHECK(FEATURES_OK == features_builder_set(&builder, 1234435, &value,
+            FEATURES_SWITCH_PROPERTY_USED));
+    raw = features_test_encode(&builder, &data);
+    features_builder_free(&builder);
+    FEATURES_CHECK(NULL != raw);
+
+    if (NULL == raw) {
+        return;
+    }
+
+    FEATURES_CHECK(FEATURES_OK == RolloutPercent::value(data, percent) && 42 == percent);
+
+    // Every type, its first, deprecated second and last slot
+    features_test_switch<bool, FEATURES_TEST_SWITCH(1, 0)>(data);
+    features_test_switch<bool, FEATURES_TEST_SWITCH(1, 1)>(data);
+    features_test_switch<bool, FEATURES_TEST_SWITCH(1, FEATURES_FLAGS_PER_BLOCK - 1)>(data);
+    features_test_switch<uint8_t, FEATURES_TEST_SWITCH(2, 0)>(data);
+    features_test_switch<uint8_t, FEATURES_TEST_SWITCH(2, FEATURES_UINT8_PER_BLOCK - 1)>(data);
+    features_test_switch<uint16_t, FEATURES_TEST_SWITCH(3, 0)>(data);
+    features_test_switch<uint16_t, FEATURES_TEST_SWITCH(3, 1)>(data);
+    features_test_switch<uint32_t, FEATURES_TEST_SWITCH(4, FEATURES_UINT32_PER_BLOCK - 1)>(data);
+    features_test_switch<uint64_t, FEATURES_TEST_SWITCH(5, 0)>(data);
+    features_test_switch<int8_t, FEATURES_TEST_SWITCH(6, FEATURES_INT8_PER_BLOCK - 1)>(data);
+    features_test_switch<int16_t, FEATURES_TEST_SWITCH(7, 0)>(data);
+    features_test_switch<int32_t, FEATURES_TEST_SWITCH(8, 0)>(data);
+    features_test_switch<int64_t, FEATURES_TEST_SWITCH(9, FEATURES_INT64_PER_BLOCK - 1)>(data);
+
+    // An unused slot, a block of another type, an unused block, a page
+    // left out of the sparse file and a page past the end
+    features_test_switch<uint16_t, FEATURES_TEST_SWITCH(3, 2)>(data);
+    features_test_switch<uint32_t, FEATURES_TEST_SWITCH(3, 0)>(data);
+    features_test_switch<uint16_t, FEATURES_TEST_SWITCH(10, 0)>(data);
+    features_test_switch<uint16_t, (features_switch_number_t)50 * 16384 + 3 * 256>(data);
+    features_test_switch<uint16_t, (features_switch_number_t)76 * 16384 + 3 * 256>(data);
+
+    // In a block of another type the slot is checked first, so an unused
+    // or deprecated slot reads as such and a slot past the block's
+    // capacity as invalid
+    features_test_switch<uint8_t, FEATURES_TEST_SWITCH(3, 2)>(data);
+    features_test_switch<uint8_t, FEATURES_TEST_SWITCH(3, 1)>(data);
+    features_test_switch<bool, FEATURES_TEST_SWITCH(9, FEATURES_INT64_PER_BLOCK)>(data);
+    features_test_switch<uint8_t, FEATURES_TEST_SWITCH(5, 40)>(data);
+
+    free(raw);
+}
+
+template <typename T, features_switch_number_t Number>
+static void
+features_test_switch(const features_data_t &data) {
+    features_switch_value_t expected;
+    features_err_t expected_rc;
+    features_err_t rc;
+    T val;
+
+    expected_rc = features_switch_value(&data, Number, &expected);
+
+    // The C lookup reports the type of the block, not the one asked for
+    if (FEATURES_OK == expected_rc && features::SwitchTraits<T>::type != expected.type) {
+        expected_rc = FEATURES_ERR_INCORRECT_TYPE;
+    }
+
+    rc = features::Switch<T, Number>::value(data, val);
+    FEATURES_CHECK(expected_rc == rc);
+
+    if (FEATURES_OK == rc && FEATURES_OK == expected_rc) {
+        FEATURES_CHECK(features_test_same(val, expected));
+    }
+}
+
+static bool
+features_test_same(bool val, const features_switch_value_t &expected) {
+    return val == (0 != expected.value.flag);
+}
+
+// Every member of the value union starts at its first byte
+template <typename T>
+static bool
+features_test_same(T val, const features_switch_value_t &expected) {
+    T expected_val;
+
+    memcpy(&expected_val, &expected.value, sizeof(T));
+    return val == expected_val;
+}
@@ -0,0 +1,213 @@
+#include <stdio.h>
+
+#include "watch.h"
+#include "test.h"
+
+// A file renamed over the watched one is reloaded, published and its
+// changed switches reported in order to every subscriber, while a file
+// that does not load keeps the current snapshot
+
+static const uint32_t features_test_pages[] = {0, 1, 4};
+
+#define FEATURES_TEST_PAGE_COUNT (sizeof(features_test_pages) / sizeof(features_test_pages[0]))
+
+#define FEATURES_TEST_SWITCH_COUNT (FEATURES_TEST_PAGE_COUNT * FEATURES_TEST_BLOCKS_PER_PAGE \
+        * FEATURES_TEST_SWITCHES_PER_BLOCK)
+
+enum {
+    // A block's worth
+    FEATURES_TEST_MAX_CHANGES = 256,
+    // Polls before a change that should have been seen counts as missed
+    FEATURES_TEST_POLLS = 50
+};
+
+typedef struct features_test_changes_t {
+    features_switch_change_t changes[FEATURES_TEST_MAX_CHANGES];
+    size_t count;
+} features_test_changes_t;
+
+static void
+features_test_collect(
+        const features_switch_change_t *change,
+        void *ctx);
+
+static void
+features_test_replace(
+        const features_builder_t *builder,
+        const char *path);
+
+static features_err_t
+features_test_poll(
+        features_watch_t *watch,
+        features_test_changes_t *changes);
+
+int
+main(void) {
+    features_test_switch_t switches[FEATURES_TEST_SWITCH_COUNT];
+    features_test_changes_t changes[2];
+    features_switch_value_t value;
+    const features_snapshot_t *pinned;
+    features_builder_t builder;
+    features_reader_t reader;
+    features_watch_t watch;
+    features_live_t live;
+    char tmp_path[256];
+    char path[256];
+    size_t count;
+    size_t i;
+    FILE *out;
+
+    features_test_path(path, sizeof(path), "watch.bin");
+
+    features_builder_init(&builder);
+    count = features_test_fill(&builder, features_test_pages, FEATURES_TEST_PAGE_COUNT, 67, switches);
+    features_test_replace(&builder, path);
+
+    FEATURES_CHECK(FEATURES_OK == features_live_init(&live, 1));
+    FEATURES_CHECK(FEATURES_OK == features_live_register(&live, &reader));
+
+    if (FEATURES_OK != features_watch_init(&watch, path, &live)) {
+        FEATURES_CHECK(0);
+        features_builder_free(&builder);
+        unlink(path);
+        return features_test_result();
+    }
+
+    memset(changes, 0, sizeof(changes));
+    FEATURES_CHECK(FEATURES_OK == features_watch_subscribe(&watch, features_test_collect, &changes[0]));
+    FEATURES_CHECK(FEATURES_OK == features_watch_subscribe(&watch, features_test_collect, &changes[1]));
+
+    // The first snapshot is published too
+    pinned = features_live_pin(&reader);
+    FEATURES_CHECK(NULL != pinned && features_watch_data(&watch) == &pinned->data);
+    features_live_unpin(&reader);
+    features_test_check_switches(features_watch_data(&watch), switches, count);
+
+    // Nothing changed
+    FEATURES_CHECK(FEATURES_OK == features_watch_poll(&watch, 0));
+    FEATURES_CHECK(0 == changes[0].count);
+
+    // A new value on page 4 and a deprecated switch on page 0
+    switches[60].value = features_test_value(switches[60].value.type,
+            switches[60].value.value.uint64 + 1);
+    FEATURES_CHECK(FEATURES_OK == features_builder_set(&builder,
+            switches[60].switch_number, &switches[60].value, switches[60].properties));
+    switches[3].properties |= FEATURES_SWITCH_PROPERTY_DEPRECATED;
+    FEATURES_CHECK(FEATURES_OK == features_builder_set(&builder,
+            switches[3].switch_number, &switches[3].value, switches[3].properties));
+    features_test_replace(&builder, path);
+
+    FEATURES_CHECK(FEATURES_OK == features_test_poll(&watch, &changes[0]));
+    FEATURES_CHECK(2 == changes[0].count && 2 == changes[1].count);
+    FEATURES_CHECK(0 == memcmp(&changes[0], &changes[1], sizeof(changes[0])));
+    FEATURES_CHECK(switches[3].switch_number == changes[0].changes[0].switch_number);
+    FEATURES_CHECK(FEATURES_OK == changes[0].changes[0].old_rc);
+    FEATURES_CHECK(FEATURES_ERR_DEPRECATED == changes[0].changes[0].new_rc);
+    FEATURES_CHECK(switches[60].switch_number == changes[0].changes[1].switch_number);
+    FEATURES_CHECK(FEATURES_OK == changes[0].changes[1].new_rc);
+    FEATURES_CHECK(features_test_value_equal(&switches[60].value, &changes[0].changes[1].new_value));
+
+    pinned = features_live_pin(&reader);
+    FEATURES_CHECK(NULL != pinned && features_watch_data(&watch) == &pinned->data);
+
+    if (NULL != pinned) {
+        features_test_check_switches(&pinned->data, switches, count);
+    }
+
+    features_live_unpin(&reader);
+
+    // A file that does not load leaves the snapshot as it was
+    changes[0].count = 0;
+    changes[1].count = 0;
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    out = fopen(tmp_path, "w");
+    FEATURES_CHECK(NULL != out);
+
+    if (NULL != out) {
+        fputs("not a switch file", out);
+        fclose(out);
+        FEATURES_CHECK(0 == rename(tmp_path, path));
+    }
+
+    FEATURES_CHECK(FEATURES_OK != features_test_poll(&watch, &changes[0]));
+    FEATURES_CHECK(0 == changes[0].count);
+    features_test_check_switches(features_watch_data(&watch), switches, count);
+
+    // A switch added on a new page after that, where the slots past what
+    // a uint32 block holds stop reading as unused too
+    value = features_test_value(FEATURES_SWITCH_TYPE_UINT32, 99);
+    FEATURES_CHECK(FEATURES_OK == features_builder_set(&builder, 6 * 16384 + 256 + 2, &value,
+            FEATURES_SWITCH_PROPERTY_USED));
+    features_test_replace(&builder, path);
+
+    for (i = 0; i < FEATURES_TEST_POLLS && 0 == changes[0].count; ++i) {
+        features_watch_poll(&watch, 100);
+    }
+
+    FEATURES_CHECK(1 + 256 - FEATURES_UINT32_PER_BLOCK == changes[0].count);
+    FEATURES_CHECK(6 * 16384 + 256 + 2 == changes[0].changes[0].switch_number);
+    FEATURES_CHECK(FEATURES_ERR_UNUSED == changes[0].changes[0].old_rc);
+    FEATURES_CHECK(FEATURES_OK == changes[0].changes[0].new_rc);
+    FEATURES_CHECK(features_test_value_equal(&value, &changes[0].changes[0].new_value));
+
+    for (i = 1; i < changes[0].count; ++i) {
+        FEATURES_CHECK(6 * 16384 + 256 + FEATURES_UINT32_PER_BLOCK - 1 + i
+                == changes[0].changes[i].switch_number);
+        FEATURES_CHECK(FEATURES_ERR_UNUSED == changes[0].changes[i].old_rc);
+        FEATURES_CHECK(FEATURES_OK != changes[0].changes[i].new_rc
+                && FEATURES_ERR_UNUSED != changes[0].changes[i].new_rc);
+    }
+
+    features_watch_free(&watch);
+    features_live_unregister(&reader);
+    features_live_destroy(&live);
+    features_builder_free(&builder);
+    unlink(path);
+
+    return features_test_result();
+}
+
+static void
+features_test_collect(
+        const features_switch_change_t *change,
+        void *ctx) {
+    features_test_changes_t *changes;
+
+    changes = ctx;
+    FEATURES_CHECK(changes->count < FEATURES_TEST_MAX_CHANGES);
+
+    if (changes->count < FEATURES_TEST_MAX_CHANGES) {
+        changes->changes[changes->count++] = *change;
+    }
+}
+
+// Saves the builder next to path and renames it over path
+static void
+features_test_replace(
+        const features_builder_t *builder,
+        const char *path) {
+    char tmp_path[256];
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    FEATURES_CHECK(FEATURES_OK == features_builder_save(builder, tmp_path));
+    FEATURES_CHECK(0 == rename(tmp_path, path));
+}
+
+// Polls until the watch reloads or fails to, or too many polls pass
+static features_err_t
+features_test_poll(
+        features_watch_t *watch,
+        features_test_changes_t *changes) {
+    features_err_t rc;
+    size_t i;
+
+    for (i = 0; i < FEATURES_TEST_POLLS; ++i) {
+        rc = features_watch_poll(watch, 100);
+
+        if (FEATURES_OK != rc || 0 != changes->count) {
+            return rc;
+        }
+    }
+
+    return FEATURES_OK;
+}
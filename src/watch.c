@@ -0,0 +1,366 @@
+#include "watch.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#endif
+
+enum {
+    // Longest sleep between stat() calls without inotify
+    FEATURES_WATCH_STAT_INTERVAL_MS = 1000
+};
+
+typedef struct features_watch_collect_t {
+    features_watch_t *watch;
+    features_err_t rc;
+} features_watch_collect_t;
+
+static features_err_t
+features_watch_add(features_watch_t *watch);
+
+static int
+features_watch_events(features_watch_t *watch);
+
+static int
+features_watch_stat(
+        features_watch_t *watch,
+        int update);
+
+static void
+features_watch_collect(
+        const features_switch_change_t *change,
+        void *ctx);
+
+features_err_t
+features_watch_init(
+        features_watch_t *watch,
+        const char *path,
+        features_live_t *live) {
+    features_err_t rc;
+    const char *name;
+    size_t size;
+
+    memset(watch, 0, sizeof(features_watch_t));
+    watch->fd = -1;
+    watch->wd = -1;
+    watch->live = live;
+
+    size = strlen(path) + 1;
+    watch->path = malloc(size);
+
+    if (NULL == watch->path) {
+        return FEATURES_ERR_NOMEM;
+    }
+
+    memcpy(watch->path, path, size);
+
+    name = strrchr(path, '/');
+    watch->name_offset = NULL == name ? 0 : (size_t)(name - path) + 1;
+
+    // Watching before the first load means no change is missed
+    rc = features_watch_add(watch);
+
+    if (FEATURES_OK == rc) {
+        features_watch_stat(watch, 1);
+        rc = features_snapshot_open(&watch->snapshot, watch->path);
+    }
+
+    if (FEATURES_OK != rc) {
+        features_watch_free(watch);
+        return rc;
+    }
+
+    if (NULL != live) {
+        features_live_publish(live, watch->snapshot);
+    }
+
+    return FEATURES_OK;
+}
+
+void
+features_watch_free(features_watch_t *watch) {
+    if (watch->fd >= 0) {
+        close(watch->fd);
+    }
+
+    if (NULL == watch->live) {
+        features_snapshot_release(watch->snapshot);
+    }
+
+    free(watch->path);
+    free(watch->subscribers);
+    free(watch->changes);
+    memset(watch, 0, sizeof(features_watch_t));
+    watch->fd = -1;
+    watch->wd = -1;
+}
+
+features_err_t
+features_watch_subscribe(
+        features_watch_t *watch,
+        features_diff_fn fn,
+        void *ctx) {
+    features_watch_subscriber_t *subscribers;
+
+    subscribers = realloc(watch->subscribers,
+            (watch->subscriber_count + 1) * sizeof(features_watch_subscriber_t));
+
+    if (NULL == subscribers) {
+        return FEATURES_ERR_NOMEM;
+    }
+
+    subscribers[watch->subscriber_count].fn = fn;
+    subscribers[watch->subscriber_count].ctx = ctx;
+
+    watch->subscribers = subscribers;
+    ++watch->subscriber_count;
+
+    return FEATURES_OK;
+}
+
+int
+features_watch_fd(const features_watch_t *watch) {
+    return watch->fd;
+}
+
+features_err_t
+features_watch_poll(
+        features_watch_t *watch,
+        int timeout_ms) {
+    struct pollfd pollfd;
+    int step_ms;
+    int rc;
+
+    if (watch->fd >= 0) {
+        pollfd.fd = watch->fd;
+        pollfd.events = POLLIN;
+
+        rc = poll(&pollfd, 1, timeout_ms);
+
+        if (rc < 0 && EINTR != errno) {
+            return FEATURES_ERR_IO;
+        }
+
+        if (rc <= 0 || !features_watch_events(watch)) {
+            return FEATURES_OK;
+        }
+
+        return features_watch_reload(watch);
+    }
+
+    for (;;) {
+        if (features_watch_stat(watch, 0)) {
+            return features_watch_reload(watch);
+        }
+
+        if (0 == timeout_ms) {
+            return FEATURES_OK;
+        }
+
+        step_ms = timeout_ms < 0 || timeout_ms > FEATURES_WATCH_STAT_INTERVAL_MS
+            ? FEATURES_WATCH_STAT_INTERVAL_MS
+            : timeout_ms;
+
+        poll(NULL, 0, step_ms);
+
+        if (timeout_ms > 0) {
+            timeout_ms -= step_ms;
+        }
+    }
+}
+
+features_err_t
+features_watch_reload(features_watch_t *watch) {
+    features_watch_collect_t collect;
+    features_snapshot_t *snapshot;
+    features_err_t rc;
+    size_t i;
+    size_t j;
+
+    // A change between the stat() and the open is seen by the next poll
+    features_watch_stat(watch, 1);
+
+    rc = features_snapshot_open(&snapshot, watch->path);
+
+    if (FEATURES_OK != rc) {
+        return rc;
+    }
+
+    collect.watch = watch;
+    collect.rc = FEATURES_OK;
+    watch->change_count = 0;
+
+    rc = features_diff(&watch->snapshot->data, &snapshot->data, features_watch_collect, &collect);
+
+    if (FEATURES_OK == rc) {
+        rc = collect.rc;
+    }
+
+    if (FEATURES_OK != rc) {
+        features_snapshot_release(snapshot);
+        return rc;
+    }
+
+    // The old snapshot is not touched once replaced, the live manager
+    // releases it when its readers are done
+    if (NULL != watch->live) {
+        features_live_publish(watch->live, snapshot);
+    } else {
+        features_snapshot_release(watch->snapshot);
+    }
+
+    watch->snapshot = snapshot;
+
+    for (i = 0; i < watch->subscriber_count; ++i) {
+        for (j = 0; j < watch->change_count; ++j) {
+            watch->subscribers[i].fn(&watch->changes[j], watch->subscribers[i].ctx);
+        }
+    }
+
+    return FEATURES_OK;
+}
+
+const features_data_t *
+features_watch_data(const features_watch_t *watch) {
+    return &watch->snapshot->data;
+}
+
+// Watches the directory of the file, which sees a new file renamed
+// over it as well as writes to it
+static features_err_t
+features_watch_add(features_watch_t *watch) {
+#ifdef HAVE_SYS_INOTIFY_H
+    char saved;
+
+    watch->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+    if (watch->fd < 0) {
+        return FEATURES_ERR_IO;
+    }
+
+    saved = watch->path[watch->name_offset];
+    watch->path[watch->name_offset] = '\0';
+
+    watch->wd = inotify_add_watch(watch->fd, 0 == watch->name_offset ? "." : watch->path,
+            IN_CLOSE_WRITE | IN_MOVED_TO);
+
+    watch->path[watch->name_offset] = saved;
+
+    if (watch->wd < 0) {
+        return FEATURES_ERR_IO;
+    }
+#else
+    (void)watch;
+#endif
+
+    return FEATURES_OK;
+}
+
+// Drains the pending inotify events, returns whether any was for the
+// file
+static int
+features_watch_events(features_watch_t *watch) {
+#ifdef HAVE_SYS_INOTIFY_H
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    const struct inotify_event *event;
+    const char *name;
+    ssize_t n;
+    ssize_t i;
+    int changed;
+
+    name = watch->path + watch->name_offset;
+    changed = 0;
+
+    for (;;) {
+        n = read(watch->fd, buf, sizeof(buf));
+
+        if (n < 0 && EINTR == errno) {
+            continue;
+        }
+
+        if (n <= 0) {
+            return changed;
+        }
+
+        for (i = 0; i < n; i += sizeof(struct inotify_event) + event->len) {
+            event = (const struct inotify_event *)(buf + i);
+
+            // Dropped events may have included the file
+            if ((event->mask & IN_Q_OVERFLOW)
+                    || (event->len > 0 && 0 == strcmp(event->name, name))) {
+                changed = 1;
+            }
+        }
+    }
+#else
+    (void)watch;
+    return 0;
+#endif
+}
+
+// Returns whether the file differs from the one last recorded, and
+// records it when update is set
+static int
+features_watch_stat(
+        features_watch_t *watch,
+        int update) {
+    struct stat st;
+    int changed;
+
+    if (0 != stat(watch->path, &st)) {
+        return 0;
+    }
+
+    changed = st.st_dev != watch->dev
+        || st.st_ino != watch->ino
+        || st.st_size != watch->size
+        || st.st_mtim.tv_sec != watch->mtime.tv_sec
+        || st.st_mtim.tv_nsec != watch->mtime.tv_nsec;
+
+    if (update) {
+        watch->dev = st.st_dev;
+        watch->ino = st.st_ino;
+        watch->size = st.st_size;
+        watch->mtime = st.st_mtim;
+    }
+
+    return changed;
+}
+
+static void
+features_watch_collect(
+        const features_switch_change_t *change,
+        void *ctx) {
+    features_watch_collect_t *collect;
+    features_switch_change_t *changes;
+    features_watch_t *watch;
+    size_t capacity;
+
+    collect = ctx;
+    watch = collect->watch;
+
+    if (FEATURES_OK != collect->rc) {
+        return;
+    }
+
+    if (watch->change_count == watch->change_capacity) {
+        capacity = 0 == watch->change_capacity ? 64 : watch->change_capacity * 2;
+        changes = realloc(watch->changes, capacity * sizeof(features_switch_change_t));
+
+        if (NULL == changes) {
+            collect->rc = FEATURES_ERR_NOMEM;
+            return;
+        }
+
+        watch->changes = changes;
+        watch->change_capacity = capacity;
+    }
+
+    watch->changes[watch->change_count++] = *change;
+}
@@ -0,0 +1,104 @@
+#ifndef FEATURES_WATCH_H
+#define FEATURES_WATCH_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "diff.h"
+#include "snapshot.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct features_watch_subscriber_t {
+    features_diff_fn fn;
+    void *ctx;
+} features_watch_subscriber_t;
+
+// Reloads a switch file when it is rewritten or replaced and tells
+// subscribers which switches changed. With inotify the directory of the
+// file is watched, so both writing the file in place and renaming a new
+// file over it are seen. Elsewhere the file is polled with stat().
+//
+// Files should be replaced by renaming. Writing in place also changes
+// the mapped pages of the current snapshot, so the diff sees no change
+// and readers may see a half written file.
+//
+// A watch is driven by a single thread calling features_watch_poll().
+typedef struct features_watch_t {
+    char *path;
+    // Offset of the file name in path
+    size_t name_offset;
+    // inotify descriptor, -1 when polling with stat()
+    int fd;
+    int wd;
+
+    // What the current snapshot was opened from, for stat() polling
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+
+    // Owned by live when there is one, by the watch otherwise
+    features_snapshot_t *snapshot;
+    features_live_t *live;
+
+    features_watch_subscriber_t *subscribers;
+    size_t subscriber_count;
+
+    // Changes of the reload in progress, reused between reloads
+    features_switch_change_t *changes;
+    size_t change_count;
+    size_t change_capacity;
+} features_watch_t;
+
+// Opens path and starts watching it. When live is given every reload is
+// published to it, including the first, and the watch never releases a
+// snapshot itself.
+features_err_t
+features_watch_init(
+        features_watch_t *watch,
+        const char *path,
+        features_live_t *live);
+
+void
+features_watch_free(features_watch_t *watch);
+
+// Calls fn with each switch a reload changes, after the new snapshot is
+// published
+features_err_t
+features_watch_subscribe(
+        features_watch_t *watch,
+        features_diff_fn fn,
+        void *ctx);
+
+// The descriptor to wait on in an event loop before calling
+// features_watch_poll() with a timeout of 0, -1 without inotify
+int
+features_watch_fd(const features_watch_t *watch);
+
+// Waits up to timeout_ms, -1 for ever, for the file to change and
+// reloads it. Returns FEATURES_OK when nothing changed too. A file that
+// fails to load, such as one still being written, keeps the current
+// snapshot and its error is returned.
+features_err_t
+features_watch_poll(
+        features_watch_t *watch,
+        int timeout_ms);
+
+// Reloads the file now
+features_err_t
+features_watch_reload(features_watch_t *watch);
+
+// The current data, only valid on the polling thread until the next
+// reload. Readers on other threads pin the live manager instead.
+const features_data_t *
+features_watch_data(const features_watch_t *watch);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif